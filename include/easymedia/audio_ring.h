@@ -0,0 +1,81 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_AUDIO_RING_H_
+#define EASYMEDIA_AUDIO_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+
+#include "sound.h"
+#include "utils.h"
+
+namespace easymedia {
+
+class MediaBuffer;
+class SampleBuffer;
+class SizeClassBufferPool;
+struct AudioRingStore;
+
+// Re-frames pcm into frames of frame_samples in a ring of frame slots, a
+// frame starting a slot read as a view of it and others copied. When full,
+// the oldest samples are dropped. Not thread safe.
+class _API AudioRing {
+public:
+  // capacity rounded up to a power of two frames, at least 2
+  AudioRing(const SampleInfo &info, int frame_samples, int capacity,
+            std::shared_ptr<SizeClassBufferPool> pool = nullptr);
+  ~AudioRing();
+  AudioRing(const AudioRing &) = delete;
+  AudioRing &operator=(const AudioRing &) = delete;
+
+  bool IsValid() const { return store != nullptr; }
+  int GetCapacity() const { return max_slots * frame_samples; }
+  int GetFrameSamples() const { return frame_samples; }
+
+  // data as in a SampleBuffer: planar planes one after the other.
+  // return the samples written.
+  int Write(const uint8_t *data, int samples, int64_t timestamp_us);
+  int Write(const std::shared_ptr<SampleBuffer> &input);
+  // a frame, or with flush the last samples in a shorter frame, still of
+  // the size of a whole frame. nullptr if not enough samples.
+  std::shared_ptr<SampleBuffer> Read(bool flush = false);
+  int GetSamples();
+  int64_t GetDropSamples();
+  void Reset();
+
+private:
+  struct Anchor {
+    uint64_t pos;
+    int64_t timestamp_us;
+  };
+  uint8_t *At(uint64_t pos);
+  void Grow(uint64_t need);
+  uint64_t Tail();
+  void AlignEmpty();
+  std::shared_ptr<SampleBuffer> Copy(int samples);
+  int64_t TimeStampAt(uint64_t pos);
+
+  SampleInfo info;
+  int frame_samples;
+  int capacity; // of the slots allocated
+  int slots;
+  int max_slots;
+  int planes;
+  size_t sample_bytes; // in a plane
+  std::shared_ptr<AudioRingStore> store;
+  std::shared_ptr<SizeClassBufferPool> pool;
+  std::deque<Anchor> anchors;
+  uint64_t read_pos;
+  uint64_t write_pos;
+  uint64_t held_pos; // the oldest slot a view may still hold
+  int64_t drop_samples;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_AUDIO_RING_H_
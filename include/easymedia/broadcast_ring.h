@@ -0,0 +1,92 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_BROADCAST_RING_H_
+#define EASYMEDIA_BROADCAST_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils.h"
+
+namespace easymedia {
+
+class MediaBuffer;
+
+// One producer fans the same buffers out to many readers. Every reader has
+// a cursor into one ring, a push is one store and one eventfd write for
+// all of them. A buffer is released once the slowest reader passed it.
+// A reader more than max lag behind, or behind the oldest buffer kept,
+// jumps forward: with gop_aware to the newest key frame group, the
+// extra intra buffers and the intra after them, otherwise, or if the stream
+// has no intra flags, such as mjpeg, it drops half of the max lag.
+class _API BroadcastRing {
+public:
+  BroadcastRing(size_t capacity, size_t max_lag, bool gop_aware);
+  ~BroadcastRing();
+  BroadcastRing(const BroadcastRing &) = delete;
+  BroadcastRing &operator=(const BroadcastRing &) = delete;
+
+  // create the eventfd
+  bool Init();
+  // readable when pushed or notified
+  int GetEventFd() const { return event_fd; }
+  void ClearEvent();
+  void Notify();
+  // clamped to the capacity
+  void SetMaxLag(size_t lag);
+  // With gop_aware, keep the newest key frame group and the frames after
+  // it while they are in bytes, even without readers, so that a new reader
+  // starts from a decodable frame at once. 0 disables it.
+  void SetGopCache(size_t bytes);
+  void GetGopCache(size_t &bytes, int &num);
+
+  void Push(const std::shared_ptr<MediaBuffer> &buffer);
+
+  // A new reader starts from the newest key frame group if still kept,
+  // otherwise from the next push. return the reader id.
+  int AddReader();
+  void RemoveReader(int id);
+  // nullptr if nothing new or id is not a reader
+  std::shared_ptr<MediaBuffer> Pop(int id);
+  bool HasData(int id);
+  int GetReaderNum();
+  // buffers skipped by the reader, -1 if id is not a reader
+  int64_t GetDropNum(int id);
+
+private:
+  struct Reader {
+    bool used;
+    uint64_t cursor;
+    int64_t drop_num;
+  };
+  void Release();
+  bool IsReader(int id, const char *caller);
+
+  std::mutex mtx;
+  std::vector<std::shared_ptr<MediaBuffer>> slots;
+  std::vector<Reader> readers;
+  int reader_num;
+  uint64_t head; // next sequence to push
+  uint64_t tail; // oldest sequence kept
+  uint64_t key_seq;
+  uint64_t extra_seq;
+  bool key_valid;
+  bool in_extra;
+  size_t extra_bytes;
+  size_t key_bytes; // from key_seq to head
+  bool key_cached;
+  size_t cache_budget;
+  size_t max_lag;
+  bool gop_aware;
+  int event_fd;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_BROADCAST_RING_H_
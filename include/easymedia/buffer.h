@@ -9,7 +9,10 @@
 #include <string.h>
 #include <sys/time.h>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "image.h"
 #include "media_type.h"
@@ -21,6 +24,8 @@ typedef int (*DeleteFun)(void *arg);
 
 namespace easymedia {
 
+struct NaluIndex;
+
 // wrapping existing buffer
 class _API MediaBuffer {
 public:
@@ -37,12 +42,14 @@ public:
 
   MediaBuffer()
       : ptr(nullptr), size(0), fd(-1), valid_size(0), type(Type::None),
-        user_flag(0), ustimestamp(0), eof(false) {}
+        user_flag(0), ustimestamp(0), atomic_clock(0), enqueue_clock(0),
+        eof(false) {}
   // Set userdata and delete function if you want free resource when destrut.
   MediaBuffer(void *buffer_ptr, size_t buffer_size, int buffer_fd = -1,
               void *user_data = nullptr, DeleteFun df = nullptr)
       : ptr(buffer_ptr), size(buffer_size), fd(buffer_fd), valid_size(0),
-        type(Type::None), user_flag(0), ustimestamp(0), eof(false) {
+        type(Type::None), user_flag(0), ustimestamp(0), atomic_clock(0),
+        enqueue_clock(0), eof(false) {
     SetUserData(user_data, df);
   }
   virtual ~MediaBuffer() = default;
@@ -101,6 +108,15 @@ public:
     atomic_clock = val.tv_sec * 1000000LL + val.tv_usec;
   }
 
+  // monotonic us of the last Flow::SendInput of this buffer. One buffer may
+  // be queued to several flows at once, so it is accessed atomically.
+  int64_t GetEnqueueClock() const {
+    return __atomic_load_n(&enqueue_clock, __ATOMIC_RELAXED);
+  }
+  void SetEnqueueClock(int64_t us) {
+    __atomic_store_n(&enqueue_clock, us, __ATOMIC_RELAXED);
+  }
+
   void SetUserData(std::shared_ptr<void> user_data) { userdata = user_data; }
   std::shared_ptr<void> GetUserData() { return userdata; }
 
@@ -117,6 +133,15 @@ public:
     return related_sptrs;
   }
 
+  // nal units of an encoded buffer, see GetNaluIndex in codec.h.
+  // Consumers of one buffer may run in different threads.
+  std::shared_ptr<NaluIndex> GetNaluIndex() const {
+    return std::atomic_load(&nalu_index);
+  }
+  void SetNaluIndex(std::shared_ptr<NaluIndex> index) {
+    std::atomic_store(&nalu_index, std::move(index));
+  }
+
   bool IsValid() { return valid_size > 0; }
   bool IsHwBuffer() { return fd >= 0; }
 
@@ -129,6 +154,11 @@ public:
   static MediaBuffer Alloc2(size_t size, MemType type = MemType::MEM_COMMON);
   static std::shared_ptr<MediaBuffer>
   Clone(MediaBuffer &src, MemType dst_type = MemType::MEM_COMMON);
+  // View of [offset, offset + size) of the valid data of src, without copy.
+  // It holds src until released, and is not a hardware buffer itself.
+  static std::shared_ptr<MediaBuffer>
+  SubBuffer(const std::shared_ptr<MediaBuffer> &src, size_t offset,
+            size_t size);
 
 private:
   // copy attributs except buffer
@@ -142,10 +172,12 @@ private:
   uint32_t user_flag;
   int64_t ustimestamp;
   int64_t atomic_clock;
+  int64_t enqueue_clock;
   bool eof;
 
   std::shared_ptr<void> userdata;
   std::vector<std::shared_ptr<void>> related_sptrs;
+  std::shared_ptr<NaluIndex> nalu_index;
 };
 
 MediaBuffer::MemType StringToMemType(const char *s);
@@ -267,22 +299,115 @@ private:
   std::shared_ptr<void> userdata;
 };
 
+// Hardware buffers are limited. Consumers that may hold buffers for long,
+// such as the clients of the rtsp flow, get a view of a hardware buffer
+// until they hold max_num of them, which tells a slow consumer or too few
+// buffers in the pool, then a MEM_COMMON copy.
+class _API HwBufferHolder {
+public:
+  HwBufferHolder(int max_num);
+  void SetMaxNum(int num) { max_num = num; }
+  // a view or a copy of mb, mb itself if not a hardware buffer
+  std::shared_ptr<MediaBuffer> Hold(const std::shared_ptr<MediaBuffer> &mb);
+  // a copy whatever held
+  std::shared_ptr<MediaBuffer> Copy(const std::shared_ptr<MediaBuffer> &mb);
+  int GetHeldNum() const { return held->load(); }
+  int64_t GetCopiedBytes() const { return copied_bytes; }
+
+private:
+  // views may outlive the holder
+  std::shared_ptr<std::atomic<int>> held;
+  int max_num;
+  int64_t copied_bytes;
+};
+
+struct BufferPoolSlot;
 class _API BufferPool {
 public:
+  // fixed number of buffers
   BufferPool(int cnt, int size, MediaBuffer::MemType type);
+  // min_cnt buffers at start, grow on demand up to max_cnt, and the idle
+  // buffers above min_cnt are released again
+  BufferPool(int min_cnt, int max_cnt, int size, MediaBuffer::MemType type);
   ~BufferPool();
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
 
   std::shared_ptr<MediaBuffer> GetBuffer(bool block = true);
-  int PutBuffer(MediaGroupBuffer *mgb);
+  // timeout_ms < 0: wait until a buffer is released, 0: do not wait.
+  // return nullptr if timeout.
+  std::shared_ptr<MediaBuffer> GetBuffer(int timeout_ms);
 
   void DumpInfo();
 
 private:
-  std::list<MediaGroupBuffer *> ready_buffers;
-  std::list<MediaGroupBuffer *> busy_buffers;
-  ConditionLockMutex mtx;
-  int buf_cnt;
+  void Init(int min, int max, int size, MediaBuffer::MemType type);
+  BufferPoolSlot *PopReady();
+  void PushReady(BufferPoolSlot *slot);
+  BufferPoolSlot *Grow();
+  void Shrink();
+  void PutSlot(BufferPoolSlot *slot);
+  friend struct BufferPoolSlot;
+
+  // intrusive free list of the ready slots, lock free.
+  // (aba tag << 32) | (slot index + 1), 0 index is the end.
+  std::atomic<uint64_t> ready_head;
+  FutexEvent ready_event;
+  // max_cnt entries, a slot is never freed before the pool
+  std::vector<BufferPoolSlot *> slots;
+  std::vector<int> empty_slots; // slots without buffer, under grow_mtx
+  std::mutex grow_mtx;
+  MediaBuffer::MemType mem_type;
+  int min_cnt;
+  int max_cnt;
   int buf_size;
+  std::atomic<int> buf_cnt;
+  std::atomic<int> ready_num;
+  std::atomic<int> busy_num;
+  std::atomic<int> releasing_num;
+  // statistics
+  std::atomic<int> busy_high;  // high watermark of busy buffers
+  std::atomic<int> ready_low;  // low watermark of ready buffers
+  std::atomic<int> window_low; // ready low watermark since last shrink
+  std::atomic<int64_t> get_cnt;
+  std::atomic<int64_t> starved_cnt; // no ready buffer when get
+  std::atomic<int64_t> timeout_cnt;
+  std::atomic<int64_t> grow_cnt;
+  std::atomic<int64_t> shrink_cnt;
+  std::atomic<int64_t> heap_cnt; // control blocks not recycled
+};
+
+// power of two classes from 256B to 16MB
+#define SIZE_CLASS_MIN_SHIFT 8
+#define SIZE_CLASS_MAX_SHIFT 24
+#define SIZE_CLASS_NUM (SIZE_CLASS_MAX_SHIFT - SIZE_CLASS_MIN_SHIFT + 1)
+
+// Buffer service for the per frame outputs of variable size. Each size
+// class is an elastic BufferPool of at most cnt buffers, created on first
+// use. GetBuffer never blocks. When the class is exhausted or the size is
+// larger than the last class, it falls back to a MEM_COMMON allocation,
+// never a new hardware one, or returns nullptr without fallback.
+class _API SizeClassBufferPool {
+public:
+  SizeClassBufferPool(int cnt, MediaBuffer::MemType type);
+  ~SizeClassBufferPool();
+  SizeClassBufferPool(const SizeClassBufferPool &) = delete;
+  SizeClassBufferPool &operator=(const SizeClassBufferPool &) = delete;
+  // shared by all users of the same cnt and type
+  static std::shared_ptr<SizeClassBufferPool>
+  GetShared(int cnt, MediaBuffer::MemType type);
+
+  // GetSize() of the buffer is the class size, valid size is 0
+  std::shared_ptr<MediaBuffer> GetBuffer(size_t size, bool fallback = true);
+
+  void DumpInfo();
+
+private:
+  std::atomic<BufferPool *> classes[SIZE_CLASS_NUM];
+  std::mutex mtx;
+  int max_cnt;
+  MediaBuffer::MemType mem_type;
+  std::atomic<int64_t> fallback_cnt;
 };
 
 } // namespace easymedia
@@ -7,6 +7,7 @@
 
 #include <list>
 #include <memory>
+#include <vector>
 
 #include "media_config.h"
 
@@ -43,12 +44,53 @@ private:
   std::shared_ptr<MediaBuffer> extra_data;
 };
 
+// SSE2/NEON when built for, returns end if not found
 _API const uint8_t *find_nalu_startcode(const uint8_t *p, const uint8_t *end);
+
+// one nal unit of an annexb stream, offset and size include the start code
+typedef struct {
+  uint32_t offset;
+  uint32_t size;
+  uint8_t type;
+  uint8_t start_len; // 3 or 4
+} NaluEntry;
+
+// All nal units of an encoded buffer, scanned once and attached to it, so
+// that the muxer, rtsp and any other consumer look up instead of rescan.
+struct NaluIndex {
+  CodecType codec;
+  const void *ptr;   // data scanned
+  size_t valid_size; // and its length
+  std::vector<NaluEntry> nalus;
+  // first nal unit of type, nullptr if none
+  const NaluEntry *Find(int type) const {
+    for (auto &entry : nalus)
+      if (entry.type == type)
+        return &entry;
+    return nullptr;
+  }
+};
+
+// h264 or h265 data, false if no start code
+_API bool ScanNalus(const uint8_t *buffer, size_t length, CodecType c_type,
+                    std::vector<NaluEntry> &nalus);
+// Scan mb and attach the index to it, for the producer of the buffer.
+_API std::shared_ptr<NaluIndex>
+BuildNaluIndex(const std::shared_ptr<MediaBuffer> &mb, CodecType c_type);
+// The attached index if it still matches the data, otherwise build it.
+// Who rewrites the data in place with the same size must build it again.
+_API std::shared_ptr<NaluIndex>
+GetNaluIndex(const std::shared_ptr<MediaBuffer> &mb, CodecType c_type);
+
 // must be h264 data
 _API std::list<std::shared_ptr<MediaBuffer>>
 split_h264_separate(const uint8_t *buffer, size_t length, int64_t timestamp);
 _API std::list<std::shared_ptr<MediaBuffer>>
 split_h265_separate(const uint8_t *buffer, size_t length, int64_t timestamp);
+// h264 or h265, views of the leading vps/sps/pps of buffer, without copy
+_API std::list<std::shared_ptr<MediaBuffer>>
+split_separate_view(const std::shared_ptr<MediaBuffer> &buffer,
+                    CodecType c_type);
 _API void *GetVpsFromBuffer(std::shared_ptr<MediaBuffer> &mb,
   int &size, CodecType c_type);
 _API void *GetSpsFromBuffer(std::shared_ptr<MediaBuffer> &mb,
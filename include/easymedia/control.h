@@ -54,6 +54,7 @@ typedef enum {
   USER_DEL,
   USER_CLR,
   USER_ENABLE,
+  USER_IMPORT, /* pic_path is a feature file or a directory of them */
 } FaceRegArgType;
 
 typedef struct {
@@ -129,6 +130,18 @@ enum {
   S_MUXER_FILE_DURATION,
   S_MUXER_FILE_PATH,
   S_MUXER_FILE_PREFIX,
+
+  // Flow controls, every flow answers them, see FLOW_CONTROL_BASE
+  // FlowMetrics *
+  G_FLOW_METRICS = 10900,
+  // no argument
+  S_FLOW_METRICS_RESET,
+  // no argument, record the process spans for the chrome trace
+  S_FLOW_TRACE_START,
+  S_FLOW_TRACE_STOP,
+  // std::string *, chrome trace event json of this flow
+  G_FLOW_TRACE_JSON,
+  S_LAST_FLOW_CONTROL = 10999,
 };
 
 } // namespace easymedia
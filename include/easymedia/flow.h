@@ -6,7 +6,9 @@
 #define EASYMEDIA_FLOW_H_
 
 #include "lock.h"
+#include "lock_free_ring.h"
 #include "message.h"
+#include "rcu_snapshot.h"
 #include "reflector.h"
 #include "utils.h"
 
@@ -34,10 +36,19 @@ DECLARE_REFLECTOR(Flow)
                               GetError() < 0)
 
 class MediaBuffer;
-enum class Model { NONE, ASYNCCOMMON, ASYNCATOMIC, SYNC };
+// POOLED: no own thread, the coroutine is a task of the shared flow executor,
+// scheduled when input arrives. Tasks of one coroutine never run in parallel.
+enum class Model { NONE, ASYNCCOMMON, ASYNCATOMIC, SYNC, POOLED };
 // PushMode
 enum class InputMode { NONE, BLOCKING, DROPFRONT, DROPCURRENT };
 enum class HoldInputMode { NONE, HOLD_INPUT, INHERIT_FORM_INPUT };
+// Input queue of ASYNCCOMMON, LOCKED is the deque protected by mutex.
+// SPSC requires that only one upstream feeds the input slot.
+enum class InputQueue { NONE, LOCKED, SPSC, MPSC };
+// ASYNCATOMIC, what to do after a period deadline is missed.
+// SKIP: drop the missed periods, run at the next future deadline.
+// CATCHUP: run the missed periods back to back, resync if too far behind.
+enum class DeadlinePolicy { NONE, SKIP, CATCHUP };
 using MediaBufferVector = std::vector<std::shared_ptr<MediaBuffer>>;
 // TODO: outputs ret, outslot index, outslot queue model
 using FunctionProcess =
@@ -66,10 +77,13 @@ class _API SlotMap {
 public:
   SlotMap()
       : thread_model(Model::SYNC), mode_when_full(InputMode::DROPFRONT),
-        process(nullptr), interval(16.66f) {}
+        input_queue(InputQueue::LOCKED), block_timeout(0), process(nullptr),
+        interval(16.66f), deadline_policy(DeadlinePolicy::SKIP) {}
   std::vector<int> input_slots;
   Model thread_model;
   InputMode mode_when_full;
+  InputQueue input_queue;
+  int block_timeout; // ms, if BLOCKING; <= 0, block until not full
   std::vector<bool> fetch_block; // if ASYNCCOMMON
   std::vector<int> input_maxcachenum;
   std::vector<int> output_slots;
@@ -77,8 +91,87 @@ public:
   std::vector<HoldInputMode> hold_input;
   FunctionProcess process;
   float interval;
+  DeadlinePolicy deadline_policy; // if ASYNCATOMIC
+  // if ASYNCATOMIC, slot maps of the same group share one timer thread,
+  // empty means a timer thread of its own.
+  std::string timer_group;
 };
 
+// period statistics of ASYNCATOMIC, jitter is wakeup time - deadline
+typedef struct {
+  int64_t ticks;
+  int64_t skipped; // periods dropped by SKIP
+  int64_t late;    // ticks run one period or more after the deadline
+  int64_t jitter_avg; // us
+  int64_t jitter_max; // us
+} FlowTimerStats;
+
+#define FLOW_METRICS_MAX_SLOT 8
+// bucket 0 is < 1us, bucket i is [2^(i-1), 2^i) us, the last one is open
+#define FLOW_HISTOGRAM_BUCKETS 24
+
+typedef struct {
+  int64_t count;
+  int64_t sum; // us
+  int64_t max; // us
+  int64_t buckets[FLOW_HISTOGRAM_BUCKETS];
+} FlowHistogram;
+
+typedef struct {
+  int64_t in; // non null buffers sent to the slot
+  int64_t dropped_front;
+  int64_t dropped_current;
+  int64_t depth;     // buffers in queue now
+  int64_t max_depth; // since reset
+  // from SendInput to the fetch of buffer to process, the queue wait of
+  // this flow, on CLOCK_MONOTONIC
+  FlowHistogram latency;
+} FlowInputMetrics;
+
+typedef struct {
+  int64_t out; // non null buffers set to the slot
+} FlowOutputMetrics;
+
+typedef struct {
+  int input_num;
+  int output_num;
+  FlowInputMetrics input[FLOW_METRICS_MAX_SLOT];
+  FlowOutputMetrics output[FLOW_METRICS_MAX_SLOT];
+  FlowHistogram process; // time of process function, us
+} FlowMetrics;
+
+// upper bound of the bucket holding the ratio (0~1) of samples, us
+_API int64_t FlowHistogramPercentile(const FlowHistogram &h, float ratio);
+
+// Histogram updated by several threads without lock.
+class FlowHistogramCounter {
+public:
+  FlowHistogramCounter() { Reset(); }
+  void Add(int64_t us);
+  void Read(FlowHistogram &h) const;
+  void Reset();
+
+private:
+  std::atomic<int64_t> count;
+  std::atomic<int64_t> sum;
+  std::atomic<int64_t> max;
+  std::atomic<int64_t> buckets[FLOW_HISTOGRAM_BUCKETS];
+};
+
+// Put it at the head of Control of sub class, so that the flow requests
+// (G_FLOW_METRICS ...) reach the base flow.
+#define FLOW_CONTROL_BASE(request)                                             \
+  if (Flow::IsFlowControl(request)) {                                          \
+    void *_flow_arg = nullptr;                                                 \
+    if (Flow::FlowControlHasArg(request)) {                                    \
+      va_list _flow_vl;                                                        \
+      va_start(_flow_vl, request);                                             \
+      _flow_arg = va_arg(_flow_vl, void *);                                    \
+      va_end(_flow_vl);                                                        \
+    }                                                                          \
+    return Flow::FlowControl(request, _flow_arg);                              \
+  }
+
 class FlowCoroutine;
 class _API Flow {
 public:
@@ -103,7 +196,7 @@ public:
   void SetDisable() { enable = false; }
 
   // The Control must be called in the same thread to that create flow
-  virtual int Control(unsigned long int request _UNUSED, ...) { return -1; }
+  virtual int Control(unsigned long int request, ...);
   virtual int SubControl(unsigned long int request, void *arg, int size = 0) {
     SubRequest subreq = {request, size, arg};
     return Control(S_SUB_REQUEST, &subreq);
@@ -114,13 +207,17 @@ public:
 
   // The global event hander is the same thread to the born thread of this
   // object.
-  void RegisterEventHandler(std::shared_ptr<Flow> flow, EventHook proc);
+  // limit: fifo and unique events queued at most
+  void RegisterEventHandler(std::shared_ptr<Flow> flow, EventHook proc,
+                            size_t limit = EVENT_QUEUE_DEFAULT_LIMIT);
   void UnRegisterEventHandler();
   void EventHookWait();
   void NotifyToEventHandler(EventParamPtr param, int type = MESSAGE_TYPE_FIFO);
   void NotifyToEventHandler(int id, int type = MESSAGE_TYPE_FIFO);
   MessagePtr GetEventMessage();
   EventParamPtr GetEventParam(MessagePtr msg);
+  // return false if no event handler
+  bool GetEventQueueStats(EventQueueStats &stats);
 
   // Add Link hander For app Link
   void SetVideoHandler(LinkVideoHandler hander) {
@@ -168,6 +265,13 @@ public:
   int GetRunTimesRemaining();
 
   bool IsAllBuffEmpty();
+  // return false if flow has no ASYNCATOMIC slot map
+  bool GetTimerStats(FlowTimerStats &stats);
+  void GetMetrics(FlowMetrics &metrics);
+  void ResetMetrics();
+  // chrome trace events of recorded process spans, without the brackets,
+  // tid is the row of this flow in the trace viewer
+  void AppendTraceEvents(std::string &events, int tid);
   void DumpBase(std::string &dump_info);
   virtual void Dump(std::string &dump_info) { DumpBase(dump_info); }
 
@@ -189,7 +293,7 @@ protected:
     void SetOutputToQueueBehavior(const std::shared_ptr<MediaBuffer> &output);
 
   public:
-    FlowMap() : valid(false), hold_input(HoldInputMode::NONE) {
+    FlowMap() : valid(false), hold_input(HoldInputMode::NONE), out_cnt(0) {
       assert(list_mtx.valid);
     }
     FlowMap(FlowMap &&);
@@ -197,29 +301,44 @@ protected:
     bool valid;
     HoldInputMode hold_input;
     // down flow
-    void AddFlow(std::shared_ptr<Flow> flow, int index);
+    bool AddFlow(std::shared_ptr<Flow> flow, int index);
     void RemoveFlow(std::shared_ptr<Flow> flow);
+    // copy flows to snapshot, list_mtx is locked
+    void PublishFlows();
     std::list<FlowInputMap> flows;
     ReadWriteLockMutex list_mtx;
+    // what the coroutine sends to, read without lock or copy
+    RcuSnapshot<std::vector<FlowInputMap>> snapshot;
     std::deque<std::shared_ptr<MediaBuffer>> cached_buffers; // never drop
     std::shared_ptr<MediaBuffer> cached_buffer;
     decltype(&FlowMap::SetOutputBehavior) set_output_behavior;
+    std::atomic<int64_t> out_cnt;
   };
   class Input {
   private:
     void SyncSendInputBehavior(std::shared_ptr<MediaBuffer> &input);
     void ASyncSendInputCommonBehavior(std::shared_ptr<MediaBuffer> &input);
     void ASyncSendInputAtomicBehavior(std::shared_ptr<MediaBuffer> &input);
+    void ASyncSendInputLockFreeBehavior(std::shared_ptr<MediaBuffer> &input);
+    void PooledSendInputBehavior(std::shared_ptr<MediaBuffer> &input);
     // behavior when input list exceed max_cache_num
     bool ASyncFullBlockingBehavior(volatile bool &pred);
     bool ASyncFullDropFrontBehavior(volatile bool &pred);
     bool ASyncFullDropCurrentBehavior(volatile bool &pred);
+    bool ASyncRingBlockingPush(std::shared_ptr<MediaBuffer> &input);
 
   public:
-    Input() : valid(false), flow(nullptr), fetch_block(true) {}
+    Input()
+        : valid(false), flow(nullptr), fetch_block(true), block_timeout(0),
+          cached_fresh(false), upstream_num(0), blocked_time(0),
+          blocked_cnt(0), in_cnt(0), drop_front_cnt(0), drop_current_cnt(0),
+          max_depth(0) {}
     Input(Input &&);
-    void Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
-              std::shared_ptr<FlowCoroutine> fc);
+    void Init(Flow *f, Model m, int mcn, InputMode im, InputQueue iq,
+              int b_timeout, bool f_block, std::shared_ptr<FlowCoroutine> fc);
+    size_t GetCachedNum();
+    // called by consumer after taking buffers out
+    void NotifyNotFull();
     bool valid;
     Flow *flow;
     Model thread_model;
@@ -228,11 +347,28 @@ protected:
     ConditionLockMutex mtx;
     int max_cache_num;
     InputMode mode_when_full;
+    int block_timeout; // ms
     std::shared_ptr<MediaBuffer> cached_buffer;
+    // ASYNCATOMIC, cached_buffer not yet fetched by the coroutine
+    bool cached_fresh;
     SpinLockMutex spin_mtx;
     decltype(&Input::SyncSendInputBehavior) send_input_behavior;
     decltype(&Input::ASyncFullBlockingBehavior) async_full_behavior;
     std::shared_ptr<FlowCoroutine> coroutine;
+    // valid if input queue is SPSC or MPSC
+    std::unique_ptr<LockFreeRing<std::shared_ptr<MediaBuffer>>> ring;
+    std::atomic_int upstream_num;
+    // producers of lock free ring park here when BLOCKING
+    FutexEvent not_full_event;
+    // total time producers blocked on full input, us
+    std::atomic<int64_t> blocked_time;
+    std::atomic<int64_t> blocked_cnt;
+    // metrics
+    std::atomic<int64_t> in_cnt;
+    std::atomic<int64_t> drop_front_cnt;
+    std::atomic<int64_t> drop_current_cnt;
+    std::atomic<int64_t> max_depth;
+    FlowHistogramCounter latency;
   };
 
   // Can not change the following values after initialize,
@@ -254,9 +390,23 @@ protected:
                       int exp_process_time);
   bool SetOutput(const std::shared_ptr<MediaBuffer> &output,
                  int out_slot_index);
+  // run the process of an ASYNCCOMMON coroutine once more, with null
+  // inputs if none queued, for the outputs made on other threads
+  void WakeUp();
+  static bool IsFlowControl(unsigned long int request) {
+    return request >= G_FLOW_METRICS && request <= S_LAST_FLOW_CONTROL;
+  }
+  // the flow requests without argument pass none to Control
+  static bool FlowControlHasArg(unsigned long int request) {
+    return request == G_FLOW_METRICS || request == G_FLOW_TRACE_JSON;
+  }
+  int FlowControl(unsigned long int request, void *arg);
   bool ParseWrapFlowParams(const char *param,
                            std::map<std::string, std::string> &flow_params,
                            std::list<std::string> &sub_param_list);
+  // count upstreams of input slot, refuse the second one of spsc queue
+  bool AttachUpstream(int in_slot_index);
+  void DetachUpstream(int in_slot_index);
   // As sub threads may call the variable of child class,
   // we should define this for child class when it deconstruct.
   void StopAllThread();
@@ -275,6 +425,10 @@ private:
   volatile bool enable;
   volatile bool quit;
   ConditionLockMutex cond_mtx;
+  // wake up coroutines which fetch from lock free input rings
+  FutexEvent input_event;
+  // set by WakeUp(), the next fetch does not wait
+  std::atomic<bool> wake_pending;
 
   // event handler
   std::unique_ptr<EventHandler> event_handler_;
@@ -297,6 +451,19 @@ private:
   // FlowTag is used to distinguish Flow.
   std::string flow_tag;
 
+  // metrics of process and the recorded spans for chrome trace
+  typedef struct {
+    int64_t start; // us
+    int32_t cost;  // us
+    int32_t depth; // buffers in input 0
+  } TraceSpan;
+  void RecordSpan(int64_t start, int64_t cost, int64_t depth);
+  FlowHistogramCounter process_time;
+  volatile bool trace_enable;
+  SpinLockMutex trace_mtx;
+  std::vector<TraceSpan> trace_spans; // ring
+  size_t trace_pos;
+
   // Control the number of executions of threads inside Flow
   int run_times;
 
@@ -307,6 +474,8 @@ private:
 std::string gen_datatype_rule(std::map<std::string, std::string> &params);
 Model GetModelByString(const std::string &model);
 InputMode GetInputModelByString(const std::string &in_model);
+InputQueue GetInputQueueByString(const std::string &in_queue);
+DeadlinePolicy GetDeadlinePolicyByString(const std::string &policy);
 _API void ParseParamToSlotMap(std::map<std::string, std::string> &params,
                               SlotMap &sm, int &input_maxcachenum);
 size_t FlowOutputHoldInput(std::shared_ptr<MediaBuffer> &out_buffer,
@@ -316,6 +485,10 @@ size_t FlowOutputInheritFromInput(std::shared_ptr<MediaBuffer> &out_buffer,
 
 // the separator of flow params and flow core element params
 #define FLOW_PARAM_SEPARATE_CHAR ' '
+// write chrome trace json of flows, open it in chrome://tracing or perfetto
+_API bool FlowTraceExport(const std::vector<std::shared_ptr<Flow>> &flows,
+                          const char *path);
+
 _API std::string JoinFlowParam(const std::string &flow_param, size_t num_elem,
                                ...);
 _API std::list<std::string> ParseFlowParamToList(const char *param);
@@ -0,0 +1,108 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_FLOW_CHAIN_H_
+#define EASYMEDIA_FLOW_CHAIN_H_
+
+#include <stddef.h>
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "flow.h"
+#include "key_string.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// A stage is any type with
+//   bool operator()(std::shared_ptr<MediaBuffer> &buffer);
+// It may replace the buffer; false drops it, as a process function which
+// returns false.
+// FusedChain calls the stages one after another in one call site, so the
+// compiler sees through and inlines them, without the SendInput, RunOnce
+// and input vector of a flow per stage.
+template <typename... Stages> class FusedChain {
+public:
+  FusedChain() {}
+  explicit FusedChain(Stages... s) : stages(std::move(s)...) {}
+
+  bool operator()(std::shared_ptr<MediaBuffer> &buffer) {
+    return Run<0>(buffer);
+  }
+  template <size_t I>
+  typename std::tuple_element<I, std::tuple<Stages...>>::type &Get() {
+    return std::get<I>(stages);
+  }
+
+private:
+  template <size_t I>
+  typename std::enable_if<(I < sizeof...(Stages)), bool>::type
+  Run(std::shared_ptr<MediaBuffer> &buffer) {
+    return std::get<I>(stages)(buffer) && Run<I + 1>(buffer);
+  }
+  template <size_t I>
+  typename std::enable_if<(I == sizeof...(Stages)), bool>::type
+  Run(std::shared_ptr<MediaBuffer> &buffer _UNUSED) {
+    return true;
+  }
+
+  std::tuple<Stages...> stages;
+};
+
+// One flow running a FusedChain, input slot 0 to output slot 0. It is
+// wired with AddDownFlow/SendInput as any flow, the whole chain is one hop.
+// The thread model is SYNC unless the param sets another one.
+// usage: std::make_shared<FusedChainFlow<A, B, C>>(param, a, b, c)
+template <typename... Stages> class FusedChainFlow : public Flow {
+public:
+  explicit FusedChainFlow(const char *param, Stages... s)
+      : chain(std::move(s)...) {
+    std::map<std::string, std::string> params;
+    if (param && *param && !parse_media_param_map(param, params)) {
+      SetError(-EINVAL);
+      return;
+    }
+    SlotMap sm;
+    int input_maxcachenum = 2;
+    ParseParamToSlotMap(params, sm, input_maxcachenum);
+    if (params[KEK_THREAD_SYNC_MODEL].empty())
+      sm.thread_model = Model::SYNC;
+    if (params[KEK_INPUT_MODEL].empty())
+      sm.mode_when_full = InputMode::DROPFRONT;
+    sm.input_slots.push_back(0);
+    sm.input_maxcachenum.push_back(input_maxcachenum);
+    sm.output_slots.push_back(0);
+    sm.process = Process;
+    std::string &name = params[KEY_NAME];
+    if (name.empty())
+      name = "fused_chain";
+    if (!InstallSlotMap(sm, name, -1)) {
+      LOG("Fail to InstallSlotMap for %s\n", name.c_str());
+      SetError(-EINVAL);
+      return;
+    }
+    SetFlowTag(name);
+  }
+  virtual ~FusedChainFlow() { StopAllThread(); }
+  FusedChain<Stages...> &GetChain() { return chain; }
+
+private:
+  static bool Process(Flow *f, MediaBufferVector &input_vector) {
+    FusedChainFlow *flow = static_cast<FusedChainFlow *>(f);
+    auto &buffer = input_vector[0];
+    if (!buffer || !flow->chain(buffer))
+      return false;
+    return flow->SetOutput(buffer, 0);
+  }
+
+  FusedChain<Stages...> chain;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_FLOW_CHAIN_H_
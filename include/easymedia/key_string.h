@@ -32,6 +32,17 @@
 #define KEY_RIGHT_DIRECTION "->"
 #define KEY_BUFFER_RECT "rect"
 #define KEY_BUFFER_ROTATE "rotate"
+// cpu_image: by default area when shrunk to half or less, else bilinear
+#define KEY_BUFFER_SCALE_MODE "scale_mode"
+#define KEY_SCALE_BILINEAR "bilinear"
+#define KEY_SCALE_AREA "area"
+// cpu_image: threads over bands of rows
+#define KEY_IMAGE_THREADS "image_threads"
+// image_dispatch: the rga, the cpu, or the one to finish sooner
+#define KEY_DISPATCH_POLICY "dispatch_policy"
+#define KEY_DISPATCH_HW "hw"
+#define KEY_DISPATCH_CPU "cpu"
+#define KEY_DISPATCH_BALANCED "balanced"
 
 // video info
 #define KEY_COMPRESS_QP_INIT "qp_init"
@@ -56,6 +67,9 @@
 #define KEY_COMPRESS_RC_MODE "rc_mode"
 #define KEY_NEED_EXTRA_OUTPUT "need_extra_output"
 #define KEY_NEED_EXTRA_MERGE "need_extra_merge"
+// video_enc_parallel: encoder threads, and frames of a closed gop each
+#define KEY_ENC_WORKERS "enc_workers"
+#define KEY_ENC_SEGMENT_FRAMES "segment_frames"
 #define KEY_FULL_RANGE "full_range"
 #define KEY_H264_TRANS_8x8 "h264_trans_8x8"
 
@@ -95,6 +109,10 @@
 #define KEY_SAMPLE_RATE "sample_rate"
 #define KEY_FRAMES "frame_num"
 #define KEY_FLOAT_QUALITY "compress_quality"
+// audio_enc: re-frame any input to the frame of the encoder, "y" or not
+#define KEY_AUDIO_REFRAME "audio_reframe"
+// audio_enc and ffmpeg_audio_fifo: most samples held, in a power of 2 frames
+#define KEY_AUDIO_RING_SAMPLES "ring_samples"
 
 // v4l2 info
 #define KEY_USE_LIBV4L2 "use_libv4l2"
@@ -112,6 +130,11 @@
 #define KEY_USERNAME "username"
 #define KEY_USERPASSWORD "userpwd"
 #define KEY_CHANNEL_NAME "channel_name"
+// hardware buffers held without copy, copy the next ones past it
+#define KEY_HW_HOLD_NUM "hw_hold_num"
+// bytes of the newest gop sent at once to a new client, copied out of
+// hardware buffers, 0 (default) disables
+#define KEY_GOP_CACHE_SIZE "gop_cache_size"
 
 #define KEY_MEM_CNT "mem_cnt"
 #define KEY_MEM_TYPE "mem_type"
@@ -128,12 +151,25 @@
 #define KEY_ASYNCCOMMON "asynccommon"
 #define KEY_ASYNCATOMIC "asyncatomic"
 #define KEY_SYNC "sync"
+#define KEY_POOLED "pooled"
+
+#define KEY_DEADLINE_POLICY "deadline_policy"
+#define KEY_SKIP "skip"
+#define KEY_CATCHUP "catchup"
+#define KEY_TIMER_GROUP "timer_group"
 
 #define KEK_INPUT_MODEL "input_model"
 #define KEY_BLOCKING "blocking"
 #define KEY_DROPFRONT "dropfront"
 #define KEY_DROPCURRENT "dropcurrent"
 
+#define KEY_INPUT_QUEUE "input_queue"
+#define KEY_LOCKED "locked"
+#define KEY_SPSC "spsc"
+#define KEY_MPSC "mpsc"
+
+#define KEY_INPUT_BLOCK_TIMEOUT "input_block_timeout"
+
 #define KEY_INPUT_CACHE_NUM "input_cache_num"
 #define KEY_OUTPUT_CACHE_NUM "output_cache_num"
 
@@ -185,6 +221,8 @@
 #define KEY_DRAW_MIN_RECT "min_rect"
 #define KEY_DRAW_OFFSET_X "offset_x"
 #define KEY_DRAW_OFFSET_Y "offset_y"
+// threads to draw many boxes
+#define KEY_DRAW_THREADS "draw_threads"
 #define KEY_FRAME_INTERVAL "frame_interval"
 #define KEY_SCORE_THRESHOD "score_threshod"
 #define KEY_FRAME_RATE "frame_rate"
@@ -200,6 +238,11 @@
 //rockx
 #define KEY_ROCKX_MODEL "rockx_model"
 #define KEY_DB_PATH "db_path"
+// 1 to compare with the nearest features of a resident index only, for
+// features that are raw floats of one version, default 0
+#define KEY_FEATURE_INDEX "feature_index"
+// threads of the face feature index scan
+#define KEY_INDEX_THREADS "index_threads"
 
 // throuh_guard
 #define KEY_ALLOW_THROUGH_COUNT "allow_through_count"
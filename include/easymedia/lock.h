@@ -7,6 +7,7 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <stdint.h>
 
 #include <atomic>
 #include <condition_variable>
@@ -44,6 +45,8 @@ public:
   virtual void unlock() override;
   virtual void wait() override;
   virtual void notify() override;
+  // must be locked, return false if timeout
+  bool wait_for(int64_t timeout_us);
 
 private:
   std::mutex mtx;
@@ -78,6 +81,29 @@ private:
   std::atomic_flag flag;
 };
 
+// Event count built on futex, used to park a consumer of lock free queues.
+// Notify() costs a fence and a load when nobody is waiting.
+// Consumer usage:
+//   uint32_t key = ev.PrepareWait();
+//   if (condition satisfied) ev.CancelWait(); else ev.Wait(key);
+class FutexEvent {
+public:
+  FutexEvent() : seq(0), waiters(0) {}
+  FutexEvent(const FutexEvent &) = delete;
+  FutexEvent &operator=(const FutexEvent &) = delete;
+  uint32_t PrepareWait();
+  void CancelWait();
+  // timeout_ms < 0: wait until notified.
+  // return false if timeout.
+  bool Wait(uint32_t key, int timeout_ms = -1);
+  // wake up at most count waiters
+  void Notify(int count = INT32_MAX);
+
+private:
+  std::atomic<uint32_t> seq;
+  std::atomic<int> waiters;
+};
+
 class AutoLockMutex {
 public:
   AutoLockMutex(LockMutex &lm) : m_lm(lm) { m_lm.lock(); }
@@ -0,0 +1,126 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_LOCK_FREE_RING_H_
+#define EASYMEDIA_LOCK_FREE_RING_H_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <utility>
+
+namespace easymedia {
+
+#define RING_CACHE_LINE_SIZE 64
+
+// Bounded ring based on per cell sequence numbers (D. Vyukov).
+// Push is wait free for a single producer and lock free for multiple
+// producers, pop is lock free and may be called from more than one thread,
+// so that a producer can evict the oldest element when the ring is full.
+// 'limit' is the logical depth, the real capacity is rounded up to pow2.
+template <typename T> class LockFreeRing {
+public:
+  LockFreeRing(size_t limit, bool multi_producer)
+      : cells(nullptr), mask(0), max_num(limit), mp(multi_producer), head(0),
+        tail(0) {
+    assert(limit > 0);
+    size_t cap = 1;
+    while (cap < limit)
+      cap <<= 1;
+    mask = cap - 1;
+    cells = new Cell[cap];
+    for (size_t i = 0; i < cap; i++)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+  ~LockFreeRing() { delete[] cells; }
+  LockFreeRing(const LockFreeRing &) = delete;
+  LockFreeRing &operator=(const LockFreeRing &) = delete;
+
+  // return false if ring is full
+  bool TryPush(const T &v) {
+    Cell *cell;
+    size_t pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      intptr_t used = (intptr_t)(pos - head.load(std::memory_order_acquire));
+      if (used >= (intptr_t)max_num)
+        return false;
+      cell = &cells[pos & mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (!mp) {
+          tail.store(pos + 1, std::memory_order_relaxed);
+          break;
+        }
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = v;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // return false if ring is empty
+  bool TryPop(T &v) {
+    Cell *cell;
+    size_t pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+    v = std::move(cell->value);
+    cell->value = T();
+    cell->seq.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only a snapshot when producers or consumer are running.
+  size_t Size() const {
+    size_t h = head.load(std::memory_order_acquire);
+    size_t t = tail.load(std::memory_order_acquire);
+    return t > h ? t - h : 0;
+  }
+  bool Empty() const { return Size() == 0; }
+  size_t Limit() const { return max_num; }
+  bool IsMultiProducer() const { return mp; }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  Cell *cells;
+  size_t mask;
+  size_t max_num;
+  bool mp;
+  // keep consumer and producer index on different cache lines
+  char pad0[RING_CACHE_LINE_SIZE];
+  std::atomic<size_t> head;
+  char pad1[RING_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail;
+  char pad2[RING_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_LOCK_FREE_RING_H_
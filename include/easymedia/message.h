@@ -6,12 +6,17 @@
 #define EASYMEDIA_MESSAGE_H_
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
-#include <vector>
+
+#include <atomic>
+#include <memory>
 #include <thread>
+#include <vector>
 
 #include "lock.h"
+#include "lock_free_ring.h"
 #include "message_type.h"
 
 namespace easymedia {
@@ -23,25 +28,28 @@ class EventParam {
 public:
   EventParam() = delete;
   EventParam(int id, int param = 0)
-    : id_(id), param_(param), params_(nullptr) {}
-  ~EventParam() {
-    if (params_) {
-      free(params_);
-      params_ = nullptr;
-    }
-  }
+      : id_(id), param_(param), params_(nullptr), params_size_(0) {}
+  ~EventParam() { FreeParams(); }
+  // params from malloc, freed with free()
   int SetParams(void *params, int size) {
-    if(params_)
-      free(params_);
+    FreeParams();
     params_ = params;
     params_size_ = size;
     return 0;
   }
   int GetId() { return id_; }
   int GetParam() { return param_; }
-  void * GetParams() { return params_; }
+  void *GetParams() { return params_; }
   int GetParamsSize() { return params_size_; }
+
 private:
+  void FreeParams() {
+    if (params_)
+      free(params_);
+    params_ = nullptr;
+    params_size_ = 0;
+  }
+
   int id_;
   int param_;
   void *params_;
@@ -68,32 +76,78 @@ private:
 
 typedef int (* EventHook)(std::shared_ptr<Flow>flow, bool &loop);
 typedef std::shared_ptr<EventMessage> MessagePtr;
-typedef std::vector<MessagePtr> MessagePtrQueue;
 
+// fifo and unique events queued, the oldest dropped beyond
+#define EVENT_QUEUE_DEFAULT_LIMIT 256
+// lifo events queued, the oldest dropped beyond
+#define EVENT_LIFO_LIMIT 16
+// distinct ids of unique events, more are queued as fifo
+#define EVENT_UNIQUE_SLOT_NUM 32
+
+typedef struct {
+  size_t queued;
+  size_t limit;
+  int64_t pushed;
+  int64_t coalesced; // unique events merged into one already queued
+  int64_t dropped;   // the oldest dropped when full
+} EventQueueStats;
+
+// Bounded event queue, many producers and the hook thread to consume.
+// Fifo events and unique event tokens share one lock free ring, so both
+// keep their order. A unique event replaces the message in the slot of
+// its id, and is only queued again after the hook took it, so a repost
+// keeps the place of the queued one instead of moving to the back. Lifo
+// events go to a small stack, taken before the ring. When full, the oldest
+// is dropped, the newest events are the ones that matter; a unique token
+// merged since it was queued goes back to the tail instead.
 class EventHandler {
 public:
-  EventHandler() {}
+  EventHandler(size_t limit = EVENT_QUEUE_DEFAULT_LIMIT);
   virtual ~EventHandler() {}
 
   void RegisterEventHook(std::shared_ptr<Flow>flow, EventHook proc);
   void UnRegisterEventHook();
+  // return at once if an event is queued
   void EventHookWait();
   void SignalEventHook();
 
-  void CleanRepeatMessage(MessagePtr msg);
-  void InsertMessage(MessagePtr msg, bool front = false);
   MessagePtr GetEventMessage();
   void NotifyToEventHandler(MessagePtr msg);
-
-public:
+  void GetStats(EventQueueStats &stats);
 
 private:
-  EventHook process_;
+  struct Entry {
+    Entry() : slot(-1) {}
+    Entry(MessagePtr m, int s) : msg(m), slot(s) {}
+    MessagePtr msg;
+    int slot; // the message is in unique_slots_[slot] if >= 0
+  };
+  struct UniqueSlot {
+    UniqueSlot() : id(INT32_MIN), queued(false), merged(false) {}
+    std::atomic<int> id;
+    SpinLockMutex mtx;
+    MessagePtr msg;
+    bool queued;
+    bool merged; // msg replaced since the token was queued
+  };
+
+  int FindUniqueSlot(int id);
+  MessagePtr TakeUniqueSlot(int slot);
+  bool DropUniqueToken(int slot);
+  void PushEntry(const Entry &entry);
+
+  std::atomic<EventHook> process_;
   bool event_thread_loop_;
   std::unique_ptr<std::thread> event_thread_;
-  MessagePtrQueue event_msgs_;
-  ConditionLockMutex event_cond_mtx_;
-  ReadWriteLockMutex event_queue_mtx_;
+  FutexEvent event_;
+  LockFreeRing<Entry> ring_;
+  UniqueSlot unique_slots_[EVENT_UNIQUE_SLOT_NUM];
+  SpinLockMutex lifo_mtx_;
+  std::vector<MessagePtr> lifo_msgs_;
+  std::atomic<int> lifo_num_;
+  std::atomic<int64_t> pushed_;
+  std::atomic<int64_t> coalesced_;
+  std::atomic<int64_t> dropped_;
 };
 
 } // namespace easymedia
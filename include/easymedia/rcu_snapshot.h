@@ -0,0 +1,107 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_RCU_SNAPSHOT_H_
+#define EASYMEDIA_RCU_SNAPSHOT_H_
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace easymedia {
+
+// Immutable object published by writers and read without lock.
+// Readers count themselves in one of two epoch counters. A writer swaps the
+// pointer and retires the old object, which is freed once the epoch has
+// been flipped twice after it, each flip followed by the readers of the
+// epoch before draining; then it can not be seen by any reader.
+// Nobody waits for the readers: the flips and the frees go on in Publish
+// and in the last ReadUnlock of an epoch, whichever finds the readers gone.
+// Writers must be serialized by the caller.
+template <typename T> class RcuSnapshot {
+public:
+  RcuSnapshot() : ptr(new T()), epoch(0), drained(0), retired_num(0) {
+    readers[0] = 0;
+    readers[1] = 0;
+  }
+  ~RcuSnapshot() {
+    delete ptr.load();
+    for (auto &r : retired)
+      delete r.object;
+  }
+  RcuSnapshot(const RcuSnapshot &) = delete;
+  RcuSnapshot &operator=(const RcuSnapshot &) = delete;
+
+  // wait free, no allocation
+  const T *ReadLock(unsigned &ticket) {
+    ticket = epoch.load() & 1;
+    readers[ticket].fetch_add(1);
+    return ptr.load();
+  }
+  void ReadUnlock(unsigned ticket) {
+    if (readers[ticket].fetch_sub(1) == 1 &&
+        retired_num.load(std::memory_order_relaxed) > 0)
+      Reclaim();
+  }
+  // writer side
+  const T *Get() const { return ptr.load(); }
+  void Publish(T *next) {
+    const T *old = ptr.exchange(next);
+    retire_mtx.lock();
+    // the two flips from the current epoch on
+    retired.push_back({old, epoch.load() + 2});
+    retired_num = retired.size();
+    retire_mtx.unlock();
+    Reclaim();
+  }
+
+private:
+  struct Retired {
+    const T *object;
+    unsigned grace; // freed when drained reaches it
+  };
+
+  // never blocks, the one holding retire_mtx goes on
+  void Reclaim() {
+    std::unique_lock<std::mutex> lock(retire_mtx, std::try_to_lock);
+    if (!lock.owns_lock())
+      return;
+    std::vector<const T *> done;
+    for (;;) {
+      unsigned e = epoch.load();
+      if (drained != e) {
+        // the flip from e - 1 is done, wait for its readers to drain
+        if (readers[(e - 1) & 1].load(std::memory_order_acquire) > 0)
+          break;
+        drained = e;
+      }
+      while (!retired.empty() && (int)(drained - retired.front().grace) >= 0) {
+        done.push_back(retired.front().object);
+        retired.pop_front();
+      }
+      if (retired.empty())
+        break;
+      epoch.fetch_add(1);
+    }
+    retired_num = retired.size();
+    lock.unlock();
+    // may drop the last reference of something with a snapshot of its own
+    for (auto p : done)
+      delete p;
+  }
+
+  std::atomic<const T *> ptr;
+  std::atomic<unsigned> epoch;
+  std::atomic<int> readers[2];
+  // guarded by retire_mtx
+  std::mutex retire_mtx;
+  unsigned drained; // the epoch whose flip readers have all left
+  std::deque<Retired> retired;
+  std::atomic<size_t> retired_num;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_RCU_SNAPSHOT_H_
@@ -69,6 +69,10 @@ _CAPI RK_S32 RK_MPI_VI_GetChnRegionLuma(VI_PIPE ViPipe, VI_CHN ViChn,
                                         const VIDEO_REGION_INFO_S *pstRegionInfo,
                                         RK_U64 *pu64LumaData,
                                         RK_S32 s32MilliSec);
+/* u32StatFlags of REGION_LUMA_STAT_E, all regions in one pass */
+_CAPI RK_S32 RK_MPI_VI_GetChnRegionLumaStat(
+    VI_PIPE ViPipe, VI_CHN ViChn, const VIDEO_REGION_INFO_S *pstRegionInfo,
+    RK_U32 u32StatFlags, VIDEO_REGION_LUMA_S *pstLuma, RK_S32 s32MilliSec);
 _CAPI RK_S32 RK_MPI_VI_StartStream(VI_PIPE ViPipe, VI_CHN ViChn);
 /********************************************************************
  * Venc api
@@ -21,6 +21,25 @@ typedef struct rkVIDEO_REGION_INFO_S {
   RECT_S *pstRegion; /* region attribute */
 } VIDEO_REGION_INFO_S;
 
+/* statistics of RK_MPI_VI_GetChnRegionLumaStat, the sum is always there */
+typedef enum rkREGION_LUMA_STAT_E {
+  REGION_LUMA_SUM = 0,
+  REGION_LUMA_MIN_MAX = 1 << 0, /* u8Min and u8Max */
+  REGION_LUMA_HIST = 1 << 1,    /* au32Hist */
+  /* sums from an integral image of the frame if there are many regions
+   * overlapping, only without the other statistics */
+  REGION_LUMA_INTEGRAL = 1 << 2,
+} REGION_LUMA_STAT_E;
+
+#define REGION_LUMA_HIST_BINS 16 /* luma >> 4 */
+
+typedef struct rkVIDEO_REGION_LUMA_S {
+  RK_U64 u64Sum;
+  RK_U8 u8Min;
+  RK_U8 u8Max;
+  RK_U32 au32Hist[REGION_LUMA_HIST_BINS];
+} VIDEO_REGION_LUMA_S;
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,282 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "audio_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "buffer.h"
+
+namespace easymedia {
+
+// slots of a new ring, grown up to the capacity
+#define AUDIO_RING_START_SLOTS 4
+
+// the memory and the slots held by views, kept alive by the views out
+struct AudioRingStore {
+  AudioRingStore(size_t size, int slots)
+      : memory(size), held(new std::atomic<bool>[slots]) {
+    for (int i = 0; i < slots; i++)
+      held[i] = false;
+  }
+  std::vector<uint8_t> memory;
+  std::unique_ptr<std::atomic<bool>[]> held;
+};
+
+static bool is_planar(SampleFormat fmt) {
+  return fmt == SAMPLE_FMT_U8P || fmt == SAMPLE_FMT_S16P ||
+         fmt == SAMPLE_FMT_S32P || fmt == SAMPLE_FMT_FLTP;
+}
+
+AudioRing::AudioRing(const SampleInfo &sample_info, int frame_num,
+                     int capacity_num,
+                     std::shared_ptr<SizeClassBufferPool> buffer_pool)
+    : info(sample_info), frame_samples(frame_num), capacity(0), slots(0),
+      max_slots(0), planes(1), sample_bytes(0), pool(buffer_pool), read_pos(0),
+      write_pos(0), held_pos(0), drop_samples(0) {
+  info.nb_samples = frame_samples;
+  if (frame_samples <= 0 || !SampleInfoIsValid(info)) {
+    LOG("audio ring: invalid sample info or frame samples %d\n",
+        frame_samples);
+    return;
+  }
+  sample_bytes = GetSampleSize(info);
+  if (is_planar(info.fmt)) {
+    planes = info.channels;
+    sample_bytes /= info.channels;
+  }
+  max_slots = 2;
+  while ((int64_t)max_slots * frame_samples < capacity_num)
+    max_slots <<= 1;
+  slots = std::min(max_slots, AUDIO_RING_START_SLOTS);
+  capacity = slots * frame_samples;
+  store =
+      std::make_shared<AudioRingStore>(planes * capacity * sample_bytes, slots);
+}
+
+AudioRing::~AudioRing() {}
+
+// the samples of the first plane from pos, contiguous to the end of the
+// slot of pos; those of the next planes are a frame apart
+inline uint8_t *AudioRing::At(uint64_t pos) {
+  size_t slot = pos / frame_samples & (slots - 1);
+  size_t off = pos % frame_samples;
+  return store->memory.data() +
+         (slot * planes * frame_samples + off) * sample_bytes;
+}
+
+// a store of at least need samples, with the samples not read; views keep
+// the old one
+void AudioRing::Grow(uint64_t need) {
+  int num = slots;
+  while (num < max_slots && (uint64_t)num * frame_samples < need)
+    num <<= 1;
+  if (num == slots)
+    return;
+  size_t slot_size = planes * frame_samples * sample_bytes;
+  auto old = store;
+  int old_slots = slots;
+  store = std::make_shared<AudioRingStore>(num * slot_size, num);
+  slots = num;
+  capacity = slots * frame_samples;
+  for (uint64_t i = read_pos / frame_samples; i * frame_samples < write_pos;
+       i++)
+    memcpy(store->memory.data() + (i & (slots - 1)) * slot_size,
+           old->memory.data() + (i & (old_slots - 1)) * slot_size, slot_size);
+  held_pos = read_pos / frame_samples * frame_samples;
+}
+
+// the first sample that can not be written over
+inline uint64_t AudioRing::Tail() {
+  while (held_pos < read_pos &&
+         !store->held[held_pos / frame_samples & (slots - 1)].load(
+             std::memory_order_acquire))
+    held_pos += frame_samples;
+  return std::min(held_pos, read_pos);
+}
+
+// an empty ring restarts at a slot, so that the frames read are views
+void AudioRing::AlignEmpty() {
+  if (read_pos != write_pos)
+    return;
+  read_pos = write_pos = (write_pos + frame_samples - 1) / frame_samples *
+                         frame_samples;
+}
+
+int AudioRing::Write(const uint8_t *data, int samples, int64_t timestamp_us) {
+  if (!store || !data || samples <= 0)
+    return 0;
+  int offset = 0;
+  if (samples > max_slots * frame_samples) {
+    // only the newest fit
+    offset = samples - max_slots * frame_samples;
+    drop_samples += offset;
+    timestamp_us += (int64_t)offset * 1000000 / info.sample_rate;
+  }
+  int n = samples - offset;
+  uint64_t free_num = capacity - (write_pos - Tail());
+  if (n > (int)free_num) {
+    Grow(write_pos + n - Tail() / frame_samples * frame_samples);
+    free_num = capacity - (write_pos - Tail());
+  }
+  if (n > (int)free_num) {
+    // up to the end of a slot, for the next frame to start one
+    uint64_t end = read_pos + n - free_num + frame_samples - 1;
+    end = std::min(end / frame_samples * frame_samples, write_pos);
+    drop_samples += end - read_pos;
+    read_pos = end;
+    AlignEmpty();
+    free_num = capacity - (write_pos - Tail());
+    if (n > (int)free_num) {
+      drop_samples += n - free_num;
+      n = free_num;
+    }
+  }
+  if (n <= 0)
+    return 0;
+  uint64_t pos = write_pos;
+  for (int done = 0; done < n;) {
+    int num = std::min(n - done, frame_samples - (int)(pos % frame_samples));
+    uint8_t *dst = At(pos);
+    for (int p = 0; p < planes; p++)
+      memcpy(dst + p * frame_samples * sample_bytes,
+             data + (p * samples + offset + done) * sample_bytes,
+             num * sample_bytes);
+    pos += num;
+    done += num;
+  }
+  // an input going on within 1 us from the last anchor, as capture does,
+  // needs none
+  bool going_on = false;
+  if (!anchors.empty()) {
+    const Anchor &a = anchors.back();
+    int64_t off = (timestamp_us - a.timestamp_us) * info.sample_rate -
+                  (int64_t)(write_pos - a.pos) * 1000000;
+    going_on = llabs(off) <= info.sample_rate;
+  }
+  if (!going_on) {
+    anchors.push_back({write_pos, timestamp_us});
+    while (anchors.size() > 1 && anchors[1].pos <= read_pos)
+      anchors.pop_front();
+  }
+  write_pos += n;
+  return n;
+}
+
+int AudioRing::Write(const std::shared_ptr<SampleBuffer> &input) {
+  if (!input || !input->IsValid())
+    return 0;
+  SampleInfo &in_info = input->GetSampleInfo();
+  if (in_info.fmt != info.fmt || in_info.channels != info.channels ||
+      in_info.sample_rate != info.sample_rate) {
+    LOG("audio ring: input %s %dch %dHz, expect %s %dch %dHz\n",
+        SampleFmtToString(in_info.fmt), in_info.channels,
+        in_info.sample_rate, SampleFmtToString(info.fmt), info.channels,
+        info.sample_rate);
+    return 0;
+  }
+  return Write((const uint8_t *)input->GetPtr(), input->GetSamples(),
+               input->GetUSTimeStamp());
+}
+
+int64_t AudioRing::TimeStampAt(uint64_t pos) {
+  for (auto it = anchors.rbegin(); it != anchors.rend(); ++it) {
+    if (it->pos <= pos)
+      return it->timestamp_us +
+             (int64_t)(pos - it->pos) * 1000000 / info.sample_rate;
+  }
+  return 0;
+}
+
+std::shared_ptr<SampleBuffer> AudioRing::Copy(int samples) {
+  size_t size = planes * frame_samples * sample_bytes;
+  std::shared_ptr<SampleBuffer> frame;
+  if (pool) {
+    auto mb = pool->GetBuffer(size);
+    if (mb)
+      frame = std::make_shared<SampleBuffer>(*mb, info);
+  } else {
+    frame = std::make_shared<SampleBuffer>(MediaBuffer::Alloc2(size), info);
+  }
+  if (!frame || frame->GetSize() < size) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  uint8_t *dst = (uint8_t *)frame->GetPtr();
+  uint64_t pos = read_pos;
+  for (int done = 0; done < samples;) {
+    int num =
+        std::min(samples - done, frame_samples - (int)(pos % frame_samples));
+    const uint8_t *src = At(pos);
+    for (int p = 0; p < planes; p++)
+      memcpy(dst + (p * samples + done) * sample_bytes,
+             src + p * frame_samples * sample_bytes, num * sample_bytes);
+    pos += num;
+    done += num;
+  }
+  return frame;
+}
+
+std::shared_ptr<SampleBuffer> AudioRing::Read(bool flush) {
+  if (!store)
+    return nullptr;
+  uint64_t avail = write_pos - read_pos;
+  int n = frame_samples;
+  if (avail < (uint64_t)frame_samples) {
+    if (!flush || !avail)
+      return nullptr;
+    n = avail;
+  }
+  int64_t timestamp = TimeStampAt(read_pos);
+  std::shared_ptr<SampleBuffer> frame;
+  if (n == frame_samples && read_pos % frame_samples == 0) {
+    // a view, held against writes until released
+    size_t slot = read_pos / frame_samples & (slots - 1);
+    store->held[slot].store(true, std::memory_order_relaxed);
+    std::shared_ptr<AudioRingStore> s = store;
+    std::shared_ptr<void> lease(s.get(), [s, slot](void *) {
+      s->held[slot].store(false, std::memory_order_release);
+    });
+    MediaBuffer mb(At(read_pos), planes * n * sample_bytes);
+    mb.SetUserData(lease);
+    frame = std::make_shared<SampleBuffer>(mb, info);
+  } else {
+    frame = Copy(n);
+    if (!frame)
+      return nullptr;
+  }
+  frame->SetSamples(n);
+  frame->SetUSTimeStamp(timestamp);
+  read_pos += n;
+  while (anchors.size() > 1 && anchors[1].pos <= read_pos)
+    anchors.pop_front();
+  return frame;
+}
+
+int AudioRing::GetSamples() {
+  if (!store)
+    return 0;
+  return write_pos - read_pos;
+}
+
+int64_t AudioRing::GetDropSamples() {
+  if (!store)
+    return 0;
+  return drop_samples;
+}
+
+void AudioRing::Reset() {
+  if (!store)
+    return;
+  read_pos = write_pos;
+  AlignEmpty();
+  anchors.clear();
+}
+
+} // namespace easymedia
@@ -0,0 +1,223 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "broadcast_ring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "buffer.h"
+
+namespace easymedia {
+
+BroadcastRing::BroadcastRing(size_t capacity, size_t lag, bool gop)
+    : slots(capacity), reader_num(0), head(0), tail(0), key_seq(0),
+      extra_seq(0), key_valid(false), in_extra(false), extra_bytes(0),
+      key_bytes(0), key_cached(false), cache_budget(0),
+      max_lag(std::min(lag, capacity)), gop_aware(gop), event_fd(-1) {
+  assert(capacity > 0);
+}
+
+BroadcastRing::~BroadcastRing() {
+  if (event_fd >= 0)
+    close(event_fd);
+}
+
+bool BroadcastRing::Init() {
+  event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (event_fd < 0) {
+    LOG("eventfd failed: %m\n");
+    return false;
+  }
+  return true;
+}
+
+void BroadcastRing::ClearEvent() {
+  uint64_t cnt;
+  if (read(event_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+    LOG("read eventfd failed: %m\n");
+}
+
+void BroadcastRing::Notify() {
+  uint64_t one = 1;
+  if (write(event_fd, &one, sizeof(one)) < 0)
+    LOG("write eventfd failed: %m\n");
+}
+
+void BroadcastRing::SetMaxLag(size_t lag) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  max_lag = std::min(lag, slots.size());
+}
+
+void BroadcastRing::SetGopCache(size_t bytes) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  cache_budget = gop_aware ? bytes : 0;
+  key_cached = key_cached && key_bytes <= cache_budget;
+  Release();
+}
+
+void BroadcastRing::GetGopCache(size_t &bytes, int &num) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  bytes = key_cached ? key_bytes : 0;
+  num = key_cached ? (int)(head - key_seq) : 0;
+}
+
+void BroadcastRing::Push(const std::shared_ptr<MediaBuffer> &buffer) {
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (gop_aware) {
+      uint32_t flag = buffer->GetUserFlag();
+      size_t size = buffer->GetValidSize();
+      if (flag & MediaBuffer::kExtraIntra) {
+        if (!in_extra) {
+          extra_seq = head;
+          extra_bytes = 0;
+        }
+        extra_bytes += size;
+        in_extra = true;
+      } else {
+        if (flag & MediaBuffer::kIntra) {
+          key_seq = in_extra ? extra_seq : head;
+          key_valid = true;
+          key_bytes = in_extra ? extra_bytes : 0;
+          key_cached = key_seq >= tail;
+        }
+        in_extra = false;
+      }
+      // the key frame group and all after it, if in budget
+      if (key_valid) {
+        key_bytes += size;
+        key_cached = key_cached && key_bytes <= cache_budget;
+      }
+    }
+    // the parameter sets may start the next cached group
+    bool cache = key_cached || (cache_budget > 0 && in_extra);
+    if (reader_num == 0 && !cache) {
+      // nobody to keep it for
+      for (; tail < head; tail++)
+        slots[tail % slots.size()].reset();
+      tail = ++head;
+      return;
+    }
+    if (head - tail >= slots.size()) {
+      // the slowest reader lost it
+      slots[tail % slots.size()].reset();
+      tail++;
+      if (tail > key_seq)
+        key_cached = false;
+    }
+    slots[head % slots.size()] = buffer;
+    head++;
+    if (reader_num == 0 || cache_budget > 0)
+      Release();
+    if (reader_num == 0)
+      return;
+  }
+  Notify();
+}
+
+int BroadcastRing::AddReader() {
+  std::lock_guard<std::mutex> _lg(mtx);
+  Reader r;
+  r.used = true;
+  r.cursor = head;
+  r.drop_num = 0;
+  if (gop_aware && key_valid && key_seq >= tail)
+    r.cursor = key_seq;
+  reader_num++;
+  for (size_t i = 0; i < readers.size(); i++) {
+    if (!readers[i].used) {
+      readers[i] = r;
+      return i;
+    }
+  }
+  readers.push_back(r);
+  return readers.size() - 1;
+}
+
+// under mtx
+bool BroadcastRing::IsReader(int id, const char *caller) {
+  if (id < 0 || id >= (int)readers.size() || !readers[id].used) {
+    LOG("ERROR: BroadcastRing %s: no reader %d\n", caller, id);
+    return false;
+  }
+  return true;
+}
+
+void BroadcastRing::RemoveReader(int id) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  if (id < 0 || id >= (int)readers.size() || !readers[id].used)
+    return;
+  readers[id].used = false;
+  reader_num--;
+  Release();
+}
+
+// free the buffers all readers passed and out of the gop cache, under mtx
+void BroadcastRing::Release() {
+  uint64_t min = head;
+  if (key_cached)
+    min = key_seq;
+  if (cache_budget > 0 && in_extra)
+    min = std::min(min, extra_seq);
+  for (auto &r : readers)
+    if (r.used)
+      min = std::min(min, r.cursor);
+  for (; tail < min; tail++)
+    slots[tail % slots.size()].reset();
+}
+
+std::shared_ptr<MediaBuffer> BroadcastRing::Pop(int id) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  if (!IsReader(id, __func__))
+    return nullptr;
+  Reader &r = readers[id];
+  // the slowest one frees what it passed
+  bool slowest = r.cursor <= tail;
+  if (r.cursor < tail || head - r.cursor > max_lag) {
+    uint64_t to = r.cursor;
+    if (gop_aware && key_valid) {
+      // keep on without a newer key frame, no way to decode otherwise
+      if (key_seq >= tail && key_seq > r.cursor)
+        to = key_seq;
+      else if (r.cursor < tail)
+        to = tail;
+    } else {
+      to = std::max(tail, head - std::min<uint64_t>(head, max_lag / 2));
+    }
+    r.drop_num += to - r.cursor;
+    r.cursor = to;
+  }
+  std::shared_ptr<MediaBuffer> buffer;
+  if (r.cursor < head)
+    buffer = slots[r.cursor++ % slots.size()];
+  if (slowest)
+    Release();
+  return buffer;
+}
+
+bool BroadcastRing::HasData(int id) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  if (!IsReader(id, __func__))
+    return false;
+  return readers[id].cursor < head;
+}
+
+int BroadcastRing::GetReaderNum() {
+  std::lock_guard<std::mutex> _lg(mtx);
+  return reader_num;
+}
+
+int64_t BroadcastRing::GetDropNum(int id) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  if (!IsReader(id, __func__))
+    return -1;
+  return readers[id].drop_num;
+}
+
+} // namespace easymedia
@@ -11,6 +11,12 @@
 #include <unistd.h>
 #include<sys/ioctl.h>
 
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <thread>
+
+#include "codec.h"
 #include "key_string.h"
 #include "utils.h"
 
@@ -428,9 +434,61 @@ std::shared_ptr<MediaBuffer> MediaBuffer::Clone(MediaBuffer &src,
   memcpy(new_buffer->GetPtr(), src.GetPtr(), size);
   new_buffer->SetValidSize(size);
   new_buffer->CopyAttribute(src);
+  // the nal units are at the same offsets
+  auto index = src.GetNaluIndex();
+  if (index && index->ptr == src.GetPtr() && index->valid_size == size) {
+    auto copy = std::make_shared<NaluIndex>(*index);
+    copy->ptr = new_buffer->GetPtr();
+    new_buffer->SetNaluIndex(copy);
+  }
   return new_buffer;
 }
 
+std::shared_ptr<MediaBuffer>
+MediaBuffer::SubBuffer(const std::shared_ptr<MediaBuffer> &src, size_t offset,
+                       size_t size) {
+  if (!src || offset + size > src->GetValidSize() || offset + size < size) {
+    LOG("ERROR: %s: [%zu, +%zu) out of valid size\n", __func__, offset, size);
+    return nullptr;
+  }
+  auto view = std::make_shared<MediaBuffer>((uint8_t *)src->GetPtr() + offset,
+                                            size);
+  view->SetUserData(std::static_pointer_cast<void>(src));
+  view->SetValidSize(size);
+  view->CopyAttribute(*src);
+  if (offset == 0)
+    view->SetNaluIndex(src->GetNaluIndex());
+  return view;
+}
+
+HwBufferHolder::HwBufferHolder(int num)
+    : held(std::make_shared<std::atomic<int>>(0)), max_num(num),
+      copied_bytes(0) {}
+
+std::shared_ptr<MediaBuffer>
+HwBufferHolder::Hold(const std::shared_ptr<MediaBuffer> &mb) {
+  if (!mb || !mb->IsHwBuffer())
+    return mb;
+  if (held->load() >= max_num)
+    return Copy(mb);
+  auto view = MediaBuffer::SubBuffer(mb, 0, mb->GetValidSize());
+  if (!view)
+    return nullptr;
+  auto cnt = held;
+  cnt->fetch_add(1);
+  view->SetRelatedSPtr(std::shared_ptr<void>(
+      cnt.get(), [cnt](void *) { cnt->fetch_sub(1); }));
+  return view;
+}
+
+std::shared_ptr<MediaBuffer>
+HwBufferHolder::Copy(const std::shared_ptr<MediaBuffer> &mb) {
+  auto copy = MediaBuffer::Clone(*mb);
+  if (copy)
+    copied_bytes += copy->GetValidSize();
+  return copy;
+}
+
 void MediaBuffer::CopyAttribute(MediaBuffer &src_attr) {
   type = src_attr.GetType();
   user_flag = src_attr.GetUserFlag();
@@ -499,147 +557,418 @@ MediaGroupBuffer::Alloc(size_t size, MediaBuffer::MemType type) {
   }
 }
 
+#define BUFFER_POOL_SHRINK_INTERVAL 256
+// in place storage of the MediaBuffer and the release token control blocks
+#define BUFFER_POOL_MB_STORAGE (sizeof(MediaBuffer) + 64)
+#define BUFFER_POOL_TOKEN_STORAGE 128
+
+enum { SLOT_EMPTY, SLOT_READY, SLOT_BUSY, SLOT_ORPHAN };
+
+struct BufferPoolSlot {
+  BufferPoolSlot(BufferPool *bp, int idx)
+      : pool(bp), mgb(nullptr), index(idx), next(0), state(SLOT_EMPTY),
+        refs(0) {}
+  // The slot goes back to pool when the release token and the control
+  // blocks in the storage are all gone, so the storage is always free for
+  // the next user.
+  void *Allocate(int which, size_t bytes) {
+    size_t cap = which ? BUFFER_POOL_TOKEN_STORAGE : BUFFER_POOL_MB_STORAGE;
+    if (bytes > cap) {
+      pool->heap_cnt++;
+      return ::operator new(bytes);
+    }
+    refs++;
+    return which ? (void *)token_storage : (void *)mb_storage;
+  }
+  void Deallocate(int which, void *p) {
+    if (p != (which ? (void *)token_storage : (void *)mb_storage)) {
+      ::operator delete(p);
+      return;
+    }
+    Unref();
+  }
+  void Unref() {
+    if (refs.fetch_sub(1) != 1)
+      return;
+    int expected = SLOT_BUSY;
+    if (state.compare_exchange_strong(expected, SLOT_READY)) {
+      pool->PutSlot(this);
+      return;
+    }
+    // pool is gone
+    delete mgb;
+    mgb = nullptr;
+  }
+
+  BufferPool *pool;
+  MediaGroupBuffer *mgb;
+  int index;
+  std::atomic<uint32_t> next; // intrusive link of the ready list
+  std::atomic<int> state;
+  std::atomic<int> refs;
+  alignas(std::max_align_t) char mb_storage[BUFFER_POOL_MB_STORAGE];
+  alignas(std::max_align_t) char token_storage[BUFFER_POOL_TOKEN_STORAGE];
+};
+
+// recycles the control blocks of shared_ptr in the slot
+template <typename T> struct BufferPoolAllocator {
+  typedef T value_type;
+  BufferPoolAllocator(BufferPoolSlot *s, int w) : slot(s), which(w) {}
+  template <typename U>
+  BufferPoolAllocator(const BufferPoolAllocator<U> &other)
+      : slot(other.slot), which(other.which) {}
+  T *allocate(size_t n) {
+    return static_cast<T *>(slot->Allocate(which, n * sizeof(T)));
+  }
+  void deallocate(T *p, size_t n _UNUSED) { slot->Deallocate(which, p); }
+  template <typename U> bool operator==(const BufferPoolAllocator<U> &o) const {
+    return slot == o.slot && which == o.which;
+  }
+  template <typename U> bool operator!=(const BufferPoolAllocator<U> &o) const {
+    return !(*this == o);
+  }
+
+  BufferPoolSlot *slot;
+  int which;
+};
+
+// deleter of the release token, which is shared by the MediaBuffer got from
+// pool and all its copies, such as ImageBuffer
+struct BufferPoolReleaser {
+  BufferPoolReleaser(BufferPoolSlot *s) : slot(s) {}
+  void operator()(void *p _UNUSED) { slot->Unref(); }
+  BufferPoolSlot *slot;
+};
+
+static void atomic_store_min(std::atomic<int> &a, int v) {
+  int old = a.load(std::memory_order_relaxed);
+  while (v < old && !a.compare_exchange_weak(old, v, std::memory_order_relaxed))
+    ;
+}
+
+static void atomic_store_max(std::atomic<int> &a, int v) {
+  int old = a.load(std::memory_order_relaxed);
+  while (v > old && !a.compare_exchange_weak(old, v, std::memory_order_relaxed))
+    ;
+}
+
 BufferPool::BufferPool(int cnt, int size, MediaBuffer::MemType type) {
-  bool sucess = true;
+  Init(cnt, cnt, size, type);
+}
+
+BufferPool::BufferPool(int min, int max, int size, MediaBuffer::MemType type) {
+  Init(min, max, size, type);
+}
 
-  if (cnt <= 0) {
-    LOG("ERROR: BufferPool: cnt:%d is invalid!\n", cnt);
+void BufferPool::Init(int min, int max, int size, MediaBuffer::MemType type) {
+  ready_head = 0;
+  mem_type = type;
+  min_cnt = min;
+  max_cnt = max;
+  buf_size = size;
+  buf_cnt = 0;
+  ready_num = 0;
+  busy_num = 0;
+  releasing_num = 0;
+  busy_high = 0;
+  ready_low = 0;
+  window_low = 0;
+  get_cnt = 0;
+  starved_cnt = 0;
+  timeout_cnt = 0;
+  grow_cnt = 0;
+  shrink_cnt = 0;
+  heap_cnt = 0;
+
+  if (min < 0 || max <= 0 || min > max) {
+    LOG("ERROR: BufferPool: cnt:%d~%d is invalid!\n", min, max);
+    max_cnt = 0;
     return;
   }
-
-  for (int i = 0; i < cnt; i++) {
-    auto mgb = MediaGroupBuffer::Alloc(size, type);
-    if (!mgb) {
-      sucess = false;
+  slots.resize(max, nullptr);
+  for (int i = max - 1; i >= 0; i--)
+    empty_slots.push_back(i);
+
+  for (int i = 0; i < min; i++) {
+    BufferPoolSlot *slot = Grow();
+    if (!slot) {
+      LOG("ERROR: BufferPool: Create buffer pool failed! Please check space "
+          "is enough!\n");
       break;
     }
-    mgb->SetBufferPool(this);
-    LOGD("Create: pool:%p, mgb:%p, ptr:%p, fd:%d, size:%zu\n",
-      this, mgb, mgb->GetPtr(), mgb->GetFD(), mgb->GetSize());
-    ready_buffers.push_back(mgb);
-  }
-
-  if (!sucess) {
-    while (ready_buffers.size() > 0)
-      ready_buffers.pop_front();
-    LOG("ERROR: BufferPool: Create buffer pool failed! Please check space is enough!\n");
-    return;
+    PushReady(slot);
   }
-  buf_cnt = cnt;
-  buf_size = size;
-  LOGD("BufferPool: Create buffer pool:%p, size:%d, cnt:%d\n",
-    this, size, cnt);
+  grow_cnt = 0;
+  ready_low = ready_num.load();
+  window_low = ready_num.load();
+  LOGD("BufferPool: Create buffer pool:%p, size:%d, cnt:%d~%d\n", this, size,
+       min, max);
 }
 
 BufferPool::~BufferPool() {
   int cnt = 0;
   int wait_times = 30;
 
-  while (busy_buffers.size() > 0) {
-    if (wait_times <= 0) {
+  while (busy_num > 0) {
+    if (wait_times-- <= 0) {
       LOG("ERROR: BufferPool: waiting bufferpool free for 900ms, TimeOut!\n");
       break;
     }
-    easymedia::usleep(30000); //wait 30ms
+    easymedia::usleep(30000); // wait 30ms
   }
 
-  MediaGroupBuffer *mgb = NULL;
-  while (ready_buffers.size() > 0) {
-    mgb = ready_buffers.front();
-    ready_buffers.pop_front();
-    LOGD("BufferPool: #%02d Destroy buffer pool(ready):[%p,%p]\n",
-      cnt, this, mgb);
-    delete mgb;
-    cnt++;
+  // the busy buffers are freed by their last user
+  int orphan = 0;
+  for (auto slot : slots) {
+    int expected = SLOT_BUSY;
+    if (slot && slot->state.compare_exchange_strong(expected, SLOT_ORPHAN)) {
+      LOG("WARN: BufferPool: #%02d Destroy buffer pool(busy):[%p,%p]\n",
+          slot->index, this, slot->mgb);
+      orphan++;
+    }
   }
-
-  while (busy_buffers.size() > 0) {
-    mgb = busy_buffers.front();
-    busy_buffers.pop_front();
-    LOG("WARN: BufferPool: #%02d Destroy buffer pool(busy):[%p,%p]\n",
-      cnt, this, mgb);
-    delete mgb;
-    cnt++;
+  // releasing ones which missed the orphan mark
+  while (busy_num + releasing_num > orphan)
+    std::this_thread::yield();
+
+  for (auto slot : slots) {
+    if (!slot || slot->state == SLOT_ORPHAN)
+      continue;
+    if (slot->mgb) {
+      LOGD("BufferPool: #%02d Destroy buffer pool(ready):[%p,%p]\n", cnt, this,
+           slot->mgb);
+      delete slot->mgb;
+      cnt++;
+    }
+    delete slot;
   }
 }
 
-static int __groupe_buffer_free(void *data) {
-  assert(data);
-  if (data == NULL) {
-    LOG("ERROR: BufferPool: free ptr is null!\n");
-    return 0;
-  }
-  MediaGroupBuffer *mgb = (MediaGroupBuffer *)data;
-  if (mgb->pool == NULL) {
-    LOG("ERROR: BufferPool: free pool ptr is null!\n");
-    return 0;
+BufferPoolSlot *BufferPool::PopReady() {
+  uint64_t head = ready_head.load(std::memory_order_acquire);
+  BufferPoolSlot *slot;
+  for (;;) {
+    uint32_t idx = (uint32_t)head;
+    if (!idx)
+      return nullptr;
+    // slot is never freed, so a stale next only fails the cas
+    slot = slots[idx - 1];
+    uint64_t next = ((head >> 32) + 1) << 32 | slot->next.load();
+    if (ready_head.compare_exchange_weak(head, next, std::memory_order_acquire,
+                                         std::memory_order_acquire))
+      break;
   }
+  int ready = ready_num.fetch_sub(1) - 1;
+  atomic_store_min(ready_low, ready);
+  atomic_store_min(window_low, ready);
+  return slot;
+}
 
-  BufferPool *bp = (BufferPool *)mgb->pool;
+void BufferPool::PushReady(BufferPoolSlot *slot) {
+  slot->state = SLOT_READY;
+  // count before publish, so that the ready number is never negative
+  ready_num++;
+  uint64_t head = ready_head.load(std::memory_order_relaxed);
+  uint64_t next;
+  do {
+    slot->next.store((uint32_t)head);
+    next = ((head >> 32) + 1) << 32 | (uint32_t)(slot->index + 1);
+  } while (!ready_head.compare_exchange_weak(
+      head, next, std::memory_order_release, std::memory_order_relaxed));
+}
 
-  return bp->PutBuffer(mgb);
+BufferPoolSlot *BufferPool::Grow() {
+  std::lock_guard<std::mutex> _lg(grow_mtx);
+  if (empty_slots.empty())
+    return nullptr;
+  auto mgb = MediaGroupBuffer::Alloc(buf_size, mem_type);
+  if (!mgb) {
+    LOG("ERROR: BufferPool: alloc buffer failed, cnt:%d\n", buf_cnt.load());
+    return nullptr;
+  }
+  int idx = empty_slots.back();
+  empty_slots.pop_back();
+  if (!slots[idx])
+    slots[idx] = new BufferPoolSlot(this, idx);
+  BufferPoolSlot *slot = slots[idx];
+  mgb->SetBufferPool(this);
+  slot->mgb = mgb;
+  LOGD("Create: pool:%p, mgb:%p, ptr:%p, fd:%d, size:%zu\n", this, mgb,
+       mgb->GetPtr(), mgb->GetFD(), mgb->GetSize());
+  buf_cnt++;
+  grow_cnt++;
+  window_low = 0;
+  return slot;
 }
 
-std::shared_ptr<MediaBuffer> BufferPool::GetBuffer(bool block) {
-  AutoLockMutex _alm(mtx);
-
-  while(1) {
-    if (!ready_buffers.size()) {
-      if (block)
-        mtx.wait();
-      else
-        return nullptr;
-    }
-    //mtx.notify wake up all mtx.wait.
-    if (ready_buffers.size() > 0)
+// release the buffers which have been idle for the whole last interval
+void BufferPool::Shrink() {
+  std::unique_lock<std::mutex> _lk(grow_mtx, std::try_to_lock);
+  if (!_lk.owns_lock())
+    return;
+  int excess = std::min(window_low.load(), buf_cnt.load() - min_cnt);
+  for (int i = 0; i < excess; i++) {
+    BufferPoolSlot *slot = PopReady();
+    if (!slot)
       break;
+    delete slot->mgb;
+    slot->mgb = nullptr;
+    slot->state = SLOT_EMPTY;
+    empty_slots.push_back(slot->index);
+    buf_cnt--;
+    shrink_cnt++;
   }
+  window_low = ready_num.load();
+}
 
-  auto mgb = ready_buffers.front();
-  ready_buffers.pop_front();
-  busy_buffers.push_back(mgb);
-
-  auto &&mb = std::make_shared<MediaBuffer>(mgb->GetPtr(),
-    mgb->GetSize(), mgb->GetFD(), mgb, __groupe_buffer_free);
-  return mb;
+void BufferPool::PutSlot(BufferPoolSlot *slot) {
+  releasing_num++;
+  busy_num--;
+  PushReady(slot);
+  ready_event.Notify(1);
+  // must be the last access of pool, see destructor
+  releasing_num--;
 }
 
-int BufferPool::PutBuffer(MediaGroupBuffer *mgb) {
-  std::list<MediaGroupBuffer *>::iterator it;
-  bool sucess = false;
-  AutoLockMutex _alm(mtx);
+std::shared_ptr<MediaBuffer> BufferPool::GetBuffer(bool block) {
+  return GetBuffer(block ? -1 : 0);
+}
 
-  for (it = busy_buffers.begin(); it != busy_buffers.end();) {
-    if (*it == mgb) {
-      sucess = true;
-      it = busy_buffers.erase(it);
-      ready_buffers.push_back(mgb);
-      mtx.notify();
-      break;
+std::shared_ptr<MediaBuffer> BufferPool::GetBuffer(int timeout_ms) {
+  int64_t n = get_cnt.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (max_cnt > min_cnt && n % BUFFER_POOL_SHRINK_INTERVAL == 0)
+    Shrink();
+
+  BufferPoolSlot *slot = PopReady();
+  if (!slot)
+    slot = Grow();
+  if (!slot) {
+    starved_cnt++;
+    if (timeout_ms == 0)
+      return nullptr;
+    AutoDuration ad;
+    for (;;) {
+      uint32_t key = ready_event.PrepareWait();
+      slot = PopReady();
+      if (slot) {
+        ready_event.CancelWait();
+        break;
+      }
+      int wait_ms = -1;
+      if (timeout_ms > 0) {
+        wait_ms = timeout_ms - (int)(ad.Get() / 1000);
+        if (wait_ms <= 0) {
+          ready_event.CancelWait();
+          timeout_cnt++;
+          return nullptr;
+        }
+      }
+      ready_event.Wait(key, wait_ms);
     }
-    it++;
   }
 
-  if (!sucess)
-    LOG("ERROR: BufferPool: Unknow media group buffer:%p\n", mgb);
-
-  return sucess ? 0 : -1;
+  slot->state = SLOT_BUSY;
+  slot->refs = 1; // the release token
+  atomic_store_max(busy_high, busy_num.fetch_add(1) + 1);
+  MediaGroupBuffer *mgb = slot->mgb;
+  std::shared_ptr<void> token(mgb, BufferPoolReleaser(slot),
+                              BufferPoolAllocator<char>(slot, 1));
+  auto mb = std::allocate_shared<MediaBuffer>(
+      BufferPoolAllocator<MediaBuffer>(slot, 0), mgb->GetPtr(), mgb->GetSize(),
+      mgb->GetFD());
+  mb->SetUserData(token);
+  return mb;
 }
 
 void BufferPool::DumpInfo() {
   int id = 0;
   LOG("##BufferPool DumpInfo:%p\n", this);
-  LOG("\tcnt:%d\n", buf_cnt);
-  LOG("\tsize:%zu\n", buf_size);
-  LOG("\tready buffers(%d):\n", ready_buffers.size());
-  for (auto dev : ready_buffers)
-    LOG("\t  #%02d Pool:%p, mgb:%p, ptr:%p\n",
-      id++, dev->pool, dev, dev->GetPtr());
-  LOG("\tbusy buffers(%d):\n", busy_buffers.size());
+  LOG("\tcnt:%d, min:%d, max:%d\n", buf_cnt.load(), min_cnt, max_cnt);
+  LOG("\tsize:%d\n", buf_size);
+  LOG("\twatermark: busy high:%d, ready low:%d\n", busy_high.load(),
+      ready_low.load());
+  LOG("\tget:%lld, starved:%lld, timeout:%lld\n", (long long)get_cnt.load(),
+      (long long)starved_cnt.load(), (long long)timeout_cnt.load());
+  LOG("\tgrow:%lld, shrink:%lld, unrecycled control blocks:%lld\n",
+      (long long)grow_cnt.load(), (long long)shrink_cnt.load(),
+      (long long)heap_cnt.load());
+  LOG("\tready buffers(%d):\n", ready_num.load());
+  for (auto slot : slots)
+    if (slot && slot->state == SLOT_READY)
+      LOG("\t  #%02d Pool:%p, mgb:%p, ptr:%p\n", id++, slot->mgb->pool,
+          slot->mgb, slot->mgb->GetPtr());
+  LOG("\tbusy buffers(%d):\n", busy_num.load());
   id = 0;
-  for (auto dev : busy_buffers)
-    LOG("\t  #%02d Pool:%p, mgb:%p, ptr:%p\n",
-      id++, dev->pool, dev, dev->GetPtr());
+  for (auto slot : slots)
+    if (slot && slot->state == SLOT_BUSY)
+      LOG("\t  #%02d Pool:%p, mgb:%p, ptr:%p\n", id++, slot->mgb->pool,
+          slot->mgb, slot->mgb->GetPtr());
+}
+
+SizeClassBufferPool::SizeClassBufferPool(int cnt, MediaBuffer::MemType type)
+    : max_cnt(cnt), mem_type(type), fallback_cnt(0) {
+  for (int i = 0; i < SIZE_CLASS_NUM; i++)
+    classes[i] = nullptr;
+}
+
+SizeClassBufferPool::~SizeClassBufferPool() {
+  for (int i = 0; i < SIZE_CLASS_NUM; i++)
+    delete classes[i].load();
+}
+
+std::shared_ptr<SizeClassBufferPool>
+SizeClassBufferPool::GetShared(int cnt, MediaBuffer::MemType type) {
+  static std::mutex registry_mtx;
+  static std::map<std::pair<int, int>, std::weak_ptr<SizeClassBufferPool>>
+      registry;
+  std::lock_guard<std::mutex> _lg(registry_mtx);
+  auto &wp = registry[std::make_pair(cnt, (int)type)];
+  auto pool = wp.lock();
+  if (!pool) {
+    pool = std::make_shared<SizeClassBufferPool>(cnt, type);
+    wp = pool;
+  }
+  return pool;
+}
+
+std::shared_ptr<MediaBuffer> SizeClassBufferPool::GetBuffer(size_t size,
+                                                          bool fallback) {
+  int shift = SIZE_CLASS_MIN_SHIFT;
+  while (shift <= SIZE_CLASS_MAX_SHIFT && ((size_t)1 << shift) < size)
+    shift++;
+  if (shift > SIZE_CLASS_MAX_SHIFT || max_cnt <= 0) {
+    fallback_cnt++;
+    return fallback ? MediaBuffer::Alloc(size) : nullptr;
+  }
+  auto &cls = classes[shift - SIZE_CLASS_MIN_SHIFT];
+  BufferPool *pool = cls.load(std::memory_order_acquire);
+  if (!pool) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    pool = cls.load();
+    if (!pool) {
+      pool = new BufferPool(0, max_cnt, 1 << shift, mem_type);
+      cls.store(pool, std::memory_order_release);
+    }
+  }
+  auto mb = pool->GetBuffer(0);
+  if (mb)
+    return mb;
+  // overloaded, a hardware allocation a frame is what the pool avoids
+  fallback_cnt++;
+  return fallback ? MediaBuffer::Alloc(size) : nullptr;
+}
+
+void SizeClassBufferPool::DumpInfo() {
+  LOG("##SizeClassBufferPool DumpInfo:%p\n", this);
+  LOG("\tmax cnt per class:%d, fallback:%lld\n", max_cnt,
+      (long long)fallback_cnt.load());
+  for (int i = 0; i < SIZE_CLASS_NUM; i++) {
+    BufferPool *pool = classes[i].load();
+    if (!pool)
+      continue;
+    LOG("\tclass %d bytes:\n", 1 << (i + SIZE_CLASS_MIN_SHIFT));
+    pool->DumpInfo();
+  }
 }
 
 } // namespace easymedia
@@ -4,6 +4,18 @@
 
 #include "color_table.h"
 
+#include <string.h>
+
+#include <list>
+#include <mutex>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 /* Match an RGB value to a particular palette index */
 RK_U8 find_color(const RK_U32 *pal, RK_U32 len, RK_U8 r,
                           RK_U8 g, RK_U8 b) {
@@ -45,3 +57,133 @@ RK_U8 find_color(const RK_U32 *pal, RK_U32 len, RK_U8 r,
 
   return pixel;
 }
+
+// palettes keeping their table, the least recently used one goes first
+#define COLOR_LUT_CACHE_NUM 4
+
+typedef struct {
+  std::vector<RK_U32> pal; // a copy, not the address that may be reused
+  std::shared_ptr<COLOR_LUT_S> lut;
+} ColorLutEntry;
+
+static std::mutex lut_mtx;
+static std::list<ColorLutEntry> lut_cache; // the most recent first
+
+std::shared_ptr<const COLOR_LUT_S> get_color_lut(const RK_U32 *pal,
+                                                 RK_U32 len) {
+  std::lock_guard<std::mutex> _lg(lut_mtx);
+  for (auto it = lut_cache.begin(); it != lut_cache.end(); ++it) {
+    if (it->pal.size() == len &&
+        !memcmp(it->pal.data(), pal, len * sizeof(RK_U32))) {
+      lut_cache.splice(lut_cache.begin(), lut_cache, it);
+      return it->lut;
+    }
+  }
+  auto lut = std::make_shared<COLOR_LUT_S>();
+  for (RK_U32 i = 0; i < (1 << 15); i++)
+    lut->rgb555[i] = find_color(pal, len, (i >> 10) & 0x1F, (i >> 5) & 0x1F,
+                                i & 0x1F);
+  for (RK_U32 i = 0; i < (1 << 18); i++)
+    lut->rgb666[i] =
+        find_color(pal, len, ((i >> 10) & 0xFC) | 2, ((i >> 4) & 0xFC) | 2,
+                   ((i << 2) & 0xFC) | 2);
+  lut->rgb555[1 << 15] = PALETTE_TABLE_LEN - 1;
+  lut->rgb666[1 << 18] = PALETTE_TABLE_LEN - 1;
+  lut_cache.push_front({std::vector<RK_U32>(pal, pal + len), lut});
+  // freed once the holders release it
+  if (lut_cache.size() > COLOR_LUT_CACHE_NUM)
+    lut_cache.pop_back();
+  return lut;
+}
+
+// lut indexes of ARGB1555, transparent if the alpha bit is 0
+static inline RK_U32 index555(RK_U32 c) {
+  return (c & 0x8000) ? (c & 0x7FFF) : (1 << 15);
+}
+
+// lut indexes of ARGB8888, transparent if the alpha high 4 bits are 0
+static inline RK_U32 index666(RK_U32 c) {
+  if (!(c & 0xF0000000))
+    return 1 << 18;
+  return ((c >> 6) & 0x3F000) | ((c >> 4) & 0xFC0) | ((c >> 2) & 0x3F);
+}
+
+static void line_to_palette(const RK_U32 *src, RK_U8 *dst, RK_U32 n,
+                            RK_BOOL argb1555, const COLOR_LUT_S *lut) {
+  RK_U32 i = 0;
+  const RK_U8 *table = argb1555 ? lut->rgb555 : lut->rgb666;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+  const RK_U32 transparent = argb1555 ? 1 << 15 : 1 << 18;
+  // indexes of 4 pixels at a time, then the table lookups
+  RK_U32 idx[4];
+  for (; i + 4 <= n; i += 4) {
+#if defined(__SSE2__)
+    __m128i c = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i v, t;
+    if (argb1555) {
+      v = _mm_and_si128(c, _mm_set1_epi32(0x7FFF));
+      t = _mm_cmpeq_epi32(_mm_and_si128(c, _mm_set1_epi32(0x8000)),
+                          _mm_setzero_si128());
+    } else {
+      v = _mm_or_si128(
+          _mm_or_si128(
+              _mm_and_si128(_mm_srli_epi32(c, 6), _mm_set1_epi32(0x3F000)),
+              _mm_and_si128(_mm_srli_epi32(c, 4), _mm_set1_epi32(0xFC0))),
+          _mm_and_si128(_mm_srli_epi32(c, 2), _mm_set1_epi32(0x3F)));
+      t = _mm_cmpeq_epi32(_mm_srli_epi32(c, 28), _mm_setzero_si128());
+    }
+    // the transparent entry for the masked
+    v = _mm_andnot_si128(t, v);
+    t = _mm_and_si128(t, _mm_set1_epi32(transparent));
+    _mm_storeu_si128((__m128i *)idx, _mm_or_si128(v, t));
+#else
+    uint32x4_t c = vld1q_u32(src + i);
+    uint32x4_t v, t;
+    if (argb1555) {
+      v = vandq_u32(c, vdupq_n_u32(0x7FFF));
+      t = vceqq_u32(vandq_u32(c, vdupq_n_u32(0x8000)), vdupq_n_u32(0));
+    } else {
+      v = vorrq_u32(
+          vorrq_u32(vandq_u32(vshrq_n_u32(c, 6), vdupq_n_u32(0x3F000)),
+                    vandq_u32(vshrq_n_u32(c, 4), vdupq_n_u32(0xFC0))),
+          vandq_u32(vshrq_n_u32(c, 2), vdupq_n_u32(0x3F)));
+      t = vceqq_u32(vshrq_n_u32(c, 28), vdupq_n_u32(0));
+    }
+    v = vbicq_u32(v, t);
+    t = vandq_u32(t, vdupq_n_u32(transparent));
+    vst1q_u32(idx, vorrq_u32(v, t));
+#endif
+    dst[i] = table[idx[0]];
+    dst[i + 1] = table[idx[1]];
+    dst[i + 2] = table[idx[2]];
+    dst[i + 3] = table[idx[3]];
+  }
+#endif
+  for (; i < n; i++)
+    dst[i] = table[argb1555 ? index555(src[i]) : index666(src[i])];
+}
+
+// pixels compared at a time against the last bitmap
+#define DIRTY_BLOCK 16
+
+void bitmap_to_palette(const RK_U32 *src, RK_U32 src_stride,
+                       const RK_U32 *last, RK_U8 *dst, RK_U32 dst_stride,
+                       RK_U32 width, RK_U32 height, RK_BOOL argb1555,
+                       const COLOR_LUT_S *lut) {
+  for (RK_U32 y = 0; y < height; y++) {
+    const RK_U32 *s = src + y * src_stride;
+    RK_U8 *d = dst + y * dst_stride;
+    if (!last) {
+      line_to_palette(s, d, width, argb1555, lut);
+      continue;
+    }
+    const RK_U32 *l = last + y * src_stride;
+    if (!memcmp(s, l, width * sizeof(RK_U32)))
+      continue;
+    for (RK_U32 x = 0; x < width; x += DIRTY_BLOCK) {
+      RK_U32 n = width - x < DIRTY_BLOCK ? width - x : DIRTY_BLOCK;
+      if (memcmp(s + x, l + x, n * sizeof(RK_U32)))
+        line_to_palette(s + x, d + x, n, argb1555, lut);
+    }
+  }
+}
@@ -5,6 +5,8 @@
 #ifndef _RK_COLOR_TABLES_H_
 #define _RK_COLOR_TABLES_H_
 
+#include <memory>
+
 #include "rkmedia_common.h"
 
 #define PALETTE_TABLE_LEN 256
@@ -103,4 +105,27 @@ const RK_U32 yuv444_palette_table[PALETTE_TABLE_LEN] = {
 
 RK_U8 find_color(const RK_U32 *pal, RK_U32 len, RK_U8 r, RK_U8 g, RK_U8 b);
 
+/* RGB to palette index lookup, the last entry of each is for transparent.
+ * 5 bit channels are exact, 8 bit channels are quantized to 6 bits and
+ * mapped with the center of the cell. */
+#define COLOR_LUT_RGB555_LEN ((1 << 15) + 1)
+#define COLOR_LUT_RGB666_LEN ((1 << 18) + 1)
+typedef struct rkCOLOR_LUT_S {
+  RK_U8 rgb555[COLOR_LUT_RGB555_LEN];
+  RK_U8 rgb666[COLOR_LUT_RGB666_LEN];
+} COLOR_LUT_S;
+
+/* Built on the first call for the palette contents, then shared. The last
+ * few palettes used keep their table. */
+std::shared_ptr<const COLOR_LUT_S> get_color_lut(const RK_U32 *pal,
+                                                 RK_U32 len);
+
+/* Convert a width x height bitmap of 32 bit pixels, ARGB1555 in the low
+ * half or ARGB8888, to palette indexes. If last is not NULL, only the
+ * blocks of 16 pixels that differ from it are converted. */
+void bitmap_to_palette(const RK_U32 *src, RK_U32 src_stride,
+                       const RK_U32 *last, RK_U8 *dst, RK_U32 dst_stride,
+                       RK_U32 width, RK_U32 height, RK_BOOL argb1555,
+                       const COLOR_LUT_S *lut);
+
 #endif // _RK_OSD_MIDDLEWARE_H_
@@ -0,0 +1,315 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "region_luma.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "utils.h"
+
+// below these, the row pass is faster than the integral image
+#define REGION_LUMA_INTEGRAL_MIN_NUM 64
+#define REGION_LUMA_INTEGRAL_MIN_COVER 16
+
+// sum of n bytes, and their min and max if min is not NULL
+static inline RK_U64 row_stat(const RK_U8 *p, RK_U32 n, RK_U8 *min,
+                              RK_U8 *max) {
+  RK_U64 sum = 0;
+  RK_U32 i = 0;
+  RK_U8 lo = 0xFF, hi = 0;
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  __m128i s0 = zero, s1 = zero;
+  __m128i vlo = _mm_set1_epi8((char)0xFF), vhi = zero;
+  if (!min) {
+    for (; i + 32 <= n; i += 32) {
+      s0 = _mm_add_epi64(
+          s0, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(p + i)), zero));
+      s1 = _mm_add_epi64(s1, _mm_sad_epu8(_mm_loadu_si128(
+                                              (const __m128i *)(p + i + 16)),
+                                          zero));
+    }
+  }
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    s0 = _mm_add_epi64(s0, _mm_sad_epu8(v, zero));
+    if (min) {
+      vlo = _mm_min_epu8(vlo, v);
+      vhi = _mm_max_epu8(vhi, v);
+    }
+  }
+  s0 = _mm_add_epi64(s0, s1);
+  RK_U64 s[2];
+  _mm_storeu_si128((__m128i *)s, s0);
+  sum = s[0] + s[1];
+  if (min && i) {
+    RK_U8 l[16], h[16];
+    _mm_storeu_si128((__m128i *)l, vlo);
+    _mm_storeu_si128((__m128i *)h, vhi);
+    for (int k = 0; k < 16; k++) {
+      lo = std::min(lo, l[k]);
+      hi = std::max(hi, h[k]);
+    }
+  }
+#elif defined(__ARM_NEON)
+  // 16 bit pairs into 32 bit lanes, no overflow below 2^24 bytes a row
+  uint32x4_t s0 = vdupq_n_u32(0), s1 = vdupq_n_u32(0);
+  uint8x16_t vlo = vdupq_n_u8(0xFF), vhi = vdupq_n_u8(0);
+  if (!min) {
+    for (; i + 32 <= n; i += 32) {
+      s0 = vpadalq_u16(s0, vpaddlq_u8(vld1q_u8(p + i)));
+      s1 = vpadalq_u16(s1, vpaddlq_u8(vld1q_u8(p + i + 16)));
+    }
+  }
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(p + i);
+    s0 = vpadalq_u16(s0, vpaddlq_u8(v));
+    if (min) {
+      vlo = vminq_u8(vlo, v);
+      vhi = vmaxq_u8(vhi, v);
+    }
+  }
+  uint64x2_t s = vpaddlq_u32(vaddq_u32(s0, s1));
+  sum = vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+  if (min && i) {
+    uint8x8_t l = vpmin_u8(vget_low_u8(vlo), vget_high_u8(vlo));
+    uint8x8_t h = vpmax_u8(vget_low_u8(vhi), vget_high_u8(vhi));
+    l = vpmin_u8(l, l);
+    h = vpmax_u8(h, h);
+    l = vpmin_u8(l, l);
+    h = vpmax_u8(h, h);
+    l = vpmin_u8(l, l);
+    h = vpmax_u8(h, h);
+    lo = vget_lane_u8(l, 0);
+    hi = vget_lane_u8(h, 0);
+  }
+#endif
+  if (!min) {
+#if !defined(__SSE2__) && !defined(__ARM_NEON)
+    // 32 bit lanes, no overflow below 2^24 bytes a row
+    RK_U32 s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (; i + 4 <= n; i += 4) {
+      s0 += p[i];
+      s1 += p[i + 1];
+      s2 += p[i + 2];
+      s3 += p[i + 3];
+    }
+    sum += (RK_U64)s0 + s1 + s2 + s3;
+#endif
+    for (; i < n; i++)
+      sum += p[i];
+    return sum;
+  }
+  for (; i < n; i++) {
+    sum += p[i];
+    lo = std::min(lo, p[i]);
+    hi = std::max(hi, p[i]);
+  }
+  *min = std::min(*min, lo);
+  *max = std::max(*max, hi);
+  return sum;
+}
+
+// byte counters of bins 0 to 14 for 16 bytes, the last bin is the rest
+#if defined(__SSE2__)
+#define HIST_COUNT(k)                                                          \
+  c##k = _mm_sub_epi8(c##k, _mm_cmpeq_epi8(bin, _mm_set1_epi8(k)))
+#elif defined(__ARM_NEON)
+#define HIST_COUNT(k) c##k = vsubq_u8(c##k, vceqq_u8(bin, vdupq_n_u8(k)))
+#endif
+
+static inline void row_hist(const RK_U8 *p, RK_U32 n, RK_U32 *hist) {
+  RK_U32 i = 0;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+  // added up before a byte counter overflows
+  while (i + 16 <= n) {
+    RK_U32 end = std::min(n & ~15U, i + 255 * 16);
+    RK_U32 num = end - i;
+#if defined(__SSE2__)
+    __m128i c0 = _mm_setzero_si128(), c1 = c0, c2 = c0, c3 = c0, c4 = c0;
+    __m128i c5 = c0, c6 = c0, c7 = c0, c8 = c0, c9 = c0, c10 = c0, c11 = c0;
+    __m128i c12 = c0, c13 = c0, c14 = c0;
+    for (; i < end; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+      __m128i bin = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+#else
+    uint8x16_t c0 = vdupq_n_u8(0), c1 = c0, c2 = c0, c3 = c0, c4 = c0;
+    uint8x16_t c5 = c0, c6 = c0, c7 = c0, c8 = c0, c9 = c0, c10 = c0;
+    uint8x16_t c11 = c0, c12 = c0, c13 = c0, c14 = c0;
+    for (; i < end; i += 16) {
+      uint8x16_t bin = vshrq_n_u8(vld1q_u8(p + i), 4);
+#endif
+      HIST_COUNT(0);
+      HIST_COUNT(1);
+      HIST_COUNT(2);
+      HIST_COUNT(3);
+      HIST_COUNT(4);
+      HIST_COUNT(5);
+      HIST_COUNT(6);
+      HIST_COUNT(7);
+      HIST_COUNT(8);
+      HIST_COUNT(9);
+      HIST_COUNT(10);
+      HIST_COUNT(11);
+      HIST_COUNT(12);
+      HIST_COUNT(13);
+      HIST_COUNT(14);
+    }
+#if defined(__SSE2__)
+    __m128i cnt[15] = {c0, c1, c2,  c3,  c4,  c5,  c6, c7,
+                       c8, c9, c10, c11, c12, c13, c14};
+    for (int k = 0; k < 15; k++) {
+      RK_U64 s[2];
+      _mm_storeu_si128((__m128i *)s,
+                       _mm_sad_epu8(cnt[k], _mm_setzero_si128()));
+      hist[k] += s[0] + s[1];
+      num -= s[0] + s[1];
+    }
+#else
+    uint8x16_t cnt[15] = {c0, c1, c2,  c3,  c4,  c5,  c6, c7,
+                          c8, c9, c10, c11, c12, c13, c14};
+    for (int k = 0; k < 15; k++) {
+      uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(cnt[k])));
+      hist[k] += vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+      num -= vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+    }
+#endif
+    hist[15] += num;
+  }
+#endif
+  for (; i < n; i++)
+    hist[p[i] >> 4]++;
+}
+
+// sums from a 32 bit integral image of the rows and columns of the rects,
+// wrapping, exact for a rect below 2^24 pixels
+static void integral_sum(const RK_U8 *plane, RK_U32 stride,
+                         const RECT_S *rects,
+                         const std::vector<RK_U32> &valid,
+                         VIDEO_REGION_LUMA_S *out) {
+  RK_U32 x0 = ~0U, y0 = ~0U, x1 = 0, y1 = 0;
+  for (RK_U32 r : valid) {
+    x0 = std::min(x0, (RK_U32)rects[r].s32X);
+    y0 = std::min(y0, (RK_U32)rects[r].s32Y);
+    x1 = std::max(x1, rects[r].s32X + rects[r].u32Width);
+    y1 = std::max(y1, rects[r].s32Y + rects[r].u32Height);
+  }
+  RK_U32 w = x1 - x0 + 1;
+  static thread_local std::vector<RK_U32> integral;
+  integral.resize((size_t)w * (y1 - y0 + 1));
+  memset(integral.data(), 0, w * sizeof(RK_U32));
+  for (RK_U32 y = y0; y < y1; y++) {
+    const RK_U8 *p = plane + (size_t)y * stride + x0;
+    const RK_U32 *up = integral.data() + (size_t)(y - y0) * w;
+    RK_U32 *row = integral.data() + (size_t)(y - y0 + 1) * w;
+    RK_U32 acc = 0;
+    row[0] = 0;
+    for (RK_U32 x = 0; x < w - 1; x++) {
+      acc += p[x];
+      row[x + 1] = up[x + 1] + acc;
+    }
+  }
+  for (RK_U32 r : valid) {
+    const RECT_S *rect = &rects[r];
+    RK_U32 l = rect->s32X - x0, t = rect->s32Y - y0;
+    RK_U32 rt = l + rect->u32Width, b = t + rect->u32Height;
+    const RK_U32 *top = integral.data() + (size_t)t * w;
+    const RK_U32 *bottom = integral.data() + (size_t)b * w;
+    out[r].u64Sum = (RK_U32)(bottom[rt] - bottom[l] - top[rt] + top[l]);
+  }
+}
+
+// Many regions covering the area they span several times over, for which
+// one integral image is cheaper than reading each region.
+static bool integral_pays(const RECT_S *rects,
+                          const std::vector<RK_U32> &valid) {
+  if (valid.size() < REGION_LUMA_INTEGRAL_MIN_NUM)
+    return false;
+  RK_U32 x0 = ~0U, y0 = ~0U, x1 = 0, y1 = 0;
+  RK_U64 area = 0;
+  for (RK_U32 r : valid) {
+    x0 = std::min(x0, (RK_U32)rects[r].s32X);
+    y0 = std::min(y0, (RK_U32)rects[r].s32Y);
+    x1 = std::max(x1, rects[r].s32X + rects[r].u32Width);
+    y1 = std::max(y1, rects[r].s32Y + rects[r].u32Height);
+    area += (RK_U64)rects[r].u32Width * rects[r].u32Height;
+  }
+  return area >= (RK_U64)REGION_LUMA_INTEGRAL_MIN_COVER * (x1 - x0) *
+                     (y1 - y0);
+}
+
+void region_luma_stat(const RK_U8 *plane, RK_U32 stride, RK_U32 width,
+                      RK_U32 height, const RECT_S *rects, RK_U32 num,
+                      RK_U32 flags, VIDEO_REGION_LUMA_S *out) {
+  bool min_max = flags & REGION_LUMA_MIN_MAX;
+  bool hist = flags & REGION_LUMA_HIST;
+  std::vector<RK_U32> valid;
+
+  memset(out, 0, num * sizeof(*out));
+  for (RK_U32 i = 0; i < num; i++) {
+    const RECT_S *rect = &rects[i];
+    // no sum to wrap around
+    if (rect->s32X < 0 || rect->s32Y < 0 || !rect->u32Width ||
+        !rect->u32Height || rect->u32Width > width ||
+        (RK_U32)rect->s32X > width - rect->u32Width ||
+        rect->u32Height > height ||
+        (RK_U32)rect->s32Y > height - rect->u32Height) {
+      LOG("ERROR: %s rect[%d,%d,%u,%u] out of image wxh[%u, %u]\n", __func__,
+          rect->s32X, rect->s32Y, rect->u32Width, rect->u32Height, width,
+          height);
+      continue;
+    }
+    out[i].u8Min = min_max ? 0xFF : 0;
+    valid.push_back(i);
+  }
+  if (valid.empty())
+    return;
+
+  if ((flags & REGION_LUMA_INTEGRAL) && !min_max && !hist &&
+      integral_pays(rects, valid)) {
+    integral_sum(plane, stride, rects, valid, out);
+    return;
+  }
+
+  // walk the rows down, with the rects that cover the row
+  std::sort(valid.begin(), valid.end(), [rects](RK_U32 a, RK_U32 b) {
+    return rects[a].s32Y < rects[b].s32Y;
+  });
+  std::vector<RK_U32> active;
+  size_t next = 0;
+  RK_U32 y = rects[valid[0]].s32Y;
+  while (next < valid.size() || !active.empty()) {
+    if (active.empty() && (RK_U32)rects[valid[next]].s32Y > y)
+      y = rects[valid[next]].s32Y;
+    while (next < valid.size() && (RK_U32)rects[valid[next]].s32Y == y)
+      active.push_back(valid[next++]);
+    const RK_U8 *line = plane + (size_t)y * stride;
+    for (size_t k = 0; k < active.size();) {
+      RK_U32 r = active[k];
+      const RECT_S *rect = &rects[r];
+      const RK_U8 *p = line + rect->s32X;
+      out[r].u64Sum += row_stat(p, rect->u32Width,
+                                min_max ? &out[r].u8Min : NULL,
+                                &out[r].u8Max);
+      if (hist)
+        row_hist(p, rect->u32Width, out[r].au32Hist);
+      if (rect->s32Y + rect->u32Height == y + 1) {
+        active[k] = active.back();
+        active.pop_back();
+      } else {
+        k++;
+      }
+    }
+    y++;
+  }
+}
@@ -0,0 +1,17 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef __RKMEDIA_REGION_LUMA_
+#define __RKMEDIA_REGION_LUMA_
+
+#include "rkmedia_vi.h"
+
+/* Statistics of REGION_LUMA_STAT_E flags of num rects in a width x height
+ * 8 bit plane, the rows read once for all. A rect out of the plane gets
+ * zeros. */
+void region_luma_stat(const RK_U8 *plane, RK_U32 stride, RK_U32 width,
+                      RK_U32 height, const RECT_S *rects, RK_U32 num,
+                      RK_U32 flags, VIDEO_REGION_LUMA_S *out);
+
+#endif // #ifndef __RKMEDIA_REGION_LUMA_
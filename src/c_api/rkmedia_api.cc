@@ -5,6 +5,7 @@
 #include <condition_variable>
 #include <mutex>
 #include <string>
+#include <vector>
 
 #include "encoder.h"
 #include "image.h"
@@ -16,6 +17,7 @@
 #include "utils.h"
 
 #include "osd/color_table.h"
+#include "region_luma.h"
 #include "rkmedia_api.h"
 #include "rkmedia_buffer.h"
 #include "rkmedia_buffer_impl.h"
@@ -48,6 +50,18 @@ typedef ALGO_MD_ATTR_S RkmediaMDAttr;
 
 #define RKMEDIA_CHNNAL_BUFFER_LIMIT 3
 
+// The last bitmap of an osd region and its palette indexes, so that the
+// next bitmap of the same size converts only the blocks that changed.
+typedef struct _RkmediaOsdCache {
+  OSD_PIXEL_FORMAT_E format;
+  RK_U32 bitmap_width;
+  RK_U32 bitmap_height;
+  RK_U32 canvas_width;
+  RK_U32 canvas_height;
+  std::vector<RK_U32> bitmap;
+  std::vector<RK_U8> data;
+} RkmediaOsdCache;
+
 typedef struct _RkmediaChannel {
   MOD_ID_E mode_id;
   RK_U16 chn_id;
@@ -80,6 +94,10 @@ typedef struct _RkmediaChannel {
   std::mutex luma_buf_mtx;
   std::condition_variable luma_buf_cond;
   std::shared_ptr<easymedia::MediaBuffer> luma_rkmedia_buf;
+
+  // used for osd region bitmap.
+  std::mutex osd_mtx;
+  RkmediaOsdCache osd_cache[REGION_ID_7 + 1];
 } RkmediaChannel;
 
 RkmediaChannel g_vi_chns[VI_MAX_CHN_NUM];
@@ -170,6 +188,17 @@ static void RkmediaChnClearBuffer(RkmediaChannel *ptrChn) {
        ptrChn->mode_id, ptrChn->chn_id);
 }
 
+// region_id < 0 for all regions
+static void RkmediaOsdCacheClear(RkmediaChannel *ptrChn, int region_id) {
+  std::lock_guard<std::mutex> lock(ptrChn->osd_mtx);
+  for (int i = 0; i <= REGION_ID_7; i++) {
+    if (region_id >= 0 && region_id != i)
+      continue;
+    std::vector<RK_U32>().swap(ptrChn->osd_cache[i].bitmap);
+    std::vector<RK_U8>().swap(ptrChn->osd_cache[i].data);
+  }
+}
+
 /********************************************************************
  * SYS Ctrl api
  ********************************************************************/
@@ -721,10 +750,41 @@ RK_S32 RK_MPI_VI_DisableChn(VI_PIPE ViPipe, VI_CHN ViChn) {
   return RK_ERR_SYS_OK;
 }
 
-static RK_U64
+// the latest frame of the vi channel for the luma statistics
+static RK_S32
+RkmediaViGetLumaBuffer(RkmediaChannel *target_chn, RK_S32 s32MilliSec,
+                       std::shared_ptr<easymedia::ImageBuffer> &rkmedia_mb) {
+  // The lock is only used to find the buffer, and the accumulation of
+  // the buffer is outside the lock range. This is good for frame rate.
+  std::unique_lock<std::mutex> lck(target_chn->luma_buf_mtx);
+  if (!target_chn->luma_rkmedia_buf) {
+    if (s32MilliSec < 0) {
+      target_chn->luma_buf_cond.wait(lck);
+    } else if (s32MilliSec > 0) {
+      if (target_chn->luma_buf_cond.wait_for(
+              lck, std::chrono::milliseconds(s32MilliSec)) ==
+          std::cv_status::timeout)
+        return -RK_ERR_VI_TIMEOUT;
+    } else {
+      return -RK_ERR_VI_BUF_EMPTY;
+    }
+  }
+  if (target_chn->luma_rkmedia_buf)
+    rkmedia_mb = std::static_pointer_cast<easymedia::ImageBuffer>(
+        target_chn->luma_rkmedia_buf);
+
+  target_chn->luma_rkmedia_buf.reset();
+
+  if (!rkmedia_mb)
+    return -RK_ERR_VI_BUF_EMPTY;
+
+  return RK_ERR_SYS_OK;
+}
+
+static RK_S32
 rkmediaCalculateRegionLuma(std::shared_ptr<easymedia::ImageBuffer> &rkmedia_mb,
-                           const RECT_S *ptrRect) {
-  RK_U64 sum = 0;
+                           const VIDEO_REGION_INFO_S *pstRegionInfo,
+                           RK_U32 u32StatFlags, VIDEO_REGION_LUMA_S *pstLuma) {
   ImageInfo &imgInfo = rkmedia_mb->GetImageInfo();
 
   if ((imgInfo.pix_fmt != PIX_FMT_YUV420P) &&
@@ -732,28 +792,14 @@ rkmediaCalculateRegionLuma(std::shared_ptr<easymedia::ImageBuffer> &rkmedia_mb,
       (imgInfo.pix_fmt != PIX_FMT_YUV422P) &&
       (imgInfo.pix_fmt != PIX_FMT_NV16) && (imgInfo.pix_fmt != PIX_FMT_NV61)) {
     LOG("ERROR: %s not support image type!\n", __func__);
-    return 0;
-  }
-
-  if (((RK_S32)(ptrRect->s32X + ptrRect->u32Width) > imgInfo.width) ||
-      ((RK_S32)(ptrRect->s32Y + ptrRect->u32Height) > imgInfo.height)) {
-    LOG("ERROR: %s rect[%d,%d,%u,%u] out of image wxh[%d, %d]\n", __func__,
-        ptrRect->s32X, ptrRect->s32Y, ptrRect->u32Width, ptrRect->u32Height,
-        imgInfo.width, imgInfo.height);
-    return 0;
+    return -RK_ERR_VI_ILLEGAL_PARAM;
   }
 
-  RK_U32 line_size = imgInfo.vir_width;
-  RK_U8 *rect_start =
-      (RK_U8 *)rkmedia_mb->GetPtr() + ptrRect->s32Y * line_size + ptrRect->s32X;
-  for (RK_U32 i = 0; i < ptrRect->u32Height; i++) {
-    RK_U8 *line_start = rect_start + i * line_size;
-    for (RK_U32 j = 0; j < ptrRect->u32Width; j++) {
-      sum += *(line_start + j);
-    }
-  }
+  region_luma_stat((const RK_U8 *)rkmedia_mb->GetPtr(), imgInfo.vir_width,
+                   imgInfo.width, imgInfo.height, pstRegionInfo->pstRegion,
+                   pstRegionInfo->u32RegionNum, u32StatFlags, pstLuma);
 
-  return sum;
+  return RK_ERR_SYS_OK;
 }
 
 RK_S32 RK_MPI_VI_GetChnRegionLuma(VI_PIPE ViPipe, VI_CHN ViChn,
@@ -771,40 +817,46 @@ RK_S32 RK_MPI_VI_GetChnRegionLuma(VI_PIPE ViPipe, VI_CHN ViChn,
   if (target_chn->status < CHN_STATUS_OPEN)
     return -RK_ERR_VI_NOTREADY;
 
-  {
-    // The {} here is to limit the scope of locking. The lock is only
-    // used to find the buffer, and the accumulation of the buffer is
-    // outside the lock range. This is good for frame rate.
-    std::unique_lock<std::mutex> lck(target_chn->luma_buf_mtx);
-    if (!target_chn->luma_rkmedia_buf) {
-      if (s32MilliSec < 0) {
-        target_chn->luma_buf_cond.wait(lck);
-      } else if (s32MilliSec > 0) {
-        if (target_chn->luma_buf_cond.wait_for(
-                lck, std::chrono::milliseconds(s32MilliSec)) ==
-            std::cv_status::timeout)
-          return -RK_ERR_VI_TIMEOUT;
-      } else {
-        return -RK_ERR_VI_BUF_EMPTY;
-      }
-    }
-    if (target_chn->luma_rkmedia_buf)
-      rkmedia_mb = std::static_pointer_cast<easymedia::ImageBuffer>(
-          target_chn->luma_rkmedia_buf);
-
-    target_chn->luma_rkmedia_buf.reset();
-  }
-
-  if (!rkmedia_mb)
-    return -RK_ERR_VI_BUF_EMPTY;
+  RK_S32 ret = RkmediaViGetLumaBuffer(target_chn, s32MilliSec, rkmedia_mb);
+  if (ret)
+    return ret;
 
+  // zeros if the image type is not supported
+  std::vector<VIDEO_REGION_LUMA_S> luma(pstRegionInfo->u32RegionNum);
+  rkmediaCalculateRegionLuma(rkmedia_mb, pstRegionInfo, REGION_LUMA_SUM,
+                             luma.data());
   for (RK_U32 i = 0; i < pstRegionInfo->u32RegionNum; i++)
-    *(pu64LumaData + i) =
-        rkmediaCalculateRegionLuma(rkmedia_mb, (pstRegionInfo->pstRegion + i));
+    *(pu64LumaData + i) = luma[i].u64Sum;
 
   return RK_ERR_SYS_OK;
 }
 
+RK_S32 RK_MPI_VI_GetChnRegionLumaStat(VI_PIPE ViPipe, VI_CHN ViChn,
+                                      const VIDEO_REGION_INFO_S *pstRegionInfo,
+                                      RK_U32 u32StatFlags,
+                                      VIDEO_REGION_LUMA_S *pstLuma,
+                                      RK_S32 s32MilliSec) {
+  if ((ViPipe < 0) || (ViChn < 0) || (ViChn >= VI_MAX_CHN_NUM))
+    return -RK_ERR_VI_INVALID_CHNID;
+
+  if (!pstRegionInfo || !pstRegionInfo->u32RegionNum ||
+      !pstRegionInfo->pstRegion || !pstLuma)
+    return -RK_ERR_VI_ILLEGAL_PARAM;
+
+  std::shared_ptr<easymedia::ImageBuffer> rkmedia_mb;
+  RkmediaChannel *target_chn = &g_vi_chns[ViChn];
+
+  if (target_chn->status < CHN_STATUS_OPEN)
+    return -RK_ERR_VI_NOTREADY;
+
+  RK_S32 ret = RkmediaViGetLumaBuffer(target_chn, s32MilliSec, rkmedia_mb);
+  if (ret)
+    return ret;
+
+  return rkmediaCalculateRegionLuma(rkmedia_mb, pstRegionInfo, u32StatFlags,
+                                    pstLuma);
+}
+
 RK_S32 RK_MPI_VI_StartStream(VI_PIPE ViPipe, VI_CHN ViChn) {
   if ((ViPipe < 0) || (ViChn < 0) || (ViChn > VI_MAX_CHN_NUM))
     return -RK_ERR_VI_INVALID_CHNID;
@@ -1396,6 +1448,7 @@ RK_S32 RK_MPI_VENC_DestroyChn(VENC_CHN VeChn) {
   }
 
   RkmediaChnClearBuffer(&g_venc_chns[VeChn]);
+  RkmediaOsdCacheClear(&g_venc_chns[VeChn], -1);
 
   if (g_venc_chns[VeChn].rkmedia_flow) {
     if (!g_venc_chns[VeChn].rkmedia_flow_list.empty()) {
@@ -1467,60 +1520,19 @@ RK_S32 RK_MPI_VENC_RGN_Init(VENC_CHN VeChn) {
     return -RK_ERR_VENC_NOTREADY;
   }
 
+  // the rgb to palette index table, built once
+  get_color_lut(bgra8888_palette_table, PALETTE_TABLE_LEN);
+
   return easymedia::video_encoder_set_osd_plt(g_venc_chns[VeChn].rkmedia_flow,
                                               yuv444_palette_table);
 }
 
-static RK_VOID Argb1555_To_Region_Data(const BITMAP_S *pstBitmap, RK_U8 *data,
-                                       RK_U32 canvasWidth,
-                                       RK_U32 canvasHeight) {
-  RK_U8 value_r, value_g, value_b, value_a;
-  RK_U32 TargetWidth, TargetHeight;
-  RK_U32 ColorValue;
-  RK_U32 *BitmapLineStart;
-  RK_U8 *CanvasLineStart;
-
-  TargetWidth =
-      (pstBitmap->u32Width > canvasWidth) ? canvasWidth : pstBitmap->u32Width;
-  TargetHeight = (pstBitmap->u32Height > canvasHeight) ? canvasHeight
-                                                       : pstBitmap->u32Height;
-
-  LOGD("%s Bitmap[%d, %d] -> Canvas[%d, %d], target=<%d, %d>\n", __func__,
-       pstBitmap->u32Width, pstBitmap->u32Height, canvasWidth, canvasHeight,
-       TargetWidth, TargetHeight);
-
-  // Initialize all pixels to transparent color
-  if ((canvasWidth > pstBitmap->u32Width) ||
-      (canvasHeight > pstBitmap->u32Height))
-    memset(data, 0xFF, canvasWidth * canvasHeight);
-
-  for (RK_U32 i = 0; i < TargetHeight; i++) {
-    BitmapLineStart = (RK_U32 *)pstBitmap->pData + i * pstBitmap->u32Width;
-    CanvasLineStart = data + i * canvasWidth;
-    for (RK_U32 j = 0; j < TargetWidth; j++) {
-      ColorValue = *(BitmapLineStart + j);
-      value_a = (ColorValue & 0x8000) >> 15;
-      value_r = (ColorValue & 0x7C00) >> 10;
-      value_g = (ColorValue & 0x03E0) >> 5;
-      value_b = (ColorValue & 0x001F);
-      if (value_a == 0)
-        *(CanvasLineStart + j) = PALETTE_TABLE_LEN - 1; // Transparent
-      else
-        *(CanvasLineStart + j) =
-            find_color(bgra8888_palette_table, PALETTE_TABLE_LEN, value_r,
-                       value_g, value_b);
-    }
-  }
-}
-
-static RK_VOID Argb8888_To_Region_Data(const BITMAP_S *pstBitmap, RK_U8 *data,
-                                       RK_U32 canvasWidth,
-                                       RK_U32 canvasHeight) {
-  RK_U8 value_r, value_g, value_b, value_a;
+static RK_VOID Bitmap_To_Region_Data(const BITMAP_S *pstBitmap,
+                                     RkmediaOsdCache *cache,
+                                     RK_U32 canvasWidth, RK_U32 canvasHeight) {
   RK_U32 TargetWidth, TargetHeight;
-  RK_U32 ColorValue;
-  RK_U32 *BitmapLineStart;
-  RK_U8 *CanvasLineStart;
+  const RK_U32 *LastBitmap = NULL;
+  RK_U32 BitmapPixNum = pstBitmap->u32Width * pstBitmap->u32Height;
 
   TargetWidth =
       (pstBitmap->u32Width > canvasWidth) ? canvasWidth : pstBitmap->u32Width;
@@ -1531,35 +1543,37 @@ static RK_VOID Argb8888_To_Region_Data(const BITMAP_S *pstBitmap, RK_U8 *data,
        pstBitmap->u32Width, pstBitmap->u32Height, canvasWidth, canvasHeight,
        TargetWidth, TargetHeight);
 
-  // Initialize all pixels to transparent color
-  if ((canvasWidth > pstBitmap->u32Width) ||
-      (canvasHeight > pstBitmap->u32Height))
-    memset(data, 0xFF, canvasWidth * canvasHeight);
-
-  for (RK_U32 i = 0; i < TargetHeight; i++) {
-    BitmapLineStart = (RK_U32 *)pstBitmap->pData + i * pstBitmap->u32Width;
-    CanvasLineStart = data + i * canvasWidth;
-    for (RK_U32 j = 0; j < TargetWidth; j++) {
-      ColorValue = *(BitmapLineStart + j);
-      value_a = (ColorValue & 0xF0000000) >> 24;
-      value_r = (ColorValue & 0x00FF0000) >> 16;
-      value_g = (ColorValue & 0x0000FF00) >> 8;
-      value_b = (ColorValue & 0x000000FF);
-      if (value_a == 0)
-        *(CanvasLineStart + j) = PALETTE_TABLE_LEN - 1; // Transparent
-      else
-        *(CanvasLineStart + j) =
-            find_color(bgra8888_palette_table, PALETTE_TABLE_LEN, value_r,
-                       value_g, value_b);
-    }
-  }
+  if (!cache->bitmap.empty() && cache->format == pstBitmap->enPixelFormat &&
+      cache->bitmap_width == pstBitmap->u32Width &&
+      cache->bitmap_height == pstBitmap->u32Height &&
+      cache->canvas_width == canvasWidth &&
+      cache->canvas_height == canvasHeight) {
+    LastBitmap = cache->bitmap.data();
+  } else {
+    // Initialize all pixels to transparent color
+    cache->data.assign(canvasWidth * canvasHeight, PALETTE_TABLE_LEN - 1);
+    cache->format = pstBitmap->enPixelFormat;
+    cache->bitmap_width = pstBitmap->u32Width;
+    cache->bitmap_height = pstBitmap->u32Height;
+    cache->canvas_width = canvasWidth;
+    cache->canvas_height = canvasHeight;
+  }
+
+  auto lut = get_color_lut(bgra8888_palette_table, PALETTE_TABLE_LEN);
+  bitmap_to_palette((const RK_U32 *)pstBitmap->pData, pstBitmap->u32Width,
+                    LastBitmap, cache->data.data(), canvasWidth, TargetWidth,
+                    TargetHeight,
+                    (pstBitmap->enPixelFormat == PIXEL_FORMAT_ARGB_1555)
+                        ? RK_TRUE
+                        : RK_FALSE,
+                    lut.get());
+  cache->bitmap.assign((const RK_U32 *)pstBitmap->pData,
+                       (const RK_U32 *)pstBitmap->pData + BitmapPixNum);
 }
 
 RK_S32 RK_MPI_VENC_RGN_SetBitMap(VENC_CHN VeChn,
                                  const OSD_REGION_INFO_S *pstRgnInfo,
                                  const BITMAP_S *pstBitmap) {
-  RK_U8 *rkmedia_osd_data;
-  RK_U32 total_pix_num = 0;
   RK_S32 ret = RK_ERR_SYS_OK;
 
   if ((VeChn < 0) || (VeChn >= VENC_MAX_CHN_NUM))
@@ -1571,6 +1585,7 @@ RK_S32 RK_MPI_VENC_RGN_SetBitMap(VENC_CHN VeChn,
   }
 
   if (pstRgnInfo && !pstRgnInfo->u8Enable) {
+    RkmediaOsdCacheClear(&g_venc_chns[VeChn], pstRgnInfo->enRegionId);
     OsdRegionData rkmedia_osd_rgn;
     memset(&rkmedia_osd_rgn, 0, sizeof(rkmedia_osd_rgn));
     rkmedia_osd_rgn.region_id = pstRgnInfo->enRegionId;
@@ -1597,31 +1612,27 @@ RK_S32 RK_MPI_VENC_RGN_SetBitMap(VENC_CHN VeChn,
     return -RK_ERR_VENC_ILLEGAL_PARAM;
   }
 
-  total_pix_num = pstRgnInfo->u32Width * pstRgnInfo->u32Height;
-  rkmedia_osd_data = (RK_U8 *)malloc(total_pix_num);
-  if (!rkmedia_osd_data) {
-    LOG("ERROR: No space left! RgnInfo pixels(%d)\n", total_pix_num);
-    return -RK_ERR_VENC_NOMEM;
-  }
+  if (pstRgnInfo->enRegionId > REGION_ID_7)
+    return -RK_ERR_VENC_ILLEGAL_PARAM;
 
   switch (pstBitmap->enPixelFormat) {
   case PIXEL_FORMAT_ARGB_1555:
-    Argb1555_To_Region_Data(pstBitmap, rkmedia_osd_data, pstRgnInfo->u32Width,
-                            pstRgnInfo->u32Height);
-    break;
   case PIXEL_FORMAT_ARGB_8888:
-    Argb8888_To_Region_Data(pstBitmap, rkmedia_osd_data, pstRgnInfo->u32Width,
-                            pstRgnInfo->u32Height);
     break;
   default:
     LOG("ERROR: Not support bitmap pixel format:%d\n",
         pstBitmap->enPixelFormat);
-    ret = -RK_ERR_VENC_NOT_SUPPORT;
-    break;
+    return -RK_ERR_VENC_NOT_SUPPORT;
   }
 
+  RkmediaChannel *venc_chn = &g_venc_chns[VeChn];
+  std::lock_guard<std::mutex> lock(venc_chn->osd_mtx);
+  RkmediaOsdCache *cache = &venc_chn->osd_cache[pstRgnInfo->enRegionId];
+  Bitmap_To_Region_Data(pstBitmap, cache, pstRgnInfo->u32Width,
+                        pstRgnInfo->u32Height);
+
   OsdRegionData rkmedia_osd_rgn;
-  rkmedia_osd_rgn.buffer = rkmedia_osd_data;
+  rkmedia_osd_rgn.buffer = cache->data.data();
   rkmedia_osd_rgn.region_id = pstRgnInfo->enRegionId;
   rkmedia_osd_rgn.pos_x = pstRgnInfo->u32PosX;
   rkmedia_osd_rgn.pos_y = pstRgnInfo->u32PosY;
@@ -1629,14 +1640,11 @@ RK_S32 RK_MPI_VENC_RGN_SetBitMap(VENC_CHN VeChn,
   rkmedia_osd_rgn.height = pstRgnInfo->u32Height;
   rkmedia_osd_rgn.inverse = pstRgnInfo->u8Inverse;
   rkmedia_osd_rgn.enable = pstRgnInfo->u8Enable;
-  ret = easymedia::video_encoder_set_osd_region(g_venc_chns[VeChn].rkmedia_flow,
+  ret = easymedia::video_encoder_set_osd_region(venc_chn->rkmedia_flow,
                                                 &rkmedia_osd_rgn);
   if (ret)
     ret = -RK_ERR_VENC_NOT_PERM;
 
-  if (rkmedia_osd_data)
-    free(rkmedia_osd_data);
-
   return ret;
 }
 
@@ -1657,6 +1665,7 @@ RK_S32 RK_MPI_VENC_RGN_SetCover(VENC_CHN VeChn,
   }
 
   if (pstRgnInfo && !pstRgnInfo->u8Enable) {
+    RkmediaOsdCacheClear(&g_venc_chns[VeChn], pstRgnInfo->enRegionId);
     OsdRegionData rkmedia_osd_rgn;
     memset(&rkmedia_osd_rgn, 0, sizeof(rkmedia_osd_rgn));
     rkmedia_osd_rgn.region_id = pstRgnInfo->enRegionId;
@@ -1709,6 +1718,9 @@ RK_S32 RK_MPI_VENC_RGN_SetCover(VENC_CHN VeChn,
     return -RK_ERR_VENC_NOT_SUPPORT;
   }
 
+  // the cover replaces the bitmap
+  RkmediaOsdCacheClear(&g_venc_chns[VeChn], pstRgnInfo->enRegionId);
+
   // find and fill color
   if (value_a == 0x00)
     color_id = PALETTE_TABLE_LEN - 1;
@@ -34,13 +34,15 @@ private:
   AVCodec *av_codec;
   AVCodecContext *avctx;
   AVFrame *frame;
+  AVPacket *pkt;
   enum AVSampleFormat input_fmt;
   std::string output_data_type;
   std::string ff_codec_name;
 };
 
 FFMPEGAudioEncoder::FFMPEGAudioEncoder(const char *param)
-    : av_codec(nullptr), avctx(nullptr), input_fmt(AV_SAMPLE_FMT_NONE) {
+    : av_codec(nullptr), avctx(nullptr), frame(nullptr), pkt(nullptr),
+      input_fmt(AV_SAMPLE_FMT_NONE) {
   std::map<std::string, std::string> params;
   std::list<std::pair<const std::string, std::string &>> req_list;
   req_list.push_back(std::pair<const std::string, std::string &>(
@@ -54,6 +56,9 @@ FFMPEGAudioEncoder::~FFMPEGAudioEncoder() {
   if (frame) {
     av_frame_free(&frame);
   }
+  if (pkt) {
+    av_packet_free(&pkt);
+  }
   if (avctx) {
     avcodec_free_context(&avctx);
   }
@@ -157,6 +162,11 @@ bool FFMPEGAudioEncoder::InitConfig(const MediaConfig &cfg) {
     fprintf(stderr, "Could not allocate audio frame\n");
     return false;
   }
+  pkt = av_packet_alloc();
+  if (!pkt) {
+    fprintf(stderr, "Could not allocate audio packet\n");
+    return false;
+  }
   auto &info = mc.aud_cfg.sample_info;
   frame->nb_samples = info.nb_samples;
   frame->channels = info.channels;
@@ -200,25 +210,15 @@ int FFMPEGAudioEncoder::SendInput(const std::shared_ptr<MediaBuffer> &input) {
   return 0;
 }
 
-static int __ffmpeg_packet_free(void *arg) {
-  auto pkt = (AVPacket *)arg;
-  av_packet_free(&pkt);
-  return 0;
-}
-
 std::shared_ptr<MediaBuffer> FFMPEGAudioEncoder::FetchOutput() {
-  auto pkt = av_packet_alloc();
-  if (!pkt)
-    return nullptr;
-  std::shared_ptr<MediaBuffer> buffer =
-    std::make_shared<MediaBuffer>(pkt->data, 0, -1, pkt, __ffmpeg_packet_free);
-
+  // a packet per output only, not per try
   int ret = avcodec_receive_packet(avctx, pkt);
   if (ret < 0) {
     if (ret == AVERROR(EAGAIN)) {
       errno = EAGAIN;
       return nullptr;
     } else if (ret == AVERROR_EOF) {
+      auto buffer = std::make_shared<MediaBuffer>();
       buffer->SetEOF(true);
       return buffer;
     }
@@ -226,9 +226,12 @@ std::shared_ptr<MediaBuffer> FFMPEGAudioEncoder::FetchOutput() {
     PrintAVError(ret, "Fail to receiver from encoder", av_codec->long_name);
     return nullptr;
   }
-  buffer->SetPtr(pkt->data);
-  buffer->SetValidSize(pkt->size);
-  buffer->SetUSTimeStamp(pkt->pts);
+  auto buffer = AVPacketToMediaBuffer(pkt);
+  if (!buffer) {
+    av_packet_unref(pkt);
+    errno = ENOMEM;
+    return nullptr;
+  }
   buffer->SetType(Type::Audio);
   return buffer;
 }
@@ -2,14 +2,10 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include "audio_ring.h"
 #include "buffer.h"
 #include "filter.h"
 #include <assert.h>
-extern "C" {
-#define __STDC_CONSTANT_MACROS
-#include <libavutil/audio_fifo.h>
-}
-#include "ffmpeg_utils.h"
 
 #define DEBUG_FILE 0
 #if DEBUG_FILE
@@ -17,35 +13,9 @@ extern "C" {
 #endif
 
 namespace easymedia {
-/**
- * Add converted input audio samples to the FIFO buffer for later processing.
- * @param fifo                    Buffer to add the samples to
- * @param new_samples             Samples to be added. The dimensions are
- * channel (for multi-channel audio), sample.
- * @param frame_size              Number of samples to be converted
- * @return Error code (0 if successful)
- */
-static int add_samples_to_fifo(AVAudioFifo *fifo, uint8_t **new_samples,
-                               const int frame_size) {
-  int error;
-
-  /* Make the FIFO as large as it needs to be to hold both,
-   * the old and the new samples. */
-  if ((error = av_audio_fifo_realloc(fifo, av_audio_fifo_size(fifo) +
-                                               frame_size)) < 0) {
-    fprintf(stderr, "Could not reallocate FIFO\n");
-    return error;
-  }
-
-  /* Store the new samples in the FIFO buffer. */
-  if (av_audio_fifo_write(fifo, (void **)new_samples, frame_size) <
-      frame_size) {
-    fprintf(stderr, "Could not write data to FIFO\n");
-    return AVERROR_EXIT;
-  }
-  return 0;
-};
 
+// Frames of nb_samples out of inputs of any size, through an AudioRing of
+// ring_samples, 1 second by default; from a pool of mem_cnt if given.
 class AudioFifo : public Filter {
 public:
   AudioFifo(const char *param);
@@ -59,10 +29,7 @@ private:
   int sample_rate;
   SampleFormat format;
   int nb_samples;
-  AVAudioFifo *fifo;
-  int64_t in_timestamp;  // timebase 1/AV_TIME_BASE
-  int64_t in_pts;        // timebase 1/samplerate
-  int64_t out_pts;       // timebase 1/samplerate
+  std::shared_ptr<AudioRing> ring;
   int finished;
 
 #if DEBUG_FILE
@@ -72,11 +39,15 @@ private:
 };
 
 AudioFifo::AudioFifo(const char *param)
-    : fifo(NULL), in_timestamp(0), in_pts(0), out_pts(0), finished(0) {
+    : channels(0), sample_rate(0), format(SAMPLE_FMT_NONE), nb_samples(0),
+      finished(0) {
   std::string s_format;
   std::string s_channels;
   std::string s_sample_rate;
   std::string s_nb_samples;
+  std::string s_ring_samples;
+  std::string s_mem_cnt;
+  std::string s_mem_type;
   std::map<std::string, std::string> params;
   std::list<std::pair<const std::string, std::string &>> req_list;
   req_list.push_back(
@@ -87,6 +58,12 @@ AudioFifo::AudioFifo(const char *param)
     std::pair<const std::string, std::string &>(KEY_SAMPLE_RATE, s_sample_rate));
   req_list.push_back(
     std::pair<const std::string, std::string &>(KEY_FRAMES, s_nb_samples));
+  req_list.push_back(std::pair<const std::string, std::string &>(
+      KEY_AUDIO_RING_SAMPLES, s_ring_samples));
+  req_list.push_back(
+      std::pair<const std::string, std::string &>(KEY_MEM_CNT, s_mem_cnt));
+  req_list.push_back(
+      std::pair<const std::string, std::string &>(KEY_MEM_TYPE, s_mem_type));
   parse_media_param_match(param, params, req_list);
   if (!s_channels.empty())
     channels = std::atoi(s_channels.c_str());
@@ -96,18 +73,22 @@ AudioFifo::AudioFifo(const char *param)
     format = StringToSampleFmt(s_format.c_str());
   if (!s_nb_samples.empty())
     nb_samples = std::atoi(s_nb_samples.c_str());
+  int ring_samples = sample_rate;
+  if (!s_ring_samples.empty())
+    ring_samples = std::atoi(s_ring_samples.c_str());
+  std::shared_ptr<SizeClassBufferPool> pool;
+  if (!s_mem_cnt.empty() && std::atoi(s_mem_cnt.c_str()) > 0)
+    pool = SizeClassBufferPool::GetShared(
+        std::atoi(s_mem_cnt.c_str()),
+        StringToMemType(s_mem_type.empty() ? nullptr : s_mem_type.c_str()));
 
   SampleInfo info = {format, channels, sample_rate, nb_samples};
-  int ret = SampleInfoIsValid(info);
-  if (!ret) {
+  ring = std::make_shared<AudioRing>(info, nb_samples, ring_samples, pool);
+  if (!ring->IsValid()) {
     LOG("%s: sample info not valid\n", __func__);
+    SetError(-EINVAL);
+    return;
   }
-  assert(ret == 0);
-  assert(nb_samples > 0);
-
-  /* Create the FIFO buffer based on the specified sample format. */
-  fifo = av_audio_fifo_alloc(SampleFmtToAVSamFmt(format), channels, 1);
-  assert(fifo);
 
 #if DEBUG_FILE
   static int id = 0;
@@ -125,9 +106,6 @@ AudioFifo::AudioFifo(const char *param)
 }
 
 AudioFifo::~AudioFifo() {
-  if (fifo)
-    av_audio_fifo_free(fifo);
-
 #if DEBUG_FILE
   infile.close();
   outfile.close();
@@ -135,30 +113,19 @@ AudioFifo::~AudioFifo() {
 }
 
 int AudioFifo::SendInput(std::shared_ptr<MediaBuffer> input _UNUSED) {
-  int src_linesize = 0;
-  uint8_t *src_data[channels] = {NULL};
-
   if (!input || input->GetType() != Type::Audio || !input->IsValid())
     return -EINVAL;
 
   auto in = std::static_pointer_cast<easymedia::SampleBuffer>(input);
   SampleInfo src_info = in->GetSampleInfo();
-  if (src_info.fmt != format && src_info.channels != channels &&
+  if (src_info.fmt != format || src_info.channels != channels ||
       src_info.sample_rate != sample_rate) {
     LOG("check sample info failed\n");
     return -1;
   }
-
-  in_timestamp = in->GetUSTimeStamp();
-  in_pts += in->GetSamples();
-
-  av_samples_fill_arrays(src_data, &src_linesize, (const uint8_t *)in->GetPtr(),
-                         channels, in->GetSamples(),
-                         SampleFmtToAVSamFmt(format), 1);
-  if (add_samples_to_fifo(fifo, src_data, in->GetSamples())) {
-    LOG("add samples to fifo failed\n");
-    return -1;
-  }
+  if (ring->Write(in) < in->GetSamples())
+    LOG("audio fifo full, %lld samples dropped\n",
+        (long long)ring->GetDropSamples());
 
 #if DEBUG_FILE
   infile.write((const char *)in->GetPtr(), in->GetValidSize());
@@ -167,45 +134,12 @@ int AudioFifo::SendInput(std::shared_ptr<MediaBuffer> input _UNUSED) {
 }
 
 std::shared_ptr<MediaBuffer> AudioFifo::FetchOutput() {
-  int linesize = 0;
-  uint8_t *dst_data[channels] = {NULL};
-
-  if (av_audio_fifo_size(fifo) >= nb_samples ||
-      (finished && av_audio_fifo_size(fifo) > 0)) {
-
-    const int dst_nb_samples = FFMIN(av_audio_fifo_size(fifo), nb_samples);
-    int size = av_samples_get_buffer_size(NULL, channels, dst_nb_samples,
-                                          SampleFmtToAVSamFmt(format), 1);
-    assert(size > 0);
-
-    SampleInfo dst_info = {format, channels, sample_rate, dst_nb_samples};
-    auto dst = std::make_shared<easymedia::SampleBuffer>(
-        MediaBuffer::Alloc2(size), dst_info);
-    assert(dst);
-
-    av_samples_fill_arrays(dst_data, &linesize, (const uint8_t *)dst->GetPtr(),
-                           channels, dst_nb_samples,
-                           SampleFmtToAVSamFmt(format), 1);
-
-    if (av_audio_fifo_read(fifo, (void **)dst_data, dst_nb_samples) <
-        dst_nb_samples) {
-      LOG("Could not read data from FIFO\n");
-      return NULL;
-    }
-    out_pts += dst_nb_samples;
-
-    dst->SetSamples(dst_nb_samples);
-    dst->SetValidSize(size);
-    dst->SetUSTimeStamp(
-        in_timestamp + av_rescale(out_pts - in_pts, AV_TIME_BASE, sample_rate));
-
+  auto dst = ring->Read(finished);
 #if DEBUG_FILE
+  if (dst)
     outfile.write((const char *)dst->GetPtr(), dst->GetValidSize());
-    LOG("diff pts: %lldus\n", dst->GetUSTimeStamp() - in_timestamp);
 #endif
-    return dst;
-  }
-  return NULL;
+  return dst;
 }
 
 DEFINE_COMMON_FILTER_FACTORY(AudioFifo)
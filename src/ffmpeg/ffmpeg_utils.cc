@@ -4,6 +4,8 @@
 
 #include "ffmpeg_utils.h"
 
+#include <algorithm>
+
 namespace easymedia {
 
 enum AVPixelFormat PixFmtToAVPixFmt(PixelFormat fmt) {
@@ -89,4 +91,60 @@ void PrintAVError(int err, const char *log, const char *mark) {
     LOG("%s: %s\n", log, str);
 }
 
+static int __ffmpeg_packet_free(void *arg) {
+  auto pkt = (AVPacket *)arg;
+  av_packet_free(&pkt);
+  return 0;
+}
+
+std::shared_ptr<MediaBuffer> AVPacketToMediaBuffer(AVPacket *pkt) {
+  AVPacket *ref = av_packet_alloc();
+  if (!ref) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  av_packet_move_ref(ref, pkt);
+  auto buffer = std::make_shared<MediaBuffer>(ref->data, ref->size, -1, ref,
+                                              __ffmpeg_packet_free);
+  buffer->SetValidSize(ref->size);
+  buffer->SetUSTimeStamp(ref->pts);
+  return buffer;
+}
+
+static void __media_buffer_unref(void *opaque, uint8_t *data _UNUSED) {
+  delete (std::shared_ptr<MediaBuffer> *)opaque;
+}
+
+bool MediaBufferToAVFrame(const std::shared_ptr<MediaBuffer> &buffer,
+                          const ImageInfo &info, AVFrame *frame) {
+  enum AVPixelFormat fmt = PixFmtToAVPixFmt(info.pix_fmt);
+  int vir_w = std::max(info.vir_width, info.width);
+  int vir_h = std::max(info.vir_height, info.height);
+  uint8_t *ptr = (uint8_t *)buffer->GetPtr();
+  int size = av_image_fill_arrays(frame->data, frame->linesize, ptr, fmt,
+                                  vir_w, vir_h, 1);
+  if (size < 0) {
+    PrintAVError(size, "Fail to fill image arrays",
+                 PixFmtToString(info.pix_fmt));
+    return false;
+  }
+  if ((size_t)size > buffer->GetSize()) {
+    LOG("image buffer size %zu < %d\n", buffer->GetSize(), size);
+    return false;
+  }
+  // a refcounted frame, else avcodec_send_frame copies it
+  auto ref = new std::shared_ptr<MediaBuffer>(buffer);
+  frame->buf[0] = av_buffer_create(ptr, size, __media_buffer_unref, ref,
+                                   AV_BUFFER_FLAG_READONLY);
+  if (!frame->buf[0]) {
+    delete ref;
+    LOG_NO_MEMORY();
+    return false;
+  }
+  frame->format = fmt;
+  frame->width = info.width;
+  frame->height = info.height;
+  return true;
+}
+
 } // namespace easymedia
@@ -8,9 +8,13 @@
 extern "C" {
 #define __STDC_CONSTANT_MACROS
 #include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
 }
 
+#include <memory>
+
+#include "buffer.h"
 #include "image.h"
 #include "sound.h"
 #include "media_type.h"
@@ -26,6 +30,16 @@ enum AVCodecID CodecTypeToAVCodecID(CodecType fmt);
 
 void PrintAVError(int err, const char *log, const char *mark);
 
+// MediaBuffer on the data of pkt, without a copy. The reference of pkt
+// moves to a packet freed with the buffer, pkt is left blank.
+std::shared_ptr<MediaBuffer> AVPacketToMediaBuffer(AVPacket *pkt);
+
+// Point frame at the planes of buffer, laid out with the vir_width and
+// vir_height strides of info, without a copy. The frame holds a reference
+// on buffer until the codec has done with it.
+bool MediaBufferToAVFrame(const std::shared_ptr<MediaBuffer> &buffer,
+                          const ImageInfo &info, AVFrame *frame);
+
 } // namespace easymedia
 
 #endif // #ifndef EASYMEDIA_FFMPEG_UTILS_H_
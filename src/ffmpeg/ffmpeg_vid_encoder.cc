@@ -126,35 +126,14 @@ int FFMpegVideoEncoder::SendInput(const std::shared_ptr<MediaBuffer> &input) {
 #endif
 
   if (input->GetValidSize() > 0) {
-#if 1
-    frame->data[0] = (uint8_t *)input->GetPtr();
-    frame->data[1] =
-        (uint8_t *)(input->GetPtr()) + frame->width * frame->height;
-    frame->data[2] = (uint8_t *)(input->GetPtr()) +
-                     frame->width * frame->height +
-                     frame->width * frame->height / 4;
-#else
-    memcpy(frame->data[0], (uint8_t *)input->GetPtr(),
-           frame->width * frame->height);
-    memcpy(frame->data[1],
-           (uint8_t *)(input->GetPtr()) + frame->width * frame->height,
-           frame->width * frame->height / 4);
-    memcpy(frame->data[2],
-           (uint8_t *)(input->GetPtr()) + frame->width * frame->height +
-               frame->width * frame->height / 4,
-           frame->width * frame->height / 4);
-#endif
-    // On ffmpeg 4.1.3, linesizes need to be manual configured.
-    frame->linesize[0] = frame->width;
-    frame->linesize[1] = frame->width / 2;
-    frame->linesize[2] = frame->width / 2;
+    // the planes in place, with the strides of the input
+    const ImageInfo &info = GetConfig().vid_cfg.image_cfg.image_info;
+    if (!MediaBufferToAVFrame(input, info, frame))
+      return -1;
     frame->pts = input->GetUSTimeStamp();
-
-    frame->format = Context_->pix_fmt;
-    frame->width = Context_->width;
-    frame->height = Context_->height;
-
     ret = avcodec_send_frame(Context_, frame);
+    // the codec has its own reference if it keeps the frame
+    av_frame_unref(frame);
   } else {
     ret = avcodec_send_frame(Context_, NULL);
   }
@@ -192,13 +171,15 @@ std::shared_ptr<MediaBuffer> FFMpegVideoEncoder::FetchOutput() {
   fwrite(pkt->data, 1, pkt->size, f);
   fclose(f);
 #endif
-  auto buffer = MediaBuffer::Alloc(pkt->size);
-  buffer->SetValidSize(pkt->size);
-  memcpy(buffer->GetPtr(), pkt->data, pkt->size);
-  buffer->SetUSTimeStamp(pkt->pts);
-  buffer->SetUserFlag((pkt->flags & AV_PKT_FLAG_KEY) ? MediaBuffer::kIntra
-                                                     : MediaBuffer::kPredicted);
-  av_packet_unref(pkt);
+  // the packet data is handed over, not copied
+  bool intra = pkt->flags & AV_PKT_FLAG_KEY;
+  auto buffer = AVPacketToMediaBuffer(pkt);
+  if (!buffer) {
+    av_packet_unref(pkt);
+    errno = ENOMEM;
+    return nullptr;
+  }
+  buffer->SetUserFlag(intra ? MediaBuffer::kIntra : MediaBuffer::kPredicted);
   return buffer;
 }
 
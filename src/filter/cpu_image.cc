@@ -0,0 +1,1326 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cpu_image.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "buffer.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// w x h elements step bytes apart, the channels of an element contiguous
+typedef struct {
+  uint8_t *data;
+  int stride;
+  int step;
+  int w, h;
+} CpuPlane;
+
+enum { CPU_YUV_SEMI, CPU_YUV_PLANAR, CPU_RGB24, CPU_RGB16 };
+
+typedef struct {
+  int kind;
+  int ys; // chroma rows shift of yuv, the columns are always halved
+  // v before u in a pair, r the first byte of 24 bits, b the high bits of 16
+  bool swap;
+} CpuFormat;
+
+// y, uv or y, u, v; or the pixels
+typedef struct {
+  CpuFormat f;
+  int plane_num;
+  CpuPlane p[3];
+} CpuImage;
+
+static bool get_format(PixelFormat fmt, CpuFormat &f) {
+  switch (fmt) {
+  case PIX_FMT_NV12:
+    f = {CPU_YUV_SEMI, 1, false};
+    break;
+  case PIX_FMT_NV21:
+    f = {CPU_YUV_SEMI, 1, true};
+    break;
+  case PIX_FMT_NV16:
+    f = {CPU_YUV_SEMI, 0, false};
+    break;
+  case PIX_FMT_NV61:
+    f = {CPU_YUV_SEMI, 0, true};
+    break;
+  case PIX_FMT_YUV420P:
+    f = {CPU_YUV_PLANAR, 1, false};
+    break;
+  case PIX_FMT_YUV422P:
+    f = {CPU_YUV_PLANAR, 0, false};
+    break;
+  case PIX_FMT_RGB888:
+    f = {CPU_RGB24, 0, false};
+    break;
+  case PIX_FMT_BGR888:
+    f = {CPU_RGB24, 0, true};
+    break;
+  case PIX_FMT_RGB565:
+    f = {CPU_RGB16, 0, false};
+    break;
+  case PIX_FMT_BGR565:
+    f = {CPU_RGB16, 0, true};
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+static inline bool is_yuv(const CpuFormat &f) {
+  return f.kind == CPU_YUV_SEMI || f.kind == CPU_YUV_PLANAR;
+}
+
+static inline bool same_format(const CpuFormat &a, const CpuFormat &b) {
+  return a.kind == b.kind && a.ys == b.ys && a.swap == b.swap;
+}
+
+static inline CpuPlane make_plane(uint8_t *data, int stride, int step, int w,
+                                  int h) {
+  CpuPlane p = {data, stride, step, w, h};
+  return p;
+}
+
+// the planes of rect r in an image of vw x vh, chroma from the pair of x, y
+static void map_image(const CpuFormat &f, uint8_t *data, int vw, int vh,
+                      const ImageRect &r, CpuImage &img) {
+  img.f = f;
+  int cx = r.x >> 1, cy = r.y >> f.ys;
+  int cw = (r.w + 1) >> 1, ch = (r.h + (1 << f.ys) - 1) >> f.ys;
+  uint8_t *chroma = data + vw * vh;
+  switch (f.kind) {
+  case CPU_YUV_SEMI:
+    img.plane_num = 2;
+    img.p[0] = make_plane(data + r.y * vw + r.x, vw, 1, r.w, r.h);
+    img.p[1] = make_plane(chroma + cy * vw + cx * 2, vw, 2, cw, ch);
+    break;
+  case CPU_YUV_PLANAR: {
+    int cs = vw / 2;
+    img.plane_num = 3;
+    img.p[0] = make_plane(data + r.y * vw + r.x, vw, 1, r.w, r.h);
+    img.p[1] = make_plane(chroma + cy * cs + cx, cs, 1, cw, ch);
+    chroma += cs * (vh >> f.ys);
+    img.p[2] = make_plane(chroma + cy * cs + cx, cs, 1, cw, ch);
+  } break;
+  case CPU_RGB24:
+    img.plane_num = 1;
+    img.p[0] = make_plane(data + (r.y * vw + r.x) * 3, vw * 3, 3, r.w, r.h);
+    break;
+  case CPU_RGB16:
+    img.plane_num = 1;
+    img.p[0] = make_plane(data + (r.y * vw + r.x) * 2, vw * 2, 2, r.w, r.h);
+    break;
+  }
+}
+
+// a packed w x h image in mem, of chroma cw x ch
+static void alloc_image(const CpuFormat &f, int w, int h, int cw, int ch,
+                        std::vector<uint8_t> &mem, CpuImage &img) {
+  img.f = f;
+  switch (f.kind) {
+  case CPU_YUV_SEMI:
+    mem.resize(w * h + cw * 2 * ch);
+    img.plane_num = 2;
+    img.p[0] = make_plane(mem.data(), w, 1, w, h);
+    img.p[1] = make_plane(mem.data() + w * h, cw * 2, 2, cw, ch);
+    break;
+  case CPU_YUV_PLANAR:
+    mem.resize(w * h + cw * ch * 2);
+    img.plane_num = 3;
+    img.p[0] = make_plane(mem.data(), w, 1, w, h);
+    img.p[1] = make_plane(mem.data() + w * h, cw, 1, cw, ch);
+    img.p[2] = make_plane(mem.data() + w * h + cw * ch, cw, 1, cw, ch);
+    break;
+  case CPU_RGB24:
+  case CPU_RGB16: {
+    int bpp = f.kind == CPU_RGB24 ? 3 : 2;
+    mem.resize(w * h * bpp);
+    img.plane_num = 1;
+    img.p[0] = make_plane(mem.data(), w * bpp, bpp, w, h);
+  } break;
+  }
+}
+
+// the image of img turned by 90 or 270 before, or the same for 180
+static void alloc_unrotated(const CpuImage &img, int rotate,
+                            std::vector<uint8_t> &mem, CpuImage &out) {
+  const CpuPlane &y = img.p[0];
+  const CpuPlane &c = img.p[img.plane_num > 1 ? 1 : 0];
+  if (rotate == 180)
+    alloc_image(img.f, y.w, y.h, c.w, c.h, mem, out);
+  else
+    alloc_image(img.f, y.h, y.w, c.h, c.w, mem, out);
+}
+
+// fn(y0, y1) on bands of the rows over threads, y1 a multiple of align but
+// the last
+template <typename Func>
+static void run_bands(int rows, int align, int thread_num, Func fn) {
+  int parts = std::min(thread_num, rows / CPU_IMAGE_MIN_ROWS_PER_THREAD);
+  if (parts <= 1) {
+    fn(0, rows);
+    return;
+  }
+  std::vector<std::thread> threads;
+  int y0 = 0;
+  for (int i = 0; i < parts - 1; i++) {
+    int y1 = (int)((int64_t)rows * (i + 1) / parts) / align * align;
+    threads.emplace_back(fn, y0, y1);
+    y0 = y1;
+  }
+  fn(y0, rows);
+  for (auto &t : threads)
+    t.join();
+}
+
+// the rows of a plane of h rows in the band [y0, y1) of rows
+static inline void band_rows(int rows, int h, int y0, int y1, int &b0,
+                             int &b1) {
+  b0 = (int)((int64_t)y0 * h / rows);
+  b1 = y1 == rows ? h : (int)((int64_t)y1 * h / rows);
+}
+
+// n channels of w elements from step bytes apart to contiguous, and back
+static void gather(const uint8_t *src, int step, uint8_t *dst, int w, int n) {
+  for (int x = 0; x < w; x++, src += step)
+    for (int c = 0; c < n; c++)
+      *dst++ = src[c];
+}
+
+static void scatter(const uint8_t *src, uint8_t *dst, int step, int w, int n) {
+  for (int x = 0; x < w; x++, dst += step)
+    for (int c = 0; c < n; c++)
+      dst[c] = *src++;
+}
+
+// uv pairs to u and v, and back
+static void split_uv(const uint8_t *uv, uint8_t *u, uint8_t *v, int n) {
+  int i = 0;
+#if defined(__SSE2__)
+  __m128i mask = _mm_set1_epi16(0xFF);
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(uv + i * 2));
+    __m128i b = _mm_loadu_si128((const __m128i *)(uv + i * 2 + 16));
+    _mm_storeu_si128((__m128i *)(u + i),
+                     _mm_packus_epi16(_mm_and_si128(a, mask),
+                                      _mm_and_si128(b, mask)));
+    _mm_storeu_si128((__m128i *)(v + i),
+                     _mm_packus_epi16(_mm_srli_epi16(a, 8),
+                                      _mm_srli_epi16(b, 8)));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= n; i += 16) {
+    uint8x16x2_t p = vld2q_u8(uv + i * 2);
+    vst1q_u8(u + i, p.val[0]);
+    vst1q_u8(v + i, p.val[1]);
+  }
+#endif
+  for (; i < n; i++) {
+    u[i] = uv[i * 2];
+    v[i] = uv[i * 2 + 1];
+  }
+}
+
+static void merge_uv(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n) {
+  int i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(u + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(v + i));
+    _mm_storeu_si128((__m128i *)(uv + i * 2), _mm_unpacklo_epi8(a, b));
+    _mm_storeu_si128((__m128i *)(uv + i * 2 + 16), _mm_unpackhi_epi8(a, b));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= n; i += 16) {
+    uint8x16x2_t p;
+    p.val[0] = vld1q_u8(u + i);
+    p.val[1] = vld1q_u8(v + i);
+    vst2q_u8(uv + i * 2, p);
+  }
+#endif
+  for (; i < n; i++) {
+    uv[i * 2] = u[i];
+    uv[i * 2 + 1] = v[i];
+  }
+}
+
+// d = (a * (256 - f) + b * f + 128) >> 8, 0 < f < 256
+static void blend_rows(const uint8_t *a, const uint8_t *b, uint8_t *d, int n,
+                       int f) {
+  int i = 0;
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  __m128i wa = _mm_set1_epi16(256 - f), wb = _mm_set1_epi16(f);
+  __m128i round = _mm_set1_epi16(128);
+  for (; i + 16 <= n; i += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    // at most 255 * 256 + 128, no carry out of 16 bits
+    __m128i lo = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+    __m128i hi = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+        _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+    _mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(lo, hi));
+  }
+#elif defined(__ARM_NEON)
+  uint8x8_t wa = vdup_n_u8(256 - f), wb = vdup_n_u8(f);
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t va = vld1q_u8(a + i), vb = vld1q_u8(b + i);
+    uint16x8_t lo =
+        vmlal_u8(vmull_u8(vget_low_u8(va), wa), vget_low_u8(vb), wb);
+    uint16x8_t hi =
+        vmlal_u8(vmull_u8(vget_high_u8(va), wa), vget_high_u8(vb), wb);
+    vst1q_u8(d + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+  }
+#endif
+  for (; i < n; i++)
+    d[i] = (a[i] * (256 - f) + b[i] * f + 128) >> 8;
+}
+
+// acc[i] += row[i]
+static void add_row(uint32_t *acc, const uint8_t *row, int n) {
+  int i = 0;
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(row + i));
+    __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+    __m128i *a = (__m128i *)(acc + i);
+    _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a),
+                                      _mm_unpacklo_epi16(lo, zero)));
+    _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1),
+                                          _mm_unpackhi_epi16(lo, zero)));
+    _mm_storeu_si128(a + 2, _mm_add_epi32(_mm_loadu_si128(a + 2),
+                                          _mm_unpacklo_epi16(hi, zero)));
+    _mm_storeu_si128(a + 3, _mm_add_epi32(_mm_loadu_si128(a + 3),
+                                          _mm_unpackhi_epi16(hi, zero)));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(row + i);
+    uint16x8_t lo = vmovl_u8(vget_low_u8(v)), hi = vmovl_u8(vget_high_u8(v));
+    uint32_t *a = acc + i;
+    vst1q_u32(a, vaddw_u16(vld1q_u32(a), vget_low_u16(lo)));
+    vst1q_u32(a + 4, vaddw_u16(vld1q_u32(a + 4), vget_high_u16(lo)));
+    vst1q_u32(a + 8, vaddw_u16(vld1q_u32(a + 8), vget_low_u16(hi)));
+    vst1q_u32(a + 12, vaddw_u16(vld1q_u32(a + 12), vget_high_u16(hi)));
+  }
+#endif
+  for (; i < n; i++)
+    acc[i] += row[i];
+}
+
+// source position of the center of pixel i of dst, with an 8 bit fraction
+// toward the next source pixel
+static inline void bilinear_pos(int src, int dst, int i, int &p, int &f) {
+  int64_t pos = (((int64_t)(2 * i + 1) * src) << 16) / (2 * dst) - 32768;
+  if (pos < 0)
+    pos = 0;
+  p = (int)(pos >> 16);
+  f = (int)((pos >> 8) & 0xFF);
+  if (p >= src - 1) {
+    p = src - 1;
+    f = 0;
+  }
+}
+
+static void copy_plane(const CpuPlane &s, const CpuPlane &d, int n, int y0,
+                       int y1) {
+  std::vector<uint8_t> row(d.w * n);
+  for (int y = y0; y < y1; y++) {
+    const uint8_t *sp = s.data + y * s.stride;
+    uint8_t *dp = d.data + y * d.stride;
+    if (s.step == n && d.step == n) {
+      memcpy(dp, sp, d.w * n);
+    } else if (n == 1 && s.step == 2 && d.step == 1) {
+      // u or v alone of uv pairs, the other half thrown away
+      split_uv(sp, dp, row.data(), d.w);
+    } else {
+      gather(sp, s.step, row.data(), d.w, n);
+      scatter(row.data(), dp, d.step, d.w, n);
+    }
+  }
+}
+
+// Bilinear on x into a row cache of two source rows, then on y. The
+// vertical blend is simd; the horizontal one gathers a pair a pixel.
+static void scale_bilinear(const CpuPlane &s, const CpuPlane &d, int n,
+                           int y0, int y1) {
+  int row_bytes = d.w * n;
+  std::vector<int> x0(d.w), x1(d.w);
+  std::vector<uint8_t> fx(d.w);
+  for (int x = 0; x < d.w; x++) {
+    int p, f;
+    bilinear_pos(s.w, d.w, x, p, f);
+    x0[x] = p * s.step;
+    x1[x] = (f ? p + 1 : p) * s.step;
+    fx[x] = f;
+  }
+  bool hcopy = s.w == d.w && s.step == n;
+  std::vector<uint8_t> buf(row_bytes * 3);
+  uint8_t *cache[2] = {buf.data(), buf.data() + row_bytes};
+  uint8_t *tmp = buf.data() + row_bytes * 2;
+  const uint8_t *rows[2] = {nullptr, nullptr};
+  int cached[2] = {-1, -1};
+  auto load = [&](int slot, int sy) {
+    const uint8_t *sp = s.data + sy * s.stride;
+    cached[slot] = sy;
+    if (hcopy) {
+      rows[slot] = sp;
+      return;
+    }
+    uint8_t *dp = cache[slot];
+    rows[slot] = dp;
+    for (int x = 0; x < d.w; x++) {
+      const uint8_t *a = sp + x0[x], *b = sp + x1[x];
+      int f = fx[x];
+      for (int c = 0; c < n; c++)
+        *dp++ = (a[c] * (256 - f) + b[c] * f + 128) >> 8;
+    }
+  };
+  for (int y = y0; y < y1; y++) {
+    int sy, fy;
+    bilinear_pos(s.h, d.h, y, sy, fy);
+    if (cached[0] != sy) {
+      if (cached[1] == sy) {
+        std::swap(cache[0], cache[1]);
+        std::swap(rows[0], rows[1]);
+        std::swap(cached[0], cached[1]);
+      } else {
+        load(0, sy);
+      }
+    }
+    if (fy && cached[1] != sy + 1)
+      load(1, sy + 1);
+    uint8_t *out = d.step == n ? d.data + y * d.stride : tmp;
+    if (fy)
+      blend_rows(rows[0], rows[1], out, row_bytes, fy);
+    else
+      memcpy(out, rows[0], row_bytes);
+    if (out == tmp)
+      scatter(tmp, d.data + y * d.stride, d.step, d.w, n);
+  }
+}
+
+// The source box of each pixel: rows summed into 32 bit columns by simd,
+// then the box columns from their running sums. The mean is rounded, by a
+// 32 bit reciprocal for boxes below 4096 pixels, exact as sums stay below
+// 256 times the box.
+static void scale_area(const CpuPlane &s, const CpuPlane &d, int n, int y0,
+                       int y1) {
+  std::vector<int> bx0(d.w), bx1(d.w);
+  int max_w = 1, max_h = 1;
+  for (int x = 0; x < d.w; x++) {
+    bx0[x] = (int)((int64_t)x * s.w / d.w);
+    bx1[x] = std::max((int)((int64_t)(x + 1) * s.w / d.w), bx0[x] + 1);
+    max_w = std::max(max_w, bx1[x] - bx0[x]);
+  }
+  for (int y = 0; y < d.h; y++) {
+    int b0 = (int)((int64_t)y * s.h / d.h);
+    max_h = std::max(max_h, std::max((int)((int64_t)(y + 1) * s.h / d.h),
+                                     b0 + 1) - b0);
+  }
+  std::vector<uint64_t> recip;
+  if (max_w * max_h < 4096) {
+    recip.resize(max_w * max_h + 1);
+    for (int a = 1; a <= max_w * max_h; a++)
+      recip[a] = ((1ULL << 32) + a - 1) / a;
+  }
+  int sn = s.w * n;
+  std::vector<uint32_t> acc(sn + n);
+  std::vector<uint8_t> row(std::max(sn, d.w * n));
+  for (int y = y0; y < y1; y++) {
+    int by0 = (int)((int64_t)y * s.h / d.h);
+    int by1 = std::max((int)((int64_t)(y + 1) * s.h / d.h), by0 + 1);
+    // acc[n + i] the sum of column i, acc[0..n) zero for the running sums
+    std::fill(acc.begin(), acc.end(), 0);
+    for (int sy = by0; sy < by1; sy++) {
+      const uint8_t *sp = s.data + sy * s.stride;
+      if (s.step != n) {
+        gather(sp, s.step, row.data(), s.w, n);
+        sp = row.data();
+      }
+      add_row(acc.data() + n, sp, sn);
+    }
+    for (int i = n; i < sn + n; i++)
+      acc[i] += acc[i - n];
+    uint8_t *dp = d.step == n ? d.data + y * d.stride : row.data();
+    uint8_t *out = dp;
+    for (int x = 0; x < d.w; x++) {
+      uint32_t area = (bx1[x] - bx0[x]) * (by1 - by0);
+      const uint32_t *hi = acc.data() + bx1[x] * n;
+      const uint32_t *lo = acc.data() + bx0[x] * n;
+      for (int c = 0; c < n; c++) {
+        // wrapped sums still differ by the box sum
+        uint32_t sum = hi[c] - lo[c] + area / 2;
+        *out++ = recip.empty() ? sum / area
+                               : (uint8_t)((sum * recip[area]) >> 32);
+      }
+    }
+    if (dp == row.data())
+      scatter(dp, d.data + y * d.stride, d.step, d.w, n);
+  }
+}
+
+// rows [y0, y1) of d, the s plane of n channel elements scaled
+static void scale_plane(const CpuPlane &s, const CpuPlane &d, int n,
+                        bool area, int y0, int y1) {
+  if (y0 >= y1)
+    return;
+  if (s.w == d.w && s.h == d.h)
+    copy_plane(s, d, n, y0, y1);
+  else if (area)
+    scale_area(s, d, n, y0, y1);
+  else
+    scale_bilinear(s, d, n, y0, y1);
+}
+
+// u (v if !u) of a yuv image as a plane of one channel
+static CpuPlane chroma_plane(const CpuImage &img, bool u) {
+  if (img.f.kind == CPU_YUV_PLANAR)
+    return img.p[u ? 1 : 2];
+  CpuPlane p = img.p[1];
+  if (u == img.f.swap)
+    p.data++;
+  return p;
+}
+
+// y, u and v of s into o at the sizes of o, both yuv
+static void scale_yuv(const CpuImage &s, const CpuImage &o, bool area,
+                      int thread_num) {
+  bool semi = s.f.kind == CPU_YUV_SEMI && o.f.kind == CPU_YUV_SEMI &&
+              s.f.swap == o.f.swap;
+  bool same_chroma = s.p[1].w == o.p[1].w && s.p[1].h == o.p[1].h;
+  int rows = o.p[0].h;
+  run_bands(rows, 2, thread_num, [&](int y0, int y1) {
+    scale_plane(s.p[0], o.p[0], 1, area, y0, y1);
+    int c0, c1;
+    band_rows(rows, o.p[1].h, y0, y1, c0, c1);
+    if (semi) {
+      scale_plane(s.p[1], o.p[1], 2, area, c0, c1);
+      return;
+    }
+    CpuPlane su = chroma_plane(s, true), sv = chroma_plane(s, false);
+    CpuPlane ou = chroma_plane(o, true), ov = chroma_plane(o, false);
+    // nv21 and nv61 interleave v first
+    if (same_chroma && s.f.kind == CPU_YUV_PLANAR &&
+        o.f.kind == CPU_YUV_SEMI) {
+      const CpuPlane &a = o.f.swap ? sv : su, &b = o.f.swap ? su : sv;
+      for (int y = c0; y < c1; y++)
+        merge_uv(a.data + y * a.stride, b.data + y * b.stride,
+                 o.p[1].data + y * o.p[1].stride, o.p[1].w);
+      return;
+    }
+    if (same_chroma && s.f.kind == CPU_YUV_SEMI &&
+        o.f.kind == CPU_YUV_PLANAR) {
+      const CpuPlane &a = s.f.swap ? ov : ou, &b = s.f.swap ? ou : ov;
+      for (int y = c0; y < c1; y++)
+        split_uv(s.p[1].data + y * s.p[1].stride, a.data + y * a.stride,
+                 b.data + y * b.stride, o.p[1].w);
+      return;
+    }
+    scale_plane(su, ou, 1, area, c0, c1);
+    scale_plane(sv, ov, 1, area, c0, c1);
+  });
+}
+
+// bt.601 limited range, 6 bit coefficients in 16 bit lanes:
+// y' = (y - 16) * 74 + 32, r = (y' + 102 v) >> 6,
+// g = (y' - 25 u - 52 v) >> 6, b = (y' + 129 u) >> 6, u and v less 128.
+// b may saturate at 32767, where it is clamped to 255 anyway.
+static void yuv_to_rgb_row(const uint8_t *y, const uint8_t *u,
+                           const uint8_t *v, uint8_t *r, uint8_t *g,
+                           uint8_t *b, int n) {
+  int i = 0;
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  __m128i c16 = _mm_set1_epi16(16), c32 = _mm_set1_epi16(32);
+  __m128i c128 = _mm_set1_epi16(128), c74 = _mm_set1_epi16(74);
+  __m128i c102 = _mm_set1_epi16(102), c25 = _mm_set1_epi16(-25);
+  __m128i c52 = _mm_set1_epi16(-52), c129 = _mm_set1_epi16(129);
+  for (; i + 16 <= n; i += 16) {
+    __m128i vy = _mm_loadu_si128((const __m128i *)(y + i));
+    __m128i vu = _mm_loadl_epi64((const __m128i *)(u + i / 2));
+    __m128i vv = _mm_loadl_epi64((const __m128i *)(v + i / 2));
+    vu = _mm_unpacklo_epi8(vu, vu);
+    vv = _mm_unpacklo_epi8(vv, vv);
+    __m128i out[3][2];
+    for (int h = 0; h < 2; h++) {
+      __m128i yy =
+          h ? _mm_unpackhi_epi8(vy, zero) : _mm_unpacklo_epi8(vy, zero);
+      __m128i uu =
+          h ? _mm_unpackhi_epi8(vu, zero) : _mm_unpacklo_epi8(vu, zero);
+      __m128i vvv =
+          h ? _mm_unpackhi_epi8(vv, zero) : _mm_unpacklo_epi8(vv, zero);
+      yy = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(yy, c16), c74), c32);
+      uu = _mm_sub_epi16(uu, c128);
+      vvv = _mm_sub_epi16(vvv, c128);
+      out[0][h] = _mm_srai_epi16(
+          _mm_adds_epi16(yy, _mm_mullo_epi16(vvv, c102)), 6);
+      out[1][h] = _mm_srai_epi16(
+          _mm_adds_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(uu, c25)),
+                         _mm_mullo_epi16(vvv, c52)),
+          6);
+      out[2][h] = _mm_srai_epi16(
+          _mm_adds_epi16(yy, _mm_mullo_epi16(uu, c129)), 6);
+    }
+    _mm_storeu_si128((__m128i *)(r + i),
+                     _mm_packus_epi16(out[0][0], out[0][1]));
+    _mm_storeu_si128((__m128i *)(g + i),
+                     _mm_packus_epi16(out[1][0], out[1][1]));
+    _mm_storeu_si128((__m128i *)(b + i),
+                     _mm_packus_epi16(out[2][0], out[2][1]));
+  }
+#elif defined(__ARM_NEON)
+  int16x8_t c16 = vdupq_n_s16(16), c32 = vdupq_n_s16(32);
+  int16x8_t c128 = vdupq_n_s16(128);
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t vy = vld1q_u8(y + i);
+    uint8x8_t u8 = vld1_u8(u + i / 2), v8 = vld1_u8(v + i / 2);
+    uint8x8x2_t vu = vzip_u8(u8, u8), vv = vzip_u8(v8, v8);
+    uint8x8_t out[3][2];
+    for (int h = 0; h < 2; h++) {
+      int16x8_t yy = vreinterpretq_s16_u16(
+          vmovl_u8(h ? vget_high_u8(vy) : vget_low_u8(vy)));
+      int16x8_t uu =
+          vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vu.val[h])), c128);
+      int16x8_t vvv =
+          vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vv.val[h])), c128);
+      yy = vaddq_s16(vmulq_n_s16(vsubq_s16(yy, c16), 74), c32);
+      out[0][h] = vqmovun_s16(
+          vshrq_n_s16(vqaddq_s16(yy, vmulq_n_s16(vvv, 102)), 6));
+      out[1][h] = vqmovun_s16(vshrq_n_s16(
+          vqaddq_s16(vqaddq_s16(yy, vmulq_n_s16(uu, -25)),
+                     vmulq_n_s16(vvv, -52)),
+          6));
+      out[2][h] = vqmovun_s16(
+          vshrq_n_s16(vqaddq_s16(yy, vmulq_n_s16(uu, 129)), 6));
+    }
+    vst1q_u8(r + i, vcombine_u8(out[0][0], out[0][1]));
+    vst1q_u8(g + i, vcombine_u8(out[1][0], out[1][1]));
+    vst1q_u8(b + i, vcombine_u8(out[2][0], out[2][1]));
+  }
+#endif
+  for (; i < n; i++) {
+    int yy = (y[i] - 16) * 74 + 32;
+    int uu = u[i / 2] - 128, vv = v[i / 2] - 128;
+    r[i] = std::min(std::max((yy + 102 * vv) >> 6, 0), 255);
+    g[i] = std::min(std::max((yy - 25 * uu - 52 * vv) >> 6, 0), 255);
+    b[i] = std::min(std::max((yy + 129 * uu) >> 6, 0), 255);
+  }
+}
+
+// y = ((66 r + 129 g + 25 b + 128) >> 8) + 16, at most 56228 in 16 bits
+static void rgb_to_y_row(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                         uint8_t *y, int n) {
+  int i = 0;
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  __m128i c66 = _mm_set1_epi16(66), c129 = _mm_set1_epi16(129);
+  __m128i c25 = _mm_set1_epi16(25), c128 = _mm_set1_epi16(128);
+  __m128i c16 = _mm_set1_epi16(16);
+  for (; i + 16 <= n; i += 16) {
+    __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+    __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i out[2];
+    for (int h = 0; h < 2; h++) {
+      __m128i s = _mm_add_epi16(
+          _mm_mullo_epi16(h ? _mm_unpackhi_epi8(vr, zero)
+                            : _mm_unpacklo_epi8(vr, zero),
+                          c66),
+          _mm_mullo_epi16(h ? _mm_unpackhi_epi8(vg, zero)
+                            : _mm_unpacklo_epi8(vg, zero),
+                          c129));
+      s = _mm_add_epi16(s, _mm_mullo_epi16(h ? _mm_unpackhi_epi8(vb, zero)
+                                             : _mm_unpacklo_epi8(vb, zero),
+                                           c25));
+      out[h] = _mm_add_epi16(_mm_srli_epi16(_mm_add_epi16(s, c128), 8), c16);
+    }
+    _mm_storeu_si128((__m128i *)(y + i), _mm_packus_epi16(out[0], out[1]));
+  }
+#elif defined(__ARM_NEON)
+  uint8x8_t c66 = vdup_n_u8(66), c129 = vdup_n_u8(129), c25 = vdup_n_u8(25);
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t vr = vld1q_u8(r + i), vg = vld1q_u8(g + i);
+    uint8x16_t vb = vld1q_u8(b + i);
+    uint16x8_t lo = vmull_u8(vget_low_u8(vr), c66);
+    lo = vmlal_u8(lo, vget_low_u8(vg), c129);
+    lo = vmlal_u8(lo, vget_low_u8(vb), c25);
+    uint16x8_t hi = vmull_u8(vget_high_u8(vr), c66);
+    hi = vmlal_u8(hi, vget_high_u8(vg), c129);
+    hi = vmlal_u8(hi, vget_high_u8(vb), c25);
+    vst1q_u8(y + i, vaddq_u8(vcombine_u8(vrshrn_n_u16(lo, 8),
+                                         vrshrn_n_u16(hi, 8)),
+                             vdupq_n_u8(16)));
+  }
+#endif
+  for (; i < n; i++)
+    y[i] = ((66 * r[i] + 129 * g[i] + 25 * b[i] + 128) >> 8) + 16;
+}
+
+static inline void rgb_to_uv(int r, int g, int b, uint8_t *u, uint8_t *v) {
+  *u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+  *v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+// u and v of the (n + 1) / 2 pixel pairs of a row, averaged with the pairs
+// below if r1 is not null; a last odd pixel is its own pair
+static void rgb_to_uv_row(const uint8_t *r0, const uint8_t *g0,
+                          const uint8_t *b0, const uint8_t *r1,
+                          const uint8_t *g1, const uint8_t *b1, uint8_t *u,
+                          uint8_t *v, int n) {
+  int i = 0;
+#if defined(__SSE2__)
+  __m128i mask = _mm_set1_epi16(0xFF), zero = _mm_setzero_si128();
+  __m128i c128 = _mm_set1_epi16(128);
+  __m128i round = _mm_set1_epi16(r1 ? 2 : 1);
+  int shift = r1 ? 2 : 1;
+  const uint8_t *src[2][3] = {{r0, g0, b0}, {r1, g1, b1}};
+  for (; i + 16 <= n; i += 16) {
+    __m128i avg[3];
+    for (int c = 0; c < 3; c++) {
+      __m128i p = _mm_loadu_si128((const __m128i *)(src[0][c] + i));
+      __m128i s = _mm_add_epi16(_mm_and_si128(p, mask), _mm_srli_epi16(p, 8));
+      if (r1) {
+        p = _mm_loadu_si128((const __m128i *)(src[1][c] + i));
+        s = _mm_add_epi16(s, _mm_add_epi16(_mm_and_si128(p, mask),
+                                           _mm_srli_epi16(p, 8)));
+      }
+      avg[c] = _mm_srl_epi16(_mm_add_epi16(s, round), _mm_cvtsi32_si128(shift));
+    }
+    __m128i vu = _mm_add_epi16(
+        _mm_mullo_epi16(avg[0], _mm_set1_epi16(-38)),
+        _mm_mullo_epi16(avg[1], _mm_set1_epi16(-74)));
+    vu = _mm_add_epi16(vu, _mm_add_epi16(
+                               _mm_mullo_epi16(avg[2], _mm_set1_epi16(112)),
+                               c128));
+    __m128i vv = _mm_add_epi16(
+        _mm_mullo_epi16(avg[0], _mm_set1_epi16(112)),
+        _mm_mullo_epi16(avg[1], _mm_set1_epi16(-94)));
+    vv = _mm_add_epi16(vv, _mm_add_epi16(
+                               _mm_mullo_epi16(avg[2], _mm_set1_epi16(-18)),
+                               c128));
+    vu = _mm_add_epi16(_mm_srai_epi16(vu, 8), c128);
+    vv = _mm_add_epi16(_mm_srai_epi16(vv, 8), c128);
+    _mm_storel_epi64((__m128i *)(u + i / 2), _mm_packus_epi16(vu, zero));
+    _mm_storel_epi64((__m128i *)(v + i / 2), _mm_packus_epi16(vv, zero));
+  }
+#elif defined(__ARM_NEON)
+  const uint8_t *src[2][3] = {{r0, g0, b0}, {r1, g1, b1}};
+  int16x8_t c128 = vdupq_n_s16(128);
+  for (; i + 16 <= n; i += 16) {
+    int16x8_t avg[3];
+    for (int c = 0; c < 3; c++) {
+      uint16x8_t s = vpaddlq_u8(vld1q_u8(src[0][c] + i));
+      if (r1)
+        s = vpadalq_u8(s, vld1q_u8(src[1][c] + i));
+      avg[c] = vreinterpretq_s16_u16(r1 ? vrshrq_n_u16(s, 2)
+                                        : vrshrq_n_u16(s, 1));
+    }
+    int16x8_t vu = vmulq_n_s16(avg[0], -38);
+    vu = vmlaq_n_s16(vu, avg[1], -74);
+    vu = vmlaq_n_s16(vu, avg[2], 112);
+    int16x8_t vv = vmulq_n_s16(avg[0], 112);
+    vv = vmlaq_n_s16(vv, avg[1], -94);
+    vv = vmlaq_n_s16(vv, avg[2], -18);
+    vu = vaddq_s16(vshrq_n_s16(vaddq_s16(vu, c128), 8), c128);
+    vv = vaddq_s16(vshrq_n_s16(vaddq_s16(vv, c128), 8), c128);
+    vst1_u8(u + i / 2, vqmovun_s16(vu));
+    vst1_u8(v + i / 2, vqmovun_s16(vv));
+  }
+#endif
+  for (; i < n; i += 2) {
+    int j = std::min(i + 1, n - 1);
+    int r = r0[i] + r0[j], g = g0[i] + g0[j], b = b0[i] + b0[j];
+    if (r1) {
+      r = (r + r1[i] + r1[j] + 2) >> 2;
+      g = (g + g1[i] + g1[j] + 2) >> 2;
+      b = (b + b1[i] + b1[j] + 2) >> 2;
+    } else {
+      r = (r + 1) >> 1;
+      g = (g + 1) >> 1;
+      b = (b + 1) >> 1;
+    }
+    rgb_to_uv(r, g, b, u + i / 2, v + i / 2);
+  }
+}
+
+// a row of rgb pixels to r, g and b
+static void load_rgb_row(const uint8_t *p, const CpuFormat &f, uint8_t *r,
+                         uint8_t *g, uint8_t *b, int n) {
+  int i = 0;
+  if (f.kind == CPU_RGB24) {
+    uint8_t *first = f.swap ? r : b, *last = f.swap ? b : r;
+#if defined(__ARM_NEON)
+    for (; i + 16 <= n; i += 16) {
+      uint8x16x3_t v = vld3q_u8(p + i * 3);
+      vst1q_u8(first + i, v.val[0]);
+      vst1q_u8(g + i, v.val[1]);
+      vst1q_u8(last + i, v.val[2]);
+    }
+#endif
+    for (; i < n; i++) {
+      first[i] = p[i * 3];
+      g[i] = p[i * 3 + 1];
+      last[i] = p[i * 3 + 2];
+    }
+    return;
+  }
+  // 565, the 5 and 6 bits widened by their high bits
+  uint8_t *high = f.swap ? b : r, *low = f.swap ? r : b;
+#if defined(__SSE2__)
+  __m128i m5 = _mm_set1_epi16(31), m6 = _mm_set1_epi16(63);
+  for (; i + 16 <= n; i += 16) {
+    __m128i out[3][2];
+    for (int h = 0; h < 2; h++) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(p + i * 2 + h * 16));
+      __m128i c = _mm_srli_epi16(v, 11);
+      out[0][h] = _mm_or_si128(_mm_slli_epi16(c, 3), _mm_srli_epi16(c, 2));
+      c = _mm_and_si128(_mm_srli_epi16(v, 5), m6);
+      out[1][h] = _mm_or_si128(_mm_slli_epi16(c, 2), _mm_srli_epi16(c, 4));
+      c = _mm_and_si128(v, m5);
+      out[2][h] = _mm_or_si128(_mm_slli_epi16(c, 3), _mm_srli_epi16(c, 2));
+    }
+    _mm_storeu_si128((__m128i *)(high + i),
+                     _mm_packus_epi16(out[0][0], out[0][1]));
+    _mm_storeu_si128((__m128i *)(g + i),
+                     _mm_packus_epi16(out[1][0], out[1][1]));
+    _mm_storeu_si128((__m128i *)(low + i),
+                     _mm_packus_epi16(out[2][0], out[2][1]));
+  }
+#elif defined(__ARM_NEON)
+  uint16x8_t m5 = vdupq_n_u16(31), m6 = vdupq_n_u16(63);
+  for (; i + 16 <= n; i += 16) {
+    uint8x8_t out[3][2];
+    for (int h = 0; h < 2; h++) {
+      uint16x8_t v = vld1q_u16((const uint16_t *)(p + i * 2 + h * 16));
+      uint16x8_t c = vshrq_n_u16(v, 11);
+      out[0][h] = vmovn_u16(vorrq_u16(vshlq_n_u16(c, 3), vshrq_n_u16(c, 2)));
+      c = vandq_u16(vshrq_n_u16(v, 5), m6);
+      out[1][h] = vmovn_u16(vorrq_u16(vshlq_n_u16(c, 2), vshrq_n_u16(c, 4)));
+      c = vandq_u16(v, m5);
+      out[2][h] = vmovn_u16(vorrq_u16(vshlq_n_u16(c, 3), vshrq_n_u16(c, 2)));
+    }
+    vst1q_u8(high + i, vcombine_u8(out[0][0], out[0][1]));
+    vst1q_u8(g + i, vcombine_u8(out[1][0], out[1][1]));
+    vst1q_u8(low + i, vcombine_u8(out[2][0], out[2][1]));
+  }
+#endif
+  for (; i < n; i++) {
+    int v = p[i * 2] | (p[i * 2 + 1] << 8);
+    int c = v >> 11;
+    high[i] = (c << 3) | (c >> 2);
+    c = (v >> 5) & 63;
+    g[i] = (c << 2) | (c >> 4);
+    c = v & 31;
+    low[i] = (c << 3) | (c >> 2);
+  }
+}
+
+// r, g and b to a row of rgb pixels, 565 by truncation
+static void store_rgb_row(const uint8_t *r, const uint8_t *g,
+                          const uint8_t *b, uint8_t *p, const CpuFormat &f,
+                          int n) {
+  int i = 0;
+  if (f.kind == CPU_RGB24) {
+    const uint8_t *first = f.swap ? r : b, *last = f.swap ? b : r;
+#if defined(__ARM_NEON)
+    for (; i + 16 <= n; i += 16) {
+      uint8x16x3_t v;
+      v.val[0] = vld1q_u8(first + i);
+      v.val[1] = vld1q_u8(g + i);
+      v.val[2] = vld1q_u8(last + i);
+      vst3q_u8(p + i * 3, v);
+    }
+#endif
+    for (; i < n; i++) {
+      p[i * 3] = first[i];
+      p[i * 3 + 1] = g[i];
+      p[i * 3 + 2] = last[i];
+    }
+    return;
+  }
+  const uint8_t *high = f.swap ? b : r, *low = f.swap ? r : b;
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  __m128i m5 = _mm_set1_epi16(0xF8), m6 = _mm_set1_epi16(0xFC);
+  for (; i + 16 <= n; i += 16) {
+    __m128i vh = _mm_loadu_si128((const __m128i *)(high + i));
+    __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+    __m128i vl = _mm_loadu_si128((const __m128i *)(low + i));
+    for (int h = 0; h < 2; h++) {
+      __m128i ch =
+          h ? _mm_unpackhi_epi8(vh, zero) : _mm_unpacklo_epi8(vh, zero);
+      __m128i cg =
+          h ? _mm_unpackhi_epi8(vg, zero) : _mm_unpacklo_epi8(vg, zero);
+      __m128i cl =
+          h ? _mm_unpackhi_epi8(vl, zero) : _mm_unpacklo_epi8(vl, zero);
+      __m128i v = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(ch, m5), 8),
+                               _mm_slli_epi16(_mm_and_si128(cg, m6), 3));
+      v = _mm_or_si128(v, _mm_srli_epi16(cl, 3));
+      _mm_storeu_si128((__m128i *)(p + i * 2 + h * 16), v);
+    }
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 8 <= n; i += 8) {
+    uint16x8_t v = vshlq_n_u16(vmovl_u8(vshr_n_u8(vld1_u8(high + i), 3)), 11);
+    v = vorrq_u16(v, vshlq_n_u16(vmovl_u8(vshr_n_u8(vld1_u8(g + i), 2)), 5));
+    v = vorrq_u16(v, vmovl_u8(vshr_n_u8(vld1_u8(low + i), 3)));
+    vst1q_u16((uint16_t *)(p + i * 2), v);
+  }
+#endif
+  for (; i < n; i++) {
+    int v = ((high[i] >> 3) << 11) | ((g[i] >> 2) << 5) | (low[i] >> 3);
+    p[i * 2] = v & 0xFF;
+    p[i * 2 + 1] = v >> 8;
+  }
+}
+
+// yuv to rgb at the same size, rows [y0, y1) of o
+static void convert_yuv_to_rgb(const CpuImage &s, const CpuImage &o, int y0,
+                               int y1) {
+  int w = o.p[0].w, cw = (w + 1) / 2;
+  std::vector<uint8_t> buf(cw * 2 + w * 3);
+  uint8_t *u = buf.data(), *v = u + cw;
+  uint8_t *r = v + cw, *g = r + w, *b = g + w;
+  CpuPlane su = chroma_plane(s, true), sv = chroma_plane(s, false);
+  for (int y = y0; y < y1; y++) {
+    int cy = y >> s.f.ys;
+    const uint8_t *pu, *pv;
+    if (s.f.kind == CPU_YUV_SEMI) {
+      split_uv(s.p[1].data + cy * s.p[1].stride, s.f.swap ? v : u,
+               s.f.swap ? u : v, cw);
+      pu = u;
+      pv = v;
+    } else {
+      pu = su.data + cy * su.stride;
+      pv = sv.data + cy * sv.stride;
+    }
+    yuv_to_rgb_row(s.p[0].data + y * s.p[0].stride, pu, pv, r, g, b, w);
+    store_rgb_row(r, g, b, o.p[0].data + y * o.p[0].stride, o.f, w);
+  }
+}
+
+// rgb to yuv at the same size, rows [y0, y1) of o, y0 even
+static void convert_rgb_to_yuv(const CpuImage &s, const CpuImage &o, int y0,
+                               int y1) {
+  int w = o.p[0].w, cw = (w + 1) / 2, h = o.p[0].h;
+  std::vector<uint8_t> buf(w * 6 + cw * 2);
+  uint8_t *r0 = buf.data(), *g0 = r0 + w, *b0 = g0 + w;
+  uint8_t *r1 = b0 + w, *g1 = r1 + w, *b1 = g1 + w;
+  uint8_t *u = b1 + w, *v = u + cw;
+  CpuPlane ou = chroma_plane(o, true), ov = chroma_plane(o, false);
+  int rows = 1 << o.f.ys;
+  for (int y = y0; y < y1; y += rows) {
+    const CpuPlane &sp = s.p[0];
+    load_rgb_row(sp.data + y * sp.stride, s.f, r0, g0, b0, w);
+    rgb_to_y_row(r0, g0, b0, o.p[0].data + y * o.p[0].stride, w);
+    bool pair = rows == 2;
+    if (pair && y + 1 < h) {
+      load_rgb_row(sp.data + (y + 1) * sp.stride, s.f, r1, g1, b1, w);
+      rgb_to_y_row(r1, g1, b1, o.p[0].data + (y + 1) * o.p[0].stride, w);
+    } else if (pair) {
+      // the last odd row is its own pair
+      memcpy(r1, r0, w * 3);
+    }
+    int cy = y >> o.f.ys;
+    if (o.f.kind == CPU_YUV_SEMI) {
+      rgb_to_uv_row(r0, g0, b0, pair ? r1 : nullptr, g1, b1, u, v, w);
+      merge_uv(o.f.swap ? v : u, o.f.swap ? u : v,
+               o.p[1].data + cy * o.p[1].stride, cw);
+    } else {
+      rgb_to_uv_row(r0, g0, b0, pair ? r1 : nullptr, g1, b1,
+                    ou.data + cy * ou.stride, ov.data + cy * ov.stride, w);
+    }
+  }
+}
+
+// rgb to rgb of another layout at the same size, rows [y0, y1) of o
+static void convert_rgb_to_rgb(const CpuImage &s, const CpuImage &o, int y0,
+                               int y1) {
+  int w = o.p[0].w;
+  if (same_format(s.f, o.f)) {
+    for (int y = y0; y < y1; y++)
+      memcpy(o.p[0].data + y * o.p[0].stride, s.p[0].data + y * s.p[0].stride,
+             w * o.p[0].step);
+    return;
+  }
+  std::vector<uint8_t> buf(w * 3);
+  uint8_t *r = buf.data(), *g = r + w, *b = g + w;
+  for (int y = y0; y < y1; y++) {
+    load_rgb_row(s.p[0].data + y * s.p[0].stride, s.f, r, g, b, w);
+    store_rgb_row(r, g, b, o.p[0].data + y * o.p[0].stride, o.f, w);
+  }
+}
+
+static inline void copy_element(uint8_t *d, const uint8_t *s, int bpp) {
+  d[0] = s[0];
+  if (bpp > 1)
+    d[1] = s[1];
+  if (bpp > 2)
+    d[2] = s[2];
+}
+
+// n elements of s to d in reverse order
+static void reverse_row(const uint8_t *s, uint8_t *d, int n, int bpp) {
+  int i = 0;
+#if defined(__SSE2__)
+  if (bpp <= 2) {
+    int per = 16 / bpp;
+    for (; i + per <= n; i += per) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(s + i * bpp));
+      v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+      v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+      v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+      if (bpp == 1)
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      _mm_storeu_si128((__m128i *)(d + (n - i - per) * bpp), v);
+    }
+  }
+#elif defined(__ARM_NEON)
+  if (bpp <= 2) {
+    int per = 16 / bpp;
+    for (; i + per <= n; i += per) {
+      uint8x16_t v = vld1q_u8(s + i * bpp);
+      v = bpp == 1 ? vrev64q_u8(v)
+                   : vreinterpretq_u8_u16(vrev64q_u16(vreinterpretq_u16_u8(v)));
+      vst1q_u8(d + (n - i - per) * bpp,
+               vcombine_u8(vget_high_u8(v), vget_low_u8(v)));
+    }
+  }
+#endif
+  for (; i < n; i++)
+    copy_element(d + (n - 1 - i) * bpp, s + i * bpp, bpp);
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+// the 8 x 8 elements of rows sp, columns to dp
+static void transpose8(const uint8_t *const *sp, uint8_t *const *dp, int bpp) {
+#if defined(__SSE2__)
+  if (bpp == 1) {
+    __m128i a[8];
+    for (int k = 0; k < 8; k++)
+      a[k] = _mm_loadl_epi64((const __m128i *)sp[k]);
+    __m128i b0 = _mm_unpacklo_epi8(a[0], a[1]);
+    __m128i b1 = _mm_unpacklo_epi8(a[2], a[3]);
+    __m128i b2 = _mm_unpacklo_epi8(a[4], a[5]);
+    __m128i b3 = _mm_unpacklo_epi8(a[6], a[7]);
+    __m128i c0 = _mm_unpacklo_epi16(b0, b1), c1 = _mm_unpackhi_epi16(b0, b1);
+    __m128i c2 = _mm_unpacklo_epi16(b2, b3), c3 = _mm_unpackhi_epi16(b2, b3);
+    __m128i d[4] = {_mm_unpacklo_epi32(c0, c2), _mm_unpackhi_epi32(c0, c2),
+                    _mm_unpacklo_epi32(c1, c3), _mm_unpackhi_epi32(c1, c3)};
+    for (int j = 0; j < 4; j++) {
+      _mm_storel_epi64((__m128i *)dp[j * 2], d[j]);
+      _mm_storel_epi64((__m128i *)dp[j * 2 + 1],
+                       _mm_unpackhi_epi64(d[j], d[j]));
+    }
+    return;
+  }
+  __m128i a[8], b[8];
+  for (int k = 0; k < 8; k++)
+    a[k] = _mm_loadu_si128((const __m128i *)sp[k]);
+  for (int k = 0; k < 4; k++) {
+    b[k * 2] = _mm_unpacklo_epi16(a[k * 2], a[k * 2 + 1]);
+    b[k * 2 + 1] = _mm_unpackhi_epi16(a[k * 2], a[k * 2 + 1]);
+  }
+  // columns 0 1, 2 3, 4 5, 6 7 of rows 0 to 3, then of rows 4 to 7
+  __m128i c[8] = {
+      _mm_unpacklo_epi32(b[0], b[2]), _mm_unpackhi_epi32(b[0], b[2]),
+      _mm_unpacklo_epi32(b[1], b[3]), _mm_unpackhi_epi32(b[1], b[3]),
+      _mm_unpacklo_epi32(b[4], b[6]), _mm_unpackhi_epi32(b[4], b[6]),
+      _mm_unpacklo_epi32(b[5], b[7]), _mm_unpackhi_epi32(b[5], b[7])};
+  for (int j = 0; j < 4; j++) {
+    _mm_storeu_si128((__m128i *)dp[j * 2], _mm_unpacklo_epi64(c[j], c[j + 4]));
+    _mm_storeu_si128((__m128i *)dp[j * 2 + 1],
+                     _mm_unpackhi_epi64(c[j], c[j + 4]));
+  }
+#else
+  if (bpp == 1) {
+    uint8x8x2_t t[4];
+    for (int k = 0; k < 4; k++)
+      t[k] = vtrn_u8(vld1_u8(sp[k * 2]), vld1_u8(sp[k * 2 + 1]));
+    // columns 0 4, 2 6 and 1 5, 3 7 of rows 0 to 3, then of rows 4 to 7
+    uint16x4x2_t u[4];
+    for (int k = 0; k < 2; k++) {
+      u[k * 2] = vtrn_u16(vreinterpret_u16_u8(t[k * 2].val[0]),
+                          vreinterpret_u16_u8(t[k * 2 + 1].val[0]));
+      u[k * 2 + 1] = vtrn_u16(vreinterpret_u16_u8(t[k * 2].val[1]),
+                              vreinterpret_u16_u8(t[k * 2 + 1].val[1]));
+    }
+    // column pairs 0 4, 1 5, 2 6, 3 7
+    uint32x2x2_t w[4];
+    w[0] = vtrn_u32(vreinterpret_u32_u16(u[0].val[0]),
+                    vreinterpret_u32_u16(u[2].val[0]));
+    w[1] = vtrn_u32(vreinterpret_u32_u16(u[1].val[0]),
+                    vreinterpret_u32_u16(u[3].val[0]));
+    w[2] = vtrn_u32(vreinterpret_u32_u16(u[0].val[1]),
+                    vreinterpret_u32_u16(u[2].val[1]));
+    w[3] = vtrn_u32(vreinterpret_u32_u16(u[1].val[1]),
+                    vreinterpret_u32_u16(u[3].val[1]));
+    for (int j = 0; j < 4; j++) {
+      vst1_u8(dp[j], vreinterpret_u8_u32(w[j].val[0]));
+      vst1_u8(dp[j + 4], vreinterpret_u8_u32(w[j].val[1]));
+    }
+    return;
+  }
+  uint16x8x2_t t[4];
+  for (int k = 0; k < 4; k++)
+    t[k] = vtrnq_u16(vld1q_u16((const uint16_t *)sp[k * 2]),
+                     vld1q_u16((const uint16_t *)sp[k * 2 + 1]));
+  // column pairs 0 4, 2 6 and 1 5, 3 7 of rows 0 to 3, then 4 to 7
+  uint32x4x2_t u[4];
+  for (int k = 0; k < 2; k++) {
+    u[k * 2] = vtrnq_u32(vreinterpretq_u32_u16(t[k * 2].val[0]),
+                         vreinterpretq_u32_u16(t[k * 2 + 1].val[0]));
+    u[k * 2 + 1] = vtrnq_u32(vreinterpretq_u32_u16(t[k * 2].val[1]),
+                             vreinterpretq_u32_u16(t[k * 2 + 1].val[1]));
+  }
+  // u[0] columns 0 4 and 2 6 of rows 0 to 3, u[1] 1 5 and 3 7, u[2], u[3]
+  // the same of rows 4 to 7
+  const uint32x4_t *cols[4] = {&u[0].val[0], &u[1].val[0], &u[0].val[1],
+                               &u[1].val[1]};
+  const uint32x4_t *cols2[4] = {&u[2].val[0], &u[3].val[0], &u[2].val[1],
+                                &u[3].val[1]};
+  for (int j = 0; j < 4; j++) {
+    vst1q_u32((uint32_t *)dp[j],
+              vcombine_u32(vget_low_u32(*cols[j]), vget_low_u32(*cols2[j])));
+    vst1q_u32((uint32_t *)dp[j + 4],
+              vcombine_u32(vget_high_u32(*cols[j]), vget_high_u32(*cols2[j])));
+  }
+#endif
+}
+#endif
+
+// rows [y0, y1) of d, s turned clockwise by 90, 180 or 270
+static void rotate_plane(const CpuPlane &s, const CpuPlane &d, int rotate,
+                         int y0, int y1) {
+  int bpp = s.step;
+  if (rotate == 180) {
+    for (int y = y0; y < y1; y++)
+      reverse_row(s.data + (s.h - 1 - y) * s.stride, d.data + y * d.stride,
+                  d.w, bpp);
+    return;
+  }
+  // d(x, y) is s(y, h - 1 - x) for 90, s(w - 1 - y, x) for 270
+  int y = y0;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+  if (bpp <= 2) {
+    const uint8_t *sp[8];
+    uint8_t *dp[8];
+    for (; y + 8 <= y1; y += 8) {
+      int x = 0;
+      for (; x + 8 <= d.w; x += 8) {
+        for (int k = 0; k < 8; k++) {
+          if (rotate == 90)
+            sp[k] = s.data + (s.h - 1 - x - k) * s.stride + y * bpp;
+          else
+            sp[k] = s.data + (x + k) * s.stride + (s.w - 8 - y) * bpp;
+          int j = rotate == 90 ? k : 7 - k;
+          dp[j] = d.data + (y + k) * d.stride + x * bpp;
+        }
+        transpose8(sp, dp, bpp);
+      }
+      for (int k = 0; k < 8; k++)
+        for (int xx = x; xx < d.w; xx++) {
+          int sx = rotate == 90 ? y + k : s.w - 1 - y - k;
+          int sy = rotate == 90 ? s.h - 1 - xx : xx;
+          copy_element(d.data + (y + k) * d.stride + xx * bpp,
+                       s.data + sy * s.stride + sx * bpp, bpp);
+        }
+    }
+  }
+#endif
+  for (; y < y1; y++) {
+    uint8_t *dp = d.data + y * d.stride;
+    for (int x = 0; x < d.w; x++) {
+      int sx = rotate == 90 ? y : s.w - 1 - y;
+      int sy = rotate == 90 ? s.h - 1 - x : x;
+      copy_element(dp + x * bpp, s.data + sy * s.stride + sx * bpp, bpp);
+    }
+  }
+}
+
+// every plane of s turned into d
+static void rotate_image(const CpuImage &s, const CpuImage &d, int rotate,
+                         int thread_num) {
+  int rows = d.p[0].h;
+  run_bands(rows, 2, thread_num, [&](int y0, int y1) {
+    for (int i = 0; i < d.plane_num; i++) {
+      int b0, b1;
+      band_rows(rows, d.p[i].h, y0, y1, b0, b1);
+      rotate_plane(s.p[i], d.p[i], rotate, b0, b1);
+    }
+  });
+}
+
+static bool rect_valid(const ImageRect &r, const ImageInfo &info) {
+  return r.x >= 0 && r.y >= 0 && r.w > 0 && r.h > 0 &&
+         r.x + r.w <= info.vir_width && r.y + r.h <= info.vir_height;
+}
+
+int cpu_image_blit(const ImageInfo &src_info, const uint8_t *src,
+                   const ImageRect *src_rect, const ImageInfo &dst_info,
+                   uint8_t *dst, const ImageRect *dst_rect, int rotate,
+                   CpuScaleMode mode, int thread_num) {
+  CpuFormat sf, df;
+  if (!get_format(src_info.pix_fmt, sf) || !get_format(dst_info.pix_fmt, df)) {
+    LOG("cpu image: %s to %s is not supported\n",
+        PixFmtToString(src_info.pix_fmt), PixFmtToString(dst_info.pix_fmt));
+    return -1;
+  }
+  if (rotate != 0 && rotate != 90 && rotate != 180 && rotate != 270) {
+    LOG("WARN: rotate is not valid! use default:0\n");
+    rotate = 0;
+  }
+  ImageRect sr = {0, 0, src_info.width, src_info.height};
+  ImageRect dr = {0, 0, dst_info.width, dst_info.height};
+  if (src_rect)
+    sr = *src_rect;
+  if (dst_rect)
+    dr = *dst_rect;
+  if (!rect_valid(sr, src_info) || !rect_valid(dr, dst_info)) {
+    LOG("cpu image: rect out of the image\n");
+    return -1;
+  }
+  if (thread_num < 1)
+    thread_num = 1;
+  bool turn = rotate == 90 || rotate == 270;
+  int pw = turn ? dr.h : dr.w, ph = turn ? dr.w : dr.h;
+  bool area = mode == CPU_SCALE_AREA ||
+              (mode == CPU_SCALE_AUTO && sr.w >= pw * 2 && sr.h >= ph * 2);
+  bool scale = sr.w != pw || sr.h != ph;
+
+  CpuImage s, d;
+  map_image(sf, (uint8_t *)src, src_info.vir_width, src_info.vir_height, sr,
+            s);
+  map_image(df, dst, dst_info.vir_width, dst_info.vir_height, dr, d);
+  // each pass to a packed image but the last, in the order
+  // yuv: scale, convert to rgb, rotate
+  // rgb: 565 to 24 bits if scaled, scale, rotate, convert
+  std::vector<uint8_t> mem[3];
+  if (is_yuv(sf) && is_yuv(df)) {
+    CpuImage t;
+    if (rotate)
+      alloc_unrotated(d, rotate, mem[0], t);
+    scale_yuv(s, rotate ? t : d, area, thread_num);
+    if (rotate)
+      rotate_image(t, d, rotate, thread_num);
+    return 0;
+  }
+  if (is_yuv(sf)) {
+    CpuImage cur = s, t;
+    if (scale) {
+      CpuFormat planar = {CPU_YUV_PLANAR, sf.ys, false};
+      alloc_image(planar, pw, ph, (pw + 1) / 2,
+                  (ph + (1 << sf.ys) - 1) >> sf.ys, mem[0], t);
+      scale_yuv(s, t, area, thread_num);
+      cur = t;
+    }
+    CpuImage o = d;
+    if (rotate)
+      alloc_image(df, pw, ph, 0, 0, mem[1], o);
+    run_bands(ph, 1, thread_num, [&](int y0, int y1) {
+      convert_yuv_to_rgb(cur, o, y0, y1);
+    });
+    if (rotate)
+      rotate_image(o, d, rotate, thread_num);
+    return 0;
+  }
+  CpuImage cur = s, t;
+  if (scale) {
+    if (sf.kind == CPU_RGB16) {
+      CpuFormat rgb24 = {CPU_RGB24, 0, true};
+      alloc_image(rgb24, sr.w, sr.h, 0, 0, mem[0], t);
+      run_bands(sr.h, 1, thread_num, [&](int y0, int y1) {
+        convert_rgb_to_rgb(s, t, y0, y1);
+      });
+      cur = t;
+    }
+    CpuImage o;
+    if (!rotate && same_format(cur.f, df))
+      o = d;
+    else
+      alloc_image(cur.f, pw, ph, 0, 0, mem[1], o);
+    run_bands(ph, 1, thread_num, [&](int y0, int y1) {
+      scale_plane(cur.p[0], o.p[0], 3, area, y0, y1);
+    });
+    if (o.p[0].data == d.p[0].data)
+      return 0;
+    cur = o;
+  }
+  if (rotate) {
+    CpuImage o;
+    if (!is_yuv(df) && same_format(cur.f, df))
+      o = d;
+    else
+      alloc_image(cur.f, dr.w, dr.h, 0, 0, mem[2], o);
+    rotate_image(cur, o, rotate, thread_num);
+    if (o.p[0].data == d.p[0].data)
+      return 0;
+    cur = o;
+  }
+  int align = is_yuv(df) ? 2 : 1;
+  run_bands(dr.h, align, thread_num, [&](int y0, int y1) {
+    if (is_yuv(df))
+      convert_rgb_to_yuv(cur, d, y0, y1);
+    else
+      convert_rgb_to_rgb(cur, d, y0, y1);
+  });
+  return 0;
+}
+
+bool cpu_image_support(PixelFormat fmt) {
+  CpuFormat f;
+  return get_format(fmt, f);
+}
+
+int cpu_image_blit(std::shared_ptr<ImageBuffer> src,
+                   std::shared_ptr<ImageBuffer> dst, ImageRect *src_rect,
+                   ImageRect *dst_rect, int rotate, CpuScaleMode mode,
+                   int thread_num) {
+  if (!src || !src->IsValid())
+    return -EINVAL;
+  if (!dst || !dst->IsValid())
+    return -EINVAL;
+  src->BeginCPUAccess(true);
+  dst->BeginCPUAccess(false);
+  int ret = cpu_image_blit(src->GetImageInfo(), (uint8_t *)src->GetPtr(),
+                           src_rect, dst->GetImageInfo(),
+                           (uint8_t *)dst->GetPtr(), dst_rect, rotate, mode,
+                           thread_num);
+  dst->EndCPUAccess(false);
+  src->EndCPUAccess(true);
+  if (ret) {
+    dst->SetValidSize(0);
+    return -EINVAL;
+  }
+  dst->SetValidSize(CalPixFmtSize(dst->GetPixelFormat(), dst->GetVirWidth(),
+                                  dst->GetVirHeight()));
+  if (src->GetUSTimeStamp() > dst->GetUSTimeStamp())
+    dst->SetUSTimeStamp(src->GetUSTimeStamp());
+  dst->SetAtomicClock(src->GetAtomicClock());
+  return 0;
+}
+
+} // namespace easymedia
@@ -0,0 +1,53 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_CPU_IMAGE_H_
+#define EASYMEDIA_CPU_IMAGE_H_
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "image.h"
+
+// rows of a pass a thread takes at least
+#define CPU_IMAGE_MIN_ROWS_PER_THREAD 64
+
+namespace easymedia {
+
+enum CpuScaleMode {
+  CPU_SCALE_AUTO,     // area when shrunk to half or less, else bilinear
+  CPU_SCALE_BILINEAR, // pixel centers, 8 bit weights, rows then columns
+  CPU_SCALE_AREA,     // rounded mean of the source box of each pixel
+};
+
+// What rga_blit does on the cpu: src_rect of src converted, scaled and
+// rotated clockwise by 0, 90, 180 or 270 into dst_rect of dst. A null rect
+// is the whole image. For 90 and 270 src_rect is scaled to the transposed
+// dst_rect, then rotated. Yuv is bt.601 limited range, the chroma of a
+// pixel pair (and row pair for 4:2:0) averaged from rgb. Formats: NV12,
+// NV21, NV16, NV61, YUV420P, YUV422P, RGB888, BGR888, RGB565, BGR565, in
+// the byte order of rga and ffmpeg (RGB888 is b, g, r in memory). Each
+// pass can be split in bands of rows over threads.
+// Return -1 if a format or rect is not supported.
+int cpu_image_blit(const ImageInfo &src_info, const uint8_t *src,
+                   const ImageRect *src_rect, const ImageInfo &dst_info,
+                   uint8_t *dst, const ImageRect *dst_rect, int rotate = 0,
+                   CpuScaleMode mode = CPU_SCALE_AUTO, int thread_num = 1);
+
+class ImageBuffer;
+
+// As rga_blit: around the cpu access of both, with the valid size,
+// timestamp and clock of dst set on success.
+int cpu_image_blit(std::shared_ptr<ImageBuffer> src,
+                   std::shared_ptr<ImageBuffer> dst,
+                   ImageRect *src_rect = nullptr,
+                   ImageRect *dst_rect = nullptr, int rotate = 0,
+                   CpuScaleMode mode = CPU_SCALE_AUTO, int thread_num = 1);
+
+bool cpu_image_support(PixelFormat fmt);
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_CPU_IMAGE_H_
@@ -0,0 +1,130 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "buffer.h"
+#include "cpu_image.h"
+#include "filter.h"
+
+namespace easymedia {
+
+// The params and rects of rkrga, done by cpu_image_blit(), for boards and
+// hosts without rga or with its queue full.
+class CpuImageFilter : public Filter {
+public:
+  CpuImageFilter(const char *param);
+  virtual ~CpuImageFilter() = default;
+  static const char *GetFilterName() { return "cpu_image"; }
+  virtual int Process(std::shared_ptr<MediaBuffer> input,
+                      std::shared_ptr<MediaBuffer> &output) override;
+
+  void SetRects(std::vector<ImageRect> vec_rect);
+
+private:
+  std::vector<ImageRect> vec_rect;
+  int rotate;
+  CpuScaleMode scale_mode;
+  int thread_num;
+};
+
+CpuImageFilter::CpuImageFilter(const char *param)
+    : rotate(0), scale_mode(CPU_SCALE_AUTO), thread_num(1) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  const std::string &value = params[KEY_BUFFER_RECT];
+  auto &&rects = StringToTwoImageRect(value);
+  if (rects.empty()) {
+    LOG("missing rects\n");
+    SetError(-EINVAL);
+    return;
+  }
+  vec_rect = std::move(rects);
+  const std::string &v = params[KEY_BUFFER_ROTATE];
+  if (!v.empty())
+    rotate = std::stoi(v);
+  const std::string &mode = params[KEY_BUFFER_SCALE_MODE];
+  if (mode == KEY_SCALE_BILINEAR)
+    scale_mode = CPU_SCALE_BILINEAR;
+  else if (mode == KEY_SCALE_AREA)
+    scale_mode = CPU_SCALE_AREA;
+  const std::string &threads = params[KEY_IMAGE_THREADS];
+  if (!threads.empty())
+    thread_num = std::max(std::stoi(threads), 1);
+}
+
+void CpuImageFilter::SetRects(std::vector<ImageRect> rects) {
+  vec_rect = std::move(rects);
+}
+
+int CpuImageFilter::Process(std::shared_ptr<MediaBuffer> input,
+                            std::shared_ptr<MediaBuffer> &output) {
+  if (vec_rect.size() < 2)
+    return -EINVAL;
+  if (!input || input->GetType() != Type::Image)
+    return -EINVAL;
+  if (!output || output->GetType() != Type::Image)
+    return -EINVAL;
+
+  auto src = std::static_pointer_cast<easymedia::ImageBuffer>(input);
+  ImageRect *src_rect = nullptr;
+  if (vec_rect[0].w > 0 && vec_rect[0].h > 0)
+    src_rect = &vec_rect[0];
+  auto dst = std::static_pointer_cast<easymedia::ImageBuffer>(output);
+  ImageRect *dst_rect = nullptr;
+  if (vec_rect[1].w > 0 && vec_rect[1].h > 0)
+    dst_rect = &vec_rect[1];
+  assert(!dst_rect || (dst_rect && dst->IsValid()));
+  if (!dst_rect && !dst->IsValid()) {
+    // the same to src
+    ImageInfo info = src->GetImageInfo();
+    info.pix_fmt = dst->GetPixelFormat();
+    size_t size = CalPixFmtSize(info.pix_fmt, info.vir_width,
+                                info.vir_height, 16);
+    if (size == 0)
+      return -EINVAL;
+    auto &&mb = MediaBuffer::Alloc2(size);
+    ImageBuffer ib(mb, info);
+    if (ib.GetSize() >= size) {
+      ib.SetValidSize(size);
+      *dst.get() = ib;
+    }
+    assert(dst->IsValid());
+  }
+  return cpu_image_blit(src, dst, src_rect, dst_rect, rotate, scale_mode,
+                        thread_num);
+}
+
+class _CPU_IMAGE_SUPPORT_FMTS : public SupportMediaTypes {
+public:
+  _CPU_IMAGE_SUPPORT_FMTS() {
+    types.append(TYPENEAR(IMAGE_YUV420P));
+    types.append(TYPENEAR(IMAGE_NV12));
+    types.append(TYPENEAR(IMAGE_NV21));
+    types.append(TYPENEAR(IMAGE_YUV422P));
+    types.append(TYPENEAR(IMAGE_NV16));
+    types.append(TYPENEAR(IMAGE_NV61));
+    types.append(TYPENEAR(IMAGE_RGB565));
+    types.append(TYPENEAR(IMAGE_BGR565));
+    types.append(TYPENEAR(IMAGE_RGB888));
+    types.append(TYPENEAR(IMAGE_BGR888));
+  }
+};
+static _CPU_IMAGE_SUPPORT_FMTS priv_fmts;
+
+DEFINE_COMMON_FILTER_FACTORY(CpuImageFilter)
+const char *FACTORY(CpuImageFilter)::ExpectedInputDataType() {
+  return priv_fmts.types.c_str();
+}
+const char *FACTORY(CpuImageFilter)::OutPutDataType() {
+  return priv_fmts.types.c_str();
+}
+
+} // namespace easymedia
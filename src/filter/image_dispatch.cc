@@ -0,0 +1,158 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "image_dispatch.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "cpu_image.h"
+#include "utils.h"
+
+#ifdef HAVE_RKRGA
+#include "rga_filter.h"
+#endif
+
+namespace easymedia {
+
+bool CpuImageBackend::Support(PixelFormat src, PixelFormat dst) {
+  return cpu_image_support(src) && cpu_image_support(dst);
+}
+
+int CpuImageBackend::Blit(std::shared_ptr<ImageBuffer> src,
+                          std::shared_ptr<ImageBuffer> dst,
+                          ImageRect *src_rect, ImageRect *dst_rect,
+                          int rotate) {
+  return cpu_image_blit(src, dst, src_rect, dst_rect, rotate);
+}
+
+#ifdef HAVE_RKRGA
+// the rga takes one blit at a time
+class RgaBackend : public ImageBackend {
+public:
+  RgaBackend() : ImageBackend("rga", 1) {}
+  virtual bool Support(PixelFormat src, PixelFormat dst) override {
+    return support(src) && support(dst);
+  }
+  virtual int Blit(std::shared_ptr<ImageBuffer> src,
+                   std::shared_ptr<ImageBuffer> dst, ImageRect *src_rect,
+                   ImageRect *dst_rect, int rotate) override {
+    return rga_blit(src, dst, src_rect, dst_rect, rotate);
+  }
+
+private:
+  static bool support(PixelFormat f) {
+    // the formats of get_rga_format
+    switch (f) {
+    case PIX_FMT_YUV420P:
+    case PIX_FMT_NV12:
+    case PIX_FMT_NV21:
+    case PIX_FMT_YUV422P:
+    case PIX_FMT_NV16:
+    case PIX_FMT_NV61:
+    case PIX_FMT_RGB565:
+    case PIX_FMT_RGB888:
+    case PIX_FMT_BGR888:
+    case PIX_FMT_ARGB8888:
+    case PIX_FMT_ABGR8888:
+      return true;
+    default:
+      return false;
+    }
+  }
+};
+#endif
+
+ImageDispatcher::ImageDispatcher(std::shared_ptr<ImageBackend> hw_backend,
+                                 std::shared_ptr<ImageBackend> cpu_backend) {
+  backends[0] = {hw_backend, 0, 0, 0, 0};
+  backends[1] = {cpu_backend, 0, 0, 0, 0};
+}
+
+ImageDispatcher &ImageDispatcher::GetInstance() {
+  int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+#ifdef HAVE_RKRGA
+  static ImageDispatcher dispatcher(std::make_shared<RgaBackend>(),
+                                    std::make_shared<CpuImageBackend>(cores));
+#else
+  static ImageDispatcher dispatcher(nullptr,
+                                    std::make_shared<CpuImageBackend>(cores));
+#endif
+  return dispatcher;
+}
+
+ImageDispatcher::Queue *ImageDispatcher::Pick(PixelFormat src,
+                                              PixelFormat dst, int64_t pixels,
+                                              ImageDispatchPolicy policy) {
+  Queue *best = nullptr;
+  double best_us = 0;
+  for (int i = 0; i < 2; i++) {
+    Queue &q = backends[i];
+    if (!q.backend || !q.backend->Support(src, dst))
+      continue;
+    if ((policy == IMAGE_DISPATCH_HW && i != 0) ||
+        (policy == IMAGE_DISPATCH_CPU && i != 1))
+      continue;
+    // not measured yet: taken when idle, else left to the other
+    double us = q.count ? (q.pixels + pixels) * q.us_per_px /
+                              q.backend->GetSlots()
+                        : (q.pixels ? 1e18 : 0);
+    if (!best || us < best_us) {
+      best = &q;
+      best_us = us;
+    }
+  }
+  return best;
+}
+
+int ImageDispatcher::Blit(std::shared_ptr<ImageBuffer> src,
+                          std::shared_ptr<ImageBuffer> dst,
+                          ImageRect *src_rect, ImageRect *dst_rect,
+                          int rotate, ImageDispatchPolicy policy) {
+  if (!src || !src->IsValid() || !dst || !dst->IsValid())
+    return -EINVAL;
+  // the pixels read and written
+  int64_t pixels =
+      (src_rect ? src_rect->w * src_rect->h
+                : src->GetWidth() * src->GetHeight()) +
+      (dst_rect ? dst_rect->w * dst_rect->h
+                : dst->GetWidth() * dst->GetHeight());
+  Queue *q;
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    q = Pick(src->GetPixelFormat(), dst->GetPixelFormat(), pixels, policy);
+    if (!q) {
+      LOG("image dispatch: no backend for %s -> %s\n",
+          PixFmtToString(src->GetPixelFormat()),
+          PixFmtToString(dst->GetPixelFormat()));
+      return -EINVAL;
+    }
+    q->pixels += pixels;
+    cond.wait(lock, [q] { return q->running < q->backend->GetSlots(); });
+    q->running++;
+  }
+  AutoDuration ad;
+  int ret = q->backend->Blit(src, dst, src_rect, dst_rect, rotate);
+  double us_per_px = (double)ad.Get() / pixels;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    q->running--;
+    q->pixels -= pixels;
+    if (!ret) {
+      q->us_per_px =
+          q->count ? (q->us_per_px * 7 + us_per_px) / 8 : us_per_px;
+      q->count++;
+    }
+  }
+  cond.notify_all();
+  return ret;
+}
+
+void ImageDispatcher::GetCount(int64_t &hw_count, int64_t &cpu_count) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  hw_count = backends[0].count;
+  cpu_count = backends[1].count;
+}
+
+} // namespace easymedia
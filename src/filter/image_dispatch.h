@@ -0,0 +1,91 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_IMAGE_DISPATCH_H_
+#define EASYMEDIA_IMAGE_DISPATCH_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include "buffer.h"
+#include "image.h"
+
+namespace easymedia {
+
+// A way to do a blit, such as rga or cpu_image_blit. slots is how many
+// blits it takes at once; the others wait in its queue.
+class ImageBackend {
+public:
+  ImageBackend(const char *backend_name, int slot_num)
+      : name(backend_name), slots(slot_num) {}
+  virtual ~ImageBackend() = default;
+  const char *GetName() const { return name; }
+  int GetSlots() const { return slots; }
+  virtual bool Support(PixelFormat src, PixelFormat dst) = 0;
+  // as rga_blit, dst valid and its valid size set on success
+  virtual int Blit(std::shared_ptr<ImageBuffer> src,
+                   std::shared_ptr<ImageBuffer> dst, ImageRect *src_rect,
+                   ImageRect *dst_rect, int rotate) = 0;
+
+private:
+  const char *name;
+  int slots;
+};
+
+// cpu_image_blit, one thread a blit
+class CpuImageBackend : public ImageBackend {
+public:
+  CpuImageBackend(int slot_num) : ImageBackend("cpu", slot_num) {}
+  virtual bool Support(PixelFormat src, PixelFormat dst) override;
+  virtual int Blit(std::shared_ptr<ImageBuffer> src,
+                   std::shared_ptr<ImageBuffer> dst, ImageRect *src_rect,
+                   ImageRect *dst_rect, int rotate) override;
+};
+
+enum ImageDispatchPolicy {
+  IMAGE_DISPATCH_HW,       // the hardware only
+  IMAGE_DISPATCH_CPU,      // the cpu only
+  IMAGE_DISPATCH_BALANCED, // the sooner to finish
+};
+
+// Routes each blit to the hardware or to the cpu. The balanced policy
+// estimates when each backend would finish the blit: the pixels queued
+// and running on it plus those of the blit, at its measured microseconds
+// a pixel, over its slots. A backend not measured yet is taken first.
+class ImageDispatcher {
+public:
+  ImageDispatcher(std::shared_ptr<ImageBackend> hw_backend,
+                  std::shared_ptr<ImageBackend> cpu_backend);
+  // rga when compiled in, and the cpu with a slot a core
+  static ImageDispatcher &GetInstance();
+
+  bool HasHardware() const { return backends[0].backend != nullptr; }
+  int Blit(std::shared_ptr<ImageBuffer> src, std::shared_ptr<ImageBuffer> dst,
+           ImageRect *src_rect, ImageRect *dst_rect, int rotate,
+           ImageDispatchPolicy policy);
+  // blits done by the hardware and by the cpu
+  void GetCount(int64_t &hw_count, int64_t &cpu_count);
+
+private:
+  struct Queue {
+    std::shared_ptr<ImageBackend> backend;
+    int running;
+    int64_t pixels;   // queued and running
+    double us_per_px; // moving average, 0 until the first blit
+    int64_t count;
+  };
+  Queue *Pick(PixelFormat src, PixelFormat dst, int64_t pixels,
+              ImageDispatchPolicy policy);
+
+  std::mutex mtx;
+  std::condition_variable cond;
+  Queue backends[2];
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_IMAGE_DISPATCH_H_
@@ -0,0 +1,142 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+
+#include <vector>
+
+#include "buffer.h"
+#include "filter.h"
+#include "image_dispatch.h"
+
+namespace easymedia {
+
+// The params and rects of rkrga, each blit done by the rga or by the cpu
+// as ImageDispatcher picks, shared by all the filters of the process.
+class ImageDispatchFilter : public Filter {
+public:
+  ImageDispatchFilter(const char *param);
+  virtual ~ImageDispatchFilter() = default;
+  static const char *GetFilterName() { return "image_dispatch"; }
+  virtual int Process(std::shared_ptr<MediaBuffer> input,
+                      std::shared_ptr<MediaBuffer> &output) override;
+
+  void SetRects(std::vector<ImageRect> vec_rect);
+
+private:
+  std::vector<ImageRect> vec_rect;
+  int rotate;
+  ImageDispatchPolicy policy;
+};
+
+ImageDispatchFilter::ImageDispatchFilter(const char *param)
+    : rotate(0), policy(IMAGE_DISPATCH_BALANCED) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  const std::string &value = params[KEY_BUFFER_RECT];
+  auto &&rects = StringToTwoImageRect(value);
+  if (rects.empty()) {
+    LOG("missing rects\n");
+    SetError(-EINVAL);
+    return;
+  }
+  vec_rect = std::move(rects);
+  const std::string &v = params[KEY_BUFFER_ROTATE];
+  if (!v.empty())
+    rotate = std::stoi(v);
+  const std::string &p = params[KEY_DISPATCH_POLICY];
+  if (p == KEY_DISPATCH_HW)
+    policy = IMAGE_DISPATCH_HW;
+  else if (p == KEY_DISPATCH_CPU)
+    policy = IMAGE_DISPATCH_CPU;
+  else if (!p.empty() && p != KEY_DISPATCH_BALANCED) {
+    LOG("unknown dispatch policy %s\n", p.c_str());
+    SetError(-EINVAL);
+    return;
+  }
+  if (policy == IMAGE_DISPATCH_HW &&
+      !ImageDispatcher::GetInstance().HasHardware()) {
+    LOG("image dispatch: rga is not compiled in\n");
+    SetError(-EINVAL);
+  }
+}
+
+void ImageDispatchFilter::SetRects(std::vector<ImageRect> rects) {
+  vec_rect = std::move(rects);
+}
+
+int ImageDispatchFilter::Process(std::shared_ptr<MediaBuffer> input,
+                                 std::shared_ptr<MediaBuffer> &output) {
+  if (vec_rect.size() < 2)
+    return -EINVAL;
+  if (!input || input->GetType() != Type::Image)
+    return -EINVAL;
+  if (!output || output->GetType() != Type::Image)
+    return -EINVAL;
+
+  auto src = std::static_pointer_cast<easymedia::ImageBuffer>(input);
+  ImageRect *src_rect = nullptr;
+  if (vec_rect[0].w > 0 && vec_rect[0].h > 0)
+    src_rect = &vec_rect[0];
+  auto dst = std::static_pointer_cast<easymedia::ImageBuffer>(output);
+  ImageRect *dst_rect = nullptr;
+  if (vec_rect[1].w > 0 && vec_rect[1].h > 0)
+    dst_rect = &vec_rect[1];
+  auto &dispatcher = ImageDispatcher::GetInstance();
+  assert(!dst_rect || (dst_rect && dst->IsValid()));
+  if (!dst_rect && !dst->IsValid()) {
+    // the same to src, in memory the rga can reach
+    ImageInfo info = src->GetImageInfo();
+    info.pix_fmt = dst->GetPixelFormat();
+    size_t size = CalPixFmtSize(info.pix_fmt, info.vir_width,
+                                info.vir_height, 16);
+    if (size == 0)
+      return -EINVAL;
+    auto &&mb = MediaBuffer::Alloc2(
+        size, dispatcher.HasHardware() ? MediaBuffer::MemType::MEM_HARD_WARE
+                                       : MediaBuffer::MemType::MEM_COMMON);
+    ImageBuffer ib(mb, info);
+    if (ib.GetSize() >= size) {
+      ib.SetValidSize(size);
+      *dst.get() = ib;
+    }
+    assert(dst->IsValid());
+  }
+  return dispatcher.Blit(src, dst, src_rect, dst_rect, rotate, policy);
+}
+
+class _IMAGE_DISPATCH_SUPPORT_FMTS : public SupportMediaTypes {
+public:
+  _IMAGE_DISPATCH_SUPPORT_FMTS() {
+    types.append(TYPENEAR(IMAGE_YUV420P));
+    types.append(TYPENEAR(IMAGE_NV12));
+    types.append(TYPENEAR(IMAGE_NV21));
+    types.append(TYPENEAR(IMAGE_YUV422P));
+    types.append(TYPENEAR(IMAGE_NV16));
+    types.append(TYPENEAR(IMAGE_NV61));
+    types.append(TYPENEAR(IMAGE_RGB565));
+    types.append(TYPENEAR(IMAGE_BGR565));
+    types.append(TYPENEAR(IMAGE_RGB888));
+    types.append(TYPENEAR(IMAGE_BGR888));
+#ifdef HAVE_RKRGA
+    // rga only, cpu_image has no 32 bits rgb
+    types.append(TYPENEAR(IMAGE_ARGB8888));
+    types.append(TYPENEAR(IMAGE_ABGR8888));
+#endif
+  }
+};
+static _IMAGE_DISPATCH_SUPPORT_FMTS priv_fmts;
+
+DEFINE_COMMON_FILTER_FACTORY(ImageDispatchFilter)
+const char *FACTORY(ImageDispatchFilter)::ExpectedInputDataType() {
+  return priv_fmts.types.c_str();
+}
+const char *FACTORY(ImageDispatchFilter)::OutPutDataType() {
+  return priv_fmts.types.c_str();
+}
+
+} // namespace easymedia
@@ -6,7 +6,13 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <stdio.h>
 #include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
 
 #include "buffer.h"
 #include "key_string.h"
@@ -14,6 +20,92 @@
 
 namespace easymedia {
 
+static int64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+class FlowCoroutine;
+
+// Shared executor of POOLED coroutines, one worker per core.
+// Every worker owns a task deque, and steals from the others when idle.
+// A coroutine is in at most one deque at a time, see FlowCoroutine::Schedule.
+class FlowExecutor {
+public:
+  static FlowExecutor &GetInstance();
+  void Submit(FlowCoroutine *c);
+  // take the queued task of c out, return false if it is not queued
+  bool Cancel(FlowCoroutine *c);
+  // the coroutine run by the calling worker, or null
+  static FlowCoroutine *Running() { return running; }
+  int GetWorkerNum() { return (int)workers.size(); }
+  static bool IsWorkerThread() { return worker_index >= 0; }
+
+private:
+  struct Worker {
+    std::mutex mtx;
+    std::deque<FlowCoroutine *> tasks;
+  };
+  FlowExecutor();
+  ~FlowExecutor();
+  FlowCoroutine *Take(int index);
+  void WorkerRun(int index);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  FutexEvent idle_event;
+  std::atomic_bool quit;
+  std::atomic_uint next;
+  static thread_local int worker_index;
+  static thread_local FlowCoroutine *running;
+};
+
+// Periodic scheduler of ASYNCATOMIC coroutines on timerfd, CLOCK_MONOTONIC.
+// Deadlines are absolute, start + k * period, so that the error of one
+// period never accumulates. The timerfd is armed to the nearest deadline
+// of all registered coroutines, which run one by one in the timer thread.
+// The timer thread holds the timer only while running the coroutines, so
+// when a coroutine drops the last reference, the timer is destroyed in the
+// timer thread after them, and the thread leaves at once.
+class FlowTimer {
+public:
+  // coroutines of the same non empty group share one timer
+  static std::shared_ptr<FlowTimer> GetTimer(const std::string &group,
+                                             const std::string &name);
+  FlowTimer(const std::string &name);
+  ~FlowTimer();
+  bool Register(FlowCoroutine *c, float interval_ms, DeadlinePolicy policy);
+  // wait until c is not running
+  void Unregister(FlowCoroutine *c);
+  bool GetStats(FlowCoroutine *c, FlowTimerStats &stats);
+
+private:
+  struct Entry {
+    FlowCoroutine *coroutine;
+    DeadlinePolicy policy;
+    int64_t period;   // ns
+    int64_t start;    // ns
+    int64_t index;    // deadline = start + index * period
+    int64_t deadline; // ns
+    FlowTimerStats stats;
+    int64_t jitter_sum;
+  };
+  void Start(std::weak_ptr<FlowTimer> weak);
+  void Run(std::weak_ptr<FlowTimer> weak);
+  void Arm(int64_t deadline);
+  void Advance(Entry &e, int64_t now);
+  Entry *Find(FlowCoroutine *c);
+
+  std::string thread_name;
+  int fd;
+  volatile bool quit;
+  std::list<Entry> entries;
+  ConditionLockMutex mtx;
+  FlowCoroutine *running;
+  std::thread *th;
+};
+
 class FlowCoroutine {
 public:
   FlowCoroutine(Flow *f, Model sync_model, FunctionProcess func, float inter);
@@ -23,20 +115,35 @@ public:
   bool Start();
   void RunOnce();
   int GetCachedBufferCnt();
+  // POOLED, called by producer after input pushed
+  void Schedule();
+  // POOLED, called by executor worker
+  void RunTask();
+
+  void SetDeadline(DeadlinePolicy policy, const std::string &group) {
+    deadline_policy = policy;
+    timer_group = group;
+  }
+  bool GetTimerStats(FlowTimerStats &stats) {
+    return timer && timer->GetStats(this, stats);
+  }
 
 private:
   void WhileRun();
-  void WhileRunSleep();
   void SyncFetchInput(MediaBufferVector &in);
   void ASyncFetchInputCommon(MediaBufferVector &in);
   void ASyncFetchInputAtomic(MediaBufferVector &in);
+  void ASyncFetchInputLockFree(MediaBufferVector &in);
+  void PooledFetchInput(MediaBufferVector &in);
+  bool HasPooledInput();
 
   void SendNullBufferDown(Flow::FlowMap &fm, const MediaBufferVector &in,
-                          std::list<Flow::FlowInputMap> &flows);
+                          const std::vector<Flow::FlowInputMap> &flows);
   void SendBufferDown(Flow::FlowMap &fm, const MediaBufferVector &in,
-                      std::list<Flow::FlowInputMap> &flows, bool process_ret);
+                      const std::vector<Flow::FlowInputMap> &flows,
+                      bool process_ret);
   void SendBufferDownFromDeque(Flow::FlowMap &fm, const MediaBufferVector &in,
-                               std::list<Flow::FlowInputMap> &flows,
+                               const std::vector<Flow::FlowInputMap> &flows,
                                bool process_ret);
   size_t OutputHoldRelated(Flow::FlowMap &fm,
                            std::shared_ptr<MediaBuffer> &out_buffer,
@@ -53,6 +160,18 @@ private:
   MediaBufferVector in_vector;
   decltype(&FlowCoroutine::SyncFetchInput) fetch_input_func;
   decltype(&FlowCoroutine::SendBufferDown) send_down_func;
+  // POOLED, schedule requests not yet consumed by RunTask.
+  // The coroutine is queued or running while it is not 0.
+  std::atomic_int pending;
+  // POOLED, the destructor waits here for pending to drop to 0
+  std::mutex idle_mtx;
+  std::condition_variable idle_cond;
+  // ASYNCATOMIC
+  DeadlinePolicy deadline_policy;
+  std::string timer_group;
+  std::shared_ptr<FlowTimer> timer;
+
+  friend class FlowTimer;
 
 public:
   void SetMarkName(std::string s) { name = s; }
@@ -65,15 +184,38 @@ public:
 FlowCoroutine::FlowCoroutine(Flow *f, Model sync_model, FunctionProcess func,
                              float inter)
     : flow(f), model(sync_model), interval(inter), th(nullptr), th_run(func),
+      pending(0), deadline_policy(DeadlinePolicy::SKIP),
       expect_process_time(0)
 
 {}
 
 FlowCoroutine::~FlowCoroutine() {
+  if (timer) {
+    timer->Unregister(this);
+    timer.reset();
+  }
   if (th) {
     th->join();
     delete th;
   }
+  // flow->quit is set, queued task returns at once
+  if (FlowExecutor::Running() == this) {
+    LOG("%s destroyed in its own task\n", name.c_str());
+  } else if (FlowExecutor::IsWorkerThread()) {
+    // the queued task may sit behind this worker and never run, take it out
+    // and drop the requests it owns. A task run by another worker ends soon.
+    auto &executor = FlowExecutor::GetInstance();
+    std::unique_lock<std::mutex> lock(idle_mtx);
+    while (pending.load() > 0) {
+      if (executor.Cancel(this))
+        pending = 0;
+      else
+        idle_cond.wait_for(lock, std::chrono::milliseconds(1));
+    }
+  } else {
+    std::unique_lock<std::mutex> lock(idle_mtx);
+    idle_cond.wait(lock, [this] { return pending.load() == 0; });
+  }
   LOG("%s quit\n", name.c_str());
 }
 
@@ -86,18 +228,27 @@ void FlowCoroutine::Bind(std::vector<int> &in, std::vector<int> &out) {
 
 bool FlowCoroutine::Start() {
   bool need_thread = false;
-  auto func = &FlowCoroutine::WhileRun;
   switch (model) {
   case Model::ASYNCCOMMON:
     need_thread = true;
     fetch_input_func = &FlowCoroutine::ASyncFetchInputCommon;
+    if (!in_slots.empty() && flow->v_input[in_slots[0]].ring)
+      fetch_input_func = &FlowCoroutine::ASyncFetchInputLockFree;
     send_down_func = &FlowCoroutine::SendBufferDownFromDeque;
     break;
   case Model::ASYNCATOMIC:
-    need_thread = true;
+    assert(interval > 0);
     fetch_input_func = &FlowCoroutine::ASyncFetchInputAtomic;
     send_down_func = &FlowCoroutine::SendBufferDown;
-    func = &FlowCoroutine::WhileRunSleep;
+    timer = FlowTimer::GetTimer(timer_group, name);
+    if (!timer)
+      return false;
+    break;
+  case Model::POOLED:
+    fetch_input_func = &FlowCoroutine::PooledFetchInput;
+    send_down_func = &FlowCoroutine::SendBufferDownFromDeque;
+    // create the workers before the first input
+    FlowExecutor::GetInstance();
     break;
   case Model::SYNC:
     fetch_input_func = &FlowCoroutine::SyncFetchInput;
@@ -108,8 +259,12 @@ bool FlowCoroutine::Start() {
     return false;
   }
   in_vector.resize(in_slots.size());
+  if (timer && !timer->Register(this, interval, deadline_policy)) {
+    timer.reset();
+    return false;
+  }
   if (need_thread) {
-    th = new std::thread(func, this);
+    th = new std::thread(&FlowCoroutine::WhileRun, this);
     if (!th) {
       errno = ENOMEM;
       return false;
@@ -130,27 +285,40 @@ void FlowCoroutine::RunOnce() {
   bool ret = true;
   (this->*fetch_input_func)(in_vector);
 
+  int64_t fetched = monotonic_ns() / 1000;
+  for (size_t i = 0; i < in_vector.size(); i++) {
+    auto &buffer = in_vector[i];
+    // ASYNCATOMIC measures in the fetch, only new buffers
+    if (!buffer || buffer->GetEnqueueClock() <= 0 ||
+        model == Model::ASYNCATOMIC)
+      continue;
+    int64_t latency = fetched - buffer->GetEnqueueClock();
+    if (latency >= 0)
+      flow->v_input[in_slots[i]].latency.Add(latency);
+  }
+  int64_t start = gettimeofday();
   if (flow->GetRunTimesRemaining()) {
+    ret = (*th_run)(flow, in_vector);
+    int64_t cost = gettimeofday() - start;
+    flow->process_time.Add(cost);
+    if (flow->trace_enable)
+      flow->RecordSpan(start, cost,
+                       in_slots.empty()
+                           ? 0
+                           : flow->v_input[in_slots[0]].GetCachedNum());
 #ifndef NDEBUG
-    {
-      AutoDuration ad;
-#endif
-      ret = (*th_run)(flow, in_vector);
-#ifndef NDEBUG
-      if (expect_process_time > 0)
-        check_consume_time(name.c_str(), expect_process_time,
-                          (int)(ad.Get() / 1000));
-    }
+    if (expect_process_time > 0)
+      check_consume_time(name.c_str(), expect_process_time,
+                         (int)(cost / 1000));
 #endif // DEBUG
   }
 
   for (int idx : out_slots) {
     auto &fm = flow->downflowmap[idx];
-    std::list<Flow::FlowInputMap> flows;
-    fm.list_mtx.read_lock();
-    flows = fm.flows;
-    fm.list_mtx.unlock();
-    (this->*send_down_func)(fm, in_vector, flows, ret);
+    unsigned ticket;
+    auto flows = fm.snapshot.ReadLock(ticket);
+    (this->*send_down_func)(fm, in_vector, *flows, ret);
+    fm.snapshot.ReadUnlock(ticket);
   }
   for (auto &buffer : in_vector)
     buffer.reset();
@@ -163,23 +331,33 @@ void FlowCoroutine::WhileRun() {
     RunOnce();
 }
 
-void FlowCoroutine::WhileRunSleep() {
-  int64_t times = 0;
-  AutoDuration ad;
-  assert(interval > 0);
-  prctl(PR_SET_NAME, this->name.c_str());
-  LOGD("flow-name %s\n", this->name.c_str());
+// Producers add 1 to pending, only the one who makes it leave 0 submits the
+// task, so that one coroutine is never queued twice or run in parallel.
+void FlowCoroutine::Schedule() {
+  if (pending.fetch_add(1) == 0)
+    FlowExecutor::GetInstance().Submit(this);
+}
 
-  while (!flow->quit) {
-    if (times == 0)
-      ad.Reset();
-    RunOnce();
-    ++times;
-    int64_t remain = (interval * times - ad.Get()) / 1000;
-    if (remain > 0)
-      msleep((int)remain);
-    if (times >= 10000)
-      times = 0;
+#define POOLED_TASK_BATCH 8
+
+void FlowCoroutine::RunTask() {
+  for (;;) {
+    int n = pending.load();
+    int batch = POOLED_TASK_BATCH;
+    while (!flow->quit && batch-- > 0 && HasPooledInput())
+      RunOnce();
+    if (!flow->quit && HasPooledInput()) {
+      // give other tasks a chance, still owned as pending is not 0
+      FlowExecutor::GetInstance().Submit(this);
+      return;
+    }
+    // must not touch this after idle_mtx is released with pending 0, the
+    // destructor may go on at once
+    std::lock_guard<std::mutex> _lg(idle_mtx);
+    if (pending.fetch_sub(n) == n) {
+      idle_cond.notify_all();
+      return;
+    }
   }
 }
 
@@ -202,7 +380,7 @@ void FlowCoroutine::ASyncFetchInputCommon(MediaBufferVector &in) {
     if (!v.empty())
       empty = false;
   }
-  if (empty)
+  if (empty && !flow->wake_pending.exchange(false))
     flow->cond_mtx.wait();
   flow->cond_mtx.unlock();
 
@@ -221,9 +399,63 @@ void FlowCoroutine::ASyncFetchInputCommon(MediaBufferVector &in) {
     assert(!v.empty());
     in[i] = v.front();
     v.pop_front();
+    input.NotifyNotFull();
   }
 }
 
+void FlowCoroutine::ASyncFetchInputLockFree(MediaBufferVector &in) {
+  auto &event = flow->input_event;
+  uint32_t key = event.PrepareWait();
+  bool empty = true;
+  for (int idx : in_slots) {
+    if (!flow->v_input[idx].ring->Empty()) {
+      empty = false;
+      break;
+    }
+  }
+  if (empty && !flow->quit && !flow->wake_pending.exchange(false))
+    event.Wait(key);
+  else
+    event.CancelWait();
+
+  for (size_t i = 0; i < in_slots.size(); i++) {
+    if (!flow->enable) {
+      in.assign(in_slots.size(), nullptr);
+      break;
+    }
+    auto &input = flow->v_input[in_slots[i]];
+    if (input.ring->TryPop(in[i]))
+      input.NotifyNotFull();
+  }
+}
+
+void FlowCoroutine::PooledFetchInput(MediaBufferVector &in) {
+  for (size_t i = 0; i < in_slots.size(); i++) {
+    if (!flow->enable) {
+      in.assign(in_slots.size(), nullptr);
+      break;
+    }
+    auto &input = flow->v_input[in_slots[i]];
+    auto &v = input.cached_buffers;
+    AutoLockMutex _alm(input.mtx);
+    if (v.empty())
+      continue;
+    in[i] = v.front();
+    v.pop_front();
+    input.NotifyNotFull();
+  }
+}
+
+bool FlowCoroutine::HasPooledInput() {
+  for (int idx : in_slots) {
+    auto &input = flow->v_input[idx];
+    AutoLockMutex _alm(input.mtx);
+    if (!input.cached_buffers.empty())
+      return true;
+  }
+  return false;
+}
+
 void FlowCoroutine::ASyncFetchInputAtomic(MediaBufferVector &in) {
   int i = 0;
   for (int idx : in_slots) {
@@ -231,14 +463,22 @@ void FlowCoroutine::ASyncFetchInputAtomic(MediaBufferVector &in) {
     auto &input = flow->v_input[idx];
     input.spin_mtx.lock();
     buffer = input.cached_buffer;
+    bool fresh = input.cached_fresh;
+    input.cached_fresh = false;
     input.spin_mtx.unlock();
+    // the same buffer is fetched every tick until replaced, measure it once
+    if (fresh && buffer && buffer->GetEnqueueClock() > 0) {
+      int64_t latency = monotonic_ns() / 1000 - buffer->GetEnqueueClock();
+      if (latency >= 0)
+        input.latency.Add(latency);
+    }
     in[i++] = buffer;
   }
 }
 
-void FlowCoroutine::SendNullBufferDown(Flow::FlowMap &fm,
-                                       const MediaBufferVector &in,
-                                       std::list<Flow::FlowInputMap> &flows) {
+void FlowCoroutine::SendNullBufferDown(
+    Flow::FlowMap &fm, const MediaBufferVector &in,
+    const std::vector<Flow::FlowInputMap> &flows) {
   std::shared_ptr<MediaBuffer> nullbuffer;
   if (fm.hold_input != HoldInputMode::NONE) {
     auto empty_result = std::make_shared<easymedia::MediaBuffer>();
@@ -251,7 +491,7 @@ void FlowCoroutine::SendNullBufferDown(Flow::FlowMap &fm,
 
 void FlowCoroutine::SendBufferDown(Flow::FlowMap &fm,
                                    const MediaBufferVector &in,
-                                   std::list<Flow::FlowInputMap> &flows,
+                                   const std::vector<Flow::FlowInputMap> &flows,
                                    bool process_ret) {
   if (!process_ret) {
     SendNullBufferDown(fm, in, flows);
@@ -266,7 +506,7 @@ void FlowCoroutine::SendBufferDown(Flow::FlowMap &fm,
 
 void FlowCoroutine::SendBufferDownFromDeque(
     Flow::FlowMap &fm, const MediaBufferVector &in,
-    std::list<Flow::FlowInputMap> &flows, bool process_ret) {
+    const std::vector<Flow::FlowInputMap> &flows, bool process_ret) {
   if (!process_ret) {
     SendNullBufferDown(fm, in, flows);
     return;
@@ -302,6 +542,271 @@ int FlowCoroutine::GetCachedBufferCnt() {
   return cnt;
 }
 
+// in catch up, resync after falling behind this
+#define TIMER_CATCHUP_MAX_NS 1000000000LL
+
+std::shared_ptr<FlowTimer> FlowTimer::GetTimer(const std::string &group,
+                                               const std::string &name) {
+  static std::mutex groups_mtx;
+  static std::map<std::string, std::weak_ptr<FlowTimer>> groups;
+  if (group.empty()) {
+    auto timer = std::make_shared<FlowTimer>(name);
+    timer->Start(timer);
+    return timer;
+  }
+  std::lock_guard<std::mutex> _lg(groups_mtx);
+  auto timer = groups[group].lock();
+  if (!timer) {
+    timer = std::make_shared<FlowTimer>("timer_" + group);
+    timer->Start(timer);
+    groups[group] = timer;
+  }
+  return timer;
+}
+
+FlowTimer::FlowTimer(const std::string &name)
+    : thread_name(name), fd(-1), quit(false), running(nullptr), th(nullptr) {
+  fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (fd < 0)
+    LOG("timerfd_create failed, %m\n");
+}
+
+void FlowTimer::Start(std::weak_ptr<FlowTimer> weak) {
+  if (fd >= 0 && !th)
+    th = new std::thread(&FlowTimer::Run, this, weak);
+}
+
+FlowTimer::~FlowTimer() {
+  if (th) {
+    quit = true;
+    // fire at once
+    Arm(1);
+    // in the timer thread, Run returns without touching this, see Run
+    if (th->get_id() == std::this_thread::get_id())
+      th->detach();
+    else
+      th->join();
+    delete th;
+  }
+  if (fd >= 0)
+    close(fd);
+}
+
+// 0, disarm
+void FlowTimer::Arm(int64_t deadline) {
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = deadline / 1000000000LL;
+  its.it_value.tv_nsec = deadline % 1000000000LL;
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, nullptr))
+    LOG("timerfd_settime failed, %m\n");
+}
+
+bool FlowTimer::Register(FlowCoroutine *c, float interval_ms,
+                         DeadlinePolicy policy) {
+  if (!th)
+    return false;
+  Entry e;
+  memset(&e, 0, sizeof(e));
+  e.coroutine = c;
+  e.policy = policy;
+  e.period = (int64_t)(interval_ms * 1000000.0);
+  if (e.period <= 0)
+    e.period = 1;
+  // first period runs at once
+  e.start = monotonic_ns();
+  e.deadline = e.start;
+  AutoLockMutex _alm(mtx);
+  entries.push_back(e);
+  Arm(e.deadline);
+  return true;
+}
+
+void FlowTimer::Unregister(FlowCoroutine *c) {
+  AutoLockMutex _alm(mtx);
+  entries.remove_if([c](Entry &e) { return e.coroutine == c; });
+  // c may unregister itself from its own run
+  if (th && th->get_id() == std::this_thread::get_id())
+    return;
+  while (running == c)
+    mtx.wait();
+}
+
+FlowTimer::Entry *FlowTimer::Find(FlowCoroutine *c) {
+  for (auto &e : entries) {
+    if (e.coroutine == c)
+      return &e;
+  }
+  return nullptr;
+}
+
+bool FlowTimer::GetStats(FlowCoroutine *c, FlowTimerStats &stats) {
+  AutoLockMutex _alm(mtx);
+  Entry *e = Find(c);
+  if (!e)
+    return false;
+  stats = e->stats;
+  if (e->stats.ticks > 0)
+    stats.jitter_avg = e->jitter_sum / e->stats.ticks;
+  return true;
+}
+
+// mtx is locked, e is the tick started at now
+void FlowTimer::Advance(Entry &e, int64_t now) {
+  int64_t jitter = (now - e.deadline) / 1000;
+  e.stats.ticks++;
+  e.jitter_sum += jitter;
+  if (jitter > e.stats.jitter_max)
+    e.stats.jitter_max = jitter;
+  if (now - e.deadline >= e.period)
+    e.stats.late++;
+  e.index++;
+  int64_t next = e.start + e.index * e.period;
+  if (next <= now && (e.policy != DeadlinePolicy::CATCHUP ||
+                      now - next > TIMER_CATCHUP_MAX_NS)) {
+    int64_t index = (now - e.start) / e.period + 1;
+    e.stats.skipped += index - e.index;
+    e.index = index;
+    next = e.start + e.index * e.period;
+  }
+  e.deadline = next;
+}
+
+// A destructor out of this thread joins it, so this is valid until Run
+// returns. Otherwise the last reference is dropped at self.reset().
+void FlowTimer::Run(std::weak_ptr<FlowTimer> weak) {
+  prctl(PR_SET_NAME, thread_name.c_str());
+  while (!quit) {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EINTR) {
+      LOG("read timerfd failed, %m\n");
+      break;
+    }
+    std::shared_ptr<FlowTimer> self = weak.lock();
+    if (!self)
+      return;
+    mtx.lock();
+    while (!quit) {
+      Entry *due = nullptr;
+      for (auto &e : entries) {
+        if (!due || e.deadline < due->deadline)
+          due = &e;
+      }
+      int64_t now = monotonic_ns();
+      if (!due || due->deadline > now) {
+        Arm(due ? due->deadline : 0);
+        break;
+      }
+      Advance(*due, now);
+      FlowCoroutine *c = due->coroutine;
+      running = c;
+      mtx.unlock();
+      c->RunOnce();
+      mtx.lock();
+      running = nullptr;
+      mtx.notify();
+    }
+    mtx.unlock();
+    self.reset();
+    if (weak.expired())
+      return;
+  }
+}
+
+thread_local int FlowExecutor::worker_index = -1;
+thread_local FlowCoroutine *FlowExecutor::running = nullptr;
+
+FlowExecutor &FlowExecutor::GetInstance() {
+  static FlowExecutor executor;
+  return executor;
+}
+
+FlowExecutor::FlowExecutor() : quit(false), next(0) {
+  int num = (int)std::thread::hardware_concurrency();
+  if (num < 1)
+    num = 1;
+  for (int i = 0; i < num; i++)
+    workers.emplace_back(new Worker());
+  for (int i = 0; i < num; i++)
+    threads.emplace_back(&FlowExecutor::WorkerRun, this, i);
+  LOG("flow executor: %d workers\n", num);
+}
+
+FlowExecutor::~FlowExecutor() {
+  quit = true;
+  idle_event.Notify();
+  for (auto &th : threads)
+    th.join();
+}
+
+void FlowExecutor::Submit(FlowCoroutine *c) {
+  int idx = worker_index;
+  if (idx < 0)
+    idx = (int)(next++ % workers.size());
+  auto &w = workers[idx];
+  w->mtx.lock();
+  w->tasks.push_back(c);
+  w->mtx.unlock();
+  idle_event.Notify(1);
+}
+
+bool FlowExecutor::Cancel(FlowCoroutine *c) {
+  for (auto &w : workers) {
+    std::lock_guard<std::mutex> _lg(w->mtx);
+    auto it = std::find(w->tasks.begin(), w->tasks.end(), c);
+    if (it != w->tasks.end()) {
+      w->tasks.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+// own deque in fifo order, steal the newest task of the others
+FlowCoroutine *FlowExecutor::Take(int index) {
+  FlowCoroutine *c = nullptr;
+  int num = (int)workers.size();
+  for (int i = 0; i < num && !c; i++) {
+    auto &w = workers[(index + i) % num];
+    std::lock_guard<std::mutex> _lg(w->mtx);
+    if (w->tasks.empty())
+      continue;
+    if (i == 0) {
+      c = w->tasks.front();
+      w->tasks.pop_front();
+    } else {
+      c = w->tasks.back();
+      w->tasks.pop_back();
+    }
+  }
+  return c;
+}
+
+void FlowExecutor::WorkerRun(int index) {
+  char name[16];
+  snprintf(name, sizeof(name), "flow_pool_%d", index);
+  prctl(PR_SET_NAME, name);
+  worker_index = index;
+  while (!quit) {
+    FlowCoroutine *c = Take(index);
+    if (!c) {
+      uint32_t key = idle_event.PrepareWait();
+      c = Take(index);
+      if (c || quit) {
+        idle_event.CancelWait();
+      } else {
+        idle_event.Wait(key);
+        continue;
+      }
+    }
+    if (c) {
+      running = c;
+      c->RunTask();
+      running = nullptr;
+    }
+  }
+}
+
 DEFINE_REFLECTOR(Flow)
 DEFINE_FACTORY_COMMON_PARSE(Flow)
 DEFINE_PART_FINAL_EXPOSE_PRODUCT(Flow, Flow)
@@ -311,9 +816,10 @@ const FunctionProcess Flow::void_transaction00 = void_transaction<0, 0>;
 Flow::Flow()
     : out_slot_num(0), input_slot_num(0), down_flow_num(0), waite_down_flow(true),
       event_handler2_(nullptr), event_callback_(nullptr), enable(true),
-      quit(false), event_handler_(nullptr), play_video_handler_(nullptr),
-      play_audio_handler_(nullptr), user_handler_(nullptr),
-      user_callback_(nullptr), out_handler_(nullptr), out_callback_(nullptr),
+      quit(false), wake_pending(false), event_handler_(nullptr),
+      play_video_handler_(nullptr), play_audio_handler_(nullptr),
+      user_handler_(nullptr), user_callback_(nullptr), out_handler_(nullptr),
+      out_callback_(nullptr), trace_enable(false), trace_pos(0),
       run_times(-1) {}
 
 Flow::~Flow() { StopAllThread(); }
@@ -324,17 +830,210 @@ void Flow::StopAllThread() {
   cond_mtx.lock();
   cond_mtx.notify();
   cond_mtx.unlock();
+  input_event.Notify();
+  // wake up the producers blocked on full inputs
+  for (auto &input : v_input) {
+    if (input.mode_when_full != InputMode::BLOCKING)
+      continue;
+    input.mtx.lock();
+    input.mtx.notify();
+    input.mtx.unlock();
+    input.not_full_event.Notify();
+  }
+  // pooled input holds the coroutine too, release it to wait for the task
+  for (auto &input : v_input) {
+    if (input.thread_model == Model::POOLED)
+      input.coroutine.reset();
+  }
   for (auto &coroutine : coroutines)
     coroutine.reset();
 }
 
+bool Flow::GetTimerStats(FlowTimerStats &stats) {
+  for (auto &coroutine : coroutines) {
+    if (coroutine && coroutine->GetTimerStats(stats))
+      return true;
+  }
+  return false;
+}
+
+void FlowHistogramCounter::Add(int64_t us) {
+  int idx = 0;
+  if (us > 0)
+    idx = 64 - __builtin_clzll((unsigned long long)us);
+  if (idx >= FLOW_HISTOGRAM_BUCKETS)
+    idx = FLOW_HISTOGRAM_BUCKETS - 1;
+  buckets[idx].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(us, std::memory_order_relaxed);
+  int64_t m = max.load(std::memory_order_relaxed);
+  while (us > m && !max.compare_exchange_weak(m, us))
+    ;
+}
+
+void FlowHistogramCounter::Read(FlowHistogram &h) const {
+  h.count = count.load(std::memory_order_relaxed);
+  h.sum = sum.load(std::memory_order_relaxed);
+  h.max = max.load(std::memory_order_relaxed);
+  for (int i = 0; i < FLOW_HISTOGRAM_BUCKETS; i++)
+    h.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+}
+
+void FlowHistogramCounter::Reset() {
+  count = 0;
+  sum = 0;
+  max = 0;
+  for (auto &b : buckets)
+    b = 0;
+}
+
+int64_t FlowHistogramPercentile(const FlowHistogram &h, float ratio) {
+  if (h.count <= 0)
+    return 0;
+  int64_t target = (int64_t)(h.count * ratio);
+  int64_t acc = 0;
+  for (int i = 0; i < FLOW_HISTOGRAM_BUCKETS - 1; i++) {
+    acc += h.buckets[i];
+    if (acc > target)
+      return std::min((int64_t)1 << i, h.max);
+  }
+  return h.max;
+}
+
+void Flow::GetMetrics(FlowMetrics &metrics) {
+  memset(&metrics, 0, sizeof(metrics));
+  metrics.input_num = std::min((int)v_input.size(), FLOW_METRICS_MAX_SLOT);
+  for (int i = 0; i < metrics.input_num; i++) {
+    auto &in = v_input[i];
+    auto &m = metrics.input[i];
+    m.in = in.in_cnt;
+    m.dropped_front = in.drop_front_cnt;
+    m.dropped_current = in.drop_current_cnt;
+    m.depth = in.valid ? (int64_t)in.GetCachedNum() : 0;
+    m.max_depth = in.max_depth;
+    in.latency.Read(m.latency);
+  }
+  metrics.output_num =
+      std::min((int)downflowmap.size(), FLOW_METRICS_MAX_SLOT);
+  for (int i = 0; i < metrics.output_num; i++)
+    metrics.output[i].out = downflowmap[i].out_cnt;
+  process_time.Read(metrics.process);
+}
+
+void Flow::ResetMetrics() {
+  for (auto &in : v_input) {
+    in.in_cnt = 0;
+    in.drop_front_cnt = 0;
+    in.drop_current_cnt = 0;
+    in.max_depth = 0;
+    in.latency.Reset();
+  }
+  for (auto &fm : downflowmap)
+    fm.out_cnt = 0;
+  process_time.Reset();
+}
+
+#define FLOW_TRACE_SPAN_NUM 4096
+
+void Flow::RecordSpan(int64_t start, int64_t cost, int64_t depth) {
+  AutoLockMutex _alm(trace_mtx);
+  if (trace_spans.empty())
+    return;
+  TraceSpan &span = trace_spans[trace_pos++ % trace_spans.size()];
+  span.start = start;
+  span.cost = (int32_t)cost;
+  span.depth = (int32_t)depth;
+}
+
+void Flow::AppendTraceEvents(std::string &events, int tid) {
+  char line[256];
+  int pid = getpid();
+  snprintf(line, sizeof(line),
+           "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+           "\"args\":{\"name\":\"%s\"}}",
+           pid, tid, GetFlowTag());
+  if (!events.empty())
+    events.append(",\n");
+  events.append(line);
+  AutoLockMutex _alm(trace_mtx);
+  size_t num = std::min(trace_pos, trace_spans.size());
+  for (size_t i = trace_pos - num; i < trace_pos; i++) {
+    const TraceSpan &span = trace_spans[i % trace_spans.size()];
+    snprintf(line, sizeof(line),
+             ",\n{\"name\":\"process\",\"cat\":\"flow\",\"ph\":\"X\","
+             "\"ts\":%lld,\"dur\":%d,\"pid\":%d,\"tid\":%d}",
+             (long long)span.start, span.cost, pid, tid);
+    events.append(line);
+    snprintf(line, sizeof(line),
+             ",\n{\"name\":\"%s queue\",\"ph\":\"C\",\"ts\":%lld,"
+             "\"pid\":%d,\"tid\":%d,\"args\":{\"depth\":%d}}",
+             GetFlowTag(), (long long)span.start, pid, tid, span.depth);
+    events.append(line);
+  }
+}
+
+int Flow::Control(unsigned long int request, ...) {
+  FLOW_CONTROL_BASE(request)
+  return -1;
+}
+
+int Flow::FlowControl(unsigned long int request, void *arg) {
+  switch (request) {
+  case G_FLOW_METRICS:
+    if (!arg)
+      return -1;
+    GetMetrics(*(FlowMetrics *)arg);
+    break;
+  case S_FLOW_METRICS_RESET:
+    ResetMetrics();
+    break;
+  case S_FLOW_TRACE_START: {
+    AutoLockMutex _alm(trace_mtx);
+    trace_spans.resize(FLOW_TRACE_SPAN_NUM);
+    trace_pos = 0;
+    trace_enable = true;
+  } break;
+  case S_FLOW_TRACE_STOP:
+    trace_enable = false;
+    break;
+  case G_FLOW_TRACE_JSON: {
+    if (!arg)
+      return -1;
+    std::string events;
+    AppendTraceEvents(events, 1);
+    *(std::string *)arg = "{\"traceEvents\":[\n" + events + "\n]}\n";
+  } break;
+  default:
+    return -1;
+  }
+  return 0;
+}
+
+bool FlowTraceExport(const std::vector<std::shared_ptr<Flow>> &flows,
+                     const char *path) {
+  std::string events;
+  int tid = 1;
+  for (auto &f : flows) {
+    if (f)
+      f->AppendTraceEvents(events, tid++);
+  }
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    LOG("open %s failed, %m\n", path);
+    return false;
+  }
+  fprintf(fp, "{\"traceEvents\":[\n%s\n]}\n", events.c_str());
+  fclose(fp);
+  return true;
+}
+
 bool Flow::IsAllBuffEmpty() {
 #ifndef NDEBUG
   int i = 0;
 
   for (auto &input : v_input) {
     LOG("#FLOW v_input-%d cached_buffers size:%zu\n", i,
-        input.cached_buffers.size());
+        input.GetCachedNum());
     LOG("#FLOW v_input-%d cached_buffer :%s\n", i++,
         input.cached_buffer ? "NotNull" : "Null");
   }
@@ -355,7 +1054,7 @@ bool Flow::IsAllBuffEmpty() {
 #endif
 
   for (auto &input : v_input) {
-    if (input.cached_buffers.size() || input.cached_buffer)
+    if (input.GetCachedNum() || input.cached_buffer)
       return false;
   }
 
@@ -396,6 +1095,18 @@ int Flow::GetRunTimesRemaining() {
   return remaining_value;
 }
 
+static void DumpHistogram(std::string &dump_info, const char *name,
+                          const FlowHistogram &h) {
+  char str_line[256];
+  snprintf(str_line, sizeof(str_line),
+           "%s: cnt:%lld, avg:%lldus, p50:%lldus, p99:%lldus, max:%lldus\r\n",
+           name, (long long)h.count,
+           (long long)(h.count ? h.sum / h.count : 0),
+           (long long)FlowHistogramPercentile(h, 0.5f),
+           (long long)FlowHistogramPercentile(h, 0.99f), (long long)h.max);
+  dump_info.append(str_line);
+}
+
 void Flow::DumpBase(std::string &dump_info) {
   int idx = 0;
   char str_line[1024] = {0};
@@ -424,6 +1135,8 @@ void Flow::DumpBase(std::string &dump_info) {
       sprintf(str_line, "    ThreadMode: ASYNCATOMIC\r\n");
     else if (input.thread_model == Model::SYNC)
       sprintf(str_line, "    ThreadMode: SYNC\r\n");
+    else if (input.thread_model == Model::POOLED)
+      sprintf(str_line, "    ThreadMode: POOLED\r\n");
     else
       sprintf(str_line, "    ThreadMode: NONE\r\n");
     dump_info.append(str_line);
@@ -438,8 +1151,51 @@ void Flow::DumpBase(std::string &dump_info) {
       sprintf(str_line, "    InputMode: NONE\r\n");
     dump_info.append(str_line);
     memset(str_line, 0, sizeof(str_line));
-    sprintf(str_line, "    BufferCnt: current:%d, max:%d\r\n",
-            input.cached_buffers.size(), input.max_cache_num);
+    sprintf(str_line, "    BufferCnt: current:%zu, max:%d\r\n",
+            input.GetCachedNum(), input.max_cache_num);
+    dump_info.append(str_line);
+    if (input.mode_when_full == InputMode::BLOCKING) {
+      memset(str_line, 0, sizeof(str_line));
+      sprintf(str_line, "    Blocked: times:%lld, total:%.2fms\r\n",
+              (long long)input.blocked_cnt.load(),
+              input.blocked_time.load() / 1000.0);
+      dump_info.append(str_line);
+    }
+    memset(str_line, 0, sizeof(str_line));
+    if (input.ring)
+      sprintf(str_line, "    InputQueue: %s\r\n",
+              input.ring->IsMultiProducer() ? "MPSC" : "SPSC");
+    else
+      sprintf(str_line, "    InputQueue: LOCKED\r\n");
+    dump_info.append(str_line);
+    memset(str_line, 0, sizeof(str_line));
+    sprintf(str_line,
+            "    Frames: in:%lld, dropfront:%lld, dropcurrent:%lld, "
+            "maxdepth:%lld\r\n",
+            (long long)input.in_cnt.load(),
+            (long long)input.drop_front_cnt.load(),
+            (long long)input.drop_current_cnt.load(),
+            (long long)input.max_depth.load());
+    dump_info.append(str_line);
+    FlowHistogram h;
+    input.latency.Read(h);
+    DumpHistogram(dump_info, "    Latency", h);
+    idx++;
+  }
+
+  FlowHistogram process;
+  process_time.Read(process);
+  DumpHistogram(dump_info, "  Process", process);
+
+  FlowTimerStats stats;
+  if (GetTimerStats(stats)) {
+    memset(str_line, 0, sizeof(str_line));
+    sprintf(str_line,
+            "  Timer: ticks:%lld, skipped:%lld, late:%lld, "
+            "jitter avg:%lldus, max:%lldus\r\n",
+            (long long)stats.ticks, (long long)stats.skipped,
+            (long long)stats.late, (long long)stats.jitter_avg,
+            (long long)stats.jitter_max);
     dump_info.append(str_line);
   }
 
@@ -454,6 +1210,9 @@ void Flow::DumpBase(std::string &dump_info) {
     memset(str_line, 0, sizeof(str_line));
     sprintf(str_line, "    BufferCnt: %d\r\n", fm.cached_buffers.size());
     dump_info.append(str_line);
+    memset(str_line, 0, sizeof(str_line));
+    sprintf(str_line, "    Frames: out:%lld\r\n", (long long)fm.out_cnt.load());
+    dump_info.append(str_line);
 
     dump_info.append("    NextFlow: ");
     for (auto &nflow : fm.flows) {
@@ -461,6 +1220,7 @@ void Flow::DumpBase(std::string &dump_info) {
       dump_info.append(" ");
     }
     dump_info.append("\r\n");
+    idx++;
   }
 }
 
@@ -481,7 +1241,7 @@ static bool check_slots(std::vector<int> &slots, const char *debugstr) {
   return true;
 }
 
-Flow::FlowMap::FlowMap(FlowMap &&fm) {
+Flow::FlowMap::FlowMap(FlowMap &&fm) : FlowMap() {
   if (fm.valid) {
     LOG("Flow::FlowMap is not copyable and moveable after inited\n");
     assert(0);
@@ -491,7 +1251,7 @@ Flow::FlowMap::FlowMap(FlowMap &&fm) {
 void Flow::FlowMap::Init(Model m, HoldInputMode hold_in) {
   assert(!valid);
   valid = true;
-  if (m == Model::ASYNCCOMMON)
+  if (m == Model::ASYNCCOMMON || m == Model::POOLED)
     set_output_behavior = &FlowMap::SetOutputToQueueBehavior;
   else
     set_output_behavior = &FlowMap::SetOutputBehavior;
@@ -507,14 +1267,15 @@ void Flow::FlowMap::SetOutputToQueueBehavior(
   cached_buffers.push_back(output);
 }
 
-Flow::Input::Input(Input &&in) {
+Flow::Input::Input(Input &&in) : Input() {
   if (in.valid) {
     LOG("Flow::Input is not copyable and moveable after inited\n");
     assert(0);
   }
 }
 
-void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
+void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, InputQueue iq,
+                       int b_timeout, bool f_block,
                        std::shared_ptr<FlowCoroutine> fc) {
   assert(!valid);
   valid = true;
@@ -523,9 +1284,15 @@ void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
   fetch_block = f_block;
   max_cache_num = mcn;
   mode_when_full = im;
+  block_timeout = b_timeout;
   switch (m) {
   case Model::ASYNCCOMMON:
     send_input_behavior = &Input::ASyncSendInputCommonBehavior;
+    if (iq == InputQueue::SPSC || iq == InputQueue::MPSC) {
+      ring.reset(new LockFreeRing<std::shared_ptr<MediaBuffer>>(
+          mcn, iq == InputQueue::MPSC));
+      send_input_behavior = &Input::ASyncSendInputLockFreeBehavior;
+    }
     break;
   case Model::ASYNCATOMIC:
     send_input_behavior = &Input::ASyncSendInputAtomicBehavior;
@@ -534,6 +1301,10 @@ void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
     send_input_behavior = &Input::SyncSendInputBehavior;
     coroutine = fc;
     break;
+  case Model::POOLED:
+    send_input_behavior = &Input::PooledSendInputBehavior;
+    coroutine = fc;
+    break;
   default:
     break;
   }
@@ -552,6 +1323,21 @@ void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
   }
 }
 
+size_t Flow::Input::GetCachedNum() {
+  if (ring)
+    return ring->Size();
+  return cached_buffers.size();
+}
+
+void Flow::Input::NotifyNotFull() {
+  if (mode_when_full != InputMode::BLOCKING)
+    return;
+  if (ring)
+    not_full_event.Notify();
+  else
+    mtx.notify();
+}
+
 bool Flow::SetAsSource(const std::vector<int> &output_slots, FunctionProcess f,
                        const std::string &mark) {
   source_start_cond_mtx = std::make_shared<ConditionLockMutex>();
@@ -582,6 +1368,18 @@ bool Flow::InstallSlotMap(SlotMap &map, const std::string &mark,
   }
   if (!check_slots(in_slots, "input"))
     return false;
+  if (map.thread_model == Model::POOLED) {
+    if (in_slots.empty()) {
+      LOG("%s: pooled flow need input to be scheduled\n", mark.c_str());
+      return false;
+    }
+    // a worker waiting for space may hold the worker the consumer needs
+    if (map.mode_when_full == InputMode::BLOCKING) {
+      LOG("%s: pooled flow not support blocking input, use dropfront\n",
+          mark.c_str());
+      map.mode_when_full = InputMode::DROPFRONT;
+    }
+  }
   bool ret = true;
   for (int i : in_slots) {
     if (i >= (int)v_input.size())
@@ -608,6 +1406,19 @@ bool Flow::InstallSlotMap(SlotMap &map, const std::string &mark,
   if (!ret)
     return false;
 
+  InputQueue in_queue = map.input_queue;
+  if (map.thread_model == Model::ASYNCCOMMON &&
+      (in_queue == InputQueue::SPSC || in_queue == InputQueue::MPSC)) {
+    for (size_t i = 0; i < in_slots.size(); i++) {
+      if (map.input_maxcachenum.size() <= i || map.input_maxcachenum[i] <= 0) {
+        LOG("%s: lock free input queue need input cache num > 0, "
+            "fallback to locked queue\n", mark.c_str());
+        in_queue = InputQueue::LOCKED;
+        break;
+      }
+    }
+  }
+
   auto c = std::make_shared<FlowCoroutine>(this, map.thread_model, map.process,
                                            map.interval);
   if (!c) {
@@ -621,14 +1432,12 @@ bool Flow::InstallSlotMap(SlotMap &map, const std::string &mark,
     if ((int)v_input.size() <= max_idx)
       v_input.resize(max_idx + 1);
     for (size_t i = 0; i < in_slots.size(); i++) {
+      bool queued = (map.thread_model == Model::ASYNCCOMMON ||
+                     map.thread_model == Model::POOLED);
       v_input[in_slots[i]].Init(
-          this, map.thread_model,
-          (map.thread_model == Model::ASYNCCOMMON) ? map.input_maxcachenum[i]
-                                                   : 0,
-          map.mode_when_full,
-          (map.thread_model == Model::ASYNCCOMMON && map.fetch_block.size() > i)
-              ? map.fetch_block[i]
-              : true,
+          this, map.thread_model, queued ? map.input_maxcachenum[i] : 0,
+          map.mode_when_full, in_queue, map.block_timeout,
+          (queued && map.fetch_block.size() > i) ? map.fetch_block[i] : true,
           c);
       input_slot_num++;
     }
@@ -647,25 +1456,69 @@ bool Flow::InstallSlotMap(SlotMap &map, const std::string &mark,
 
   c->SetMarkName(mark);
   c->SetExpectProcessTime(exp_process_time);
+  c->SetDeadline(map.deadline_policy, map.timer_group);
   c->Start();
   return true;
 }
 
-void Flow::FlowMap::AddFlow(std::shared_ptr<Flow> flow, int index) {
+bool Flow::FlowMap::AddFlow(std::shared_ptr<Flow> flow, int index) {
   AutoLockMutex _lg(list_mtx);
   auto i = std::find(flows.begin(), flows.end(), flow);
   if (i != flows.end()) {
     LOG("repeatedly add, update index\n");
+    if (i->index_of_in != index) {
+      if (!flow->AttachUpstream(index))
+        return false;
+      flow->DetachUpstream(i->index_of_in);
+    }
     i->index_of_in = index;
-    return;
+    PublishFlows();
+    return true;
   }
+  if (!flow->AttachUpstream(index))
+    return false;
   // TODO: sort by sync type in downflow
   flows.emplace_back(flow, index);
+  PublishFlows();
+  return true;
 }
 
 void Flow::FlowMap::RemoveFlow(std::shared_ptr<Flow> flow) {
   AutoLockMutex _lg(list_mtx);
-  flows.remove_if([&flow](FlowInputMap &fm) { return fm == flow; });
+  flows.remove_if([&flow](FlowInputMap &fm) {
+    if (!(fm == flow))
+      return false;
+    flow->DetachUpstream(fm.index_of_in);
+    return true;
+  });
+  PublishFlows();
+}
+
+// The old snapshot may hold the last reference of removed flow, which is
+// released here or by the last sender done with it, see RcuSnapshot.
+void Flow::FlowMap::PublishFlows() {
+  snapshot.Publish(new std::vector<FlowInputMap>(flows.begin(), flows.end()));
+}
+
+bool Flow::AttachUpstream(int in_slot_index) {
+  // invalid index is reported by SendInput
+  if (in_slot_index < 0 || in_slot_index >= (int)v_input.size())
+    return true;
+  auto &in = v_input[in_slot_index];
+  int num = ++in.upstream_num;
+  if (num > 1 && in.ring && !in.ring->IsMultiProducer()) {
+    in.upstream_num--;
+    LOG("ERROR: Flow[%s]: Input[%d] is spsc queue, refuse upstream %d\n",
+        GetFlowTag(), in_slot_index, num);
+    return false;
+  }
+  return true;
+}
+
+void Flow::DetachUpstream(int in_slot_index) {
+  if (in_slot_index < 0 || in_slot_index >= (int)v_input.size())
+    return;
+  v_input[in_slot_index].upstream_num--;
 }
 
 bool Flow::AddDownFlow(std::shared_ptr<Flow> down, int out_slot_index,
@@ -682,7 +1535,8 @@ bool Flow::AddDownFlow(std::shared_ptr<Flow> down, int out_slot_index,
     LOG("can not set self loop flow\n");
     return false;
   }
-  downflowmap[out_slot_index].AddFlow(down, in_slot_index_of_down);
+  if (!downflowmap[out_slot_index].AddFlow(down, in_slot_index_of_down))
+    return false;
   if (source_start_cond_mtx) {
     source_start_cond_mtx->lock();
     down_flow_num++;
@@ -718,10 +1572,26 @@ void Flow::SendInput(std::shared_ptr<MediaBuffer> &input, int in_slot_index) {
   }
   if (enable) {
     auto &in = v_input[in_slot_index];
+    if (input) {
+      in.in_cnt++;
+      input->SetEnqueueClock(monotonic_ns() / 1000);
+    }
     CALL_MEMBER_FN(in, in.send_input_behavior)(input);
+    int64_t depth = (int64_t)in.GetCachedNum();
+    int64_t max = in.max_depth.load(std::memory_order_relaxed);
+    while (depth > max && !in.max_depth.compare_exchange_weak(max, depth))
+      ;
   }
 }
 
+void Flow::WakeUp() {
+  wake_pending = true;
+  cond_mtx.lock();
+  cond_mtx.notify();
+  cond_mtx.unlock();
+  input_event.Notify();
+}
+
 bool Flow::SetOutput(const std::shared_ptr<MediaBuffer> &output,
                      int out_slot_index) {
   if (out_slot_index < 0 || out_slot_index >= out_slot_num) {
@@ -735,6 +1605,8 @@ bool Flow::SetOutput(const std::shared_ptr<MediaBuffer> &output,
 
   if (enable) {
     auto &out = downflowmap[out_slot_index];
+    if (output)
+      out.out_cnt++;
     CALL_MEMBER_FN(out, out.set_output_behavior)(output);
     return true;
   }
@@ -757,8 +1629,9 @@ bool Flow::ParseWrapFlowParams(const char *param,
   return true;
 }
 
-void Flow::RegisterEventHandler(std::shared_ptr<Flow> flow, EventHook proc) {
-  event_handler_.reset(new EventHandler());
+void Flow::RegisterEventHandler(std::shared_ptr<Flow> flow, EventHook proc,
+                                size_t limit) {
+  event_handler_.reset(new EventHandler(limit));
   if (event_handler_) {
     event_handler_->RegisterEventHook(flow, proc);
   }
@@ -805,6 +1678,13 @@ EventParamPtr Flow::GetEventParam(MessagePtr msg) {
   return nullptr;
 }
 
+bool Flow::GetEventQueueStats(EventQueueStats &stats) {
+  if (!event_handler_)
+    return false;
+  event_handler_->GetStats(stats);
+  return true;
+}
+
 void Flow::Input::SyncSendInputBehavior(std::shared_ptr<MediaBuffer> &input) {
   cached_buffer = input;
   coroutine->RunOnce();
@@ -827,32 +1707,130 @@ void Flow::Input::ASyncSendInputCommonBehavior(
   flow->cond_mtx.notify();
 }
 
+void Flow::Input::PooledSendInputBehavior(
+    std::shared_ptr<MediaBuffer> &input) {
+  mtx.lock();
+  if (max_cache_num > 0 && max_cache_num <= (int)cached_buffers.size()) {
+    bool ret = (this->*async_full_behavior)(flow->enable);
+    if (!ret) {
+      mtx.unlock();
+      return;
+    }
+  }
+  cached_buffers.push_back(input);
+  mtx.unlock();
+  coroutine->Schedule();
+}
+
+void Flow::Input::ASyncSendInputLockFreeBehavior(
+    std::shared_ptr<MediaBuffer> &input) {
+  if (ring->TryPush(input)) {
+    flow->input_event.Notify();
+    return;
+  }
+  switch (mode_when_full) {
+  case InputMode::BLOCKING:
+    if (!ASyncRingBlockingPush(input))
+      return;
+    break;
+  case InputMode::DROPCURRENT:
+    drop_current_cnt++;
+    LOG("WARN: Flow[%s]: Input: drop current buffer!\n",
+        flow ? flow->GetFlowTag() : "Name Is Null");
+    return;
+  default: {
+    // DROPFRONT, race with the consumer, drop nothing if it wins.
+    std::shared_ptr<MediaBuffer> front;
+    do {
+      if (ring->TryPop(front)) {
+        drop_front_cnt++;
+        LOG("WARN: Flow[%s]: Input: drop front buffer!\n",
+            flow ? flow->GetFlowTag() : "Name is null");
+      }
+    } while (!ring->TryPush(input));
+    break;
+  }
+  }
+  flow->input_event.Notify();
+}
+
+// the consumer signals not_full_event after each pop
+bool Flow::Input::ASyncRingBlockingPush(std::shared_ptr<MediaBuffer> &input) {
+  AutoDuration ad;
+  bool pushed = false;
+  while (flow->enable) {
+    uint32_t key = not_full_event.PrepareWait();
+    if (ring->TryPush(input)) {
+      not_full_event.CancelWait();
+      pushed = true;
+      break;
+    }
+    if (block_timeout <= 0) {
+      not_full_event.Wait(key);
+      continue;
+    }
+    int64_t remain = block_timeout - ad.Get() / 1000;
+    if (remain <= 0) {
+      not_full_event.CancelWait();
+      break;
+    }
+    not_full_event.Wait(key, (int)remain);
+  }
+  int64_t blocked = ad.Get();
+  blocked_time += blocked;
+  blocked_cnt++;
+
+  if (!pushed && flow->enable) {
+    drop_current_cnt++;
+    LOG("WARN: Flow[%s]: Input[block mode]: drop current buffer after "
+        "%.2fms\n", flow ? flow->GetFlowTag() : "Name is null",
+        blocked / 1000.0);
+  } else if (blocked > 5000000)
+    LOG("WARN: Flow[%s]: Input[block mode]: block too long(%.2fms)\n",
+        flow ? flow->GetFlowTag() : "Name is null", blocked / 1000.0);
+  return pushed;
+}
+
 void Flow::Input::ASyncSendInputAtomicBehavior(
     std::shared_ptr<MediaBuffer> &input) {
   AutoLockMutex _alm(spin_mtx);
   cached_buffer = input;
+  cached_fresh = true;
 }
 
+// mtx is locked, the consumer notifies mtx after each pop
 bool Flow::Input::ASyncFullBlockingBehavior(volatile bool &pred) {
   AutoDuration ad;
-  do {
-    mtx.unlock();
-    msleep(5);
-    if (max_cache_num > (int)cached_buffers.size()) {
-      mtx.lock();
+  bool timeout = false;
+  while (pred && max_cache_num <= (int)cached_buffers.size()) {
+    if (block_timeout <= 0) {
+      mtx.wait();
+      continue;
+    }
+    int64_t remain = block_timeout * 1000LL - ad.Get();
+    if (remain <= 0 || !mtx.wait_for(remain)) {
+      timeout = max_cache_num <= (int)cached_buffers.size();
       break;
     }
-    mtx.lock();
-  } while (pred);
-
-  if (ad.Get() > 5000 /*ms*/)
-    LOG("WARN: Flow[%s]: Input[block mode]: block too long(%.2fms) > 5ms\n",
-        flow ? flow->GetFlowTag() : "Name is null", ad.Get() / 1000.0);
-
-  return pred;
+  }
+  int64_t blocked = ad.Get();
+  blocked_time += blocked;
+  blocked_cnt++;
+
+  if (timeout) {
+    drop_current_cnt++;
+    LOG("WARN: Flow[%s]: Input[block mode]: drop current buffer after "
+        "%.2fms\n", flow ? flow->GetFlowTag() : "Name is null",
+        blocked / 1000.0);
+  } else if (blocked > 5000000)
+    LOG("WARN: Flow[%s]: Input[block mode]: block too long(%.2fms)\n",
+        flow ? flow->GetFlowTag() : "Name is null", blocked / 1000.0);
+
+  return pred && !timeout;
 }
 
 bool Flow::Input::ASyncFullDropFrontBehavior(volatile bool &pred _UNUSED) {
+  drop_front_cnt++;
   LOG("WARN: Flow[%s]: Input: drop front buffer!\n",
       flow ? flow->GetFlowTag() : "Name is null");
   cached_buffers.pop_front();
@@ -860,6 +1838,7 @@ bool Flow::Input::ASyncFullDropFrontBehavior(volatile bool &pred _UNUSED) {
 }
 
 bool Flow::Input::ASyncFullDropCurrentBehavior(volatile bool &pred _UNUSED) {
+  drop_current_cnt++;
   LOG("WARN: Flow[%s]: Input: drop current buffer!\n",
       flow ? flow->GetFlowTag() : "Name Is Null");
   return false;
@@ -875,11 +1854,32 @@ std::string gen_datatype_rule(std::map<std::string, std::string> &params) {
   return std::move(rule);
 }
 
+InputQueue GetInputQueueByString(const std::string &in_queue) {
+  static std::map<std::string, InputQueue> in_queue_map = {
+      {KEY_LOCKED, InputQueue::LOCKED},
+      {KEY_SPSC, InputQueue::SPSC},
+      {KEY_MPSC, InputQueue::MPSC}};
+  auto it = in_queue_map.find(in_queue);
+  if (it != in_queue_map.end())
+    return it->second;
+  return InputQueue::NONE;
+}
+
+DeadlinePolicy GetDeadlinePolicyByString(const std::string &policy) {
+  static std::map<std::string, DeadlinePolicy> policy_map = {
+      {KEY_SKIP, DeadlinePolicy::SKIP}, {KEY_CATCHUP, DeadlinePolicy::CATCHUP}};
+  auto it = policy_map.find(policy);
+  if (it != policy_map.end())
+    return it->second;
+  return DeadlinePolicy::NONE;
+}
+
 Model GetModelByString(const std::string &model) {
   static std::map<std::string, Model> model_map = {
       {KEY_ASYNCCOMMON, Model::ASYNCCOMMON},
       {KEY_ASYNCATOMIC, Model::ASYNCATOMIC},
-      {KEY_SYNC, Model::SYNC}};
+      {KEY_SYNC, Model::SYNC},
+      {KEY_POOLED, Model::POOLED}};
   auto it = model_map.find(model);
   if (it != model_map.end())
     return it->second;
@@ -908,6 +1908,27 @@ void ParseParamToSlotMap(std::map<std::string, std::string> &params,
   }
   sm.thread_model = GetModelByString(params[KEK_THREAD_SYNC_MODEL]);
   sm.mode_when_full = GetInputModelByString(params[KEK_INPUT_MODEL]);
+  std::string &queue_str = params[KEY_INPUT_QUEUE];
+  if (!queue_str.empty()) {
+    sm.input_queue = GetInputQueueByString(queue_str);
+    if (sm.input_queue == InputQueue::NONE) {
+      LOG("warning, unknown input queue %s, use locked\n", queue_str.c_str());
+      sm.input_queue = InputQueue::LOCKED;
+    }
+  }
+  std::string &policy_str = params[KEY_DEADLINE_POLICY];
+  if (!policy_str.empty()) {
+    sm.deadline_policy = GetDeadlinePolicyByString(policy_str);
+    if (sm.deadline_policy == DeadlinePolicy::NONE) {
+      LOG("warning, unknown deadline policy %s, use skip\n",
+          policy_str.c_str());
+      sm.deadline_policy = DeadlinePolicy::SKIP;
+    }
+  }
+  sm.timer_group = params[KEY_TIMER_GROUP];
+  std::string &timeout_str = params[KEY_INPUT_BLOCK_TIMEOUT];
+  if (!timeout_str.empty())
+    sm.block_timeout = std::stoi(timeout_str);
   std::string &cache_num_str = params[KEY_INPUT_CACHE_NUM];
   int cache_num = -1;
   if (!cache_num_str.empty()) {
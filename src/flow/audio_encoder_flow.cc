@@ -4,6 +4,7 @@
 
 #include <assert.h>
 
+#include "audio_ring.h"
 #include "encoder.h"
 #include "flow.h"
 #include "sound.h"
@@ -12,7 +13,10 @@
 
 namespace easymedia {
 
+class AudioEncoderFlow;
 static bool encode(Flow *f, MediaBufferVector &input_vector);
+static bool encode_frame(AudioEncoderFlow *af,
+                         std::shared_ptr<MediaBuffer> src);
 
 class AudioEncoderFlow : public Flow {
 public:
@@ -26,14 +30,46 @@ public:
 private:
   std::shared_ptr<AudioEncoder> enc;
   int input_size;
+  // frames of the encoder out of inputs of any size
+  std::shared_ptr<AudioRing> ring;
 
   friend bool encode(Flow *f, MediaBufferVector &input_vector);
+  friend bool encode_frame(AudioEncoderFlow *af,
+                           std::shared_ptr<MediaBuffer> src);
 };
 
 bool encode(Flow *f, MediaBufferVector &input_vector) {
   AudioEncoderFlow *af = (AudioEncoderFlow *)f;
-  std::shared_ptr<AudioEncoder> enc = af->enc;
   std::shared_ptr<MediaBuffer> &src = input_vector[0];
+  if (!af->ring)
+    return encode_frame(af, src);
+  if (!src)
+    return false;
+  bool eof = src->IsEOF();
+  if (src->GetType() == Type::Audio && src->IsValid())
+    af->ring->Write(std::static_pointer_cast<SampleBuffer>(src));
+  bool result = true;
+  bool any = false;
+  std::shared_ptr<SampleBuffer> frame = af->ring->Read(eof);
+  while (result && frame) {
+    // the eof on the last frame, padded and flushed as without the ring
+    std::shared_ptr<SampleBuffer> next = af->ring->Read(eof);
+    if (eof && !next)
+      frame->SetEOF(true);
+    result = encode_frame(af, frame);
+    frame = next;
+    any = true;
+  }
+  if (eof && !any) {
+    auto null_frame = std::make_shared<SampleBuffer>();
+    null_frame->SetEOF(true);
+    result = encode_frame(af, null_frame);
+  }
+  return result;
+}
+
+bool encode_frame(AudioEncoderFlow *af, std::shared_ptr<MediaBuffer> src) {
+  std::shared_ptr<AudioEncoder> enc = af->enc;
   std::shared_ptr<MediaBuffer> dst;
   bool result = true;
   bool feed_null = false;
@@ -153,6 +189,31 @@ AudioEncoderFlow::AudioEncoderFlow(const char *param) {
 
   enc = encoder;
   input_size = enc->GetNbSamples() * GetSampleSize(mc.aud_cfg.sample_info);
+  if (params[KEY_AUDIO_REFRAME] == "y") {
+    int frame_samples = enc->GetNbSamples();
+    int ring_samples = 0;
+    const std::string &ring_str = params[KEY_AUDIO_RING_SAMPLES];
+    if (!ring_str.empty())
+      ring_samples = std::stoi(ring_str);
+    else
+      ring_samples = mc.aud_cfg.sample_info.sample_rate; // 1 second
+    std::shared_ptr<SizeClassBufferPool> pool;
+    const std::string &mem_cnt = params[KEY_MEM_CNT];
+    if (!mem_cnt.empty() && std::stoi(mem_cnt) > 0) {
+      const std::string &mem_type = params[KEY_MEM_TYPE];
+      pool = SizeClassBufferPool::GetShared(
+          std::stoi(mem_cnt),
+          StringToMemType(mem_type.empty() ? nullptr : mem_type.c_str()));
+    }
+    ring = std::make_shared<AudioRing>(mc.aud_cfg.sample_info, frame_samples,
+                                       ring_samples, pool);
+    if (!ring->IsValid()) {
+      LOG("AudioEncoderFlow: %s has no fixed frame to re-frame to\n",
+          ccodec_name);
+      SetError(-EINVAL);
+      return;
+    }
+  }
 
   SlotMap sm;
   sm.input_slots.push_back(0);
@@ -20,6 +20,7 @@ public:
   virtual ~FilterFlow() { StopAllThread(); }
   static const char *GetFlowName() { return "filter"; }
   virtual int Control(unsigned long int request, ...) final {
+    FLOW_CONTROL_BASE(request)
     int ret = 0;
     if (!filters.size())
       return -1;
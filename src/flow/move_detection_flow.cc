@@ -106,12 +106,14 @@ bool md_process(Flow *f, MediaBufferVector &input_vector) {
     {
       EventParamPtr param =
           std::make_shared<EventParam>(MSG_FLOW_EVENT_INFO_MOVEDETECTION, 0);
+      // the whole struct, the consumers may copy sizeof(MoveDetectEvent)
       int mdevent_size = sizeof(MoveDetectEvent);
       MoveDetectEvent *mdevent = (MoveDetectEvent *)malloc(mdevent_size);
       if (!mdevent) {
         LOG_NO_MEMORY();
         return false;
       }
+      param->SetParams(mdevent, mdevent_size);
       MoveDetecInfo *mdinfo = mdevent->data;
       mdevent->info_cnt = info_cnt;
       mdevent->ori_height = mdf->ori_height;
@@ -130,7 +132,6 @@ bool md_process(Flow *f, MediaBufferVector &input_vector) {
           info_id++;
         }
       }
-      param->SetParams(mdevent, mdevent_size);
       mdf->NotifyToEventHandler(param, MESSAGE_TYPE_FIFO);
     }
 
@@ -168,14 +169,22 @@ bool md_process(Flow *f, MediaBufferVector &input_vector) {
     // We need to create result_cnt + 1 INFO_LIST, and the last one sets
     // the flag to 0 to tell the librocchip_mpp.so that this is the end marker.
     result_size += sizeof(INFO_LIST);
-    dst = MediaBuffer::Alloc(result_size, MediaBuffer::MemType::MEM_HARD_WARE);
+    if (mdf->buffer_pool)
+      dst = mdf->buffer_pool->GetBuffer(result_size);
+    else
+      dst = MediaBuffer::Alloc(result_size,
+                               MediaBuffer::MemType::MEM_HARD_WARE);
     if (!dst) {
       LOG_NO_MEMORY();
       return false;
     }
     memcpy(dst->GetPtr(), info_list, result_size);
   } else {
-    dst = MediaBuffer::Alloc(4, MediaBuffer::MemType::MEM_COMMON);
+    // empty result, only valid size 0 matters
+    if (mdf->buffer_pool)
+      dst = mdf->buffer_pool->GetBuffer(4);
+    else
+      dst = MediaBuffer::Alloc(4, MediaBuffer::MemType::MEM_COMMON);
     if (!dst) {
       LOG_NO_MEMORY();
       return false;
@@ -374,10 +383,27 @@ MoveDetectionFlow::MoveDetectionFlow(const char *param) {
   md_ctx = move_detection_init(ori_width, ori_height, ds_width, ds_height,
                                is_single_ref);
 
+  std::string &mem_cnt = params[KEY_MEM_CNT];
+  if (!mem_cnt.empty()) {
+    int m_cnt = std::stoi(mem_cnt);
+    if (m_cnt <= 0) {
+      LOG("ERROR: MD: mem_cnt %s invalid!\n", mem_cnt.c_str());
+      SetError(-EINVAL);
+      return;
+    }
+    std::string &mem_type = params[KEY_MEM_TYPE];
+    if (mem_type.empty())
+      mem_type = KEY_MEM_HARDWARE;
+    buffer_pool = SizeClassBufferPool::GetShared(
+        m_cnt, StringToMemType(mem_type.c_str()));
+  }
+
   SlotMap sm;
   sm.input_slots.push_back(0);
   sm.process = md_process;
   sm.thread_model = Model::ASYNCCOMMON;
+  if (params[KEK_THREAD_SYNC_MODEL] == KEY_POOLED)
+    sm.thread_model = Model::POOLED;
   sm.mode_when_full = InputMode::DROPFRONT;
   sm.input_maxcachenum.push_back(3);
   if (!InstallSlotMap(sm, "MDFlow", 20)) {
@@ -404,6 +430,7 @@ MoveDetectionFlow::~MoveDetectionFlow() {
 }
 
 int MoveDetectionFlow::Control(unsigned long int request, ...) {
+  FLOW_CONTROL_BASE(request)
   int ret = 0;
   va_list ap;
   va_start(ap, request);
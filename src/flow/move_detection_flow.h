@@ -48,6 +48,7 @@ private:
   std::mutex md_results_mtx;
   std::condition_variable con_var;
   std::list<std::shared_ptr<MediaBuffer>> md_results;
+  std::shared_ptr<SizeClassBufferPool> buffer_pool;
   friend bool md_process(Flow *f, MediaBufferVector &input_vector);
 };
 
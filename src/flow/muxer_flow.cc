@@ -28,7 +28,12 @@ static unsigned sg_buffer_count = 0;
 #endif
 static int muxer_buffer_callback(void *handler, uint8_t *buf, int buf_size) {
   MuxerFlow *f = (MuxerFlow *)handler;
-  auto media_buffer = MediaBuffer::Alloc(buf_size);
+  auto media_buffer = f->buffer_pool ? f->buffer_pool->GetBuffer(buf_size)
+                                     : MediaBuffer::Alloc(buf_size);
+  if (!media_buffer) {
+    LOG_NO_MEMORY();
+    return -1;
+  }
   memcpy(media_buffer->GetPtr(), buf, buf_size);
   f->GetInputSize();
   media_buffer->SetValidSize(buf_size);
@@ -118,6 +123,20 @@ MuxerFlow::MuxerFlow(const char *param)
 
   ffmpeg_avdictionary = params[KEY_MUXER_FFMPEG_AVDICTIONARY];
 
+  // chunks written by customio come from pool
+  std::string &mem_cnt = params[KEY_MEM_CNT];
+  if (is_use_customio && !mem_cnt.empty()) {
+    int m_cnt = std::stoi(mem_cnt);
+    if (m_cnt <= 0) {
+      LOG("ERROR: Muxer:: mem_cnt %s invalid!\n", mem_cnt.c_str());
+      SetError(-EINVAL);
+      return;
+    }
+    std::string &mem_type = params[KEY_MEM_TYPE];
+    buffer_pool = SizeClassBufferPool::GetShared(
+        m_cnt, StringToMemType(mem_type.empty() ? nullptr : mem_type.c_str()));
+  }
+
   for (auto param_str : separate_list) {
     MediaConfig enc_config;
     std::map<std::string, std::string> enc_params;
@@ -151,6 +170,8 @@ MuxerFlow::MuxerFlow(const char *param)
   if (is_use_customio)
     sm.output_slots.push_back(0);
   sm.thread_model = Model::ASYNCCOMMON;
+  if (params[KEK_THREAD_SYNC_MODEL] == KEY_POOLED)
+    sm.thread_model = Model::POOLED;
   sm.mode_when_full = InputMode::DROPFRONT;
   sm.input_maxcachenum.push_back(10);
   sm.input_maxcachenum.push_back(20);
@@ -231,6 +252,7 @@ std::string MuxerFlow::GenFilePath() {
 }
 
 int MuxerFlow::Control(unsigned long int request, ...) {
+  FLOW_CONTROL_BASE(request)
   int ret = 0;
   va_list vl;
   va_start(vl, request);
@@ -61,6 +61,7 @@ private:
   bool is_use_customio;
   std::string GenFilePath();
   bool enable_streaming;
+  std::shared_ptr<SizeClassBufferPool> buffer_pool;
 };
 
 class VideoRecorder {
@@ -15,6 +15,7 @@ public:
   virtual ~OutPutStreamFlow() { StopAllThread(); };
   static const char *GetFlowName() { return "output_stream"; }
   virtual int Control(unsigned long int request, ...) final {
+    FLOW_CONTROL_BASE(request)
     if (!out_stream)
       return -1;
     va_list vl;
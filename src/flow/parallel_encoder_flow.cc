@@ -0,0 +1,388 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "encoder.h"
+#include "flow.h"
+#include "lock.h"
+#include "media_type.h"
+
+#define PARALLEL_ENC_DEFAULT_WORKERS 4
+#define PARALLEL_ENC_DEFAULT_SEGMENT 30
+
+namespace easymedia {
+
+static bool collect(Flow *f, MediaBufferVector &input_vector);
+
+// frames encoded from an idr by an encoder of their own
+typedef struct {
+  int64_t index;
+  bool failed; // the packets before the failure are kept
+  std::vector<std::shared_ptr<MediaBuffer>> frames;
+  std::vector<std::shared_ptr<MediaBuffer>> packets;
+} EncodeSegment;
+
+typedef std::shared_ptr<EncodeSegment> EncodeSegmentPtr;
+
+// Offline encoding over workers. The raw frames are cut in segments of
+// segment_frames, each one encoded as a closed gop by a new encoder on a
+// worker thread, and the packets go out in the order of the segments.
+// The encoder must do SendInput()/FetchOutput(), like ffmpeg_vid. The
+// packets take the time of their frame in the stream at the frame rate,
+// from the first input, as the inputs of a file read have no pace.
+// The workers queue the segments encoded, the flow thread sends them out.
+// An input with eof, or no data, flushes the last segment and goes out
+// after the packets; destroying the flow does the same for the frames
+// taken since the last eof. A segment that fails to encode ends the
+// stream: its packets before the failure go out, then an eof, and the
+// later segments and inputs are dropped.
+class ParallelVideoEncoderFlow : public Flow {
+public:
+  ParallelVideoEncoderFlow(const char *param);
+  virtual ~ParallelVideoEncoderFlow();
+  static const char *GetFlowName() { return "video_enc_parallel"; }
+
+private:
+  void WorkerRun();
+  bool Encode(EncodeSegment &seg);
+  void Submit();
+  void Emit();
+  void Flush();
+  void EndStream();
+
+  std::string codec_name;
+  std::string enc_param;
+  MediaConfig mc;
+  CodecType codec_type;
+  int worker_num;
+  int segment_frames;
+  int64_t frame_num;
+  int64_t first_ts;
+  EncodeSegmentPtr current;
+  int64_t segment_num;
+  int64_t next_emit;
+  int in_flight; // submitted, not yet encoded
+  bool quit;
+  bool ended; // no frame taken since the last eof out
+  std::atomic<bool> failed;
+  ConditionLockMutex mtx;
+  std::deque<EncodeSegmentPtr> pending;
+  std::map<int64_t, EncodeSegmentPtr> finished;
+  std::vector<std::thread> workers;
+  friend bool collect(Flow *f, MediaBufferVector &input_vector);
+};
+
+ParallelVideoEncoderFlow::ParallelVideoEncoderFlow(const char *param)
+    : codec_type(CODEC_TYPE_NONE), worker_num(PARALLEL_ENC_DEFAULT_WORKERS),
+      segment_frames(0), frame_num(0), first_ts(0), segment_num(0),
+      next_emit(0), in_flight(0), quit(false), ended(true), failed(false) {
+  std::list<std::string> separate_list;
+  std::map<std::string, std::string> params;
+  if (!ParseWrapFlowParams(param, params, separate_list)) {
+    SetError(-EINVAL);
+    return;
+  }
+  codec_name = params[KEY_NAME];
+  const char *ccodec_name = codec_name.c_str();
+  std::string &&rule = gen_datatype_rule(params);
+  if (rule.empty()) {
+    SetError(-EINVAL);
+    return;
+  }
+  if (!REFLECTOR(Encoder)::IsMatch(ccodec_name, rule.c_str())) {
+    LOG("Unsupport for video encoder %s : [%s]\n", ccodec_name, rule.c_str());
+    SetError(-EINVAL);
+    return;
+  }
+
+  enc_param = separate_list.back();
+  std::map<std::string, std::string> enc_params;
+  if (!parse_media_param_map(enc_param.c_str(), enc_params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  if (enc_param.find(KEY_OUTPUTDATATYPE) == enc_param.npos)
+    PARAM_STRING_APPEND(enc_param, KEY_OUTPUTDATATYPE,
+                        params[KEY_OUTPUTDATATYPE]);
+  if (enc_params[KEY_INPUTDATATYPE].empty())
+    enc_params[KEY_INPUTDATATYPE] = params[KEY_INPUTDATATYPE];
+  if (enc_params[KEY_OUTPUTDATATYPE].empty())
+    enc_params[KEY_OUTPUTDATATYPE] = params[KEY_OUTPUTDATATYPE];
+  memset(&mc, 0, sizeof(mc));
+  if (!ParseMediaConfigFromMap(enc_params, mc) || mc.type != Type::Video) {
+    LOG("ERROR: VEnc Parallel Flow: need a video config\n");
+    SetError(-EINVAL);
+    return;
+  }
+  const std::string &output_dt = enc_params[KEY_OUTPUTDATATYPE];
+  if (output_dt == VIDEO_H264)
+    codec_type = CODEC_TYPE_H264;
+  else if (output_dt == VIDEO_H265)
+    codec_type = CODEC_TYPE_H265;
+
+  // fail here rather than on the first segment
+  auto encoder =
+      REFLECTOR(Encoder)::Create<VideoEncoder>(ccodec_name, enc_param.c_str());
+  if (!encoder || !encoder->InitConfig(mc)) {
+    LOG("Fail to create video encoder %s<%s>\n", ccodec_name,
+        enc_param.c_str());
+    SetError(-EINVAL);
+    return;
+  }
+  encoder.reset();
+
+  const std::string &workers_str = params[KEY_ENC_WORKERS];
+  if (!workers_str.empty())
+    worker_num = std::stoi(workers_str);
+  segment_frames = mc.vid_cfg.gop_size > 0 ? mc.vid_cfg.gop_size
+                                           : PARALLEL_ENC_DEFAULT_SEGMENT;
+  const std::string &segment_str = params[KEY_ENC_SEGMENT_FRAMES];
+  if (!segment_str.empty())
+    segment_frames = std::stoi(segment_str);
+  if (worker_num <= 0 || segment_frames <= 0) {
+    LOG("ERROR: VEnc Parallel Flow: workers %d or segment frames %d "
+        "invalid!\n",
+        worker_num, segment_frames);
+    SetError(-EINVAL);
+    return;
+  }
+  if (mc.vid_cfg.frame_rate <= 0)
+    mc.vid_cfg.frame_rate = 30;
+  if (mc.vid_cfg.frame_rate_den <= 0)
+    mc.vid_cfg.frame_rate_den = 1;
+
+  SlotMap sm;
+  sm.input_slots.push_back(0);
+  sm.output_slots.push_back(0);
+  sm.process = collect;
+  sm.thread_model = Model::ASYNCCOMMON;
+  // a file read must not lose frames, Submit() holds it back
+  sm.mode_when_full = InputMode::BLOCKING;
+  sm.input_maxcachenum.push_back(segment_frames);
+  if (!InstallSlotMap(sm, "ParallelVideoEncoderFlow", -1)) {
+    LOG("Fail to InstallSlotMap, %s\n", ccodec_name);
+    SetError(-EINVAL);
+    return;
+  }
+  for (int i = 0; i < worker_num; i++)
+    workers.emplace_back(&ParallelVideoEncoderFlow::WorkerRun, this);
+  LOG("VEnc Parallel Flow: %d workers, %d frames per segment\n", worker_num,
+      segment_frames);
+  SetFlowTag("ParallelVideoEncoderFlow");
+}
+
+ParallelVideoEncoderFlow::~ParallelVideoEncoderFlow() {
+  AutoPrintLine apl(__func__);
+  // the frames already taken still go out, by an eof through the flow thread
+  mtx.lock();
+  bool flush = !ended && !workers.empty() && IsEnable();
+  mtx.unlock();
+  if (flush) {
+    auto eos = std::make_shared<MediaBuffer>();
+    eos->SetEOF(true);
+    SendInput(eos, 0);
+    mtx.lock();
+    while (!ended)
+      mtx.wait();
+    mtx.unlock();
+  }
+  StopAllThread();
+  mtx.lock();
+  quit = true;
+  mtx.notify();
+  mtx.unlock();
+  for (auto &t : workers)
+    t.join();
+}
+
+bool ParallelVideoEncoderFlow::Encode(EncodeSegment &seg) {
+  auto enc =
+      REFLECTOR(Encoder)::Create<VideoEncoder>(codec_name.c_str(),
+                                               enc_param.c_str());
+  if (!enc || !enc->InitConfig(mc)) {
+    LOG("ERROR: VEnc Parallel Flow: segment %lld, fail to create encoder\n",
+        (long long)seg.index);
+    return false;
+  }
+  auto eos = std::make_shared<MediaBuffer>();
+  size_t n = 0;
+  while (true) {
+    const std::shared_ptr<MediaBuffer> &in =
+        n < seg.frames.size() ? seg.frames[n] : eos;
+    if (enc->SendInput(in) < 0) {
+      LOG("ERROR: VEnc Parallel Flow: segment %lld, frame %d encode failed\n",
+          (long long)seg.index, (int)n);
+      return false;
+    }
+    std::shared_ptr<MediaBuffer> out;
+    while ((out = enc->FetchOutput()) && !out->IsEOF()) {
+      if (out->GetValidSize() == 0)
+        continue;
+      if (codec_type != CODEC_TYPE_NONE)
+        BuildNaluIndex(out, codec_type);
+      seg.packets.push_back(out);
+    }
+    if (in == eos)
+      break;
+    // the frame is released as soon as encoded
+    seg.frames[n++].reset();
+  }
+  return true;
+}
+
+void ParallelVideoEncoderFlow::WorkerRun() {
+  while (true) {
+    EncodeSegmentPtr seg;
+    mtx.lock();
+    while (pending.empty() && !quit)
+      mtx.wait();
+    if (pending.empty()) {
+      mtx.unlock();
+      break;
+    }
+    seg = pending.front();
+    pending.pop_front();
+    mtx.unlock();
+
+    seg->failed = !Encode(*seg);
+    seg->frames.clear();
+    mtx.lock();
+    finished[seg->index] = seg;
+    in_flight--;
+    mtx.notify();
+    mtx.unlock();
+    // SetOutput() is for the flow thread only
+    WakeUp();
+  }
+}
+
+// at most worker_num segments held, each one is frames of raw picture
+void ParallelVideoEncoderFlow::Submit() {
+  if (!current)
+    return;
+  mtx.lock();
+  while (in_flight >= worker_num)
+    mtx.wait();
+  pending.push_back(current);
+  in_flight++;
+  mtx.notify();
+  mtx.unlock();
+  current.reset();
+}
+
+// the segments finished in order, on the flow thread
+void ParallelVideoEncoderFlow::Emit() {
+  while (true) {
+    EncodeSegmentPtr seg;
+    mtx.lock();
+    auto it = finished.find(next_emit);
+    if (it != finished.end()) {
+      seg = it->second;
+      finished.erase(it);
+      next_emit++;
+    }
+    mtx.unlock();
+    if (!seg)
+      break;
+    if (failed)
+      continue;
+    for (auto &packet : seg->packets)
+      SetOutput(packet, 0);
+    if (seg->failed) {
+      LOG("ERROR: VEnc Parallel Flow: stream ends at segment %lld\n",
+          (long long)seg->index);
+      failed = true;
+      auto eos = std::make_shared<MediaBuffer>();
+      eos->SetEOF(true);
+      SetOutput(eos, 0);
+      EndStream();
+    }
+  }
+}
+
+void ParallelVideoEncoderFlow::EndStream() {
+  mtx.lock();
+  ended = true;
+  mtx.notify();
+  mtx.unlock();
+}
+
+// the segment begun, then wait for all to go out
+void ParallelVideoEncoderFlow::Flush() {
+  Submit();
+  mtx.lock();
+  while (in_flight > 0)
+    mtx.wait();
+  mtx.unlock();
+  Emit();
+}
+
+bool collect(Flow *f, MediaBufferVector &input_vector) {
+  ParallelVideoEncoderFlow *pf = (ParallelVideoEncoderFlow *)f;
+  std::shared_ptr<MediaBuffer> &src = input_vector[0];
+  // woken by a worker
+  if (!src) {
+    pf->Emit();
+    return true;
+  }
+  // the eof went out already
+  if (pf->failed) {
+    pf->EndStream();
+    return false;
+  }
+  if (src->IsEOF() || src->GetValidSize() == 0) {
+    pf->Flush();
+    bool ret = pf->failed ? false : pf->SetOutput(src, 0);
+    pf->EndStream();
+    return ret;
+  }
+
+  if (pf->frame_num == 0)
+    pf->first_ts = src->GetUSTimeStamp();
+  // a shallow copy, the input may go to other flows
+  std::shared_ptr<MediaBuffer> frame;
+  if (src->GetType() == Type::Image)
+    frame = std::make_shared<ImageBuffer>(
+        *std::static_pointer_cast<ImageBuffer>(src));
+  else
+    frame = std::make_shared<MediaBuffer>(*src);
+  const VideoConfig &vcfg = pf->mc.vid_cfg;
+  frame->SetUSTimeStamp(pf->first_ts + pf->frame_num * 1000000LL *
+                                           vcfg.frame_rate_den /
+                                           vcfg.frame_rate);
+  pf->frame_num++;
+  if (pf->ended) {
+    pf->mtx.lock();
+    pf->ended = false;
+    pf->mtx.unlock();
+  }
+
+  if (!pf->current) {
+    pf->current = std::make_shared<EncodeSegment>();
+    pf->current->index = pf->segment_num++;
+    pf->current->failed = false;
+    pf->current->frames.reserve(pf->segment_frames);
+  }
+  pf->current->frames.push_back(frame);
+  if ((int)pf->current->frames.size() >= pf->segment_frames)
+    pf->Submit();
+  return true;
+}
+
+DEFINE_FLOW_FACTORY(ParallelVideoEncoderFlow, Flow)
+// type depends on encoder
+const char *FACTORY(ParallelVideoEncoderFlow)::ExpectedInputDataType() {
+  return "";
+}
+const char *FACTORY(ParallelVideoEncoderFlow)::OutPutDataType() { return ""; }
+
+} // namespace easymedia
@@ -16,6 +16,7 @@ public:
   virtual ~SourceStreamFlow();
   static const char *GetFlowName() { return "source_stream"; }
   virtual int Control(unsigned long int request, ...) final {
+    FLOW_CONTROL_BASE(request)
     if (!stream)
       return -1;
     va_list vl;
@@ -4,6 +4,8 @@
 
 #include <assert.h>
 
+#include <algorithm>
+
 #include "encoder.h"
 #include "flow.h"
 
@@ -48,6 +50,9 @@ private:
   bool extra_output;
   bool extra_merge;
   std::list<std::shared_ptr<MediaBuffer>> extra_buffer_list;
+  std::shared_ptr<SizeClassBufferPool> buffer_pool;
+  size_t out_buffer_size;
+  CodecType codec_type;
 #ifdef RK_MOVE_DETECTION
   MoveDetectionFlow *md_flow;
 #endif //RK_MOVE_DETECTION
@@ -63,7 +68,15 @@ bool encode(Flow *f, MediaBufferVector &input_vector) {
   if (!src)
     return false;
 
-  dst = std::make_shared<MediaBuffer>(); // TODO: buffer pool
+  if (vf->buffer_pool) {
+    dst = vf->buffer_pool->GetBuffer(vf->out_buffer_size, false);
+    // a valid size tells encoder to output into this buffer
+    if (dst)
+      dst->SetValidSize(dst->GetSize());
+  }
+  // without, the encoder hands over a buffer of its own
+  if (!dst)
+    dst = std::make_shared<MediaBuffer>();
   if (!dst) {
     LOG_NO_MEMORY();
     return false;
@@ -104,7 +117,7 @@ bool encode(Flow *f, MediaBufferVector &input_vector) {
           md_info->GetValidSize() / sizeof(INFO_LIST),
           md_info.get(), md_info->GetValidSize());
 #endif
-        if (md_info->GetSize() >= sizeof(INFO_LIST)) {
+        if (md_info->GetValidSize() >= sizeof(INFO_LIST)) {
 #ifndef NDEBUG
           INFO_LIST *info = (INFO_LIST *)md_info->GetPtr();
           while (info->flag) {
@@ -133,6 +146,9 @@ bool encode(Flow *f, MediaBufferVector &input_vector) {
   // when output fps less len input fps, enc->Proccess() may
   // return a empty mediabuff.
   if (dst->GetValidSize() > 0) {
+    // scan once here for all the consumers of the packet
+    if (vf->codec_type != CODEC_TYPE_NONE)
+      BuildNaluIndex(dst, vf->codec_type);
     ret = vf->SetOutput(dst, 0);
     if (vf->extra_output)
       ret &= vf->SetOutput(extra_dst, 1);
@@ -141,8 +157,24 @@ bool encode(Flow *f, MediaBufferVector &input_vector) {
   return ret;
 }
 
+// an intra frame may take this many times the average bytes of a frame
+#define ENC_INTRA_FRAME_RATIO 8
+
+// pool class of the packets, the larger ones are handed over by encoder
+static size_t packet_size_of_bit_rate(const VideoConfig &vcfg) {
+  size_t raw = CalPixFmtSize(vcfg.image_cfg.image_info);
+  int bps = vcfg.bit_rate_max > 0 ? vcfg.bit_rate_max : vcfg.bit_rate;
+  double fps = vcfg.frame_rate;
+  if (vcfg.frame_rate_den > 0)
+    fps /= vcfg.frame_rate_den;
+  if (bps <= 0 || fps <= 0)
+    return raw;
+  size_t size = (size_t)(bps / 8 / fps * ENC_INTRA_FRAME_RATIO);
+  return std::min(std::max(size, (size_t)4096), raw);
+}
+
 VideoEncoderFlow::VideoEncoderFlow(const char *param) : extra_output(false),
-    extra_merge(false)
+    extra_merge(false), out_buffer_size(0), codec_type(CODEC_TYPE_NONE)
 #ifdef  RK_MOVE_DETECTION
 , md_flow(nullptr)
 #endif
@@ -254,9 +286,40 @@ VideoEncoderFlow::VideoEncoderFlow(const char *param) : extra_output(false),
   encoder->GetExtraData(&extra_data, &extra_data_size);
   // TODO: if not h264
   const std::string &output_dt = enc_params[KEY_OUTPUTDATATYPE];
+  if (output_dt == VIDEO_H264)
+    codec_type = CODEC_TYPE_H264;
+  else if (output_dt == VIDEO_H265)
+    codec_type = CODEC_TYPE_H265;
 
   enc = encoder;
 
+  // Output buffers from pool. The default size of a video packet is from
+  // the bit rate, up to one raw frame. A larger packet, or one while the
+  // pool is exhausted, is handed over by the encoder in its own buffer.
+  std::string &mem_cnt = params[KEY_MEM_CNT];
+  if (!mem_cnt.empty()) {
+    std::string &mem_type = params[KEY_MEM_TYPE];
+    std::string &mem_size = params[KEY_MEM_SIZE_PERTIME];
+    if (!mem_size.empty())
+      out_buffer_size = std::stoi(mem_size);
+    else if (mc.type == Type::Image)
+      out_buffer_size = CalPixFmtSize(mc.img_cfg.image_info);
+    else
+      out_buffer_size = packet_size_of_bit_rate(mc.vid_cfg);
+    int m_cnt = std::stoi(mem_cnt);
+    if (m_cnt <= 0 || out_buffer_size <= 0) {
+      LOG("ERROR: VEnc Flow: mem_cnt %s or buffer size %zu invalid!\n",
+          mem_cnt.c_str(), out_buffer_size);
+      SetError(-EINVAL);
+      return;
+    }
+    MediaBuffer::MemType m_type =
+        StringToMemType(mem_type.empty() ? KEY_MEM_HARDWARE : mem_type.c_str());
+    buffer_pool = SizeClassBufferPool::GetShared(m_cnt, m_type);
+    LOG("VEnc Flow: Enable BufferPool! memcnt:%d, size:%zu\n", m_cnt,
+        out_buffer_size);
+  }
+
   SlotMap sm;
   sm.input_slots.push_back(0);
   sm.output_slots.push_back(0);
@@ -266,6 +329,8 @@ VideoEncoderFlow::VideoEncoderFlow(const char *param) : extra_output(false),
   }
   sm.process = encode;
   sm.thread_model = Model::ASYNCCOMMON;
+  if (params[KEK_THREAD_SYNC_MODEL] == KEY_POOLED)
+    sm.thread_model = Model::POOLED;
   sm.mode_when_full = InputMode::DROPFRONT;
   sm.input_maxcachenum.push_back(3);
   if (!InstallSlotMap(sm, "VideoEncoderFlow", 40)) {
@@ -305,6 +370,7 @@ VideoEncoderFlow::VideoEncoderFlow(const char *param) : extra_output(false),
 }
 
 int VideoEncoderFlow::Control(unsigned long int request, ...) {
+  FLOW_CONTROL_BASE(request)
   va_list ap;
   va_start(ap, request);
   auto value = va_arg(ap, std::shared_ptr<ParameterBuffer>);
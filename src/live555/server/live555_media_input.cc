@@ -5,11 +5,10 @@
 #include "live555_media_input.hh"
 
 #include <assert.h>
-#include <fcntl.h>
-#include <unistd.h>
 
 #include <algorithm>
 
+#include "broadcast_ring.h"
 #include "buffer.h"
 #include "codec.h"
 #include "utils.h"
@@ -17,38 +16,29 @@
 namespace easymedia {
 // A common "FramedSource" subclass, used for reading from a cached buffer list:
 
+#define MAX_CACHE_NUMBER 60
+// buffers kept for the slowest client
+#define RING_CAPACITY 1024
+
+static std::shared_ptr<BroadcastStream>
+create_stream(UsageEnvironment &env, size_t max_lag, bool gop_aware) {
+  auto stream = std::make_shared<BroadcastStream>(env, max_lag, gop_aware);
+  if (!stream->Init())
+    return nullptr;
+  return stream;
+}
+
 Live555MediaInput::Live555MediaInput(UsageEnvironment &env)
     : Medium(env), connecting(false), video_callback(nullptr),
-      audio_callback(nullptr), m_max_idr_size(0) {}
+      audio_callback(nullptr), m_max_idr_size(0) {
+  // late video clients jump to the newest IDR, others drop half
+  video_stream = create_stream(env, MAX_CACHE_NUMBER, true);
+  audio_stream = create_stream(env, MAX_CACHE_NUMBER, false);
+  muxer_stream = create_stream(env, MAX_CACHE_NUMBER, false);
+}
 
 Live555MediaInput::~Live555MediaInput() {
   LOG_FILE_FUNC_LINE();
-  video_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
-
-  audio_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
-
-  muxer_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
   connecting = false;
 }
 
@@ -67,99 +57,27 @@ Live555MediaInput *Live555MediaInput::createNew(UsageEnvironment &env) {
   return new Live555MediaInput(env);
 }
 
-#define MAX_CACHE_NUMBER 60
-static void common_reduction(void *userdata,
-                             std::list<std::shared_ptr<MediaBuffer>> &mb_list) {
-  Source *source = (Source *)userdata;
-  if (mb_list.size() > source->GetCachedBufSize()) {
-    for (unsigned i = 0; i < source->GetCachedBufSize() / 2; i++) {
-      mb_list.pop_front();
-      if (source) {
-        int j = 0;
-        ssize_t read_size = (ssize_t)sizeof(j);
-        ssize_t ret = read(source->GetReadFd(), &j, sizeof(j));
-        if (ret != read_size) {
-          LOG("%s:%d, read from pipe error, %m\n", __func__, __LINE__);
-        }
-      }
-    }
-    LOG("call common_reduction.\n");
-  }
-}
-
-static void
-h264_packet_reduction(void *userdata _UNUSED,
-                      std::list<std::shared_ptr<MediaBuffer>> &mb_list) {
-  if (mb_list.size() < MAX_CACHE_NUMBER)
-    return;
-  // only remain one I frame
-  auto i = mb_list.rbegin();
-  for (; i != mb_list.rend(); ++i) {
-    auto &b = *i;
-    if (b->GetUserFlag() & MediaBuffer::kIntra)
-      break;
-  }
-  if (i == mb_list.rend())
-    return;
-  auto iter = mb_list.begin();
-  for (; iter != mb_list.end(); ++iter) {
-    auto &b = *iter;
-    if (!(b->GetUserFlag() & MediaBuffer::kExtraIntra))
-      break;
-  }
-  LOG("h264 reduction before, num: %d \n", (int)mb_list.size());
-  mb_list.erase(iter, (++i).base());
-  LOG("h264 reduction after, num: %d \n", (int)mb_list.size());
-}
-
 FramedSource *Live555MediaInput::videoSource(CodecType c_type) {
-  // if (!video_source)
-  Source *source = new Source();
-  if (!source)
+  if (!video_stream)
     return nullptr;
-  ListReductionPtr func;
   if (c_type == CODEC_TYPE_JPEG)
-    func = common_reduction;
-  else
-    func = h264_packet_reduction;
-  if (!source->Init(func)) {
-    delete source;
-    return nullptr;
-  }
-  video_list.push_back(source);
-  if (c_type == CODEC_TYPE_JPEG) {
-    return new CommonFramedSource(envir(), *source);
-  } else {
-    VideoFramedSource *video_source = new VideoFramedSource(envir(), *source);
-    video_source->SetCodecType(c_type);
-    return video_source;
-  }
+    return new CommonFramedSource(envir(), video_stream);
+  VideoFramedSource *video_source =
+      new VideoFramedSource(envir(), video_stream);
+  video_source->SetCodecType(c_type);
+  return video_source;
 }
 
 FramedSource *Live555MediaInput::audioSource() {
-  Source *source = new Source();
-  if (!source)
+  if (!audio_stream)
     return nullptr;
-  if (!source->Init(common_reduction)) {
-    delete source;
-    return nullptr;
-  }
-  audio_list.push_back(source);
-  ListSource *audio_source = new CommonFramedSource(envir(), *source);
-  return audio_source;
+  return new CommonFramedSource(envir(), audio_stream);
 }
 
 FramedSource *Live555MediaInput::muxerSource() {
-  Source *source = new Source();
-  if (!source)
-    return nullptr;
-  if (!source->Init(common_reduction)) {
-    delete source;
+  if (!muxer_stream)
     return nullptr;
-  }
-  muxer_list.push_back(source);
-  ListSource *muxer_source = new CommonFramedSource(envir(), *source);
-  return muxer_source;
+  return new CommonFramedSource(envir(), muxer_stream);
 }
 #if 0
 static void printErr(UsageEnvironment& env, char const* str = NULL) {
@@ -170,69 +88,29 @@ static void printErr(UsageEnvironment& env, char const* str = NULL) {
 #endif
 
 void Live555MediaInput::PushNewVideo(std::shared_ptr<MediaBuffer> &buffer) {
-  if (!buffer)
+  if (!buffer || !video_stream)
     return;
   if ((buffer->GetUserFlag() & MediaBuffer::kIntra)) {
     if (m_max_idr_size < buffer->GetValidSize())
       m_max_idr_size = buffer->GetValidSize();
   }
-  video_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
-
-  for (auto video : video_list) {
-    if (video) {
-      if (!video->GetReadFdStatus()) {
-        video->Push(buffer);
-      }
-    }
-  }
+  video_stream->GetRing().Push(buffer);
 }
 
 void Live555MediaInput::PushNewAudio(std::shared_ptr<MediaBuffer> &buffer) {
-  if (!buffer)
+  if (!buffer || !audio_stream)
     return;
-  audio_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
-  for (auto audio : audio_list) {
-    if (audio) {
-      if (!audio->GetReadFdStatus()) {
-        audio->Push(buffer);
-      }
-    }
-  }
+  audio_stream->GetRing().Push(buffer);
 }
 
 void Live555MediaInput::PushNewMuxer(std::shared_ptr<MediaBuffer> &buffer) {
-  if (!buffer)
+  if (!buffer || !muxer_stream)
     return;
-  muxer_list.remove_if([](Source *s) {
-    if (s->GetReadFdStatus()) {
-      delete s;
-      return true;
-    } else {
-      return false;
-    }
-  });
-  for (auto muxer : muxer_list) {
-    if (muxer) {
-      if (!muxer->GetReadFdStatus()) {
-        muxer->SetCachedBufSize(buffer->GetValidSize());
-        muxer->Push(buffer);
-      }
-    }
-  }
+  // max: 5 M/s
+  size_t size = buffer->GetValidSize();
+  if (size > 0)
+    muxer_stream->GetRing().SetMaxLag(1024 * 1024 * 5 / size);
+  muxer_stream->GetRing().Push(buffer);
 }
 void Live555MediaInput::SetStartVideoStreamCallback(
     const StartStreamCallback &cb) {
@@ -253,100 +131,101 @@ StartStreamCallback Live555MediaInput::GetStartAudioStreamCallback() {
   return audio_callback;
 }
 
+void Live555MediaInput::SetVideoGopCache(size_t bytes) {
+  if (video_stream)
+    video_stream->GetRing().SetGopCache(bytes);
+}
+
 unsigned Live555MediaInput::getMaxIdrSize() {
   return (m_max_idr_size * 13 / 10) * 3 * 2 / 25;
 }
-Source::Source()
-    : reduction(nullptr), m_cached_buffers_size(MAX_CACHE_NUMBER),
-      m_read_fd_status(false) {
-  wakeFds[0] = wakeFds[1] = -1;
-  LOG("Source :: %p wakeFds[0] = %d, wakeFds[1]= %d.\n", this, wakeFds[0],
-      wakeFds[1]);
+BroadcastStream::BroadcastStream(UsageEnvironment &env, size_t max_lag,
+                                 bool gop_aware)
+    : fEnv(env), ring(new BroadcastRing(RING_CAPACITY, max_lag, gop_aware)),
+      handling(false) {}
+
+BroadcastStream::~BroadcastStream() {
+  if (handling)
+    fEnv.taskScheduler().turnOffBackgroundReadHandling(ring->GetEventFd());
 }
 
-void Source::CloseReadFd() {
-  if (wakeFds[0] >= 0) {
-    m_read_fd_status = true;
+bool BroadcastStream::Init() { return ring->Init(); }
+
+void BroadcastStream::Wait(ListSource *source) {
+  waiting.push_back(source);
+  // pushed before the wait
+  if (source->fSource.HasData())
+    ring->Notify();
+  if (!handling) {
+    fEnv.taskScheduler().turnOnBackgroundReadHandling(
+        ring->GetEventFd(),
+        (TaskScheduler::BackgroundHandlerProc *)&incomingDataHandler, this);
+    handling = true;
   }
 }
 
-Source::~Source() {
-  if (wakeFds[0] >= 0) {
-    ::close(wakeFds[0]);
-    wakeFds[0] = -1;
-  }
-  if (wakeFds[1] >= 0) {
-    ::close(wakeFds[1]);
-    wakeFds[1] = -1;
-  }
-  LOG("~Source::%p remain %d buffers, will auto release\n", this,
-      (int)cached_buffers.size());
+void BroadcastStream::Cancel(ListSource *source) {
+  waiting.remove(source);
+  delivering.remove(source);
+}
+
+void BroadcastStream::incomingDataHandler(BroadcastStream *stream,
+                                          int /*mask*/) {
+  stream->incomingDataHandler1();
 }
 
-bool Source::Init(ListReductionPtr func) {
-  // create pipe fds
-  int ret = pipe2(wakeFds, O_CLOEXEC);
-  if (ret) {
-    LOG("pipe2 failed: %m\n");
-    return false;
+void BroadcastStream::incomingDataHandler1() {
+  ring->ClearEvent();
+  for (auto it = waiting.begin(); it != waiting.end();) {
+    if ((*it)->fSource.HasData()) {
+      delivering.push_back(*it);
+      it = waiting.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  // a source may wait again or be closed while delivering
+  while (!delivering.empty()) {
+    ListSource *source = delivering.front();
+    delivering.pop_front();
+    source->incomingDataHandler1();
   }
-  assert(wakeFds[0] >= 0 && wakeFds[1] >= 0);
-  reduction = func;
-  return true;
-}
-
-void Source::Push(std::shared_ptr<MediaBuffer> &buffer) {
-  AutoLockMutex _alm(mtx);
-  if (reduction)
-    reduction(this, cached_buffers);
-  cached_buffers.push_back(buffer);
-  // mtx.notify();
-  int i = 0;
-  ssize_t count = write(wakeFds[1], &i, sizeof(i));
-  if (count < 0) {
-    LOG("write failed: %s, %p, fd = %d\n", strerror(errno), this, wakeFds[1]);
+  if (waiting.empty() && handling) {
+    fEnv.taskScheduler().turnOffBackgroundReadHandling(ring->GetEventFd());
+    handling = false;
   }
 }
 
-std::shared_ptr<MediaBuffer> Source::Pop() {
-  AutoLockMutex _alm(mtx);
-  if (cached_buffers.empty())
-    return nullptr;
-  auto buffer = cached_buffers.front();
-  cached_buffers.pop_front();
-  return std::move(buffer);
-}
+Source::Source(const std::shared_ptr<BroadcastStream> &s)
+    : stream(s), reader_id(s->GetRing().AddReader()) {}
 
-void Source::SetCachedBufSize(size_t one_buf_size) {
-  // max: 5 M/s
-  if (one_buf_size > 0)
-    m_cached_buffers_size = 1024 * 1024 * 5 / one_buf_size;
+Source::~Source() {
+  BroadcastRing &ring = stream->GetRing();
+  int64_t drop_num = ring.GetDropNum(reader_id);
+  if (drop_num > 0)
+    LOG("~Source::%p dropped %lld buffers for lag\n", this,
+        (long long)drop_num);
+  ring.RemoveReader(reader_id);
 }
-void ListSource::doGetNextFrame() {
-  assert(fSource.GetReadFd() >= 0);
-  // Await the next incoming data on our FID:
-  envir().taskScheduler().turnOnBackgroundReadHandling(
-      fSource.GetReadFd(),
-      (TaskScheduler::BackgroundHandlerProc *)&incomingDataHandler, this);
+
+std::shared_ptr<MediaBuffer> Source::Pop() {
+  return stream->GetRing().Pop(reader_id);
 }
 
+bool Source::HasData() { return stream->GetRing().HasData(reader_id); }
+
+void ListSource::doGetNextFrame() { fSource.GetStream().Wait(this); }
+
 void ListSource::doStopGettingFrames() {
   LOG_FILE_FUNC_LINE();
+  fSource.GetStream().Cancel(this);
   FramedSource::doStopGettingFrames();
 }
 
-void ListSource::incomingDataHandler(ListSource *source, int /*mask*/) {
-  source->incomingDataHandler1();
-}
-
 void ListSource::incomingDataHandler1() {
-  // Read the data from our file into the client's buffer:
+  // Read the data from our list into the client's buffer:
   readFromList();
 
-  assert(fSource.GetReadFd() >= 0);
-  // Stop handling any more input, until we're ready again:
-  envir().taskScheduler().turnOffBackgroundReadHandling(fSource.GetReadFd());
-
   // Tell our client that we have new data:
   afterGetting(this);
 }
@@ -359,8 +238,9 @@ void ListSource::flush() {
   fNumTruncatedBytes = 0;
 }
 
-VideoFramedSource::VideoFramedSource(UsageEnvironment &env, Source &source)
-    : ListSource(env, source), got_iframe(false) {
+VideoFramedSource::VideoFramedSource(
+    UsageEnvironment &env, const std::shared_ptr<BroadcastStream> &stream)
+    : ListSource(env, stream), got_iframe(false) {
   // fReadFd = input.vs->GetReadFd();
 }
 
@@ -374,15 +254,7 @@ bool VideoFramedSource::readFromList(bool flush _UNUSED) {
   fprintf(stderr, "$$$$ %s, %d\n", __func__, __LINE__);
 #endif
   std::shared_ptr<MediaBuffer> buffer;
-  int i = 0;
-  ssize_t read_size = (ssize_t)sizeof(i);
-  ssize_t ret = read(fSource.GetReadFd(), &i, sizeof(i));
-  if (ret != read_size) {
-    LOG("video %s:%d, fd = %d. read from pipe error, %m\n", __func__, __LINE__,
-        fSource.GetReadFd());
-    envir() << __LINE__ << " read from pipe error: " << errno << "\n";
-    goto err;
-  }
+  ssize_t read_size;
 
   buffer = fSource.Pop();
   if (buffer) {
@@ -441,8 +313,9 @@ err:
   return false;
 }
 
-CommonFramedSource::CommonFramedSource(UsageEnvironment &env, Source &source)
-    : ListSource(env, source) {
+CommonFramedSource::CommonFramedSource(
+    UsageEnvironment &env, const std::shared_ptr<BroadcastStream> &stream)
+    : ListSource(env, stream) {
   // fReadFd = input.as->GetReadFd();
 }
 
@@ -462,16 +335,6 @@ bool CommonFramedSource::readFromList(bool flush _UNUSED) {
   std::shared_ptr<MediaBuffer> buffer;
   uint8_t *p;
 
-  int i = 0;
-  ssize_t read_size = (ssize_t)sizeof(i);
-  ssize_t ret = read(fSource.GetReadFd(), &i, sizeof(i));
-  if (ret != read_size) {
-    LOG("common %s:%d, fd = %d. read from pipe error, %m\n", __func__, __LINE__,
-        fSource.GetReadFd());
-    envir() << __LINE__ << " read from pipe error: " << errno << "\n";
-    goto err;
-  }
-
   buffer = fSource.Pop();
   if (buffer) {
     p = (uint8_t *)buffer->GetPtr();
@@ -508,7 +371,6 @@ bool CommonFramedSource::readFromList(bool flush _UNUSED) {
     return true;
   }
 
-err:
   fFrameSize = 0;
   fNumTruncatedBytes = 0;
   return false;
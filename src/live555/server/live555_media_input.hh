@@ -18,35 +18,49 @@
 namespace easymedia {
 
 class MediaBuffer;
+class BroadcastRing;
+class ListSource;
 class VideoFramedSource;
 class CommonFramedSource;
-using ListReductionPtr = std::add_pointer<void(
-    void *userdata, std::list<std::shared_ptr<MediaBuffer>> &mb_list)>::type;
 
 // using StartStreamCallback = std::add_pointer<void(void)>::type;
 typedef std::function<void()> StartStreamCallback;
 
+// One BroadcastRing per stream for all clients. Its eventfd wakes up the
+// sources waiting in the live555 event loop, instead of a pipe per client.
+class BroadcastStream {
+public:
+  BroadcastStream(UsageEnvironment &env, size_t max_lag, bool gop_aware);
+  ~BroadcastStream();
+  bool Init();
+  BroadcastRing &GetRing() { return *ring; }
+  // in live555 thread
+  void Wait(ListSource *source);
+  void Cancel(ListSource *source);
+
+private:
+  static void incomingDataHandler(BroadcastStream *stream, int mask);
+  void incomingDataHandler1();
+
+  UsageEnvironment &fEnv;
+  std::unique_ptr<BroadcastRing> ring;
+  std::list<ListSource *> waiting;
+  std::list<ListSource *> delivering;
+  bool handling;
+};
+
+// the reader of one client
 class Source {
 public:
-  Source();
+  Source(const std::shared_ptr<BroadcastStream> &s);
   ~Source();
-  bool Init(ListReductionPtr func = nullptr);
-  void Push(std::shared_ptr<easymedia::MediaBuffer> &);
   std::shared_ptr<MediaBuffer> Pop();
-  int GetReadFd() { return wakeFds[0]; }
-  int GetWriteFd() { return wakeFds[1]; }
-  Boolean GetReadFdStatus() { return m_read_fd_status; }
-  void CloseReadFd();
-  unsigned GetCachedBufSize() { return m_cached_buffers_size; }
-  void SetCachedBufSize(size_t one_buf_size);
+  bool HasData();
+  BroadcastStream &GetStream() { return *stream; }
 
 private:
-  std::list<std::shared_ptr<MediaBuffer>> cached_buffers;
-  ConditionLockMutex mtx;
-  ListReductionPtr reduction;
-  int wakeFds[2]; // Live555's EventTrigger is poor for multithread, use fds
-  unsigned m_cached_buffers_size;
-  Boolean m_read_fd_status;
+  std::shared_ptr<BroadcastStream> stream;
+  int reader_id;
 };
 
 class Live555MediaInput : public Medium {
@@ -68,6 +82,8 @@ public:
   StartStreamCallback GetStartAudioStreamCallback();
 
   unsigned getMaxIdrSize();
+  // bytes of the newest gop kept for new video clients, 0 disables
+  void SetVideoGopCache(size_t bytes);
 
 protected:
   virtual ~Live555MediaInput();
@@ -75,9 +91,9 @@ protected:
 private:
   Live555MediaInput(UsageEnvironment &env);
 
-  std::list<Source *> video_list;
-  std::list<Source *> audio_list;
-  std::list<Source *> muxer_list;
+  std::shared_ptr<BroadcastStream> video_stream;
+  std::shared_ptr<BroadcastStream> audio_stream;
+  std::shared_ptr<BroadcastStream> muxer_stream;
   volatile bool connecting;
 
   StartStreamCallback video_callback;
@@ -93,31 +109,28 @@ private:
 
 class ListSource : public FramedSource {
 protected:
-  ListSource(UsageEnvironment &env, Source &source)
-      : FramedSource(env), fSource(source) {}
-  virtual ~ListSource() {
-    if (fSource.GetReadFd() >= 0)
-      envir().taskScheduler().turnOffBackgroundReadHandling(
-          fSource.GetReadFd());
-    fSource.CloseReadFd();
-  }
+  ListSource(UsageEnvironment &env,
+             const std::shared_ptr<BroadcastStream> &stream)
+      : FramedSource(env), fSource(stream) {}
+  virtual ~ListSource() { fSource.GetStream().Cancel(this); }
 
   virtual bool readFromList(bool flush = false) = 0;
   virtual void flush();
 
-  Source &fSource;
+  Source fSource;
 
 private: // redefined virtual functions:
   virtual void doGetNextFrame();
   virtual void doStopGettingFrames();
 
-  static void incomingDataHandler(ListSource *source, int mask);
+  friend class BroadcastStream;
   void incomingDataHandler1();
 };
 
 class VideoFramedSource : public ListSource {
 public:
-  VideoFramedSource(UsageEnvironment &env, Source &source);
+  VideoFramedSource(UsageEnvironment &env,
+                    const std::shared_ptr<BroadcastStream> &stream);
   virtual ~VideoFramedSource();
 
   void SetCodecType(CodecType type) { codec_type = type; }
@@ -131,7 +144,8 @@ protected: // redefined virtual functions:
 
 class CommonFramedSource : public ListSource {
 public:
-  CommonFramedSource(UsageEnvironment &env, Source &source);
+  CommonFramedSource(UsageEnvironment &env,
+                     const std::shared_ptr<BroadcastStream> &stream);
   virtual ~CommonFramedSource();
 
 protected: // redefined virtual functions:
@@ -37,6 +37,12 @@
 #include "media_reflector.h"
 #include "media_type.h"
 
+// hardware buffers the clients may hold before the rtsp flow copies them
+#define DEFAULT_HW_HOLD_NUM 4
+// a new client starts from the newest IDR instead of waiting for the next,
+// opt-in with gop_cache_size bytes, as it holds the gop buffers
+#define DEFAULT_GOP_CACHE_SIZE 0
+
 namespace easymedia {
 static bool SendMediaToServer(Flow *f, MediaBufferVector &input_vector);
 class RtspServerFlow : public Flow {
@@ -52,6 +58,9 @@ private:
   std::string channel_name;
   std::string video_type;
   std::string audio_type;
+  // views of hardware buffers for the clients
+  HwBufferHolder hw_holder;
+  bool gop_cache;
   friend bool SendMediaToServer(Flow *f, MediaBufferVector &input_vector);
   void CallPlayVideoHandler();
   void CallPlayAudioHandler();
@@ -63,24 +72,22 @@ bool SendMediaToServer(Flow *f, MediaBufferVector &input_vector) {
   for (auto &buffer : input_vector) {
     if (!buffer)
       continue;
-    if (buffer && buffer->IsHwBuffer()) {
-      // hardware buffer is limited, copy it
-      auto new_buffer = MediaBuffer::Clone(*buffer.get());
-      new_buffer->SetType(buffer->GetType());
-      buffer = new_buffer;
-    }
+    // the gop cache keeps a whole gop, which would pin more hardware
+    // buffers than the pool has
+    if (rtsp_flow->gop_cache && buffer->IsHwBuffer() &&
+        buffer->GetType() == Type::Video)
+      buffer = rtsp_flow->hw_holder.Copy(buffer);
+    else
+      buffer = rtsp_flow->hw_holder.Hold(buffer);
+    if (!buffer)
+      continue;
 
     if ((buffer->GetUserFlag() & MediaBuffer::kIntra)) {
       std::list<std::shared_ptr<easymedia::MediaBuffer>> spspps;
-      if (rtsp_flow->video_type == VIDEO_H264) {
-        spspps = split_h264_separate((const uint8_t *)buffer->GetPtr(),
-                                     buffer->GetValidSize(),
-                                     buffer->GetUSTimeStamp());
-      } else if (rtsp_flow->video_type == VIDEO_H265) {
-        spspps = split_h265_separate((const uint8_t *)buffer->GetPtr(),
-                                     buffer->GetValidSize(),
-                                     buffer->GetUSTimeStamp());
-      }
+      if (rtsp_flow->video_type == VIDEO_H264)
+        spspps = split_separate_view(buffer, CODEC_TYPE_H264);
+      else if (rtsp_flow->video_type == VIDEO_H265)
+        spspps = split_separate_view(buffer, CODEC_TYPE_H265);
       // Independently send vps, sps, pps packets to live555.
       for (auto &buf : spspps)
         rtsp_flow->server_input->PushNewVideo(buf);
@@ -100,7 +107,8 @@ bool SendMediaToServer(Flow *f, MediaBufferVector &input_vector) {
   return true;
 }
 
-RtspServerFlow::RtspServerFlow(const char *param) {
+RtspServerFlow::RtspServerFlow(const char *param)
+    : hw_holder(DEFAULT_HW_HOLD_NUM), gop_cache(false) {
   std::list<std::string> input_data_types;
   std::map<std::string, std::string> params;
   if (!parse_media_param_map(param, params)) {
@@ -135,6 +143,10 @@ RtspServerFlow::RtspServerFlow(const char *param) {
   if (!value.empty())
     bitrate = std::stoi(value);
 
+  value = params[KEY_HW_HOLD_NUM];
+  if (!value.empty())
+    hw_holder.SetMaxNum(std::stoi(value));
+
   if (rtspConnection) {
     int in_idx = 0;
     std::string markname;
@@ -155,6 +167,11 @@ RtspServerFlow::RtspServerFlow(const char *param) {
     server_input = rtspConnection->createNewChannel(
         channel_name, video_type, audio_type, channels, sample_rate, bitrate,
         profiles);
+    value = params[KEY_GOP_CACHE_SIZE];
+    size_t gop_cache_size =
+        value.empty() ? DEFAULT_GOP_CACHE_SIZE : std::stoul(value);
+    server_input->SetVideoGopCache(gop_cache_size);
+    gop_cache = gop_cache_size > 0;
     server_input->SetStartVideoStreamCallback(
         std::bind(&RtspServerFlow::CallPlayVideoHandler, this));
     server_input->SetStartAudioStreamCallback(
@@ -196,6 +213,9 @@ RtspServerFlow::~RtspServerFlow() {
   AutoPrintLine apl(__func__);
   StopAllThread();
   SetDisable();
+  if (hw_holder.GetCopiedBytes() > 0)
+    LOG("rtsp %s: copied %lld bytes of hardware buffers\n",
+        channel_name.c_str(), (long long)hw_holder.GetCopiedBytes());
   if (rtspConnection) {
     rtspConnection->removeChannel(channel_name);
   }
@@ -4,7 +4,12 @@
 
 #include "lock.h"
 
+#include <errno.h>
+#include <linux/futex.h>
 #include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace easymedia {
 
@@ -41,6 +46,10 @@ void ConditionLockMutex::unlock() {
 }
 void ConditionLockMutex::wait() { cond.wait(mtx); }
 void ConditionLockMutex::notify() { cond.notify_all(); }
+bool ConditionLockMutex::wait_for(int64_t timeout_us) {
+  return cond.wait_for(mtx, std::chrono::microseconds(timeout_us)) ==
+         std::cv_status::no_timeout;
+}
 
 ReadWriteLockMutex::ReadWriteLockMutex() : valid(true) {
   int ret = pthread_rwlock_init(&rwlock, NULL);
@@ -81,4 +90,39 @@ void SpinLockMutex::unlock() {
   flag.clear(std::memory_order_release);
 }
 
+uint32_t FutexEvent::PrepareWait() {
+  waiters.fetch_add(1, std::memory_order_relaxed);
+  // pairs with the fence in Notify, see the condition check of the caller
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return seq.load(std::memory_order_acquire);
+}
+
+void FutexEvent::CancelWait() {
+  waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool FutexEvent::Wait(uint32_t key, int timeout_ms) {
+  struct timespec ts;
+  struct timespec *pts = nullptr;
+  if (timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    pts = &ts;
+  }
+  int ret = syscall(SYS_futex, (int *)&seq, FUTEX_WAIT_PRIVATE, key, pts,
+                    nullptr, 0);
+  bool timeout = (ret < 0 && errno == ETIMEDOUT);
+  waiters.fetch_sub(1, std::memory_order_relaxed);
+  return !timeout;
+}
+
+void FutexEvent::Notify(int count) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters.load(std::memory_order_relaxed) <= 0)
+    return;
+  seq.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, (int *)&seq, FUTEX_WAKE_PRIVATE, count, nullptr,
+          nullptr, 0);
+}
+
 } // namespace easymedia
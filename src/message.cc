@@ -15,21 +15,23 @@
 
 namespace easymedia {
 
+EventHandler::EventHandler(size_t limit)
+    : process_(nullptr), event_thread_loop_(false), ring_(limit, true),
+      lifo_num_(0), pushed_(0), coalesced_(0), dropped_(0) {}
+
 void EventHandler::RegisterEventHook(std::shared_ptr<easymedia::Flow> flow,
                                           EventHook proc)
 {
   process_ = proc;
   event_thread_loop_ = true;
-  event_thread_.reset(new std::thread(process_, flow, std::ref(event_thread_loop_)));
+  event_thread_.reset(new std::thread(proc, flow, std::ref(event_thread_loop_)));
 }
 
 void EventHandler::UnRegisterEventHook()
 {
   if (event_thread_) {
     event_thread_loop_ = false;
-    event_cond_mtx_.lock();
-    event_cond_mtx_.notify();
-    event_cond_mtx_.unlock();
+    event_.Notify();
     event_thread_->join();
     event_thread_.reset(nullptr);
   }
@@ -37,66 +39,154 @@ void EventHandler::UnRegisterEventHook()
 
 void EventHandler::EventHookWait()
 {
-  AutoLockMutex _signal_mtx(event_cond_mtx_);
-  event_cond_mtx_.wait();
+  uint32_t key = event_.PrepareWait();
+  if (!event_thread_loop_ || !ring_.Empty() || lifo_num_ > 0) {
+    event_.CancelWait();
+    return;
+  }
+  event_.Wait(key);
 }
 
 void EventHandler::SignalEventHook()
 {
-  AutoLockMutex _signal_mtx(event_cond_mtx_);
-  event_cond_mtx_.notify();
+  event_.Notify();
 }
 
-MessagePtr EventHandler::GetEventMessage()
+int EventHandler::FindUniqueSlot(int id)
 {
-  AutoLockMutex _rw_mtx(event_queue_mtx_);
-  if (process_) {
-    if (event_msgs_.empty()) {
-      return nullptr;
-    }
-    auto msg = event_msgs_.front();
-    event_msgs_.erase(event_msgs_.begin());
-    return msg;
+  int start = (uint32_t)id * 2654435761U % EVENT_UNIQUE_SLOT_NUM;
+  for (int i = 0; i < EVENT_UNIQUE_SLOT_NUM; i++) {
+    int slot = (start + i) % EVENT_UNIQUE_SLOT_NUM;
+    int cur = unique_slots_[slot].id.load(std::memory_order_acquire);
+    if (cur == INT32_MIN &&
+        unique_slots_[slot].id.compare_exchange_strong(cur, id))
+      return slot;
+    if (cur == id)
+      return slot;
   }
-  return nullptr;
+  return -1;
+}
+
+MessagePtr EventHandler::TakeUniqueSlot(int slot)
+{
+  UniqueSlot &us = unique_slots_[slot];
+  AutoLockMutex _lm(us.mtx);
+  MessagePtr msg = std::move(us.msg);
+  us.queued = false;
+  us.merged = false;
+  return msg;
+}
+
+// The token of slot is dropped from the ring. A message merged after the
+// token was queued is newer than its place, keep it and return true, so
+// that the token is queued again.
+bool EventHandler::DropUniqueToken(int slot)
+{
+  MessagePtr msg; // freed out of the lock
+  UniqueSlot &us = unique_slots_[slot];
+  AutoLockMutex _lm(us.mtx);
+  if (us.merged) {
+    us.merged = false;
+    return true;
+  }
+  msg = std::move(us.msg);
+  us.queued = false;
+  return false;
 }
 
-void EventHandler::CleanRepeatMessage(MessagePtr msg)
+void EventHandler::PushEntry(const Entry &entry)
 {
-  for (auto iter = event_msgs_.cbegin();
-       iter != event_msgs_.cend();) {
-    auto tmp = *iter;
-    auto param = tmp->GetEventParam();
-    if (param->GetId() == msg->GetEventParam()->GetId()) {
-      iter = event_msgs_.erase(iter);
-    } else {
-      iter++;
+  if (ring_.TryPush(entry))
+    return;
+  // pushed from the top, the kept unique tokens before entry. A slot has
+  // one token at most, so they fit.
+  Entry pending[EVENT_UNIQUE_SLOT_NUM + 1];
+  int num = 0;
+  pending[num++] = entry;
+  while (num > 0) {
+    if (ring_.TryPush(pending[num - 1])) {
+      pending[--num] = Entry();
+      continue;
     }
+    Entry oldest;
+    if (!ring_.TryPop(oldest))
+      continue;
+    if (oldest.slot >= 0 && DropUniqueToken(oldest.slot))
+      pending[num++] = oldest;
+    else
+      dropped_++;
   }
 }
 
-void EventHandler::InsertMessage(MessagePtr msg, bool front)
+MessagePtr EventHandler::GetEventMessage()
 {
-  if (front) {
-    auto iter = event_msgs_.begin();
-    iter = event_msgs_.insert(iter, msg);
-  } else {
-    event_msgs_.push_back(msg);
+  if (!process_)
+    return nullptr;
+  if (lifo_num_ > 0) {
+    AutoLockMutex _lm(lifo_mtx_);
+    if (!lifo_msgs_.empty()) {
+      MessagePtr msg = std::move(lifo_msgs_.back());
+      lifo_msgs_.pop_back();
+      lifo_num_--;
+      return msg;
+    }
+  }
+  Entry entry;
+  while (ring_.TryPop(entry)) {
+    if (entry.slot < 0)
+      return entry.msg;
+    // empty if dropped meanwhile
+    MessagePtr msg = TakeUniqueSlot(entry.slot);
+    if (msg)
+      return msg;
   }
+  return nullptr;
 }
 
 void EventHandler::NotifyToEventHandler(MessagePtr msg)
 {
-  bool inser_front = false;
-  AutoLockMutex _rw_mtx(event_queue_mtx_);
-  if (process_) {
-    if (msg->GetType() == MESSAGE_TYPE_UNIQUE) {
-      CleanRepeatMessage(msg);
-    } else if (msg->GetType() == MESSAGE_TYPE_LIFO) {
-      inser_front = true;;
+  if (!process_)
+    return;
+  pushed_++;
+  if (msg->GetType() == MESSAGE_TYPE_LIFO) {
+    AutoLockMutex _lm(lifo_mtx_);
+    if (lifo_msgs_.size() >= EVENT_LIFO_LIMIT) {
+      lifo_msgs_.erase(lifo_msgs_.begin());
+      lifo_num_--;
+      dropped_++;
     }
-    InsertMessage(msg, inser_front);
+    lifo_msgs_.push_back(msg);
+    lifo_num_++;
+    return;
+  }
+  int slot = -1;
+  if (msg->GetType() == MESSAGE_TYPE_UNIQUE)
+    slot = FindUniqueSlot(msg->GetEventParam()->GetId());
+  if (slot < 0) {
+    PushEntry(Entry(msg, -1));
+    return;
   }
+  UniqueSlot &us = unique_slots_[slot];
+  bool queued;
+  us.mtx.lock();
+  queued = us.queued;
+  us.msg = msg;
+  us.queued = true;
+  us.merged = queued;
+  us.mtx.unlock();
+  if (queued)
+    coalesced_++;
+  else
+    PushEntry(Entry(nullptr, slot));
+}
+
+void EventHandler::GetStats(EventQueueStats &stats)
+{
+  stats.queued = ring_.Size() + lifo_num_;
+  stats.limit = ring_.Limit() + EVENT_LIFO_LIMIT;
+  stats.pushed = pushed_;
+  stats.coalesced = coalesced_;
+  stats.dropped = dropped_;
 }
 
 } // namespace easymedia
@@ -354,6 +354,13 @@ int MPPEncoder::Process(const std::shared_ptr<MediaBuffer> &input,
     last_ts = 0;
   }
 
+  if (output->IsValid() && !import_packet &&
+      packet_len > output->GetSize()) {
+    // hand over the packet instead, the output buffer goes back to its pool
+    LOG("WARN: MPP Encoder: packet %zu bytes over output buffer %zu\n",
+        packet_len, output->GetSize());
+    output->SetValidSize(0);
+  }
   if (output->IsValid()) {
     if (!import_packet) {
       // !!time-consuming operation
@@ -5,22 +5,22 @@
 #include <queue>
 
 #include "buffer.h"
+#include "draw_rect.h"
 #include "encoder.h"
 #include "filter.h"
 #include "lock.h"
 #include "media_config.h"
 
 #define YUV_PIXEL_RED ((0x4C << 16) | (0x54 << 8) | 0xFF)
+#define RGB_PIXEL_RED 0xFF0000
 
 namespace easymedia {
 
-static void draw_rect(std::shared_ptr<ImageBuffer> &buffer, Rect &rect,
-                      int thick);
-static int draw_nv12_rect(uint8_t *data, int img_w, int img_h, Rect &rect,
-                          int thick, int yuv_color);
+static void draw_rect(std::shared_ptr<ImageBuffer> &buffer,
+                      std::vector<Rect> &rects, int thick, int thread_num);
 static Rect combine_rect(std::vector<Rect> &rect);
-static void hw_draw_rect(uint8_t *data, int img_w, Rect &rect, int thick,
-                         int palette_index);
+static void hw_draw_rect(uint8_t *data, int img_w, int img_h, Rect &rect,
+                         int thick, int palette_index);
 
 class DrawFilter : public Filter {
 public:
@@ -44,6 +44,7 @@ private:
   bool enable_;
   bool need_hw_draw_;
   int draw_rect_thick_;
+  int draw_threads_;
   int draw_frame_rate_;
   int min_rect_size_;
   float offset_x_;
@@ -53,7 +54,8 @@ private:
 };
 
 DrawFilter::DrawFilter(const char *param)
-    : need_hw_draw_(false), draw_rect_thick_(2), draw_handler_(nullptr) {
+    : need_hw_draw_(false), draw_rect_thick_(2), draw_threads_(1),
+      draw_handler_(nullptr) {
   std::map<std::string, std::string> params;
   if (!parse_media_param_map(param, params)) {
     SetError(-EINVAL);
@@ -70,6 +72,10 @@ DrawFilter::DrawFilter(const char *param)
     draw_rect_thick_ = atoi(params[KEY_DRAW_RECT_THICK].c_str());
   }
 
+  const std::string &draw_threads = params[KEY_DRAW_THREADS];
+  if (!draw_threads.empty())
+    draw_threads_ = atoi(draw_threads.c_str());
+
   if (params[KEY_FRAME_RATE].empty()) {
     draw_frame_rate_ = 30;
   } else {
@@ -98,7 +104,8 @@ DrawFilter::DrawFilter(const char *param)
 }
 
 void DrawFilter::DoDrawRect(std::shared_ptr<ImageBuffer> &buffer, Rect &rect) {
-  draw_rect(buffer, rect, draw_rect_thick_);
+  std::vector<Rect> rects(1, rect);
+  draw_rect(buffer, rects, draw_rect_thick_, 1);
 }
 
 void DrawFilter::DoHwDrawRect(OsdRegionData *region_data, int enable) {
@@ -170,8 +177,8 @@ void DrawFilter::DoHwDraw(std::list<RknnResult> &nn_result) {
   }
   memset(osd_region_data.buffer, 0xFF, buffer_size);
   for (auto &rect : rects) {
-    hw_draw_rect(osd_region_data.buffer, osd_region_data.width, rect,
-                 draw_rect_thick_, color_index);
+    hw_draw_rect(osd_region_data.buffer, osd_region_data.width,
+                 osd_region_data.height, rect, draw_rect_thick_, color_index);
   }
   DoHwDrawRect(&osd_region_data);
 
@@ -182,12 +189,16 @@ void DrawFilter::DoHwDraw(std::list<RknnResult> &nn_result) {
 
 void DrawFilter::DoDraw(std::shared_ptr<ImageBuffer> &buffer,
                         std::list<RknnResult> &nn_result) {
-  for (auto info : nn_result) {
-    rockface_det_t face_det = info.face_info.base;
+  // all the boxes at once, so that many can be split over threads
+  std::vector<Rect> rects;
+  rects.reserve(nn_result.size());
+  for (auto &info : nn_result) {
+    rockface_det_t &face_det = info.face_info.base;
     Rect rect = {face_det.box.left, face_det.box.top, face_det.box.right,
                  face_det.box.bottom};
-    DoDrawRect(buffer, rect);
+    rects.push_back(rect);
   }
+  draw_rect(buffer, rects, draw_rect_thick_, draw_threads_);
 }
 
 void DrawFilter::ConvertRect(std::list<RknnResult> &nn_list) {
@@ -276,65 +287,33 @@ const char *FACTORY(DrawFilter)::ExpectedInputDataType() {
 }
 const char *FACTORY(DrawFilter)::OutPutDataType() { return TYPE_ANYTHING; }
 
-void draw_rect(std::shared_ptr<ImageBuffer> &buffer, Rect &rect, int thick) {
+void draw_rect(std::shared_ptr<ImageBuffer> &buffer, std::vector<Rect> &rects,
+               int thick, int thread_num) {
   ImageInfo info = buffer->GetImageInfo();
   uint8_t *img_data = (uint8_t *)buffer->GetPtr();
   int img_w = buffer->GetWidth();
   int img_h = buffer->GetHeight();
 
-  if (rect.right > img_w - thick) {
-    // LOG("draw_rect right > img_w\n");
-    rect.right = img_w - thick;
-  }
-  if (rect.left < 0) {
-    // LOG("draw_rect letf < 0\n");
-    rect.left = 0;
-  }
-  if (rect.bottom > img_h - thick) {
-    // LOG("draw_rect bottom > img_h\n");
-    rect.bottom = img_h - thick;
-  }
-  if (rect.top < 0) {
-    // LOG("draw_rect top < 0\n");
-    rect.top = 0;
+  for (auto &rect : rects) {
+    // keep the right and bottom edges in the image
+    if (rect.right > img_w - thick)
+      rect.right = img_w - thick;
+    if (rect.left < 0)
+      rect.left = 0;
+    if (rect.bottom > img_h - thick)
+      rect.bottom = img_h - thick;
+    if (rect.top < 0)
+      rect.top = 0;
   }
 
-  if (info.pix_fmt == PIX_FMT_NV12) {
-    draw_nv12_rect(img_data, img_w, img_h, rect, thick, YUV_PIXEL_RED);
-  } else {
+  // the edges included, thick + 1 wide as always
+  uint32_t color = (info.pix_fmt == PIX_FMT_RGB888 ||
+                    info.pix_fmt == PIX_FMT_BGR888)
+                       ? RGB_PIXEL_RED
+                       : YUV_PIXEL_RED;
+  if (draw_rect_borders(info, img_data, rects.data(), rects.size(), thick + 1,
+                        color, thread_num) < 0)
     LOG("RockFaceDebug:can't draw rect on this format yet!\n");
-  }
-}
-
-int draw_nv12_rect(uint8_t *data, int img_w, int img_h, Rect &rect, int thick,
-                   int yuv_color) {
-  int j, k;
-  int uv_offset = img_w * img_h;
-  int y_offset, u_offset, v_offset;
-  int rect_x, rect_y, rect_w, rect_h;
-  rect_x = rect.left;
-  rect_y = rect.top;
-  rect_w = rect.right - rect.left;
-  rect_h = rect.bottom - rect.top;
-
-  int y = (yuv_color >> 16) & 0xFF;
-  int u = (yuv_color >> 8) & 0xFF;
-  int v = (yuv_color >> 0) & 0xFF;
-
-  for (j = rect_y; j <= rect_y + rect_h; j++) {
-    for (k = rect_x; k <= rect_x + rect_w; k++) {
-      if (k <= (rect_x + thick) || k >= (rect_x + rect_w - thick) ||
-          j <= (rect_y + thick) || j >= (rect_y + rect_h - thick)) {
-        y_offset = j * img_w + k;
-        u_offset = (j >> 1) * img_w + k - k % 2 + uv_offset;
-        v_offset = u_offset + 1;
-        data[y_offset] = y;
-        data[u_offset] = u;
-        data[v_offset] = v;
-      }
-    }
-  }
-  return 0;
 }
 
 Rect combine_rect(std::vector<Rect> &rect) {
@@ -356,17 +335,11 @@ Rect combine_rect(std::vector<Rect> &rect) {
   return combine;
 }
 
-void hw_draw_rect(uint8_t *data, int img_w, Rect &rect, int thick, int index) {
-  int j, k, offset;
-  for (j = rect.top; j < rect.bottom; j++) {
-    for (k = rect.left; k < rect.right; k++) {
-      if (k < (rect.left + thick) || k > (rect.right - thick) ||
-          j < (rect.top + thick) || j > (rect.bottom - thick)) {
-        offset = j * img_w + k;
-        data[offset] = index;
-      }
-    }
-  }
+void hw_draw_rect(uint8_t *data, int img_w, int img_h, Rect &rect, int thick,
+                  int index) {
+  // right and bottom are past the edges
+  Rect border = {rect.left, rect.top, rect.right - 1, rect.bottom - 1};
+  draw_plane_rect(data, img_w, img_h, border, thick, index);
 }
 
 } // namespace easymedia
@@ -0,0 +1,179 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "draw_rect.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace easymedia {
+
+// a plane to draw on, x and y subsampled by 1 << xs and 1 << ys
+typedef struct {
+  uint8_t *base;
+  int stride; // bytes
+  int xs, ys;
+  int size;        // bytes of an element, a pixel or an uv pair
+  uint8_t pat[48]; // the color repeated, a multiple of 1, 2 and 3
+} DrawPlane;
+
+static void init_plane(DrawPlane &p, uint8_t *base, int stride, int xs,
+                       int ys, int size, const uint8_t *color) {
+  p.base = base;
+  p.stride = stride;
+  p.xs = xs;
+  p.ys = ys;
+  p.size = size;
+  for (int i = 0; i < (int)sizeof(p.pat); i++)
+    p.pat[i] = color[i % size];
+}
+
+// n elements of the plane color
+static inline void fill(const DrawPlane &p, uint8_t *dst, int n) {
+  // the strips of the vertical edges, a call costs more
+  if (n * p.size <= 8) {
+    for (int i = 0; i < n * p.size; i++)
+      dst[i] = p.pat[i];
+    return;
+  }
+  if (p.size == 1) {
+    memset(dst, p.pat[0], n);
+    return;
+  }
+  int bytes = n * p.size;
+  if (bytes <= (int)sizeof(p.pat)) {
+    memcpy(dst, p.pat, bytes);
+    return;
+  }
+  while (bytes >= (int)sizeof(p.pat)) {
+    memcpy(dst, p.pat, sizeof(p.pat));
+    dst += sizeof(p.pat);
+    bytes -= sizeof(p.pat);
+  }
+  memcpy(dst, p.pat, bytes);
+}
+
+// the rows [y0, y1) of the plane, in its own coordinates, of a rect already
+// clipped to the image
+static void draw_plane_rows(const DrawPlane &p, const Rect &r, int thick,
+                            int y0, int y1) {
+  int x0 = r.left >> p.xs, x1 = r.right >> p.xs;
+  // the vertical edges, in plane columns
+  int lx1 = std::min(r.left + thick - 1, r.right) >> p.xs;
+  int rx0 = std::max(r.right - thick + 1, r.left) >> p.xs;
+  // luma rows of the horizontal edges
+  int top_end = r.top + thick - 1, bottom_begin = r.bottom - thick + 1;
+  int first = std::max(y0, r.top >> p.ys);
+  int last = std::min(y1 - 1, r.bottom >> p.ys);
+  for (int y = first; y <= last; y++) {
+    uint8_t *row = p.base + y * p.stride;
+    // the luma rows of this plane row in the rect
+    int ly0 = std::max(y << p.ys, r.top);
+    int ly1 = std::min(((y + 1) << p.ys) - 1, r.bottom);
+    if (ly0 <= top_end || ly1 >= bottom_begin) {
+      fill(p, row + x0 * p.size, x1 - x0 + 1);
+    } else if (lx1 + 1 >= rx0) {
+      fill(p, row + x0 * p.size, x1 - x0 + 1);
+    } else {
+      fill(p, row + x0 * p.size, lx1 - x0 + 1);
+      fill(p, row + rx0 * p.size, x1 - rx0 + 1);
+    }
+  }
+}
+
+// luma rows [y0, y1) of all the rects, y0 and y1 even but the last
+static void draw_band(const DrawPlane *planes, int plane_num,
+                      const std::vector<Rect> &rects, int thick, int y0,
+                      int y1) {
+  for (int i = 0; i < plane_num; i++) {
+    const DrawPlane &p = planes[i];
+    int py0 = y0 >> p.ys;
+    int py1 = (y1 + (1 << p.ys) - 1) >> p.ys;
+    for (const Rect &r : rects)
+      draw_plane_rows(p, r, thick, py0, py1);
+  }
+}
+
+// clip to w x h, false if nothing left
+static bool clip_rect(const Rect &in, int w, int h, Rect &out) {
+  out.left = std::max(in.left, 0);
+  out.top = std::max(in.top, 0);
+  out.right = std::min(in.right, w - 1);
+  out.bottom = std::min(in.bottom, h - 1);
+  return out.left <= out.right && out.top <= out.bottom;
+}
+
+int draw_rect_borders(const ImageInfo &info, uint8_t *data, const Rect *rects,
+                      int num, int thick, uint32_t color, int thread_num) {
+  int vw = info.vir_width, vh = info.vir_height;
+  uint8_t c[3] = {(uint8_t)(color >> 16), (uint8_t)(color >> 8),
+                  (uint8_t)color};
+  DrawPlane planes[2];
+  int plane_num = 1;
+  switch (info.pix_fmt) {
+  case PIX_FMT_NV12:
+  case PIX_FMT_NV16:
+    init_plane(planes[0], data, vw, 0, 0, 1, c);
+    init_plane(planes[1], data + vw * vh, vw, 1,
+               info.pix_fmt == PIX_FMT_NV12 ? 1 : 0, 2, c + 1);
+    plane_num = 2;
+    break;
+  case PIX_FMT_RGB888:
+    init_plane(planes[0], data, vw * 3, 0, 0, 3, c);
+    break;
+  case PIX_FMT_BGR888: {
+    uint8_t bgr[3] = {c[2], c[1], c[0]};
+    init_plane(planes[0], data, vw * 3, 0, 0, 3, bgr);
+  } break;
+  default:
+    return -1;
+  }
+  if (thick <= 0)
+    return 0;
+
+  std::vector<Rect> clipped;
+  clipped.reserve(num);
+  for (int i = 0; i < num; i++) {
+    Rect r;
+    if (clip_rect(rects[i], info.width, info.height, r))
+      clipped.push_back(r);
+  }
+  int parts = std::min(thread_num, (int)clipped.size() /
+                                       DRAW_RECT_MIN_PER_THREAD);
+  if (parts <= 1) {
+    draw_band(planes, plane_num, clipped, thick, 0, info.height);
+    return 0;
+  }
+  // bands of even rows, so that no chroma row is shared
+  std::vector<std::thread> threads;
+  for (int i = 0; i < parts; i++) {
+    int y0 = (info.height * i / parts) & ~1;
+    if (i == parts - 1) {
+      draw_band(planes, plane_num, clipped, thick, y0, info.height);
+      break;
+    }
+    int y1 = (info.height * (i + 1) / parts) & ~1;
+    threads.emplace_back([=, &planes, &clipped] {
+      draw_band(planes, plane_num, clipped, thick, y0, y1);
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  return 0;
+}
+
+void draw_plane_rect(uint8_t *plane, int stride, int rows, const Rect &rect,
+                     int thick, uint8_t value) {
+  DrawPlane p;
+  Rect r;
+  if (thick <= 0 || !clip_rect(rect, stride, rows, r))
+    return;
+  init_plane(p, plane, stride, 0, 0, 1, &value);
+  draw_plane_rows(p, r, thick, 0, rows);
+}
+
+} // namespace easymedia
@@ -0,0 +1,34 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_DRAW_RECT_H_
+#define EASYMEDIA_DRAW_RECT_H_
+
+#include <stdint.h>
+
+#include "image.h"
+#include "rknn_user.h"
+
+// rects a draw thread takes at least
+#define DRAW_RECT_MIN_PER_THREAD 16
+
+namespace easymedia {
+
+// Border of thick pixels inside each rect, the right and bottom edges
+// included, clipped to the image. Only the border rows and columns are
+// written: a horizontal edge is a run per row, a vertical edge a strip of
+// thick pixels. A chroma sample is drawn if any of its luma pixels is.
+// color is 0xYYUUVV for NV12 and NV16, 0xRRGGBB for RGB888 and BGR888.
+// With many rects, the image is split in bands of rows over threads.
+// Return -1 if the format is not supported.
+int draw_rect_borders(const ImageInfo &info, uint8_t *data, const Rect *rects,
+                      int num, int thick, uint32_t color, int thread_num = 1);
+
+// the same on one 8 bit plane, stride x rows
+void draw_plane_rect(uint8_t *plane, int stride, int rows, const Rect &rect,
+                     int thick, uint8_t value);
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_DRAW_RECT_H_
@@ -0,0 +1,224 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "face_feature_index.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "utils.h"
+
+// floats per loop of dot()
+#define INDEX_ALIGN 16
+
+namespace easymedia {
+
+// n is a multiple of INDEX_ALIGN
+static inline float dot(const float *a, const float *b, size_t n) {
+#if defined(__SSE2__)
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  __m128 s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+  for (size_t i = 0; i < n; i += INDEX_ALIGN) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                   _mm_loadu_ps(b + i + 4)));
+    s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(a + i + 8),
+                                   _mm_loadu_ps(b + i + 8)));
+    s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(a + i + 12),
+                                   _mm_loadu_ps(b + i + 12)));
+  }
+  s0 = _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3));
+  float s[4];
+  _mm_storeu_ps(s, s0);
+  return (s[0] + s[1]) + (s[2] + s[3]);
+#elif defined(__ARM_NEON)
+  float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+  float32x4_t s2 = vdupq_n_f32(0), s3 = vdupq_n_f32(0);
+  for (size_t i = 0; i < n; i += INDEX_ALIGN) {
+    s0 = vmlaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));
+    s1 = vmlaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    s2 = vmlaq_f32(s2, vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+    s3 = vmlaq_f32(s3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+  }
+  s0 = vaddq_f32(vaddq_f32(s0, s1), vaddq_f32(s2, s3));
+  float32x2_t s = vadd_f32(vget_low_f32(s0), vget_high_f32(s0));
+  return vget_lane_f32(vpadd_f32(s, s), 0);
+#else
+  float s[4] = {0, 0, 0, 0};
+  for (size_t i = 0; i < n; i += 4) {
+    s[0] += a[i] * b[i];
+    s[1] += a[i + 1] * b[i + 1];
+    s[2] += a[i + 2] * b[i + 2];
+    s[3] += a[i + 3] * b[i + 3];
+  }
+  return (s[0] + s[1]) + (s[2] + s[3]);
+#endif
+}
+
+// keep out sorted ascending, at most k
+static inline void insert(FaceMatch *out, int *num, int k, int user_id,
+                          int version, float d2) {
+  if (*num == k && d2 >= out[k - 1].distance)
+    return;
+  int i = *num < k ? (*num)++ : k - 1;
+  for (; i > 0 && out[i - 1].distance > d2; i--)
+    out[i] = out[i - 1];
+  out[i].user_id = user_id;
+  out[i].version = version;
+  out[i].distance = d2;
+}
+
+FaceFeatureIndex::FaceFeatureIndex()
+    : dim(0), stride(0), thread_num(1), min_rows(FACE_INDEX_MIN_ROWS) {}
+
+bool FaceFeatureIndex::Add(int user_id, int version, const float *feature,
+                           int d) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  if (d <= 0 || (dim > 0 && d != dim)) {
+    LOG("face index: feature dim %d, expect %d\n", d, dim);
+    return false;
+  }
+  if (dim == 0) {
+    dim = d;
+    stride = (d + INDEX_ALIGN - 1) / INDEX_ALIGN * INDEX_ALIGN;
+  }
+  size_t row = user_ids.size();
+  matrix.resize((row + 1) * stride, 0);
+  float *p = matrix.data() + row * stride;
+  memcpy(p, feature, dim * sizeof(float));
+  norms.push_back(dot(p, p, stride));
+  user_ids.push_back(user_id);
+  versions.push_back(version);
+  return true;
+}
+
+void FaceFeatureIndex::Remove(int user_id) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  size_t row = 0;
+  while (row < user_ids.size()) {
+    if (user_ids[row] != user_id) {
+      row++;
+      continue;
+    }
+    // the last row fills the hole
+    size_t last = user_ids.size() - 1;
+    if (row != last) {
+      memcpy(matrix.data() + row * stride, matrix.data() + last * stride,
+             stride * sizeof(float));
+      norms[row] = norms[last];
+      user_ids[row] = user_ids[last];
+      versions[row] = versions[last];
+    }
+    matrix.resize(last * stride);
+    norms.pop_back();
+    user_ids.pop_back();
+    versions.pop_back();
+  }
+}
+
+void FaceFeatureIndex::Clear() {
+  std::lock_guard<std::mutex> _lg(mtx);
+  matrix.clear();
+  norms.clear();
+  user_ids.clear();
+  versions.clear();
+  dim = 0;
+  stride = 0;
+}
+
+size_t FaceFeatureIndex::Size() {
+  std::lock_guard<std::mutex> _lg(mtx);
+  return user_ids.size();
+}
+
+int FaceFeatureIndex::GetDim() {
+  std::lock_guard<std::mutex> _lg(mtx);
+  return dim;
+}
+
+void FaceFeatureIndex::SetThreads(int num, int rows) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  thread_num = std::max(num, 1);
+  min_rows = std::max(rows, 1);
+}
+
+// squared distances in out, under mtx
+void FaceFeatureIndex::Scan(const float *query, float query_norm,
+                            size_t begin, size_t end, int k, FaceMatch *out,
+                            int *num) {
+  *num = 0;
+  const float *p = matrix.data() + begin * stride;
+  for (size_t row = begin; row < end; row++, p += stride) {
+    float d2 = query_norm + norms[row] - 2 * dot(query, p, stride);
+    insert(out, num, k, user_ids[row], versions[row], std::max(d2, 0.0f));
+  }
+}
+
+int FaceFeatureIndex::Search(const float *feature, int d, int k,
+                             FaceMatch *out) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  size_t rows = user_ids.size();
+  if (k <= 0 || rows == 0 || d != dim)
+    return 0;
+  std::vector<float> query(stride, 0);
+  memcpy(query.data(), feature, dim * sizeof(float));
+  float query_norm = dot(query.data(), query.data(), stride);
+
+  size_t parts = std::min<size_t>(thread_num, rows / min_rows);
+  if (parts <= 1) {
+    int num;
+    Scan(query.data(), query_norm, 0, rows, k, out, &num);
+    for (int i = 0; i < num; i++)
+      out[i].distance = sqrtf(out[i].distance);
+    return num;
+  }
+  std::vector<FaceMatch> part_out(parts * k);
+  std::vector<int> part_num(parts);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < parts; i++) {
+    size_t begin = rows * i / parts, end = rows * (i + 1) / parts;
+    FaceMatch *o = part_out.data() + i * k;
+    int *n = &part_num[i];
+    if (i == parts - 1) {
+      Scan(query.data(), query_norm, begin, end, k, o, n);
+      break;
+    }
+    threads.emplace_back([=, &query] {
+      Scan(query.data(), query_norm, begin, end, k, o, n);
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  int num = 0;
+  for (size_t i = 0; i < parts; i++)
+    for (int j = 0; j < part_num[i]; j++) {
+      FaceMatch &m = part_out[i * k + j];
+      insert(out, &num, k, m.user_id, m.version, m.distance);
+    }
+  for (int i = 0; i < num; i++)
+    out[i].distance = sqrtf(out[i].distance);
+  return num;
+}
+
+bool FaceFeatureIndex::GetFeature(int user_id, float *feature) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  for (size_t row = 0; row < user_ids.size(); row++) {
+    if (user_ids[row] == user_id) {
+      memcpy(feature, matrix.data() + row * stride, dim * sizeof(float));
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace easymedia
@@ -0,0 +1,64 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_FACE_FEATURE_INDEX_H_
+#define EASYMEDIA_FACE_FEATURE_INDEX_H_
+
+#include <stddef.h>
+
+#include <mutex>
+#include <vector>
+
+// rows a scan thread takes at least
+#define FACE_INDEX_MIN_ROWS 8192
+
+namespace easymedia {
+
+typedef struct FaceMatch {
+  int user_id;
+  int version;
+  float distance; // l2
+} FaceMatch;
+
+// Resident copy of the face features as one float matrix, a row per user,
+// with the squared norm of each row. A search is one pass of dot products
+// over the matrix, split over threads if large, keeping the k nearest.
+class FaceFeatureIndex {
+public:
+  FaceFeatureIndex();
+  virtual ~FaceFeatureIndex() = default;
+  FaceFeatureIndex(const FaceFeatureIndex &) = delete;
+  FaceFeatureIndex &operator=(const FaceFeatureIndex &) = delete;
+
+  // the first feature sets the dimension, others are refused
+  bool Add(int user_id, int version, const float *feature, int dim);
+  void Remove(int user_id);
+  void Clear();
+  size_t Size();
+  int GetDim();
+  // at most thread_num threads, each one scans min_rows at least
+  void SetThreads(int thread_num, int min_rows = FACE_INDEX_MIN_ROWS);
+  // the k nearest in ascending distance, return the number found
+  int Search(const float *feature, int dim, int k, FaceMatch *out);
+  // copy the row of user_id, false if not found
+  bool GetFeature(int user_id, float *feature);
+
+private:
+  void Scan(const float *query, float query_norm, size_t begin, size_t end,
+            int k, FaceMatch *out, int *num);
+
+  std::mutex mtx;
+  int dim;
+  size_t stride; // dim rounded up to the simd width
+  std::vector<float> matrix;
+  std::vector<float> norms;
+  std::vector<int> user_ids;
+  std::vector<int> versions;
+  int thread_num;
+  int min_rows;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_FACE_FEATURE_INDEX_H_
@@ -2,68 +2,247 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "rockface_db_manager.h"
 #include "utils.h"
 
+#define DB_BUSY_TIMEOUT_MS 1000
+
 namespace easymedia {
 
-FaceDBManager::FaceDBManager(std::string path) {
-  int ret = sqlite3_open(path.c_str(), &sqlite_);
-  if (ret) {
-    LOG("sqlite3_open %s failed.\n", path.c_str());
+FaceDBManager::FaceDBManager(std::string path)
+    : path_(path), sqlite_(nullptr), insert_stmt_(nullptr),
+      delete_stmt_(nullptr), max_user_stmt_(nullptr), max_user_id_(-1),
+      read_sqlite_(nullptr), select_stmt_(nullptr), index_enabled_(false),
+      index_valid_(false), index_version_(0) {
+  if (!OpenDb())
     return;
+  max_user_id_ = GetMaxUserId();
+}
+
+// The sdk does not tell the layout of a feature. Those of another version,
+// or not all finite floats, are not for the l2 index.
+static bool is_float_feature(const rockface_feature_t *feature) {
+  if (feature->len <= 0 || feature->len > (int)sizeof(feature->feature) ||
+      feature->len % sizeof(float))
+    return false;
+  const float *f = (const float *)feature->feature;
+  for (size_t i = 0; i < feature->len / sizeof(float); i++) {
+    if (!isfinite(f[i]))
+      return false;
   }
-  if (sqlite_)
-    CreateTable();
+  return true;
 }
 
 FaceDBManager::~FaceDBManager() {
+  FinalizeStatements();
+  if (read_sqlite_)
+    sqlite3_close(read_sqlite_);
   if (sqlite_)
     sqlite3_close(sqlite_);
 }
 
+bool FaceDBManager::OpenDb(void) {
+  int ret = sqlite3_open(path_.c_str(), &sqlite_);
+  if (ret) {
+    LOG("sqlite3_open %s failed.\n", path_.c_str());
+    return false;
+  }
+  sqlite3_busy_timeout(sqlite_, DB_BUSY_TIMEOUT_MS);
+  // readers see the last commit while a writer goes on
+  if (!Exec("PRAGMA journal_mode=WAL;") || !Exec("PRAGMA synchronous=NORMAL;"))
+    LOG("%s: no WAL mode, the reads wait for the writes\n", path_.c_str());
+  CreateTable();
+
+  ret = sqlite3_open_v2(path_.c_str(), &read_sqlite_, SQLITE_OPEN_READWRITE,
+                        nullptr);
+  if (ret) {
+    LOG("sqlite3_open %s for read failed.\n", path_.c_str());
+    return false;
+  }
+  sqlite3_busy_timeout(read_sqlite_, DB_BUSY_TIMEOUT_MS);
+  return PrepareStatements();
+}
+
+bool FaceDBManager::Exec(const char *sql) {
+  char *error = nullptr;
+  int ret = sqlite3_exec(sqlite_, sql, nullptr, nullptr, &error);
+  if (ret != SQLITE_OK) {
+    LOG("sqlite3_exec %s failed, error = %s\n", sql, error);
+    sqlite3_free(error);
+    return false;
+  }
+  return true;
+}
+
+bool FaceDBManager::PrepareStatements(void) {
+  struct {
+    sqlite3 *db;
+    const char *sql;
+    sqlite3_stmt **stmt;
+  } stmts[] = {
+      {sqlite_,
+       "INSERT INTO FACE (USER, FEATURE_VERSION, FEATURE_COUNT, FEATURE) "
+       "VALUES (?, ?, ?, ?);",
+       &insert_stmt_},
+      {sqlite_, "DELETE FROM FACE WHERE USER = ?;", &delete_stmt_},
+      {sqlite_, "SELECT MAX(USER) FROM FACE;", &max_user_stmt_},
+      {read_sqlite_, "SELECT * FROM FACE;", &select_stmt_},
+  };
+  for (auto &s : stmts) {
+    int ret = sqlite3_prepare_v2(s.db, s.sql, -1, s.stmt, nullptr);
+    if (ret != SQLITE_OK) {
+      LOG("sqlite3_prepare_v2 %s failed, ret = %d\n", s.sql, ret);
+      return false;
+    }
+  }
+  return true;
+}
+
+void FaceDBManager::FinalizeStatements(void) {
+  sqlite3_finalize(insert_stmt_);
+  sqlite3_finalize(delete_stmt_);
+  sqlite3_finalize(max_user_stmt_);
+  sqlite3_finalize(select_stmt_);
+  insert_stmt_ = delete_stmt_ = max_user_stmt_ = select_stmt_ = nullptr;
+}
+
 int FaceDBManager::AddUser(rockface_feature_t *feature) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  FaceDb face_db;
-  face_db.user_id = GetMaxUserId() + 1;
-  memcpy(&face_db.feature, feature, sizeof(rockface_feature_t));
-  int ret = InsertFaceDb(&face_db);
-  if (ret < 0) {
+  std::vector<int> ids;
+  std::vector<rockface_feature_t> features(1);
+  memcpy(&features[0], feature, sizeof(rockface_feature_t));
+  if (AddUsers(features, &ids) != 1) {
     LOG("insert feature failed.\n");
     return -1;
   }
-  return face_db.user_id;
+  return ids[0];
 }
 
-int FaceDBManager::DeleteUser(int user_id) {
+int FaceDBManager::AddUsers(const std::vector<rockface_feature_t> &features,
+                            std::vector<int> *ids) {
   std::lock_guard<std::mutex> lock(mutex_);
-  char sq_buffer[SQ_BUFFER_LEN];
-  snprintf(sq_buffer, SQ_BUFFER_LEN, "DELETE from FACE WHERE USER='%d';",
-           user_id);
+  if (!insert_stmt_ || features.empty())
+    return features.empty() ? 0 : -1;
+  if (!Exec("BEGIN IMMEDIATE;"))
+    return -1;
+  std::vector<FaceDb> added(features.size());
+  int user_id = max_user_id_;
+  for (size_t i = 0; i < features.size(); i++) {
+    FaceDb &face_db = added[i];
+    face_db.user_id = ++user_id;
+    memcpy(&face_db.feature, &features[i], sizeof(rockface_feature_t));
+    if (InsertFaceDb(&face_db) < 0) {
+      Exec("ROLLBACK;");
+      return -1;
+    }
+  }
+  if (!Exec("COMMIT;")) {
+    Exec("ROLLBACK;");
+    return -1;
+  }
+  max_user_id_ = user_id;
+  for (FaceDb &face_db : added) {
+    if (index_valid_ && !AddToIndex(&face_db))
+      index_valid_ = false;
+    if (ids)
+      ids->push_back(face_db.user_id);
+  }
+  return added.size();
+}
 
-  char *error = nullptr;
-  int ret = sqlite3_exec(sqlite_, sq_buffer, nullptr, nullptr, &error);
-  if (ret != SQLITE_OK) {
-    LOG("sqlite3_exec failed, error = %s\n", error);
+int FaceDBManager::ReadFeatureFile(const std::string &path,
+                                   std::vector<rockface_feature_t> &features) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    LOG("open %s failed: %m\n", path.c_str());
     return -1;
   }
+  int ret = 0;
+  int32_t head[2];
+  size_t head_len;
+  while ((head_len = fread(head, 1, sizeof(head), fp)) > 0) {
+    rockface_feature_t feature;
+    feature.version = head[0];
+    feature.len = head[1];
+    if (head_len != sizeof(head) || feature.len <= 0 ||
+        feature.len > (int)sizeof(feature.feature) ||
+        fread(feature.feature, feature.len, 1, fp) != 1) {
+      LOG("%s: bad feature record at %d\n", path.c_str(), (int)ftell(fp));
+      ret = -1;
+      break;
+    }
+    features.push_back(feature);
+  }
+  fclose(fp);
+  return ret;
+}
+
+int FaceDBManager::ImportFeatures(std::string path) {
+  std::vector<rockface_feature_t> features;
+  int ret = 0;
+  DIR *dir = opendir(path.c_str());
+  if (dir) {
+    struct dirent *ent;
+    while ((ent = readdir(dir))) {
+      std::string file = path + "/" + ent->d_name;
+      // the file system may not give the type, or it is a link
+      if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK) {
+        struct stat st;
+        if (stat(file.c_str(), &st) || !S_ISREG(st.st_mode))
+          continue;
+      } else if (ent->d_type != DT_REG) {
+        continue;
+      }
+      ret = ReadFeatureFile(file, features);
+      if (ret)
+        break;
+    }
+    closedir(dir);
+  } else {
+    ret = ReadFeatureFile(path, features);
+  }
+  // all or nothing, AddUsers rolls back if an insert fails
+  if (ret) {
+    LOG("%s: nothing imported\n", path.c_str());
+    return -1;
+  }
+  int num = AddUsers(features);
+  LOG("%s: %d features imported\n", path.c_str(), num);
+  return num;
+}
+
+int FaceDBManager::DeleteUser(int user_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!delete_stmt_)
+    return -1;
+  sqlite3_bind_int(delete_stmt_, 1, user_id);
+  int ret = sqlite3_step(delete_stmt_);
+  sqlite3_reset(delete_stmt_);
+  if (ret != SQLITE_DONE) {
+    LOG("delete user %d failed, error = %s\n", user_id,
+        sqlite3_errmsg(sqlite_));
+    return -1;
+  }
+  index_.Remove(user_id);
+  // the id of the last user is given again
+  if (user_id == max_user_id_)
+    max_user_id_ = GetMaxUserId();
   return 0;
 }
 
 void FaceDBManager::ClearDb(void) {
   std::lock_guard<std::mutex> lock(mutex_);
-  char sq_buffer[SQ_BUFFER_LEN] = "DROP TABLE IF EXISTS FACE;";
-
-  char *error = nullptr;
-  int ret = sqlite3_exec(sqlite_, sq_buffer, nullptr, nullptr, &error);
-  if (ret != SQLITE_OK) {
-    LOG("sqlite3_exec failed, error = %s\n", error);
+  // not dropped, the prepared statements stay valid
+  if (!Exec("DELETE FROM FACE;"))
     return;
-  }
-  if (sqlite_)
-    CreateTable();
+  max_user_id_ = -1;
+  index_.Clear();
+  index_valid_ = index_enabled_;
 }
 
 void FaceDBManager::CreateTable(void) {
@@ -74,7 +253,8 @@ void FaceDBManager::CreateTable(void) {
       "USER INT,"
       "FEATURE_VERSION INT,"
       "FEATURE_COUNT INT,"
-      "FEATURE BLOB);";
+      "FEATURE BLOB);"
+      "CREATE INDEX IF NOT EXISTS FACE_USER ON FACE (USER);";
   int ret = sqlite3_exec(sqlite_, sq_buffer, nullptr, 0, &error);
   if (ret != SQLITE_OK) {
     LOG("sqlite3_exec error: %s\n", error);
@@ -101,46 +281,31 @@ int FaceDBManager::GetRecordCount(void) {
   return count;
 }
 
+// under mutex_
 int FaceDBManager::GetMaxUserId(void) {
-  sqlite3_stmt *stmt;
-  char sq_buffer[SQ_BUFFER_LEN] = "SELECT * FROM FACE;";
-
   int max_user = -1;
-  int ret = sqlite3_prepare_v2(sqlite_, sq_buffer, -1, &stmt, nullptr);
-  if (ret != SQLITE_OK) {
-    LOG("sqlite3_prepare failed. ret = %d\n", ret);
-    goto exit;
-  }
-  ret = sqlite3_step(stmt);
-  while (ret == SQLITE_ROW) {
-    int user_id = sqlite3_column_int(stmt, 1);
-    if (user_id > max_user)
-      max_user = user_id;
-    ret = sqlite3_step(stmt);
-  }
-exit:
-  sqlite3_finalize(stmt);
+  if (!max_user_stmt_)
+    return max_user;
+  if (sqlite3_step(max_user_stmt_) == SQLITE_ROW &&
+      sqlite3_column_type(max_user_stmt_, 0) != SQLITE_NULL)
+    max_user = sqlite3_column_int(max_user_stmt_, 0);
+  sqlite3_reset(max_user_stmt_);
   return max_user;
 }
 
+// on the reader connection, never waits for the writer
 std::vector<FaceDb> FaceDBManager::GetAllFaceDb(void) {
-  std::lock_guard<std::mutex> lock(mutex_);
-
-  sqlite3_stmt *stmt;
+  std::lock_guard<std::mutex> lock(read_mutex_);
   std::vector<FaceDb> face_db;
-  char sq_buffer[SQ_BUFFER_LEN] = "SELECT * FROM FACE;";
+  if (!select_stmt_)
+    return face_db;
 
-  int ret = sqlite3_prepare_v2(sqlite_, sq_buffer, -1, &stmt, nullptr);
-  if (ret != SQLITE_OK) {
-    LOG("sqlite3_prepare failed. ret = %d\n", ret);
-    goto exit;
-  }
-  ret = sqlite3_step(stmt);
+  int ret = sqlite3_step(select_stmt_);
   while (ret == SQLITE_ROW) {
-    int user = sqlite3_column_int(stmt, 1);
-    int feature_version = sqlite3_column_int(stmt, 2);
-    int feature_len = sqlite3_column_int(stmt, 3);
-    const void *feature = sqlite3_column_blob(stmt, 4);
+    int user = sqlite3_column_int(select_stmt_, 1);
+    int feature_version = sqlite3_column_int(select_stmt_, 2);
+    int feature_len = sqlite3_column_int(select_stmt_, 3);
+    const void *feature = sqlite3_column_blob(select_stmt_, 4);
 
     FaceDb face;
     face.user_id = user;
@@ -148,39 +313,110 @@ std::vector<FaceDb> FaceDBManager::GetAllFaceDb(void) {
     face.feature.len = feature_len;
     memcpy(face.feature.feature, feature, feature_len);
     face_db.push_back(face);
-    ret = sqlite3_step(stmt);
+    ret = sqlite3_step(select_stmt_);
   }
-exit:
-  sqlite3_finalize(stmt);
-  return std::move(face_db);
+  if (ret != SQLITE_DONE)
+    LOG("sqlite3_step failed. ret = %d\n", ret);
+  sqlite3_reset(select_stmt_);
+  return face_db;
 }
 
+std::vector<FaceDb> FaceDBManager::GetNearestFaceDb(rockface_feature_t *feature,
+                                                    int k) {
+  if (!index_valid_ || feature->version != index_version_ ||
+      feature->len != index_.GetDim() * (int)sizeof(float) ||
+      !is_float_feature(feature))
+    return GetAllFaceDb();
+
+  std::vector<FaceMatch> matches(k);
+  int num = index_.Search((const float *)feature->feature,
+                          feature->len / sizeof(float), k, matches.data());
+  std::vector<FaceDb> face_db;
+  for (int i = 0; i < num; i++) {
+    FaceDb face;
+    face.user_id = matches[i].user_id;
+    face.feature.version = matches[i].version;
+    face.feature.len = feature->len;
+    if (index_.GetFeature(face.user_id, (float *)face.feature.feature))
+      face_db.push_back(face);
+  }
+  return face_db;
+}
+
+void FaceDBManager::EnableIndex(bool enable) {
+  if (enable) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      index_enabled_ = true;
+    }
+    LoadIndex();
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  index_enabled_ = false;
+  index_valid_ = false;
+  index_.Clear();
+}
+
+void FaceDBManager::SetIndexThreads(int thread_num) {
+  index_.SetThreads(thread_num);
+}
+
+// under mutex_
+bool FaceDBManager::AddToIndex(FaceDb *face_db) {
+  if (!is_float_feature(&face_db->feature)) {
+    LOG("feature of user %d is not floats, no index\n", face_db->user_id);
+    return false;
+  }
+  if (index_.Size() && face_db->feature.version != index_version_) {
+    LOG("feature version %d of user %d is not %d, no index\n",
+        face_db->feature.version, face_db->user_id, index_version_.load());
+    return false;
+  }
+  if (!index_.Add(face_db->user_id, face_db->feature.version,
+                  (const float *)face_db->feature.feature,
+                  face_db->feature.len / sizeof(float)))
+    return false;
+  index_version_ = face_db->feature.version;
+  return true;
+}
+
+void FaceDBManager::LoadIndex(void) {
+  std::vector<FaceDb> vec = GetAllFaceDb();
+  std::lock_guard<std::mutex> lock(mutex_);
+  index_.Clear();
+  index_valid_ = index_enabled_;
+  if (!index_enabled_)
+    return;
+  for (FaceDb &face : vec) {
+    if (!AddToIndex(&face)) {
+      index_.Clear();
+      index_valid_ = false;
+      break;
+    }
+  }
+  LOG("face index: %d features loaded\n", (int)index_.Size());
+}
+
+// under mutex_, in a transaction
 int FaceDBManager::InsertFaceDb(FaceDb *face_db) {
   if (!face_db)
     return -1;
 
-  char sq_buffer[SQ_BUFFER_LEN] = {0};
-  snprintf(sq_buffer, SQ_BUFFER_LEN,
-           "INSERT INTO FACE (USER, FEATURE_VERSION, FEATURE_COUNT, FEATURE) "
-           "VALUES (%d, %d, %d, ? );",
-           face_db->user_id, face_db->feature.version, face_db->feature.len);
-
-  sqlite3_stmt *stmt;
-  int ret = sqlite3_prepare_v2(sqlite_, sq_buffer, -1, &stmt, nullptr);
-  if (ret != SQLITE_OK) {
-    LOG("sqlite3_prepare_v2 failed. ret = %d\n", ret);
-    goto error;
-  }
-  ret = sqlite3_bind_blob(stmt, 1, face_db->feature.feature,
-                          face_db->feature.len, nullptr);
-  if (ret != SQLITE_OK) {
-    LOG("sqlite3_bind_blob failed, ret = %d\n", ret);
-    goto error;
+  sqlite3_bind_int(insert_stmt_, 1, face_db->user_id);
+  sqlite3_bind_int(insert_stmt_, 2, face_db->feature.version);
+  sqlite3_bind_int(insert_stmt_, 3, face_db->feature.len);
+  sqlite3_bind_blob(insert_stmt_, 4, face_db->feature.feature,
+                    face_db->feature.len, SQLITE_STATIC);
+  int ret = sqlite3_step(insert_stmt_);
+  sqlite3_reset(insert_stmt_);
+  sqlite3_clear_bindings(insert_stmt_);
+  if (ret != SQLITE_DONE) {
+    LOG("insert user %d failed, error = %s\n", face_db->user_id,
+        sqlite3_errmsg(sqlite_));
+    return -1;
   }
-  sqlite3_step(stmt);
-error:
-  sqlite3_finalize(stmt);
-  return ret;
+  return 0;
 }
 
 } // namespace easymedia
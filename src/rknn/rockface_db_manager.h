@@ -2,12 +2,15 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <atomic>
 #include <mutex>
 #include <rockface/rockface.h>
 #include <sqlite3.h>
 #include <string>
 #include <vector>
 
+#include "face_feature_index.h"
+
 namespace easymedia {
 
 typedef struct FaceDb {
@@ -15,30 +18,68 @@ typedef struct FaceDb {
   int user_id;
 } FaceDb;
 
+// The database is in WAL mode, the writes go through one connection with
+// its statements prepared once, the reads through another one, so that
+// enrolment does not block recognition.
 class FaceDBManager {
 public:
   FaceDBManager(std::string path);
   virtual ~FaceDBManager();
 
   int AddUser(rockface_feature_t *feature);
+  // in one transaction, return the number added, the user ids in ids
+  int AddUsers(const std::vector<rockface_feature_t> &features,
+               std::vector<int> *ids = nullptr);
+  // A feature file, or a directory of them. A file is records of
+  // int32 version, int32 len and len bytes of feature. Return the number
+  // added, or -1 with none added if a file can not be read or is malformed.
+  int ImportFeatures(std::string path);
   int DeleteUser(int user_id);
 
   std::vector<FaceDb> GetAllFaceDb(void);
+  // the k nearest from the resident index, all if it can not serve
+  std::vector<FaceDb> GetNearestFaceDb(rockface_feature_t *feature, int k);
+  // off by default, the index assumes raw float features
+  void EnableIndex(bool enable);
+  void SetIndexThreads(int thread_num);
   void ClearDb(void);
 
 #define SQ_BUFFER_LEN (1024)
 
 protected:
+  bool OpenDb(void);
   void CreateTable(void);
+  bool PrepareStatements(void);
+  void FinalizeStatements(void);
   int GetRecordCount(void);
 
   int GetMaxUserId(void);
   int InsertFaceDb(FaceDb *face_db);
+  bool Exec(const char *sql);
+  int ReadFeatureFile(const std::string &path,
+                      std::vector<rockface_feature_t> &features);
+  void LoadIndex(void);
+  bool AddToIndex(FaceDb *face_db);
 
 private:
   std::string path_;
+  // the writer connection, its statements and max_user_id_
   std::mutex mutex_;
   sqlite3 *sqlite_;
+  sqlite3_stmt *insert_stmt_;
+  sqlite3_stmt *delete_stmt_;
+  sqlite3_stmt *max_user_stmt_;
+  int max_user_id_;
+  // the reader connection and its statement
+  std::mutex read_mutex_;
+  sqlite3 *read_sqlite_;
+  sqlite3_stmt *select_stmt_;
+
+  FaceFeatureIndex index_;
+  bool index_enabled_;
+  std::atomic<bool> index_valid_;
+  // all the indexed features are of it
+  std::atomic<int> index_version_;
 };
 
 } // namespace easymedia
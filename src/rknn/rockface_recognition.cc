@@ -108,6 +108,7 @@ protected:
 private:
   static unsigned int kMaxCacheSize;
   static float kFaceSimilarityThreshod;
+  static int kMatchCandidates;
 
   bool enable_;
   bool thread_running_;
@@ -142,6 +143,7 @@ static void ThrFunc(void *param) {
 
 unsigned int RockFaceRecognize::kMaxCacheSize = 3;
 float RockFaceRecognize::kFaceSimilarityThreshod = 0.7;
+int RockFaceRecognize::kMatchCandidates = 3;
 
 RockFaceRecognize::RockFaceRecognize(const char *param)
     : tobe_registered_count_(0), callback_(nullptr) {
@@ -178,6 +180,12 @@ RockFaceRecognize::RockFaceRecognize(const char *param)
     LOG("lost db path.\n");
     return;
   }
+  const std::string &index_threads = params[KEY_INDEX_THREADS];
+  if (!index_threads.empty())
+    db_manager_->SetIndexThreads(std::stoi(index_threads));
+  const std::string &feature_index = params[KEY_FEATURE_INDEX];
+  if (!feature_index.empty() && std::stoi(feature_index))
+    db_manager_->EnableIndex(true);
 
   enable_face_detect_ = false;
   const std::string &enable_face_detect = params[KEY_ENBALE_FACE_DETECT];
@@ -289,7 +297,9 @@ std::shared_ptr<MediaBuffer> RockFaceRecognize::FetchOutput() {
 
 int RockFaceRecognize::MatchFeature(rockface_feature_t *feature,
                                     float *out_similarity) {
-  std::vector<FaceDb> vec = db_manager_->GetAllFaceDb();
+  // with the feature index, the sdk compares the nearest ones only
+  std::vector<FaceDb> vec =
+      db_manager_->GetNearestFaceDb(feature, kMatchCandidates);
   if (vec.empty())
     return -1;
 
@@ -570,6 +580,9 @@ int RockFaceRecognize::IoCtrl(unsigned long int request, ...) {
       db_manager_->DeleteUser(arg->user_id);
     } else if (arg->type == USER_ENABLE) {
       enable_ = arg->enable;
+    } else if (arg->type == USER_IMPORT) {
+      if (db_manager_->ImportFeatures(arg->pic_path) < 0)
+        ret = -1;
     }
   } break;
   case G_NN_INFO: {
@@ -126,6 +126,7 @@ UvcFlow:: ~UvcFlow() {
 }
 
 int UvcFlow::Control(unsigned long int request, ...) {
+  FLOW_CONTROL_BASE(request)
   va_list ap;
   va_start(ap, request);
   //auto value = va_arg(ap, std::shared_ptr<ParameterBuffer>);
@@ -0,0 +1,33 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_TEST_BENCH_MAIN_H_
+#define EASYMEDIA_TEST_BENCH_MAIN_H_
+
+#include <stdio.h>
+#include <string.h>
+
+// One bench binary an area, 'argv[0] <bench> [args]' runs the bench with
+// argv from its name on.
+struct BenchEntry {
+  const char *name;
+  int (*run)(int argc, char **argv);
+};
+
+static inline int bench_main(int argc, char **argv, const BenchEntry *benches,
+                             int num) {
+  if (argc > 1) {
+    for (int i = 0; i < num; i++)
+      if (!strcmp(argv[1], benches[i].name))
+        return benches[i].run(argc - 1, argv + 1);
+  }
+  printf("usage: %s <bench> [args]\nbenches:\n", argv[0]);
+  for (int i = 0; i < num; i++)
+    printf("  %s\n", benches[i].name);
+  return -1;
+}
+
+#define BENCH_NUM(benches) ((int)(sizeof(benches) / sizeof(benches[0])))
+
+#endif // #ifndef EASYMEDIA_TEST_BENCH_MAIN_H_
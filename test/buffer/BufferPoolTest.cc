@@ -0,0 +1,106 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <list>
+#include <thread>
+
+#include "easymedia/buffer.h"
+#include "easymedia/utils.h"
+#include "gtest/gtest.h"
+
+using easymedia::BufferPool;
+using easymedia::MediaBuffer;
+
+TEST(BufferPoolTest, Timeout) {
+  BufferPool pool(2, 1024, MediaBuffer::MemType::MEM_COMMON);
+  auto mb0 = pool.GetBuffer();
+  auto mb1 = pool.GetBuffer(false);
+  ASSERT_NE(mb0, nullptr);
+  ASSERT_NE(mb1, nullptr);
+  EXPECT_EQ(pool.GetBuffer(false), nullptr);
+  easymedia::AutoDuration ad;
+  EXPECT_EQ(pool.GetBuffer(50), nullptr);
+  EXPECT_GE(ad.Get(), 50000);
+
+  // the copy holds the buffer as well as the origin
+  auto image = std::make_shared<easymedia::ImageBuffer>(*mb0);
+  mb0.reset();
+  EXPECT_EQ(pool.GetBuffer(0), nullptr);
+  image.reset();
+  mb0 = pool.GetBuffer(0);
+  ASSERT_NE(mb0, nullptr);
+
+  // a release wakes a waiting get
+  std::thread t([&mb1] {
+    easymedia::msleep(20);
+    mb1.reset();
+  });
+  auto mb2 = pool.GetBuffer(1000);
+  t.join();
+  EXPECT_NE(mb2, nullptr);
+}
+
+TEST(BufferPoolTest, Elastic) {
+  BufferPool pool(2, 8, 1024, MediaBuffer::MemType::MEM_COMMON);
+  std::list<std::shared_ptr<MediaBuffer>> list;
+  for (int i = 0; i < 8; i++) {
+    auto mb = pool.GetBuffer(0);
+    ASSERT_NE(mb, nullptr);
+    list.push_back(mb);
+  }
+  EXPECT_EQ(pool.GetBuffer(0), nullptr);
+  list.clear();
+  // idle buffers above min are released by following gets
+  for (int i = 0; i < 1024; i++)
+    EXPECT_NE(pool.GetBuffer(0), nullptr);
+  // and grown again on demand
+  for (int i = 0; i < 8; i++) {
+    auto mb = pool.GetBuffer(0);
+    ASSERT_NE(mb, nullptr);
+    list.push_back(mb);
+  }
+  EXPECT_EQ(pool.GetBuffer(0), nullptr);
+}
+
+TEST(BufferPoolTest, SizeClassFallback) {
+  easymedia::SizeClassBufferPool pool(1, MediaBuffer::MemType::MEM_COMMON);
+  auto mb0 = pool.GetBuffer(1000);
+  ASSERT_NE(mb0, nullptr);
+  EXPECT_EQ(mb0->GetSize(), 1024u);
+  // the class is exhausted
+  EXPECT_EQ(pool.GetBuffer(1000, false), nullptr);
+  auto mb1 = pool.GetBuffer(1000);
+  ASSERT_NE(mb1, nullptr);
+  EXPECT_GE(mb1->GetSize(), 1000u);
+  EXPECT_FALSE(mb1->IsHwBuffer());
+  mb0.reset();
+  EXPECT_NE(pool.GetBuffer(1000, false), nullptr);
+}
+
+TEST(BufferPoolTest, HwBufferHolder) {
+  char data[64] = {0};
+  // any fd makes it a hardware buffer
+  auto hw = std::make_shared<MediaBuffer>(data, sizeof(data), 0);
+  hw->SetValidSize(sizeof(data));
+  easymedia::HwBufferHolder holder(2);
+  auto v0 = holder.Hold(hw);
+  auto v1 = holder.Hold(hw);
+  ASSERT_NE(v0, nullptr);
+  ASSERT_NE(v1, nullptr);
+  EXPECT_EQ(v0->GetPtr(), (void *)data);
+  EXPECT_EQ(holder.GetHeldNum(), 2);
+  EXPECT_EQ(holder.GetCopiedBytes(), 0);
+  // copied over max_num
+  auto c = holder.Hold(hw);
+  ASSERT_NE(c, nullptr);
+  EXPECT_NE(c->GetPtr(), (void *)data);
+  EXPECT_EQ(holder.GetCopiedBytes(), (int64_t)sizeof(data));
+  // a released view makes room
+  v0.reset();
+  EXPECT_EQ(holder.GetHeldNum(), 1);
+  EXPECT_EQ(holder.Hold(hw)->GetPtr(), (void *)data);
+  // common buffers pass through
+  auto common = MediaBuffer::Alloc(64);
+  EXPECT_EQ(holder.Hold(common), common);
+}
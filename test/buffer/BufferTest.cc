@@ -0,0 +1,286 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+
+#include <deque>
+#include <vector>
+
+#include "easymedia/audio_ring.h"
+#include "easymedia/broadcast_ring.h"
+#include "easymedia/buffer.h"
+#include "easymedia/codec.h"
+#include "gtest/gtest.h"
+
+using namespace easymedia;
+
+// byte by byte, candidates before end - 3 as ffmpeg's
+static const uint8_t *ref_find_nalu_startcode(const uint8_t *p,
+                                              const uint8_t *end) {
+  const uint8_t *start = p;
+  for (; end - p > 3; p++)
+    if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+      return p > start && !p[-1] ? p - 1 : p;
+  return end;
+}
+
+TEST(BufferTest, NaluStartCode) {
+  unsigned int seed = 1;
+  std::vector<uint8_t> data(4096);
+  for (int round = 0; round < 20; round++) {
+    // mostly zeros and ones, for start codes and near misses at any offset
+    for (auto &b : data)
+      b = rand_r(&seed) % 4 ? rand_r(&seed) % 2 : rand_r(&seed) % 256;
+    const uint8_t *end = data.data() + data.size();
+    for (size_t from = 0; from < 64; from++) {
+      const uint8_t *p = data.data() + from;
+      int num = 0;
+      while (p != end) {
+        const uint8_t *expect = ref_find_nalu_startcode(p, end);
+        const uint8_t *got = find_nalu_startcode(p, end);
+        ASSERT_EQ(got, expect)
+            << "round " << round << " from " << p - data.data();
+        if (got == end)
+          break;
+        p = got + 3;
+        num++;
+      }
+      EXPECT_GT(num, 0);
+    }
+  }
+  // too short and none at all
+  const uint8_t code[] = {0, 0, 1};
+  EXPECT_EQ(find_nalu_startcode(code, code + 3), code + 3);
+  std::vector<uint8_t> none(1000, 0xff);
+  EXPECT_EQ(find_nalu_startcode(none.data(), none.data() + none.size()),
+            none.data() + none.size());
+}
+
+TEST(BufferTest, NaluIndex) {
+  // sps, pps, sei and idr, the 4 byte start code first
+  const uint8_t stream[] = {0, 0, 0, 1, 0x67, 1, 2, 0, 0, 1, 0x68, 3,
+                            0, 0, 1,    0x06, 4, 0, 0, 0, 1, 0x65, 5, 6};
+  auto mb = std::make_shared<MediaBuffer>((void *)stream, sizeof(stream));
+  mb->SetValidSize(sizeof(stream));
+  auto index = BuildNaluIndex(mb, CODEC_TYPE_H264);
+  ASSERT_NE(index, nullptr);
+  ASSERT_EQ(index->nalus.size(), 4U);
+  const uint8_t types[] = {7, 8, 6, 5};
+  const uint32_t offsets[] = {0, 7, 12, 17};
+  const uint32_t sizes[] = {7, 5, 5, 7};
+  const uint8_t start_lens[] = {4, 3, 3, 4};
+  for (int i = 0; i < 4; i++) {
+    auto &entry = index->nalus[i];
+    EXPECT_EQ(entry.type, types[i]);
+    EXPECT_EQ(entry.offset, offsets[i]);
+    EXPECT_EQ(entry.size, sizes[i]);
+    EXPECT_EQ(entry.start_len, start_lens[i]);
+    EXPECT_EQ(index->Find(types[i]), &entry);
+  }
+  EXPECT_EQ(index->Find(1), nullptr);
+  // attached, a lookup does not scan again until the data changes
+  EXPECT_EQ(GetNaluIndex(mb, CODEC_TYPE_H264), index);
+  mb->SetValidSize(12);
+  auto sub = GetNaluIndex(mb, CODEC_TYPE_H264);
+  ASSERT_NE(sub, index);
+  EXPECT_EQ(sub->nalus.size(), 2U);
+}
+
+// interleaved or planar, each sample the index of it
+static std::vector<uint8_t> make_period(const SampleInfo &info, int64_t first,
+                                        int samples) {
+  bool planar = info.fmt == SAMPLE_FMT_S16P;
+  std::vector<uint8_t> v(samples * GetSampleSize(info));
+  int16_t *s = (int16_t *)v.data();
+  for (int i = 0; i < samples; i++)
+    for (int c = 0; c < info.channels; c++)
+      s[planar ? c * samples + i : i * info.channels + c] =
+          (int16_t)(first + i + c);
+  return v;
+}
+
+static bool frame_ok(const SampleInfo &info,
+                     const std::shared_ptr<SampleBuffer> &f, int64_t pos) {
+  bool planar = info.fmt == SAMPLE_FMT_S16P;
+  int n = f->GetSamples();
+  const int16_t *s = (const int16_t *)f->GetPtr();
+  for (int i = 0; i < n; i++)
+    for (int c = 0; c < info.channels; c++)
+      if (s[planar ? c * n + i : i * info.channels + c] !=
+          (int16_t)(pos + i + c)) {
+        ADD_FAILURE() << "sample " << pos + i << " of channel " << c;
+        return false;
+      }
+  // the timestamps of the periods are whole microseconds
+  int64_t expect = pos * 1000000 / info.sample_rate;
+  if (llabs(f->GetUSTimeStamp() - expect) > 1) {
+    ADD_FAILURE() << "frame at " << pos << ": timestamp "
+                  << f->GetUSTimeStamp() << ", expect " << expect;
+    return false;
+  }
+  return true;
+}
+
+static void check_ring(const SampleInfo &info, int frame_samples) {
+  int period = info.sample_rate / 50;
+  AudioRing ring(info, frame_samples, info.sample_rate, nullptr);
+  int64_t in_pos = 0, out_pos = 0;
+  std::deque<std::shared_ptr<SampleBuffer>> held;
+  for (int i = 0; i < 200; i++) {
+    auto p = make_period(info, in_pos, period);
+    ring.Write(p.data(), period, in_pos * 1000000 / info.sample_rate);
+    in_pos += period;
+    while (auto f = ring.Read()) {
+      ASSERT_TRUE(frame_ok(info, f, out_pos));
+      held.push_back(f);
+      if (held.size() > 3)
+        held.pop_front();
+      out_pos += f->GetSamples();
+    }
+    // views still held are not written over
+    int64_t pos = out_pos;
+    for (auto it = held.rbegin(); it != held.rend(); ++it) {
+      pos -= (*it)->GetSamples();
+      ASSERT_TRUE(frame_ok(info, *it, pos));
+    }
+  }
+  // the flushed frame is the rest
+  auto last = ring.Read(true);
+  ASSERT_NE(last, nullptr);
+  EXPECT_TRUE(frame_ok(info, last, out_pos));
+  EXPECT_EQ(out_pos + last->GetSamples(), in_pos);
+
+  // an input of many frames grows the ring, while a view holds the old one
+  AudioRing grown(info, frame_samples, info.sample_rate, nullptr);
+  int big = info.sample_rate / 2;
+  auto b = make_period(info, 0, frame_samples + 1);
+  grown.Write(b.data(), frame_samples + 1, 0);
+  auto old_view = grown.Read();
+  ASSERT_NE(old_view, nullptr);
+  b = make_period(info, frame_samples + 1, big);
+  grown.Write(b.data(), big,
+              (frame_samples + 1) * 1000000LL / info.sample_rate);
+  EXPECT_TRUE(frame_ok(info, old_view, 0));
+  EXPECT_EQ(grown.GetDropSamples(), 0);
+  int64_t pos = frame_samples;
+  while (auto f = grown.Read(true)) {
+    ASSERT_TRUE(frame_ok(info, f, pos));
+    pos += f->GetSamples();
+  }
+  EXPECT_EQ(pos, frame_samples + 1 + big);
+
+  // full, what a view holds is not written over
+  AudioRing small(info, frame_samples, 0, nullptr);
+  auto p = make_period(info, 0, small.GetCapacity());
+  small.Write(p.data(), small.GetCapacity(), 0);
+  auto view = small.Read();
+  ASSERT_NE(view, nullptr);
+  auto q = make_period(info, small.GetCapacity(), small.GetCapacity());
+  int n = small.Write(q.data(), small.GetCapacity(),
+                      small.GetCapacity() * 1000000LL / info.sample_rate);
+  EXPECT_EQ(n, 0);
+  EXPECT_TRUE(frame_ok(info, view, 0));
+}
+
+TEST(BufferTest, AudioRing) {
+  const struct {
+    SampleFormat fmt;
+    int channels;
+  } layouts[] = {
+      {SAMPLE_FMT_S16, 1}, {SAMPLE_FMT_S16, 2}, {SAMPLE_FMT_S16P, 2}};
+  for (int rate : {8000, 16000, 48000})
+    for (auto &l : layouts) {
+      SCOPED_TRACE(testing::Message() << rate << " Hz, " << l.channels
+                                      << " channels, fmt " << l.fmt);
+      SampleInfo info = {l.fmt, l.channels, rate, 0};
+      check_ring(info, 1024);
+    }
+}
+
+static std::shared_ptr<MediaBuffer> ring_buffer(uint32_t flag) {
+  auto mb = MediaBuffer::Alloc(16);
+  mb->SetValidSize(16);
+  mb->SetUserFlag(flag);
+  return mb;
+}
+
+TEST(BufferTest, BroadcastRing) {
+  BroadcastRing ring(8, 8, false);
+  ASSERT_TRUE(ring.Init());
+  int r0 = ring.AddReader();
+  int r1 = ring.AddReader();
+  EXPECT_EQ(ring.GetReaderNum(), 2);
+  std::vector<std::shared_ptr<MediaBuffer>> pushed;
+  for (int i = 0; i < 4; i++) {
+    pushed.push_back(ring_buffer(0));
+    ring.Push(pushed.back());
+  }
+  // every reader gets all, in order
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(ring.Pop(r0), pushed[i]);
+  EXPECT_EQ(ring.Pop(r0), nullptr);
+  EXPECT_FALSE(ring.HasData(r0));
+  EXPECT_TRUE(ring.HasData(r1));
+  EXPECT_EQ(ring.Pop(r1), pushed[0]);
+  // the slow one lags more than max lag, it drops half of it
+  for (int i = 0; i < 8; i++)
+    ring.Push(ring_buffer(0));
+  EXPECT_NE(ring.Pop(r1), nullptr);
+  EXPECT_GT(ring.GetDropNum(r1), 0);
+  EXPECT_EQ(ring.GetDropNum(r0), 0);
+  ring.RemoveReader(r1);
+  EXPECT_EQ(ring.GetReaderNum(), 1);
+  // the id is used again
+  EXPECT_EQ(ring.AddReader(), r1);
+}
+
+TEST(BufferTest, BroadcastRingBadReader) {
+  BroadcastRing ring(8, 8, false);
+  ASSERT_TRUE(ring.Init());
+  int r = ring.AddReader();
+  ring.Push(ring_buffer(0));
+  // out of range, or removed
+  for (int id : {-1, r + 1, 100}) {
+    EXPECT_EQ(ring.Pop(id), nullptr);
+    EXPECT_FALSE(ring.HasData(id));
+    EXPECT_EQ(ring.GetDropNum(id), -1);
+  }
+  ring.RemoveReader(r);
+  EXPECT_EQ(ring.Pop(r), nullptr);
+  EXPECT_FALSE(ring.HasData(r));
+  EXPECT_EQ(ring.GetDropNum(r), -1);
+  ring.RemoveReader(r);
+  EXPECT_EQ(ring.GetReaderNum(), 0);
+}
+
+TEST(BufferTest, GopCache) {
+  BroadcastRing ring(64, 32, true);
+  ASSERT_TRUE(ring.Init());
+  ring.SetGopCache(1024);
+  // without readers, the newest key frame group is kept
+  for (int gop = 0; gop < 2; gop++) {
+    ring.Push(ring_buffer(MediaBuffer::kExtraIntra));
+    ring.Push(ring_buffer(MediaBuffer::kIntra));
+    for (int i = 0; i < 3; i++)
+      ring.Push(ring_buffer(0));
+  }
+  size_t bytes;
+  int num;
+  ring.GetGopCache(bytes, num);
+  EXPECT_EQ(num, 5);
+  EXPECT_EQ(bytes, 5 * 16U);
+  // a new reader starts from the parameter sets of it
+  int r = ring.AddReader();
+  auto first = ring.Pop(r);
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(first->GetUserFlag(), (uint32_t)MediaBuffer::kExtraIntra);
+  EXPECT_EQ(ring.Pop(r)->GetUserFlag(), (uint32_t)MediaBuffer::kIntra);
+  // over the budget, nothing is kept for readers to come
+  ring.RemoveReader(r);
+  ring.SetGopCache(16);
+  ring.GetGopCache(bytes, num);
+  EXPECT_EQ(num, 0);
+  r = ring.AddReader();
+  EXPECT_EQ(ring.Pop(r), nullptr);
+}
@@ -0,0 +1,158 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Re-framing 20 ms capture periods into 1024 sample encoder frames: a fifo
+// a plane grown on input and a new buffer a frame, as av_audio_fifo in
+// ffmpeg_audio_fifo before, against AudioRing, with MediaBuffer::Alloc2 or
+// a pool for the frames it copies. 8k, 16k and 48k; mono and stereo s16,
+// and stereo s16p, the layout of the aac encoder. The samples, timestamps
+// and views of the ring are checked in BufferTest.
+// usage: buffer_bench audio_ring [seconds of audio]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "audio_ring.h"
+#include "buffer.h"
+#include "utils.h"
+
+using namespace easymedia;
+
+#define FRAME_SAMPLES 1024
+#define ROUNDS 10
+
+// a circular byte fifo of a plane grown on input to what it holds, as in
+// av_audio_fifo:
+// av_fifo_realloc2 copies into a new fifo when it grows
+class GrowFifo {
+public:
+  GrowFifo() : buf(nullptr), size(0), rd(0), used(0) {}
+  ~GrowFifo() { free(buf); }
+  void Write(const uint8_t *data, size_t n) {
+    if (used + n > size) {
+      uint8_t *nbuf = (uint8_t *)malloc(used + n);
+      size_t held = used;
+      if (held)
+        Read(nbuf, held);
+      free(buf);
+      buf = nbuf;
+      size = held + n;
+      rd = 0;
+      used = held;
+    }
+    size_t wr = (rd + used) % size;
+    size_t first = std::min(n, size - wr);
+    memcpy(buf + wr, data, first);
+    memcpy(buf, data + first, n - first);
+    used += n;
+  }
+  void Read(uint8_t *out, size_t n) {
+    size_t first = std::min(n, size - rd);
+    memcpy(out, buf + rd, first);
+    memcpy(out + first, buf, n - first);
+    rd = (rd + n) % size;
+    used -= n;
+  }
+  size_t GetUsed() const { return used; }
+
+private:
+  uint8_t *buf;
+  size_t size, rd, used;
+};
+
+// interleaved or planar 20 ms periods, each sample the index of it
+static std::vector<uint8_t> make_period(const SampleInfo &info, int64_t first,
+                                        int samples) {
+  bool planar = info.fmt == SAMPLE_FMT_S16P;
+  std::vector<uint8_t> v(samples * GetSampleSize(info));
+  int16_t *s = (int16_t *)v.data();
+  for (int i = 0; i < samples; i++)
+    for (int c = 0; c < info.channels; c++)
+      s[planar ? c * samples + i : i * info.channels + c] =
+          (int16_t)(first + i + c);
+  return v;
+}
+
+// ns a frame out
+static double run_fifo(const SampleInfo &info, int seconds) {
+  int period = info.sample_rate / 50;
+  int planes = info.fmt == SAMPLE_FMT_S16P ? info.channels : 1;
+  size_t frame_bytes = FRAME_SAMPLES * GetSampleSize(info);
+  size_t in_plane = (size_t)period * GetSampleSize(info) / planes;
+  size_t out_plane = frame_bytes / planes;
+  auto p = make_period(info, 0, period);
+  // av_audio_fifo keeps a fifo a plane
+  std::vector<GrowFifo> fifos(planes);
+  int64_t frames = 0;
+  AutoDuration ad;
+  for (int i = 0; i < seconds * 50; i++) {
+    for (int c = 0; c < planes; c++)
+      fifos[c].Write(p.data() + c * in_plane, in_plane);
+    while (fifos[0].GetUsed() >= out_plane) {
+      SampleInfo out_info = info;
+      out_info.nb_samples = FRAME_SAMPLES;
+      auto f = std::make_shared<SampleBuffer>(
+          MediaBuffer::Alloc2(frame_bytes), out_info);
+      for (int c = 0; c < planes; c++)
+        fifos[c].Read((uint8_t *)f->GetPtr() + c * out_plane, out_plane);
+      f->SetSamples(FRAME_SAMPLES);
+      frames++;
+    }
+  }
+  return ad.Get() * 1000.0 / frames;
+}
+
+static double run_ring(const SampleInfo &info, int seconds,
+                       std::shared_ptr<SizeClassBufferPool> pool) {
+  int period = info.sample_rate / 50;
+  auto p = make_period(info, 0, period);
+  AudioRing ring(info, FRAME_SAMPLES, info.sample_rate, pool);
+  int64_t frames = 0;
+  AutoDuration ad;
+  for (int i = 0; i < seconds * 50; i++) {
+    ring.Write(p.data(), period, i * 20000LL);
+    while (auto f = ring.Read())
+      frames++;
+  }
+  return ad.Get() * 1000.0 / frames;
+}
+
+int audio_ring_bench(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 600;
+  if (seconds < ROUNDS)
+    seconds = 600;
+  const struct {
+    const char *name;
+    SampleFormat fmt;
+    int channels;
+  } layouts[] = {{"mono s16", SAMPLE_FMT_S16, 1},
+                 {"stereo s16", SAMPLE_FMT_S16, 2},
+                 {"stereo s16p", SAMPLE_FMT_S16P, 2}};
+  const int rates[] = {8000, 16000, 48000};
+  auto pool =
+      SizeClassBufferPool::GetShared(4, MediaBuffer::MemType::MEM_COMMON);
+  printf("%d s of 20 ms periods into %d sample frames, ns a frame, the "
+         "least of %d rounds in turn\n",
+         seconds, FRAME_SAMPLES, ROUNDS);
+  printf("%-6s %-12s %12s %12s %12s\n", "rate", "layout", "fifo+alloc",
+         "ring", "ring+pool");
+  for (int rate : rates)
+    for (auto &l : layouts) {
+      SampleInfo info = {l.fmt, l.channels, rate, 0};
+      double ns[3] = {1e9, 1e9, 1e9};
+      // in turn, for the load of others to fall alike on each
+      for (int r = 0; r < ROUNDS; r++) {
+        ns[0] = std::min(ns[0], run_fifo(info, seconds / ROUNDS));
+        ns[1] = std::min(ns[1], run_ring(info, seconds / ROUNDS, nullptr));
+        ns[2] = std::min(ns[2], run_ring(info, seconds / ROUNDS, pool));
+      }
+      printf("%-6d %-12s %12.0f %12.0f %12.0f\n", rate, l.name, ns[0], ns[1],
+             ns[2]);
+    }
+  return 0;
+}
@@ -0,0 +1,190 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// CPU of fanning buffers out to N rtsp viewers: a list, a mutex and a pipe
+// per viewer as Live555MediaInput before, against one BroadcastRing and
+// its eventfd. The producer pushes one buffer and waits for all viewers to
+// take it, the viewers are served by one epoll loop as the live555 one.
+// Reports the CPU time of both threads.
+// usage: buffer_bench broadcast_ring [buffers]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "broadcast_ring.h"
+#include "buffer.h"
+#include "utils.h"
+
+#define MAX_CACHE_NUMBER 60
+
+static int64_t thread_cpu_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// all viewers took the buffer
+struct Ack {
+  std::mutex mtx;
+  std::condition_variable cond;
+  int64_t done = 0;
+  void Set(int64_t n) {
+    std::lock_guard<std::mutex> lock(mtx);
+    done = n;
+    cond.notify_one();
+  }
+  void Wait(int64_t n) {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (done < n)
+      cond.wait(lock);
+  }
+};
+
+// Source before
+struct ListViewer {
+  std::list<std::shared_ptr<easymedia::MediaBuffer>> list;
+  std::mutex mtx;
+  int fds[2];
+  int64_t got = 0;
+  void Push(std::shared_ptr<easymedia::MediaBuffer> &buffer) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (list.size() >= MAX_CACHE_NUMBER)
+      list.pop_front();
+    list.push_back(buffer);
+    int i = 0;
+    if (write(fds[1], &i, sizeof(i)) < 0)
+      perror("viewer pipe write");
+  }
+  std::shared_ptr<easymedia::MediaBuffer> Pop() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (list.empty())
+      return nullptr;
+    auto buffer = list.front();
+    list.pop_front();
+    return buffer;
+  }
+};
+
+static void run_list(int viewers, int num, int64_t *cpu) {
+  std::vector<ListViewer> v(viewers);
+  int ep = epoll_create1(EPOLL_CLOEXEC);
+  for (int i = 0; i < viewers; i++) {
+    if (pipe(v[i].fds))
+      return;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    epoll_ctl(ep, EPOLL_CTL_ADD, v[i].fds[0], &ev);
+  }
+  Ack ack;
+  std::atomic<int64_t> consumer_cpu(0);
+  std::thread consumer([&] {
+    int64_t start = thread_cpu_ns();
+    std::vector<struct epoll_event> evs(viewers);
+    int64_t min_got = 0;
+    while (min_got < num) {
+      int n = epoll_wait(ep, evs.data(), viewers, -1);
+      for (int i = 0; i < n; i++) {
+        ListViewer &lv = v[evs[i].data.u32];
+        int token;
+        if (read(lv.fds[0], &token, sizeof(token)) != sizeof(token))
+          continue;
+        if (lv.Pop())
+          lv.got++;
+      }
+      min_got = num;
+      for (auto &lv : v)
+        min_got = std::min(min_got, lv.got);
+      ack.Set(min_got);
+    }
+    consumer_cpu = thread_cpu_ns() - start;
+  });
+  auto mb = std::make_shared<easymedia::MediaBuffer>();
+  int64_t start = thread_cpu_ns();
+  for (int i = 0; i < num; i++) {
+    for (auto &lv : v)
+      lv.Push(mb);
+    ack.Wait(i + 1);
+  }
+  int64_t producer_cpu = thread_cpu_ns() - start;
+  consumer.join();
+  *cpu = producer_cpu + consumer_cpu;
+  for (auto &lv : v) {
+    close(lv.fds[0]);
+    close(lv.fds[1]);
+  }
+  close(ep);
+}
+
+static void run_ring(int viewers, int num, int64_t *cpu) {
+  easymedia::BroadcastRing ring(1024, MAX_CACHE_NUMBER, true);
+  if (!ring.Init())
+    return;
+  std::vector<int> ids;
+  std::vector<int64_t> got(viewers, 0);
+  for (int i = 0; i < viewers; i++)
+    ids.push_back(ring.AddReader());
+  int ep = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u32 = 0;
+  epoll_ctl(ep, EPOLL_CTL_ADD, ring.GetEventFd(), &ev);
+  Ack ack;
+  std::atomic<int64_t> consumer_cpu(0);
+  std::thread consumer([&] {
+    int64_t start = thread_cpu_ns();
+    int64_t min_got = 0;
+    while (min_got < num) {
+      if (epoll_wait(ep, &ev, 1, -1) <= 0)
+        continue;
+      ring.ClearEvent();
+      min_got = num;
+      for (int i = 0; i < viewers; i++) {
+        while (ring.HasData(ids[i]))
+          if (ring.Pop(ids[i]))
+            got[i]++;
+        min_got = std::min(min_got, got[i]);
+      }
+      ack.Set(min_got);
+    }
+    consumer_cpu = thread_cpu_ns() - start;
+  });
+  auto mb = std::make_shared<easymedia::MediaBuffer>();
+  int64_t start = thread_cpu_ns();
+  for (int i = 0; i < num; i++) {
+    ring.Push(mb);
+    ack.Wait(i + 1);
+  }
+  int64_t producer_cpu = thread_cpu_ns() - start;
+  consumer.join();
+  *cpu = producer_cpu + consumer_cpu;
+  for (int id : ids)
+    ring.RemoveReader(id);
+  close(ep);
+}
+
+int broadcast_ring_bench(int argc, char **argv) {
+  int num = argc > 1 ? atoi(argv[1]) : 100000;
+  printf("%d buffers, cpu ns per buffer per viewer\n", num);
+  printf("%-8s %12s %12s\n", "viewers", "list+pipe", "ring");
+  int viewers[] = {1, 2, 4, 8, 16, 32};
+  for (int n : viewers) {
+    int64_t list_cpu = 0, ring_cpu = 0;
+    run_list(n, num, &list_cpu);
+    run_ring(n, num, &ring_cpu);
+    printf("%-8d %12.1f %12.1f\n", n, (double)list_cpu / num / n,
+           (double)ring_cpu / num / n);
+  }
+  return 0;
+}
@@ -0,0 +1,30 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benches of buffers, pools and rings, the checks are in BufferTest.
+// usage: buffer_bench <bench> [args]
+
+#include "../bench_main.h"
+
+int audio_ring_bench(int argc, char **argv);
+int broadcast_ring_bench(int argc, char **argv);
+int buffer_pool_contention_bench(int argc, char **argv);
+int buffer_pool_soak_bench(int argc, char **argv);
+int gop_cache_bench(int argc, char **argv);
+int nalu_scan_bench(int argc, char **argv);
+int rtsp_copy_bench(int argc, char **argv);
+
+static const BenchEntry benches[] = {
+    {"audio_ring", audio_ring_bench},
+    {"broadcast_ring", broadcast_ring_bench},
+    {"gop_cache", gop_cache_bench},
+    {"nalu_scan", nalu_scan_bench},
+    {"pool_contention", buffer_pool_contention_bench},
+    {"pool_soak", buffer_pool_soak_bench},
+    {"rtsp_copy", rtsp_copy_bench},
+};
+
+int main(int argc, char **argv) {
+  return bench_main(argc, argv, benches, BENCH_NUM(benches));
+}
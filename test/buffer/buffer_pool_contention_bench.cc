@@ -0,0 +1,79 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Contention benchmark of BufferPool: every thread gets a buffer, holds it
+// for a while and releases it, with fewer buffers than threads. The checks
+// of the pool are in BufferPoolTest.
+// usage: buffer_bench pool_contention [threads] [seconds] [buffer cnt]
+//        [hold us]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "utils.h"
+
+static void bench_thread(easymedia::BufferPool *pool, int hold_us,
+                         std::atomic<bool> *quit, std::vector<int64_t> *lat) {
+  lat->reserve(1 << 20);
+  while (!*quit) {
+    easymedia::AutoDuration ad;
+    auto mb = pool->GetBuffer();
+    lat->push_back(ad.Get());
+    if (!mb)
+      continue;
+    ad.Reset();
+    while (ad.Get() < hold_us)
+      ;
+  }
+}
+
+int buffer_pool_contention_bench(int argc, char **argv) {
+  int threads = 8;
+  int seconds = 3;
+  int cnt = 4;
+  int hold_us = 5;
+  if (argc > 1)
+    threads = atoi(argv[1]);
+  if (argc > 2)
+    seconds = atoi(argv[2]);
+  if (argc > 3)
+    cnt = atoi(argv[3]);
+  if (argc > 4)
+    hold_us = atoi(argv[4]);
+
+  LOG_INIT();
+  easymedia::BufferPool pool(cnt, 1024,
+                             easymedia::MediaBuffer::MemType::MEM_COMMON);
+  std::atomic<bool> quit(false);
+  std::vector<std::vector<int64_t>> lats(threads);
+  std::vector<std::thread> ths;
+  for (int i = 0; i < threads; i++)
+    ths.emplace_back(bench_thread, &pool, hold_us, &quit, &lats[i]);
+  easymedia::msleep(seconds * 1000);
+  quit = true;
+  for (auto &t : ths)
+    t.join();
+
+  std::vector<int64_t> lat;
+  for (auto &l : lats)
+    lat.insert(lat.end(), l.begin(), l.end());
+  std::sort(lat.begin(), lat.end());
+  size_t n = lat.size();
+  printf("%d threads, %d buffers, hold %dus, %ds\n", threads, cnt, hold_us,
+         seconds);
+  printf("get/put: %.0f/s, get latency p50:%lldus, p99:%lldus, max:%lldus\n",
+         n / (double)seconds, (long long)(n ? lat[n / 2] : 0),
+         (long long)(n ? lat[n * 99 / 100] : 0),
+         (long long)(n ? lat[n - 1] : 0));
+  pool.DumpInfo();
+  LOG("===== FINISH ====\n");
+  return 0;
+}
@@ -0,0 +1,120 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Soak of the per frame output buffers of video_enc, muxer customio and
+// move detection flows, with and without the size class pool. Counts
+// malloc/free of the process per frame in the steady state, malloc and
+// free of buffer_bench count only while a soak runs.
+// usage: buffer_bench pool_soak [frames] [mem_cnt]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <string>
+
+#include "buffer.h"
+#include "utils.h"
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static std::atomic<bool> counting(false);
+static std::atomic<long> malloc_cnt(0);
+static std::atomic<long> free_cnt(0);
+
+extern "C" void *malloc(size_t size) {
+  if (counting.load(std::memory_order_relaxed))
+    malloc_cnt.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+extern "C" void free(void *ptr) {
+  if (ptr && counting.load(std::memory_order_relaxed))
+    free_cnt.fetch_add(1, std::memory_order_relaxed);
+  __libc_free(ptr);
+}
+
+#define SOAK_WARMUP 100
+
+static void print_counts(const char *name, int frames) {
+  printf("%-24s malloc/frame: %6.2f, free/frame: %6.2f\n", name,
+         malloc_cnt.load() / (double)frames, free_cnt.load() / (double)frames);
+}
+
+// Output buffers of one flow, kept alive by downstream for 'depth' frames.
+// size_fn gives the size of frame i.
+template <typename F>
+static bool soak(const char *name, int frames, int mem_cnt, int depth,
+                 F size_fn) {
+  std::shared_ptr<easymedia::SizeClassBufferPool> pool;
+  if (mem_cnt > 0)
+    pool = easymedia::SizeClassBufferPool::GetShared(
+        mem_cnt, easymedia::MediaBuffer::MemType::MEM_COMMON);
+  std::deque<std::shared_ptr<easymedia::MediaBuffer>> queue;
+  static char data[1 << 20];
+  for (int i = 0; i < SOAK_WARMUP + frames; i++) {
+    if (i == SOAK_WARMUP) {
+      malloc_cnt = 0;
+      free_cnt = 0;
+      counting = true;
+    }
+    size_t size = size_fn(i);
+    auto mb =
+        pool ? pool->GetBuffer(size) : easymedia::MediaBuffer::Alloc(size);
+    if (!mb) {
+      counting = false;
+      fprintf(stderr, "%s: alloc of %zu bytes failed at frame %d\n", name,
+              size, i);
+      return false;
+    }
+    // the source only stands for the payload, copy what it holds
+    memcpy(mb->GetPtr(), data, std::min(size, sizeof(data)));
+    mb->SetValidSize(size);
+    queue.push_back(mb);
+    if ((int)queue.size() > depth)
+      queue.pop_front();
+  }
+  counting = false;
+  std::string title(name);
+  title.append(pool ? ", pool" : ", no pool");
+  print_counts(title.c_str(), frames);
+  queue.clear();
+  if (pool)
+    pool->DumpInfo();
+  return true;
+}
+
+int buffer_pool_soak_bench(int argc, char **argv) {
+  int frames = 3000;
+  int mem_cnt = 16;
+  if (argc > 1)
+    frames = atoi(argv[1]);
+  if (argc > 2)
+    mem_cnt = atoi(argv[2]);
+
+  LOG_INIT();
+  unsigned int seed = 1;
+  // video_enc: one raw frame sized output, in flight in input cache and
+  // the muxer queue
+  auto enc_size = [](int) { return (size_t)(1920 * 1080 * 3 / 2); };
+  // muxer customio: chunks written by ffmpeg avio
+  auto chunk_size = [&seed](int) {
+    return (size_t)(1 + rand_r(&seed) % 32768);
+  };
+  // move detection: result_cnt + 1 INFO_LIST
+  auto md_size = [&seed](int) {
+    return (size_t)(16 * (1 + rand_r(&seed) % 64));
+  };
+  for (int cnt : {0, mem_cnt}) {
+    if (!soak("video_enc", frames, cnt, 6, enc_size) ||
+        !soak("muxer chunks", frames, cnt, 10, chunk_size) ||
+        !soak("move detection", frames, cnt, 10, md_size))
+      return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,180 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Time to first frame of a new rtsp client, with and without the gop cache.
+// A long gop h264 stream is paced at 'speed' times real time through an
+// async flow into the video BroadcastRing, as RtspServerFlow does. Clients
+// attach at points spread over the gop and wait for the first IDR. Times
+// are reported in real time.
+// usage: buffer_bench gop_cache [gop] [speed]
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "broadcast_ring.h"
+#include "buffer.h"
+#include "flow.h"
+#include "utils.h"
+
+#define FPS 25
+#define IDR_SIZE (100 * 1024)
+#define P_SIZE (10 * 1024)
+#define CACHE_SIZE (4 * 1024 * 1024)
+#define CLIENT_NUM 8
+
+namespace easymedia {
+
+// stands for RtspServerFlow and Live555MediaInput::PushNewVideo
+class RingSinkFlow : public Flow {
+public:
+  RingSinkFlow(BroadcastRing *r) : ring(r) {
+    SlotMap sm;
+    sm.thread_model = Model::ASYNCCOMMON;
+    sm.mode_when_full = InputMode::BLOCKING;
+    sm.input_slots.push_back(0);
+    sm.input_maxcachenum.push_back(0);
+    sm.process = Push;
+    if (!InstallSlotMap(sm, "ring_sink", 0)) {
+      SetError(-EINVAL);
+      return;
+    }
+  }
+  virtual ~RingSinkFlow() { StopAllThread(); }
+
+private:
+  static bool Push(Flow *f, MediaBufferVector &input_vector) {
+    RingSinkFlow *flow = static_cast<RingSinkFlow *>(f);
+    if (input_vector[0])
+      flow->ring->Push(input_vector[0]);
+    return true;
+  }
+  BroadcastRing *ring;
+};
+
+} // namespace easymedia
+
+static std::shared_ptr<easymedia::MediaBuffer> frame(int64_t f, int gop) {
+  bool idr = f % gop == 0;
+  auto mb = easymedia::MediaBuffer::Alloc(idr ? IDR_SIZE : P_SIZE);
+  mb->SetValidSize(mb->GetSize());
+  mb->SetUserFlag(idr ? easymedia::MediaBuffer::kIntra
+                      : easymedia::MediaBuffer::kPredicted);
+  mb->SetUSTimeStamp(f * 1000000LL / FPS);
+  return mb;
+}
+
+static std::shared_ptr<easymedia::MediaBuffer> sps_pps() {
+  auto mb = easymedia::MediaBuffer::Alloc(32);
+  mb->SetValidSize(32);
+  mb->SetUserFlag(easymedia::MediaBuffer::kExtraIntra);
+  return mb;
+}
+
+struct Client {
+  int64_t at; // frame to attach at
+  int id = -1;
+  int64_t attach = 0, first = -1;
+  bool done = false;
+  int frames = 0;
+};
+
+// one event loop serving all clients as the live555 one
+static void serve(easymedia::BroadcastRing &ring, std::vector<Client> &clients,
+                  int64_t frame_us, easymedia::AutoDuration &ad) {
+  struct pollfd pfd = {ring.GetEventFd(), POLLIN, 0};
+  size_t done = 0;
+  while (done < clients.size()) {
+    for (auto &c : clients) {
+      if (c.id < 0 && !c.done && ad.Get() >= c.at * frame_us) {
+        c.id = ring.AddReader();
+        c.attach = ad.Get();
+      }
+      if (c.id < 0)
+        continue;
+      std::shared_ptr<easymedia::MediaBuffer> mb;
+      while ((mb = ring.Pop(c.id))) {
+        if (c.first < 0 &&
+            (mb->GetUserFlag() & easymedia::MediaBuffer::kIntra))
+          c.first = ad.Get() - c.attach;
+        if (c.first >= 0)
+          c.frames++;
+      }
+      if (c.first >= 0) {
+        ring.RemoveReader(c.id);
+        c.id = -1;
+        c.done = true;
+        done++;
+      }
+    }
+    poll(&pfd, 1, 1);
+    ring.ClearEvent();
+  }
+}
+
+static void run(int gop, int speed, size_t cache_size) {
+  easymedia::BroadcastRing ring(1024, 60, true);
+  if (!ring.Init())
+    return;
+  ring.SetGopCache(cache_size);
+  auto sink = std::make_shared<easymedia::RingSinkFlow>(&ring);
+  if (sink->GetError()) {
+    printf("ring sink flow failed\n");
+    return;
+  }
+
+  // spread over the second to the fifth gop
+  std::vector<Client> clients(CLIENT_NUM);
+  for (int c = 0; c < CLIENT_NUM; c++)
+    clients[c].at = gop + (int64_t)gop * 4 * c / CLIENT_NUM + 7;
+  int64_t frames = (int64_t)gop * 6;
+  int64_t frame_us = 1000000 / FPS / speed;
+  easymedia::AutoDuration ad;
+  std::thread producer([&] {
+    for (int64_t f = 0; f < frames; f++) {
+      int64_t wait = f * frame_us - ad.Get();
+      if (wait > 0)
+        easymedia::usleep(wait);
+      if (f % gop == 0) {
+        auto extra = sps_pps();
+        sink->SendInput(extra, 0);
+      }
+      auto mb = frame(f, gop);
+      sink->SendInput(mb, 0);
+    }
+  });
+  serve(ring, clients, frame_us, ad);
+  producer.join();
+  sink.reset();
+
+  std::vector<int64_t> firsts;
+  int frames_sum = 0;
+  for (auto &c : clients) {
+    firsts.push_back(c.first * speed);
+    frames_sum += c.frames;
+  }
+  std::sort(firsts.begin(), firsts.end());
+  int64_t sum = 0;
+  for (auto t : firsts)
+    sum += t;
+  printf("%-10s %10.2f %10.2f %10.2f %8.1f\n",
+         cache_size ? "cache" : "no cache", firsts.front() / 1000.0, sum / 1000.0 / firsts.size(),
+         firsts.back() / 1000.0, (double)frames_sum / CLIENT_NUM);
+}
+
+int gop_cache_bench(int argc, char **argv) {
+  int gop = argc > 1 ? atoi(argv[1]) : 250;
+  int speed = argc > 2 ? atoi(argv[2]) : 10;
+  printf("h264 %dfps, gop %d (%.1fs), replayed at %dx, %d clients\n", FPS,
+         gop, (double)gop / FPS, speed, CLIENT_NUM);
+  printf("time to first frame (ms, real time), frames sent at once\n");
+  printf("%-10s %10s %10s %10s %8s\n", "", "min", "avg", "max", "frames");
+  run(gop, speed, 0);
+  run(gop, speed, CACHE_SIZE);
+  return 0;
+}
@@ -0,0 +1,212 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Start code scan throughput of find_nalu_startcode against ffmpeg's scalar
+// scanner, and the cost of the sps/pps/sei/intra lookups of a packet by the
+// scalar rescans before against one NaluIndex built per packet.
+// The scan is checked against the scalar one in BufferTest.
+// usage: buffer_bench nalu_scan <h264|h265> <annexb file> [rounds]
+// e.g. buffer_bench nalu_scan h264 test/rkmpp/mpp_dec_test.h264
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "buffer.h"
+#include "codec.h"
+#include "utils.h"
+
+// the scanner before, copy from ffmpeg
+static const uint8_t *scalar_find_startcode(const uint8_t *p,
+                                            const uint8_t *end) {
+  const uint8_t *a = p + 4 - ((intptr_t)p & 3);
+
+  for (end -= 3; p < a && p < end; p++) {
+    if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+      return p;
+  }
+
+  for (end -= 3; p < end; p += 4) {
+    uint32_t x = *(const uint32_t *)p;
+    if ((x - 0x01010101) & (~x) & 0x80808080) {
+      if (p[1] == 0) {
+        if (p[0] == 0 && p[2] == 1)
+          return p;
+        if (p[2] == 0 && p[3] == 1)
+          return p + 1;
+      }
+      if (p[3] == 0) {
+        if (p[2] == 0 && p[4] == 1)
+          return p + 2;
+        if (p[4] == 0 && p[5] == 1)
+          return p + 3;
+      }
+    }
+  }
+
+  for (end += 3; p < end; p++) {
+    if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+      return p;
+  }
+
+  return end + 3;
+}
+
+static const uint8_t *scalar_find_nalu_startcode(const uint8_t *p,
+                                                 const uint8_t *end) {
+  const uint8_t *out = scalar_find_startcode(p, end);
+  if (p < out && out < end && !out[-1])
+    out--;
+  return out;
+}
+
+typedef const uint8_t *(*FindFunc)(const uint8_t *p, const uint8_t *end);
+
+static int count_nalus(FindFunc find, const uint8_t *data, size_t size) {
+  const uint8_t *end = data + size;
+  const uint8_t *p = find(data, end);
+  int num = 0;
+  while (p != end) {
+    num++;
+    p = find(p + 3, end);
+  }
+  return num;
+}
+
+static double scan_gbps(FindFunc find, const uint8_t *data, size_t size,
+                        int rounds, int *nalus) {
+  easymedia::AutoDuration ad;
+  for (int i = 0; i < rounds; i++)
+    *nalus = count_nalus(find, data, size);
+  int64_t cost = ad.Get();
+  return cost > 0 ? (double)size * rounds / cost / 1000.0 : 0;
+}
+
+// FindNaluByType before, every lookup scanned from the buffer start
+static int old_find_nalu(std::shared_ptr<easymedia::MediaBuffer> &mb,
+                         int nal_type, CodecType c_type) {
+  const uint8_t *start = (uint8_t *)mb->GetPtr();
+  const uint8_t *end = start + mb->GetValidSize();
+  const uint8_t *nal_start, *nal_end;
+  nal_start = nal_end = scalar_find_nalu_startcode(start, end);
+  int start_len = (nal_start[2] == 1 ? 3 : 4);
+  while (nal_start != end) {
+    nal_start = nal_end;
+    nal_end = scalar_find_nalu_startcode(nal_start + start_len, end);
+    uint8_t type = c_type == CODEC_TYPE_H264
+                       ? nal_start[start_len] & 0x1F
+                       : (nal_start[start_len] & 0x7E) >> 1;
+    if (type == nal_type)
+      return nal_end - nal_start;
+  }
+  return 0;
+}
+
+// sps, pps, sei and intra, the lookups of MuxerFlow and the rtsp source
+static const int h264_types[] = {7, 8, 6, 5};
+static const int h265_types[] = {33, 34, 39, 19};
+
+static int lookup(std::shared_ptr<easymedia::MediaBuffer> &mb,
+                  CodecType c_type, bool old) {
+  const int *types = c_type == CODEC_TYPE_H264 ? h264_types : h265_types;
+  int sum = 0;
+  for (int i = 0; i < 4; i++) {
+    if (old) {
+      sum += old_find_nalu(mb, types[i], c_type);
+      continue;
+    }
+    auto index = easymedia::GetNaluIndex(mb, c_type);
+    const easymedia::NaluEntry *entry = index->Find(types[i]);
+    if (entry)
+      sum += entry->size;
+  }
+  return sum;
+}
+
+static double lookup_ns(std::vector<std::shared_ptr<easymedia::MediaBuffer>>
+                            &packets,
+                        CodecType c_type, bool old, int rounds,
+                        int64_t *sum) {
+  *sum = 0;
+  easymedia::AutoDuration ad;
+  for (int i = 0; i < rounds; i++) {
+    for (auto &mb : packets) {
+      // the encoder flow builds it once per packet
+      if (!old)
+        easymedia::BuildNaluIndex(mb, c_type);
+      *sum += lookup(mb, c_type, old);
+    }
+  }
+  return ad.Get() * 1000.0 / (packets.size() * rounds);
+}
+
+int nalu_scan_bench(int argc, char **argv) {
+  if (argc < 3) {
+    printf("usage: %s <h264|h265> <annexb file> [rounds]\n", argv[0]);
+    return -1;
+  }
+  CodecType c_type = strcmp(argv[1], "h265") ? CODEC_TYPE_H264
+                                             : CODEC_TYPE_H265;
+  int rounds = argc > 3 ? atoi(argv[3]) : 200;
+
+  FILE *fp = fopen(argv[2], "rb");
+  if (!fp) {
+    printf("open %s failed\n", argv[2]);
+    return -1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t chunk[4096];
+  size_t len;
+  while ((len = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    data.insert(data.end(), chunk, chunk + len);
+  fclose(fp);
+  if (data.empty())
+    return -1;
+
+  int scalar_num = 0, simd_num = 0;
+  double scalar = scan_gbps(scalar_find_nalu_startcode, data.data(),
+                            data.size(), rounds, &scalar_num);
+  double simd = scan_gbps(easymedia::find_nalu_startcode, data.data(),
+                          data.size(), rounds, &simd_num);
+  if (scalar_num != simd_num) {
+    printf("scalar found %d nal units, simd %d\n", scalar_num, simd_num);
+    return -1;
+  }
+  printf("%s: %zu bytes, %d nal units\n", argv[2], data.size(), simd_num);
+  printf("%-10s %8.2f GB/s\n", "scalar", scalar);
+  printf("%-10s %8.2f GB/s\n", "simd", simd);
+
+  // one MediaBuffer per access unit, as the encoder outputs
+  std::vector<easymedia::NaluEntry> nalus;
+  easymedia::ScanNalus(data.data(), data.size(), c_type, nalus);
+  std::vector<std::shared_ptr<easymedia::MediaBuffer>> packets;
+  size_t begin = 0;
+  for (size_t i = 0; i < nalus.size(); i++) {
+    uint8_t t = nalus[i].type;
+    bool vcl = c_type == CODEC_TYPE_H264 ? (t >= 1 && t <= 5) : (t < 32);
+    if (!vcl)
+      continue;
+    size_t end = nalus[i].offset + nalus[i].size;
+    packets.push_back(std::make_shared<easymedia::MediaBuffer>(
+        data.data() + begin, end - begin));
+    packets.back()->SetValidSize(end - begin);
+    begin = end;
+  }
+
+  if (packets.empty())
+    return 0;
+  int64_t old_sum, index_sum;
+  double old = lookup_ns(packets, c_type, true, rounds, &old_sum);
+  double index = lookup_ns(packets, c_type, false, rounds, &index_sum);
+  // the old lookup took the start code length of the first nal unit for
+  // all, it misses nal units after a length change
+  printf("%zu packets, sps/pps/sei/intra lookups\n", packets.size());
+  printf("%-10s %8.1f ns/packet, found %lld bytes\n", "rescan", old,
+         (long long)old_sum / rounds);
+  printf("%-10s %8.1f ns/packet, found %lld bytes\n", "index", index,
+         (long long)index_sum / rounds);
+  return 0;
+}
@@ -0,0 +1,153 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Bytes copied per second by the rtsp flow for a 4K/25fps h264 stream of
+// hardware buffers, fanned out to N sessions. Before, every hardware buffer
+// was cloned and the sps/pps of every IDR copied out. Now the sessions hold
+// views, copies start when more than hw_hold_num hardware buffers are held.
+// A session keeps its lag in frames, as a client sending slower.
+// usage: buffer_bench rtsp_copy [seconds] [hw_hold_num]
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <deque>
+#include <vector>
+
+#include "buffer.h"
+#include "codec.h"
+#include "utils.h"
+
+#define FPS 25
+#define GOP 50
+#define IDR_SIZE (600 * 1024)
+#define P_SIZE (80 * 1024)
+
+struct Session {
+  int lag; // frames queued before the client sends
+  std::deque<std::shared_ptr<easymedia::MediaBuffer>> queue;
+};
+
+static const uint8_t sps_pps[] = {0, 0, 0, 1, 0x67, 0x64, 0x00, 0x33, 0xac,
+                                  0x1b, 0x1a, 0x80, 0x78, 0x02, 0x27, 0xe5,
+                                  0x84, 0x00, 0x00, 0x03, 0x00, 0x04, 0x00,
+                                  0x00, 0x00, 0x03, 0x00, 0xca, 0x3c, 0x48,
+                                  0x96, 0x11, 0x80, 0,    0,    0,    1,
+                                  0x68, 0xee, 0x31, 0xb2, 0x1b};
+
+// encoder output in a "hardware" buffer
+static std::shared_ptr<easymedia::MediaBuffer> encode(int frame, int fd) {
+  bool idr = frame % GOP == 0;
+  size_t size = idr ? IDR_SIZE : P_SIZE;
+  auto mb = easymedia::MediaBuffer::Alloc(size);
+  uint8_t *p = (uint8_t *)mb->GetPtr();
+  size_t pos = 0;
+  if (idr) {
+    memcpy(p, sps_pps, sizeof(sps_pps));
+    pos = sizeof(sps_pps);
+  }
+  static const uint8_t start[] = {0, 0, 0, 1};
+  memcpy(p + pos, start, sizeof(start));
+  p[pos + 4] = idr ? 0x65 : 0x41;
+  memset(p + pos + 5, 0x5a, size - pos - 5);
+  mb->SetValidSize(size);
+  mb->SetUserFlag(idr ? easymedia::MediaBuffer::kIntra
+                      : easymedia::MediaBuffer::kPredicted);
+  mb->SetType(Type::Video);
+  mb->SetFD(fd);
+  easymedia::BuildNaluIndex(mb, CODEC_TYPE_H264);
+  return mb;
+}
+
+// SendMediaToServer before
+static int64_t push_copy(std::shared_ptr<easymedia::MediaBuffer> buffer,
+                         std::vector<Session> &sessions) {
+  int64_t copied = 0;
+  buffer = easymedia::MediaBuffer::Clone(*buffer);
+  copied += buffer->GetValidSize();
+  std::list<std::shared_ptr<easymedia::MediaBuffer>> spspps;
+  if (buffer->GetUserFlag() & easymedia::MediaBuffer::kIntra)
+    spspps = easymedia::split_h264_separate(
+        (const uint8_t *)buffer->GetPtr(), buffer->GetValidSize(),
+        buffer->GetUSTimeStamp());
+  for (auto &buf : spspps)
+    copied += buf->GetValidSize();
+  for (auto &s : sessions) {
+    for (auto &buf : spspps)
+      s.queue.push_back(buf);
+    s.queue.push_back(buffer);
+  }
+  return copied;
+}
+
+// SendMediaToServer with HwBufferHolder, as the rtsp flow
+static int64_t push_view(std::shared_ptr<easymedia::MediaBuffer> buffer,
+                         std::vector<Session> &sessions,
+                         easymedia::HwBufferHolder &holder) {
+  int64_t copied = holder.GetCopiedBytes();
+  buffer = holder.Hold(buffer);
+  copied = holder.GetCopiedBytes() - copied;
+  std::list<std::shared_ptr<easymedia::MediaBuffer>> spspps;
+  if (buffer->GetUserFlag() & easymedia::MediaBuffer::kIntra)
+    spspps = easymedia::split_separate_view(buffer, CODEC_TYPE_H264);
+  for (auto &s : sessions) {
+    for (auto &buf : spspps)
+      s.queue.push_back(buf);
+    s.queue.push_back(buffer);
+  }
+  return copied;
+}
+
+static void send(std::vector<Session> &sessions) {
+  for (auto &s : sessions) {
+    while (s.queue.size() > (size_t)s.lag)
+      s.queue.pop_front();
+  }
+}
+
+static void run(const char *name, int sessions_num, int slow_lag, int seconds,
+                int hold_num, int fd) {
+  std::vector<Session> copy_sessions(sessions_num);
+  std::vector<Session> view_sessions(sessions_num);
+  for (int i = 0; i < sessions_num; i++) {
+    // sps, pps and idr are 3 entries
+    int lag = (i == 0 && slow_lag > 0) ? slow_lag : 3;
+    copy_sessions[i].lag = view_sessions[i].lag = lag;
+  }
+  easymedia::HwBufferHolder holder(hold_num);
+  int64_t copy_bytes = 0, view_bytes = 0;
+  for (int f = 0; f < seconds * FPS; f++) {
+    auto mb = encode(f, fd);
+    copy_bytes += push_copy(mb, copy_sessions);
+    send(copy_sessions);
+    view_bytes += push_view(mb, view_sessions, holder);
+    send(view_sessions);
+  }
+  printf("%-24s %8d %14.1f %14.1f\n", name, sessions_num,
+         copy_bytes / 1024.0 / seconds, view_bytes / 1024.0 / seconds);
+}
+
+int rtsp_copy_bench(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 60;
+  int hold_num = argc > 2 ? atoi(argv[2]) : 4;
+  // any fd makes it a hardware buffer to the rtsp flow
+  int fd = open("/dev/zero", O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  printf("4K h264 %dfps, gop %d, %ds, hw_hold_num %d\n", FPS, GOP, seconds,
+         hold_num);
+  printf("%-24s %8s %14s %14s\n", "clients", "sessions", "before(KB/s)",
+         "now(KB/s)");
+  int nums[] = {1, 4, 8, 16};
+  for (int n : nums)
+    run("all in time", n, 0, seconds, hold_num, fd);
+  for (int n : nums)
+    run("one 1s late", n, FPS, seconds, hold_num, fd);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,231 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// The osd palette table and the region luma of the c api, against the
+// plain loops they replaced.
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "osd/color_table.h"
+#include "region_luma.h"
+
+// the palette search of a pixel, as RK_MPI_VENC_RGN_SetBitMap did
+static RK_U8 search_color(RK_U32 c, RK_BOOL argb1555) {
+  RK_U8 a, r, g, b;
+  if (argb1555) {
+    a = (c & 0x8000) >> 15;
+    r = (c & 0x7C00) >> 10;
+    g = (c & 0x03E0) >> 5;
+    b = c & 0x001F;
+  } else {
+    a = (c & 0xF0000000) >> 24;
+    r = (c & 0x00FF0000) >> 16;
+    g = (c & 0x0000FF00) >> 8;
+    b = c & 0x000000FF;
+  }
+  return a ? find_color(bgra8888_palette_table, PALETTE_TABLE_LEN, r, g, b)
+           : PALETTE_TABLE_LEN - 1;
+}
+
+TEST(CApiTest, OsdLutArgb1555) {
+  auto lut = get_color_lut(bgra8888_palette_table, PALETTE_TABLE_LEN);
+  ASSERT_NE(lut, nullptr);
+  // 5 bit channels, every pixel maps as the search
+  std::vector<RK_U32> bitmap(1 << 16);
+  std::vector<RK_U8> data(bitmap.size());
+  for (RK_U32 c = 0; c < bitmap.size(); c++)
+    bitmap[c] = c;
+  bitmap_to_palette(bitmap.data(), 256, NULL, data.data(), 256, 256, 256,
+                    RK_TRUE, lut.get());
+  for (RK_U32 c = 0; c < bitmap.size(); c++)
+    ASSERT_EQ(data[c], search_color(c, RK_TRUE)) << "pixel " << c;
+}
+
+// distance of a pixel to a palette entry
+static double color_distance(RK_U32 c, RK_U8 index) {
+  RK_U32 p = bgra8888_palette_table[index];
+  int dr = (int)((p >> 8) & 0xFF) - (int)((c >> 16) & 0xFF);
+  int dg = (int)((p >> 16) & 0xFF) - (int)((c >> 8) & 0xFF);
+  int db = (int)(p >> 24) - (int)(c & 0xFF);
+  return sqrt(dr * dr + dg * dg + db * db);
+}
+
+TEST(CApiTest, OsdLutArgb8888) {
+  auto lut = get_color_lut(bgra8888_palette_table, PALETTE_TABLE_LEN);
+  ASSERT_NE(lut, nullptr);
+  // the grays of a text and transparent map as the search
+  std::vector<RK_U32> colors = {0xFF101010, 0xFF808080, 0xFFC0C0C0,
+                                0xFFFFFFFF, 0x00FFFFFF, 0x0F000000};
+  std::vector<RK_U8> data(colors.size());
+  bitmap_to_palette(colors.data(), colors.size(), NULL, data.data(),
+                    colors.size(), colors.size(), 1, RK_FALSE, lut.get());
+  for (size_t i = 0; i < colors.size(); i++)
+    EXPECT_EQ(data[i], search_color(colors[i], RK_FALSE))
+        << std::hex << colors[i];
+  // 6 bits a channel, any other color is at most a cell off the nearest
+  std::mt19937 rng(1);
+  colors.resize(1 << 16);
+  for (auto &c : colors)
+    c = 0xFF000000 | (rng() & 0xFFFFFF);
+  data.resize(colors.size());
+  bitmap_to_palette(colors.data(), colors.size(), NULL, data.data(),
+                    colors.size(), colors.size(), 1, RK_FALSE, lut.get());
+  for (size_t i = 0; i < colors.size(); i++) {
+    double best = color_distance(colors[i], search_color(colors[i], RK_FALSE));
+    ASSERT_LE(color_distance(colors[i], data[i]), best + 4 * sqrt(3.0))
+        << std::hex << colors[i];
+  }
+}
+
+TEST(CApiTest, OsdLutChangedBlocks) {
+  auto lut = get_color_lut(bgra8888_palette_table, PALETTE_TABLE_LEN);
+  ASSERT_NE(lut, nullptr);
+  const int w = 100, h = 20;
+  std::mt19937 rng(1);
+  std::vector<RK_U32> bitmap[2];
+  for (auto &b : bitmap) {
+    b.resize(w * h);
+    for (auto &c : b)
+      c = rng() & 0x8000 ? rng() | 0x8000 : 0;
+  }
+  // a few pixels change, one at the end of the row, the rest as before
+  std::vector<RK_U32> next = bitmap[0];
+  next[5] = bitmap[1][5];
+  next[3 * w + 99] = bitmap[1][3 * w + 99];
+  next[19 * w + 40] = bitmap[1][19 * w + 40];
+  std::vector<RK_U8> data(w * h), expect(w * h);
+  bitmap_to_palette(bitmap[0].data(), w, NULL, data.data(), w, w, h, RK_TRUE,
+                    lut.get());
+  bitmap_to_palette(next.data(), w, bitmap[0].data(), data.data(), w, w, h,
+                    RK_TRUE, lut.get());
+  bitmap_to_palette(next.data(), w, NULL, expect.data(), w, w, h, RK_TRUE,
+                    lut.get());
+  EXPECT_EQ(data, expect);
+}
+
+TEST(CApiTest, OsdLutCache) {
+  std::vector<RK_U32> pal(bgra8888_palette_table,
+                          bgra8888_palette_table + PALETTE_TABLE_LEN);
+  auto lut = get_color_lut(pal.data(), pal.size());
+  // the same contents elsewhere share the table
+  std::vector<RK_U32> copy(pal);
+  EXPECT_EQ(get_color_lut(copy.data(), copy.size()), lut);
+  // new contents at the same address get their own
+  std::reverse(pal.begin(), pal.end() - 1);
+  auto other = get_color_lut(pal.data(), pal.size());
+  ASSERT_NE(other, lut);
+  RK_U32 white = 0xFFFF;
+  RK_U8 index[2];
+  RK_U8 expect = search_color(white, RK_TRUE);
+  bitmap_to_palette(&white, 1, NULL, &index[0], 1, 1, 1, RK_TRUE, lut.get());
+  bitmap_to_palette(&white, 1, NULL, &index[1], 1, 1, 1, RK_TRUE,
+                    other.get());
+  EXPECT_EQ(index[0], expect);
+  EXPECT_EQ(index[1], PALETTE_TABLE_LEN - 2 - expect);
+  // pushed out by newer palettes, a table held is still valid
+  for (int i = 0; i < 8; i++) {
+    pal[0] = i;
+    get_color_lut(pal.data(), pal.size());
+  }
+  bitmap_to_palette(&white, 1, NULL, &index[0], 1, 1, 1, RK_TRUE, lut.get());
+  EXPECT_EQ(index[0], expect);
+}
+
+// the statistics byte by byte
+static VIDEO_REGION_LUMA_S plain_luma(const RK_U8 *plane, RK_U32 stride,
+                                      const RECT_S &rect) {
+  VIDEO_REGION_LUMA_S luma;
+  memset(&luma, 0, sizeof(luma));
+  luma.u8Min = 0xFF;
+  for (RK_U32 i = 0; i < rect.u32Height; i++)
+    for (RK_U32 j = 0; j < rect.u32Width; j++) {
+      RK_U8 v = plane[(rect.s32Y + i) * stride + rect.s32X + j];
+      luma.u64Sum += v;
+      luma.u8Min = std::min(luma.u8Min, v);
+      luma.u8Max = std::max(luma.u8Max, v);
+      luma.au32Hist[v >> 4]++;
+    }
+  return luma;
+}
+
+TEST(CApiTest, RegionLuma) {
+  const RK_U32 w = 300, h = 200, stride = 320;
+  std::vector<RK_U8> plane(stride * h);
+  std::mt19937 rng(w);
+  for (auto &v : plane)
+    v = rng();
+  std::vector<RECT_S> rects;
+  // aligned and not, nested, overlapping and at the edges
+  for (RK_U32 y = 0; y < h; y += 37)
+    for (RK_U32 x = 0; x < w; x += 41) {
+      RECT_S rect = {(RK_S32)x, (RK_S32)y,
+                     std::min(w - x, (RK_U32)(1 + rng() % 90)),
+                     std::min(h - y, (RK_U32)(1 + rng() % 60))};
+      rects.push_back(rect);
+    }
+  rects.push_back({0, 0, w, h});
+  rects.push_back({16, 16, 32, 32});
+  std::vector<VIDEO_REGION_LUMA_S> luma(rects.size());
+  const RK_U32 flags[] = {REGION_LUMA_SUM, REGION_LUMA_MIN_MAX,
+                          REGION_LUMA_HIST,
+                          REGION_LUMA_MIN_MAX | REGION_LUMA_HIST,
+                          REGION_LUMA_INTEGRAL};
+  for (RK_U32 f : flags) {
+    region_luma_stat(plane.data(), stride, w, h, rects.data(), rects.size(),
+                     f, luma.data());
+    for (size_t i = 0; i < rects.size(); i++) {
+      SCOPED_TRACE(testing::Message() << "flags " << f << ", region " << i);
+      VIDEO_REGION_LUMA_S expect = plain_luma(plane.data(), stride, rects[i]);
+      EXPECT_EQ(luma[i].u64Sum, expect.u64Sum);
+      if (f & REGION_LUMA_MIN_MAX) {
+        EXPECT_EQ(luma[i].u8Min, expect.u8Min);
+        EXPECT_EQ(luma[i].u8Max, expect.u8Max);
+      }
+      if (f & REGION_LUMA_HIST) {
+        EXPECT_EQ(0, memcmp(luma[i].au32Hist, expect.au32Hist,
+                            sizeof(expect.au32Hist)));
+      }
+    }
+  }
+}
+
+TEST(CApiTest, RegionLumaIntegral) {
+  const RK_U32 w = 256, h = 128;
+  std::vector<RK_U8> plane(w * h);
+  std::mt19937 rng(h);
+  for (auto &v : plane)
+    v = rng();
+  // dense windows, the integral image is used
+  std::vector<RECT_S> rects;
+  for (RK_U32 y = 0; y + 64 <= h; y += 8)
+    for (RK_U32 x = 0; x + 64 <= w; x += 8)
+      rects.push_back({(RK_S32)x, (RK_S32)y, 64, 64});
+  std::vector<VIDEO_REGION_LUMA_S> luma(rects.size());
+  region_luma_stat(plane.data(), w, w, h, rects.data(), rects.size(),
+                   REGION_LUMA_INTEGRAL, luma.data());
+  for (size_t i = 0; i < rects.size(); i++)
+    ASSERT_EQ(luma[i].u64Sum, plain_luma(plane.data(), w, rects[i]).u64Sum)
+        << "region " << i;
+}
+
+TEST(CApiTest, RegionLumaOutOfPlane) {
+  const RK_U32 w = 64, h = 64;
+  std::vector<RK_U8> plane(w * h, 1);
+  // the last ones wrap around in 32 bits
+  RECT_S rects[] = {{0, 0, w, h},          {-1, 0, 8, 8},
+                    {60, 0, 8, 8},         {0, 0, 0, 8},
+                    {1, 0, 0xFFFFFFFF, 8}, {0, 8, 8, 0xFFFFFFF8}};
+  const int num = sizeof(rects) / sizeof(rects[0]);
+  VIDEO_REGION_LUMA_S luma[num];
+  region_luma_stat(plane.data(), w, w, h, rects, num, REGION_LUMA_SUM, luma);
+  EXPECT_EQ(luma[0].u64Sum, w * h);
+  for (int i = 1; i < num; i++)
+    EXPECT_EQ(luma[i].u64Sum, 0U) << "region " << i;
+}
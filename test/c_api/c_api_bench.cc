@@ -0,0 +1,20 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benches of the c api helpers, the checks are in CApiTest.
+// usage: c_api_bench <bench> [args]
+
+#include "../bench_main.h"
+
+int rkmedia_osd_lut_bench(int argc, char **argv);
+int rkmedia_region_luma_bench(int argc, char **argv);
+
+static const BenchEntry benches[] = {
+    {"osd_lut", rkmedia_osd_lut_bench},
+    {"region_luma", rkmedia_region_luma_bench},
+};
+
+int main(int argc, char **argv) {
+  return bench_main(argc, argv, benches, BENCH_NUM(benches));
+}
@@ -0,0 +1,142 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Time to convert one osd region bitmap to palette indexes, a clock text on
+// a transparent background. Before, RK_MPI_VENC_RGN_SetBitMap searched the
+// palette for every pixel. Now it looks up the table built at
+// RK_MPI_VENC_RGN_Init, and for the next second only converts the blocks of
+// the digits that changed. The conversions are checked in CApiTest.
+// usage: c_api_bench osd_lut [loops]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include "osd/color_table.h"
+#include "utils.h"
+
+#define REGION_W 512
+#define REGION_H 128
+#define CHAR_W 24
+#define CHAR_H 48
+
+// the conversion before, for ARGB8888 and ARGB1555
+static void convert_before(const RK_U32 *src, RK_U8 *dst, RK_BOOL argb1555) {
+  for (int i = 0; i < REGION_W * REGION_H; i++) {
+    RK_U32 c = src[i];
+    RK_U8 a, r, g, b;
+    if (argb1555) {
+      a = (c & 0x8000) >> 15;
+      r = (c & 0x7C00) >> 10;
+      g = (c & 0x03E0) >> 5;
+      b = c & 0x001F;
+    } else {
+      a = (c & 0xF0000000) >> 24;
+      r = (c & 0x00FF0000) >> 16;
+      g = (c & 0x0000FF00) >> 8;
+      b = c & 0x000000FF;
+    }
+    dst[i] = a ? find_color(bgra8888_palette_table, PALETTE_TABLE_LEN, r, g, b)
+               : PALETTE_TABLE_LEN - 1;
+  }
+}
+
+// a stand in glyph, white with a dark outline and shades between
+static void draw_text(RK_U32 *bitmap, const char *text, RK_BOOL argb1555) {
+  static const RK_U32 shades8888[] = {0x00000000, 0xFF101010, 0xFF808080,
+                                      0xFFC0C0C0, 0xFFFFFFFF};
+  static const RK_U32 shades1555[] = {0x0000, 0x8842, 0xC210, 0xE318,
+                                      0xFFFF};
+  const RK_U32 *shades = argb1555 ? shades1555 : shades8888;
+  memset(bitmap, 0, REGION_W * REGION_H * sizeof(RK_U32));
+  for (int n = 0; text[n]; n++) {
+    std::mt19937 rng(text[n]);
+    int x0 = 16 + n * CHAR_W, y0 = (REGION_H - CHAR_H) / 2;
+    for (int y = 4; y < CHAR_H - 4; y++)
+      for (int x = 2; x < CHAR_W - 2; x++)
+        bitmap[(y0 + y) * REGION_W + x0 + x] = shades[rng() % 5];
+  }
+}
+
+int rkmedia_osd_lut_bench(int argc, char **argv) {
+  int loops = argc > 1 ? atoi(argv[1]) : 20;
+  if (loops < 1)
+    loops = 1;
+
+  easymedia::AutoDuration ad;
+  auto lut = get_color_lut(bgra8888_palette_table, PALETTE_TABLE_LEN);
+  printf("table built in %.1f ms, once per palette\n", ad.Get() / 1000.0);
+
+  // the 8 bit table is 6 bits per channel, against the full search
+  int mismatch = 0;
+  double worst = 0;
+  for (RK_U32 c = 0; c < (1 << 24); c++) {
+    RK_U32 r = c >> 16, g = (c >> 8) & 0xFF, b = c & 0xFF;
+    RK_U8 best = find_color(bgra8888_palette_table, PALETTE_TABLE_LEN, r, g,
+                            b);
+    RK_U32 pixel = 0xFF000000 | c;
+    RK_U8 got;
+    bitmap_to_palette(&pixel, 1, NULL, &got, 1, 1, 1, RK_FALSE, lut.get());
+    if (got == best)
+      continue;
+    mismatch++;
+    double d[2];
+    RK_U8 idx[2] = {best, got};
+    for (int i = 0; i < 2; i++) {
+      RK_U32 p = bgra8888_palette_table[idx[i]];
+      int dr = (int)((p >> 8) & 0xFF) - (int)r;
+      int dg = (int)((p >> 16) & 0xFF) - (int)g;
+      int db = (int)(p >> 24) - (int)b;
+      d[i] = sqrt(dr * dr + dg * dg + db * db);
+    }
+    if (d[1] - d[0] > worst)
+      worst = d[1] - d[0];
+  }
+  printf("argb8888: %.3f%% of colors get another entry, at most %.2f "
+         "farther\n",
+         mismatch * 100.0 / (1 << 24), worst);
+
+  printf("%dx%d region, ms per bitmap\n", REGION_W, REGION_H);
+  printf("%-10s %10s %10s %10s %8s\n", "format", "before", "table", "1 digit",
+         "speedup");
+  const char *text[2] = {"2020-10-17 12:34:56", "2020-10-17 12:34:57"};
+  for (int f = 0; f < 2; f++) {
+    RK_BOOL argb1555 = f ? RK_TRUE : RK_FALSE;
+    std::vector<RK_U32> bitmap[2];
+    for (int t = 0; t < 2; t++) {
+      bitmap[t].resize(REGION_W * REGION_H);
+      draw_text(bitmap[t].data(), text[t], argb1555);
+    }
+    std::vector<RK_U8> data(REGION_W * REGION_H);
+
+    ad.Reset();
+    for (int i = 0; i < loops; i++) {
+      RK_U8 *before = (RK_U8 *)malloc(REGION_W * REGION_H);
+      convert_before(bitmap[i & 1].data(), before, argb1555);
+      free(before);
+    }
+    double before = ad.GetAndReset() / 1000.0 / loops;
+
+    for (int i = 0; i < loops; i++)
+      bitmap_to_palette(bitmap[i & 1].data(), REGION_W, NULL, data.data(),
+                        REGION_W, REGION_W, REGION_H, argb1555, lut.get());
+    double table = ad.GetAndReset() / 1000.0 / loops;
+
+    // from the last one converted above, the text changes every time
+    int last = (loops - 1) & 1;
+    for (int i = 0; i < loops * 100; i++, last ^= 1)
+      bitmap_to_palette(bitmap[last ^ 1].data(), REGION_W,
+                        bitmap[last].data(), data.data(), REGION_W,
+                        REGION_W, REGION_H, argb1555, lut.get());
+    double dirty = ad.Get() / 1000.0 / loops / 100;
+    printf("%-10s %10.3f %10.3f %10.4f %7.0fx\n",
+           argb1555 ? "argb1555" : "argb8888", before, table, dirty,
+           before / dirty);
+  }
+  return 0;
+}
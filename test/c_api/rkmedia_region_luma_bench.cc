@@ -0,0 +1,122 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Time of the region luma of a synthetic NV12 frame at 1080p and 4K.
+// Before, RK_MPI_VI_GetChnRegionLuma summed one region at a time byte by
+// byte. Now all the regions are done in one pass over the rows, with the
+// min, max and histogram if asked, or the sums from an integral image.
+// The statistics are checked in CApiTest.
+// usage: c_api_bench region_luma [loops]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "region_luma.h"
+#include "utils.h"
+
+// the sum before
+static RK_U64 luma_before(const RK_U8 *plane, RK_U32 stride,
+                          const RECT_S *rect) {
+  RK_U64 sum = 0;
+  const RK_U8 *rect_start = plane + rect->s32Y * stride + rect->s32X;
+  for (RK_U32 i = 0; i < rect->u32Height; i++) {
+    const RK_U8 *line_start = rect_start + i * stride;
+    for (RK_U32 j = 0; j < rect->u32Width; j++)
+      sum += *(line_start + j);
+  }
+  return sum;
+}
+
+// n x n rects over the frame, 16 aligned
+static void add_grid(std::vector<RECT_S> &rects, int w, int h, int n) {
+  for (int y = 0; y < n; y++)
+    for (int x = 0; x < n; x++) {
+      RECT_S rect;
+      rect.s32X = (w / n * x) & ~15;
+      rect.s32Y = (h / n * y) & ~15;
+      rect.u32Width = (w / n) & ~15;
+      rect.u32Height = (h / n) & ~15;
+      rects.push_back(rect);
+    }
+}
+
+static void run(const char *name, const std::vector<RK_U8> &frame, int w,
+                int h, const std::vector<RECT_S> &rects, int loops) {
+  std::vector<RK_U64> expect(rects.size());
+  std::vector<VIDEO_REGION_LUMA_S> luma(rects.size());
+
+  easymedia::AutoDuration ad;
+  for (int l = 0; l < loops; l++)
+    for (size_t i = 0; i < rects.size(); i++)
+      expect[i] = luma_before(frame.data(), w, &rects[i]);
+  double before = ad.GetAndReset() / 1000.0 / loops;
+
+  const RK_U32 flags[4] = {REGION_LUMA_SUM, REGION_LUMA_MIN_MAX,
+                           REGION_LUMA_HIST, REGION_LUMA_INTEGRAL};
+  double now[4];
+  for (int f = 0; f < 4; f++) {
+    ad.Reset();
+    for (int l = 0; l < loops; l++)
+      region_luma_stat(frame.data(), w, w, h, rects.data(), rects.size(),
+                       flags[f], luma.data());
+    now[f] = ad.Get() / 1000.0 / loops;
+  }
+  printf("%-20s %6d %9.3f %9.3f %9.3f %9.3f %9.3f %7.1fx\n", name,
+         (int)rects.size(), before, now[0], now[1], now[2], now[3],
+         before / std::min(now[0], now[3]));
+}
+
+static void frame_size(int w, int h, int loops) {
+  // NV12, luma of a gradient with noise, chroma not read
+  std::vector<RK_U8> frame(w * h * 3 / 2);
+  std::mt19937 rng(w);
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++)
+      frame[y * w + x] = (x * 255 / w + y * 255 / h) / 2 + rng() % 64;
+
+  printf("%dx%d NV12, ms per call\n", w, h);
+  printf("%-20s %6s %9s %9s %9s %9s %9s %8s\n", "regions", "num", "before",
+         "sum", "+min/max", "+hist", "integral", "speedup");
+  std::vector<RECT_S> rects;
+  // the isp assist case, 8 regions in the middle
+  for (int i = 0; i < 8; i++) {
+    RECT_S rect;
+    rect.s32X = (w / 8 * i) & ~15;
+    rect.s32Y = (h / 4) & ~15;
+    rect.u32Width = (w / 8) & ~15;
+    rect.u32Height = (h / 2) & ~15;
+    rects.push_back(rect);
+  }
+  run("8 bands", frame, w, h, rects, loops);
+  rects.clear();
+  add_grid(rects, w, h, 16);
+  run("16x16 grid", frame, w, h, rects, loops);
+  add_grid(rects, w, h, 8);
+  add_grid(rects, w, h, 4);
+  add_grid(rects, w, h, 2);
+  add_grid(rects, w, h, 1);
+  run("16x16 to 1x1", frame, w, h, rects, loops);
+  // dense windows, where the integral image pays
+  rects.clear();
+  for (int y = 0; y + 64 <= h; y += 16)
+    for (int x = 0; x + 64 <= w; x += 16) {
+      RECT_S rect = {x, y, 64, 64};
+      rects.push_back(rect);
+    }
+  run("64x64 step 16", frame, w, h, rects, loops);
+}
+
+int rkmedia_region_luma_bench(int argc, char **argv) {
+  int loops = argc > 1 ? atoi(argv[1]) : 10;
+  if (loops < 1)
+    loops = 1;
+  frame_size(1920, 1080, loops);
+  frame_size(3840, 2160, loops);
+  return 0;
+}
@@ -0,0 +1,178 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// ffmpeg_vid with libx264 on small synthetic frames, alone and under
+// video_enc_parallel.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "easymedia/buffer.h"
+#include "easymedia/encoder.h"
+#include "easymedia/flow.h"
+#include "easymedia/key_string.h"
+#include "easymedia/media_config.h"
+#include "easymedia/media_type.h"
+#include "easymedia/reflector.h"
+#include "easymedia/utils.h"
+#include "gtest/gtest.h"
+
+using namespace easymedia;
+
+static const int kWidth = 64;
+static const int kHeight = 64;
+static const size_t kFrameSize = kWidth * kHeight * 3 / 2;
+
+// a moving gradient, so that the frames differ
+static std::vector<uint8_t> make_frames(int num) {
+  std::vector<uint8_t> yuv(kFrameSize * num);
+  for (int i = 0; i < num; i++) {
+    uint8_t *p = yuv.data() + i * kFrameSize;
+    for (int y = 0; y < kHeight; y++)
+      for (int x = 0; x < kWidth; x++)
+        p[y * kWidth + x] = (uint8_t)(x * 2 + y + i * 3);
+    memset(p + kWidth * kHeight, 128, kFrameSize - kWidth * kHeight);
+  }
+  return yuv;
+}
+
+static MediaConfig make_config(int gop) {
+  MediaConfig cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  VideoConfig &vid_cfg = cfg.vid_cfg;
+  vid_cfg.image_cfg.image_info = {PIX_FMT_YUV420P, kWidth, kHeight, kWidth,
+                                  kHeight};
+  vid_cfg.qp_step = 4;
+  vid_cfg.qp_min = 12;
+  vid_cfg.qp_max = 48;
+  vid_cfg.bit_rate = 500000;
+  vid_cfg.frame_rate = 30;
+  vid_cfg.frame_rate_den = 1;
+  vid_cfg.level = 52;
+  vid_cfg.gop_size = gop;
+  vid_cfg.profile = 100;
+  vid_cfg.rc_quality = KEY_HIGHEST;
+  vid_cfg.rc_mode = KEY_CBR;
+  cfg.type = Type::Video;
+  return cfg;
+}
+
+static size_t encode_bytes(const std::vector<uint8_t> &yuv, bool copy) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_OUTPUTDATATYPE, VIDEO_H264);
+  PARAM_STRING_APPEND(param, KEY_NAME, "libx264");
+  auto enc =
+      REFLECTOR(Encoder)::Create<VideoEncoder>("ffmpeg_vid", param.c_str());
+  if (!enc || !enc->InitConfig(make_config(30))) {
+    ADD_FAILURE() << "fail to create ffmpeg_vid with libx264";
+    return 0;
+  }
+  size_t bytes = 0;
+  int frames = yuv.size() / kFrameSize;
+  for (int i = 0; i <= frames; i++) {
+    std::shared_ptr<MediaBuffer> in;
+    if (i == frames) {
+      in = MediaBuffer::Alloc(1);
+      in->SetValidSize(0);
+    } else if (copy) {
+      in = MediaBuffer::Alloc(kFrameSize);
+      memcpy(in->GetPtr(), yuv.data() + i * kFrameSize, kFrameSize);
+      in->SetValidSize(kFrameSize);
+    } else {
+      // in place, as the frame of a capture buffer
+      in = std::make_shared<MediaBuffer>(
+          (void *)(yuv.data() + i * kFrameSize), kFrameSize);
+      in->SetValidSize(kFrameSize);
+    }
+    in->SetUSTimeStamp(i * 33333LL);
+    if (enc->SendInput(in) < 0) {
+      ADD_FAILURE() << "frame " << i << " encode failed";
+      return 0;
+    }
+    std::shared_ptr<MediaBuffer> out;
+    while ((out = enc->FetchOutput()) && !out->IsEOF())
+      bytes += out->GetValidSize();
+  }
+  return bytes;
+}
+
+TEST(FFMpegTest, VidEncInPlace) {
+  auto yuv = make_frames(20);
+  size_t copied = encode_bytes(yuv, true);
+  ASSERT_GT(copied, 0U);
+  // the frames not copied encode the same
+  EXPECT_EQ(encode_bytes(yuv, false), copied);
+}
+
+typedef struct {
+  std::mutex mtx;
+  int packets;
+  int idr;
+  bool eof;
+} ParallelOutput;
+
+static void parallel_output(void *handler, std::shared_ptr<MediaBuffer> mb) {
+  ParallelOutput *out = (ParallelOutput *)handler;
+  std::lock_guard<std::mutex> _lg(out->mtx);
+  if (mb->IsEOF() || mb->GetValidSize() == 0) {
+    out->eof = true;
+    return;
+  }
+  if (mb->GetUserFlag() & MediaBuffer::kIntra)
+    out->idr++;
+  out->packets++;
+}
+
+TEST(FFMpegTest, ParallelEncoder) {
+  const int frames = 50, gop = 10;
+  auto yuv = make_frames(frames);
+  ImageInfo info = {PIX_FMT_YUV420P, kWidth, kHeight, kWidth, kHeight};
+  for (int workers : {1, 2, 4}) {
+    SCOPED_TRACE(testing::Message() << workers << " workers");
+    std::string flow_param;
+    PARAM_STRING_APPEND(flow_param, KEY_NAME, "ffmpeg_vid");
+    PARAM_STRING_APPEND(flow_param, KEY_INPUTDATATYPE, IMAGE_YUV420P);
+    PARAM_STRING_APPEND(flow_param, KEY_OUTPUTDATATYPE, VIDEO_H264);
+    PARAM_STRING_APPEND_TO(flow_param, KEY_ENC_WORKERS, workers);
+    std::string enc_param;
+    PARAM_STRING_APPEND(enc_param, KEY_NAME, "libx264");
+    enc_param.append(to_param_string(make_config(gop), VIDEO_H264));
+    flow_param = JoinFlowParam(flow_param, 1, enc_param);
+    auto flow = REFLECTOR(Flow)::Create<Flow>("video_enc_parallel",
+                                              flow_param.c_str());
+    ASSERT_NE(flow, nullptr);
+    ParallelOutput out;
+    out.packets = 0;
+    out.idr = 0;
+    out.eof = false;
+    flow->SetOutputCallBack(&out, parallel_output);
+    for (int i = 0; i < frames; i++) {
+      MediaBuffer mb(yuv.data() + i * kFrameSize, kFrameSize);
+      std::shared_ptr<MediaBuffer> in =
+          std::make_shared<ImageBuffer>(mb, info);
+      in->SetValidSize(kFrameSize);
+      flow->SendInput(in, 0);
+    }
+    auto eof = std::make_shared<MediaBuffer>();
+    eof->SetEOF(true);
+    flow->SendInput(eof, 0);
+    for (int i = 0; i < 10000; i++) {
+      {
+        std::lock_guard<std::mutex> _lg(out.mtx);
+        if (out.eof)
+          break;
+      }
+      msleep(1);
+    }
+    flow.reset();
+    // every frame out once, an idr at each segment
+    EXPECT_TRUE(out.eof);
+    EXPECT_EQ(out.packets, frames);
+    EXPECT_GE(out.idr, (frames + gop - 1) / gop);
+  }
+}
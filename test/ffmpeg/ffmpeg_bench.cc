@@ -0,0 +1,20 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benches of the ffmpeg encoding, the checks are in FFMpegTest.
+// usage: ffmpeg_bench <bench> [args]
+
+#include "../bench_main.h"
+
+int ffmpeg_vid_enc_bench(int argc, char **argv);
+int video_enc_parallel_bench(int argc, char **argv);
+
+static const BenchEntry benches[] = {
+    {"enc_parallel", video_enc_parallel_bench},
+    {"vid_enc", ffmpeg_vid_enc_bench},
+};
+
+int main(int argc, char **argv) {
+  return bench_main(argc, argv, benches, BENCH_NUM(benches));
+}
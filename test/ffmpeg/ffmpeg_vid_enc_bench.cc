@@ -0,0 +1,173 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Software encoding of a 1080p yuv420p file through ffmpeg_vid, with the
+// packets and frames handed over in place, then again with the copies
+// done before: each input frame copied as avcodec_send_frame did for a
+// frame without buffer references, each packet copied to a new buffer.
+// The same bytes out either way is checked in FFMpegTest.
+// usage: ffmpeg_bench vid_enc -i input.yuv [-w 1920] [-h 1080] [-n frames]
+//        [-c libx264]
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "easymedia/buffer.h"
+#include "easymedia/encoder.h"
+#include "easymedia/key_string.h"
+#include "easymedia/media_config.h"
+#include "easymedia/media_type.h"
+#include "easymedia/reflector.h"
+#include "easymedia/utils.h"
+
+static std::shared_ptr<easymedia::VideoEncoder>
+create_encoder(const std::string &codec, int w, int h) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_OUTPUTDATATYPE, VIDEO_H264);
+  PARAM_STRING_APPEND(param, KEY_NAME, codec);
+  auto enc = easymedia::REFLECTOR(Encoder)::Create<easymedia::VideoEncoder>(
+      "ffmpeg_vid", param.c_str());
+  if (!enc) {
+    fprintf(stderr, "Create encoder ffmpeg_vid failed\n");
+    return nullptr;
+  }
+  MediaConfig cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  VideoConfig &vid_cfg = cfg.vid_cfg;
+  vid_cfg.image_cfg.image_info = {PIX_FMT_YUV420P, w, h, w, h};
+  vid_cfg.qp_step = 4;
+  vid_cfg.qp_min = 12;
+  vid_cfg.qp_max = 48;
+  vid_cfg.bit_rate = 4000000;
+  vid_cfg.frame_rate = 30;
+  vid_cfg.level = 52;
+  vid_cfg.gop_size = 30;
+  vid_cfg.profile = 100;
+  vid_cfg.rc_quality = KEY_HIGHEST;
+  vid_cfg.rc_mode = KEY_CBR;
+  cfg.type = Type::Video;
+  if (!enc->InitConfig(cfg)) {
+    fprintf(stderr, "Init config of encoder ffmpeg_vid failed\n");
+    return nullptr;
+  }
+  return enc;
+}
+
+static size_t drain(std::shared_ptr<easymedia::VideoEncoder> &enc,
+                    bool copy) {
+  size_t bytes = 0;
+  while (true) {
+    auto out = enc->FetchOutput();
+    if (!out || out->IsEOF())
+      break;
+    if (copy) {
+      auto buffer = easymedia::MediaBuffer::Alloc(out->GetValidSize());
+      memcpy(buffer->GetPtr(), out->GetPtr(), out->GetValidSize());
+      buffer->SetValidSize(out->GetValidSize());
+      out = buffer;
+    }
+    bytes += out->GetValidSize();
+  }
+  return bytes;
+}
+
+static double run(const std::string &codec, int w, int h,
+                  const std::vector<uint8_t> &yuv, int frames, bool copy,
+                  size_t *bytes) {
+  auto enc = create_encoder(codec, w, h);
+  if (!enc)
+    return -1;
+  size_t frame_size = w * h * 3 / 2;
+  int file_frames = yuv.size() / frame_size;
+  *bytes = 0;
+  easymedia::AutoDuration ad;
+  for (int i = 0; i < frames; i++) {
+    const uint8_t *data = yuv.data() + (i % file_frames) * frame_size;
+    std::shared_ptr<easymedia::MediaBuffer> in;
+    if (copy) {
+      in = easymedia::MediaBuffer::Alloc(frame_size);
+      memcpy(in->GetPtr(), data, frame_size);
+    } else {
+      // the frame of a capture buffer
+      in = std::make_shared<easymedia::MediaBuffer>((void *)data, frame_size);
+    }
+    in->SetValidSize(frame_size);
+    in->SetUSTimeStamp(i * 33333LL);
+    if (enc->SendInput(in) < 0) {
+      fprintf(stderr, "frame %d encode failed\n", i);
+      return -1;
+    }
+    *bytes += drain(enc, copy);
+  }
+  auto eos = easymedia::MediaBuffer::Alloc(1);
+  eos->SetValidSize(0);
+  enc->SendInput(eos);
+  *bytes += drain(enc, copy);
+  return ad.Get() / 1000.0 / frames;
+}
+
+int ffmpeg_vid_enc_bench(int argc, char **argv) {
+  std::string input, codec = "libx264";
+  int w = 1920, h = 1080, frames = 100;
+  int c;
+  while ((c = getopt(argc, argv, "i:w:h:n:c:")) != -1) {
+    switch (c) {
+    case 'i':
+      input = optarg;
+      break;
+    case 'w':
+      w = atoi(optarg);
+      break;
+    case 'h':
+      h = atoi(optarg);
+      break;
+    case 'n':
+      frames = atoi(optarg);
+      break;
+    case 'c':
+      codec = optarg;
+      break;
+    default:
+      printf("usage: %s -i input.yuv [-w 1920] [-h 1080] [-n frames] "
+             "[-c libx264]\n",
+             argv[0]);
+      return -1;
+    }
+  }
+  if (input.empty() || w <= 0 || h <= 0 || frames <= 0) {
+    printf("missing input yuv420p file\n");
+    return -1;
+  }
+  FILE *f = fopen(input.c_str(), "rb");
+  if (!f) {
+    printf("fail to open %s\n", input.c_str());
+    return -1;
+  }
+  // at most 30 frames in memory, so that the disk is out of the timing
+  size_t frame_size = w * h * 3 / 2;
+  std::vector<uint8_t> yuv(frame_size * 30);
+  size_t read = fread(yuv.data(), 1, yuv.size(), f);
+  fclose(f);
+  if (read < frame_size) {
+    printf("%s has no %dx%d frame\n", input.c_str(), w, h);
+    return -1;
+  }
+  yuv.resize(read / frame_size * frame_size);
+
+  size_t bytes[2];
+  double copy = run(codec, w, h, yuv, frames, true, &bytes[0]);
+  double zero = run(codec, w, h, yuv, frames, false, &bytes[1]);
+  if (copy < 0 || zero < 0)
+    return -1;
+  printf("%dx%d %s, %d frames, ms per frame\n", w, h, codec.c_str(), frames);
+  printf("%-12s %10s %12s\n", "", "ms", "bytes out");
+  printf("%-12s %10.3f %12zu\n", "copy", copy, bytes[0]);
+  printf("%-12s %10.3f %12zu\n", "zero copy", zero, bytes[1]);
+  return 0;
+}
@@ -0,0 +1,190 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Offline encoding of a 1080p yuv420p file through video_enc_parallel with
+// ffmpeg_vid, for 1, 2, 4 and 8 workers. The frames are sent as fast as
+// the flow takes them, and the time runs until the eof goes out.
+// Every frame out once with an idr at each segment is checked in
+// FFMpegTest.
+// usage: ffmpeg_bench enc_parallel -i input.yuv [-w 1920] [-h 1080]
+//        [-n frames] [-c libx264] [-g gop]
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "easymedia/buffer.h"
+#include "easymedia/flow.h"
+#include "easymedia/key_string.h"
+#include "easymedia/media_config.h"
+#include "easymedia/media_type.h"
+#include "easymedia/reflector.h"
+#include "easymedia/utils.h"
+
+typedef struct {
+  std::mutex mtx;
+  int packets;
+  size_t bytes;
+  int idr;
+  bool eof;
+} BenchOutput;
+
+static void bench_output(void *handler,
+                         std::shared_ptr<easymedia::MediaBuffer> mb) {
+  BenchOutput *out = (BenchOutput *)handler;
+  std::lock_guard<std::mutex> _lg(out->mtx);
+  if (mb->IsEOF() || mb->GetValidSize() == 0) {
+    out->eof = true;
+    return;
+  }
+  if (mb->GetUserFlag() & easymedia::MediaBuffer::kIntra)
+    out->idr++;
+  out->packets++;
+  out->bytes += mb->GetValidSize();
+}
+
+static std::shared_ptr<easymedia::Flow>
+create_flow(const std::string &codec, int w, int h, int gop, int workers) {
+  std::string flow_param;
+  PARAM_STRING_APPEND(flow_param, KEY_NAME, "ffmpeg_vid");
+  PARAM_STRING_APPEND(flow_param, KEY_INPUTDATATYPE, IMAGE_YUV420P);
+  PARAM_STRING_APPEND(flow_param, KEY_OUTPUTDATATYPE, VIDEO_H264);
+  PARAM_STRING_APPEND_TO(flow_param, KEY_ENC_WORKERS, workers);
+  MediaConfig cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  VideoConfig &vid_cfg = cfg.vid_cfg;
+  vid_cfg.image_cfg.image_info = {PIX_FMT_YUV420P, w, h, w, h};
+  vid_cfg.qp_step = 4;
+  vid_cfg.qp_min = 12;
+  vid_cfg.qp_max = 48;
+  vid_cfg.bit_rate = 4000000;
+  vid_cfg.frame_rate = 30;
+  vid_cfg.frame_rate_den = 1;
+  vid_cfg.level = 52;
+  vid_cfg.gop_size = gop;
+  vid_cfg.profile = 100;
+  vid_cfg.rc_quality = KEY_HIGHEST;
+  vid_cfg.rc_mode = KEY_CBR;
+  std::string enc_param;
+  PARAM_STRING_APPEND(enc_param, KEY_NAME, codec);
+  enc_param.append(easymedia::to_param_string(cfg, VIDEO_H264));
+  flow_param = easymedia::JoinFlowParam(flow_param, 1, enc_param);
+  return easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "video_enc_parallel", flow_param.c_str());
+}
+
+static double run(const std::string &codec, int w, int h, int gop,
+                  int workers, const std::vector<uint8_t> &yuv, int frames,
+                  BenchOutput &out) {
+  auto flow = create_flow(codec, w, h, gop, workers);
+  if (!flow) {
+    fprintf(stderr, "Create flow video_enc_parallel failed\n");
+    return -1;
+  }
+  out.packets = 0;
+  out.bytes = 0;
+  out.idr = 0;
+  out.eof = false;
+  flow->SetOutputCallBack(&out, bench_output);
+
+  ImageInfo info = {PIX_FMT_YUV420P, w, h, w, h};
+  size_t frame_size = w * h * 3 / 2;
+  int file_frames = yuv.size() / frame_size;
+  easymedia::AutoDuration ad;
+  for (int i = 0; i < frames; i++) {
+    uint8_t *data = (uint8_t *)yuv.data() + (i % file_frames) * frame_size;
+    easymedia::MediaBuffer mb(data, frame_size);
+    std::shared_ptr<easymedia::MediaBuffer> in =
+        std::make_shared<easymedia::ImageBuffer>(mb, info);
+    in->SetValidSize(frame_size);
+    in->SetUSTimeStamp(easymedia::gettimeofday());
+    flow->SendInput(in, 0);
+  }
+  std::shared_ptr<easymedia::MediaBuffer> eof =
+      std::make_shared<easymedia::MediaBuffer>();
+  eof->SetEOF(true);
+  flow->SendInput(eof, 0);
+  while (true) {
+    {
+      std::lock_guard<std::mutex> _lg(out.mtx);
+      if (out.eof)
+        break;
+    }
+    easymedia::msleep(1);
+  }
+  double ms = ad.Get() / 1000.0;
+  flow.reset();
+  return ms;
+}
+
+int video_enc_parallel_bench(int argc, char **argv) {
+  std::string input, codec = "libx264";
+  int w = 1920, h = 1080, frames = 300, gop = 30;
+  int c;
+  while ((c = getopt(argc, argv, "i:w:h:n:c:g:")) != -1) {
+    switch (c) {
+    case 'i':
+      input = optarg;
+      break;
+    case 'w':
+      w = atoi(optarg);
+      break;
+    case 'h':
+      h = atoi(optarg);
+      break;
+    case 'n':
+      frames = atoi(optarg);
+      break;
+    case 'c':
+      codec = optarg;
+      break;
+    case 'g':
+      gop = atoi(optarg);
+      break;
+    default:
+      printf("usage: %s -i input.yuv [-w 1920] [-h 1080] [-n frames] "
+             "[-c libx264] [-g gop]\n",
+             argv[0]);
+      return -1;
+    }
+  }
+  if (input.empty() || w <= 0 || h <= 0 || frames <= 0 || gop <= 0) {
+    printf("missing input yuv420p file\n");
+    return -1;
+  }
+  FILE *f = fopen(input.c_str(), "rb");
+  if (!f) {
+    printf("fail to open %s\n", input.c_str());
+    return -1;
+  }
+  // at most 30 frames in memory, so that the disk is out of the timing
+  size_t frame_size = w * h * 3 / 2;
+  std::vector<uint8_t> yuv(frame_size * 30);
+  size_t read = fread(yuv.data(), 1, yuv.size(), f);
+  fclose(f);
+  if (read < frame_size) {
+    printf("%s has no %dx%d frame\n", input.c_str(), w, h);
+    return -1;
+  }
+  yuv.resize(read / frame_size * frame_size);
+
+  printf("%dx%d %s, %d frames, gop %d\n", w, h, codec.c_str(), frames, gop);
+  printf("%-8s %10s %8s %12s %6s\n", "workers", "ms", "fps", "bytes out",
+         "idr");
+  const int workers[4] = {1, 2, 4, 8};
+  BenchOutput out;
+  for (int i = 0; i < 4; i++) {
+    double ms = run(codec, w, h, gop, workers[i], yuv, frames, out);
+    if (ms < 0)
+      return -1;
+    printf("%-8d %10.1f %8.1f %12zu %6d\n", workers[i], ms,
+           frames * 1000.0 / ms, out.bytes, out.idr);
+  }
+  return 0;
+}
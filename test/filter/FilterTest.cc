@@ -0,0 +1,440 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// cpu_image_blit against a per pixel reference of the same fixed point
+// math, and the image dispatcher over a mock rga.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "cpu_image.h"
+#include "filter.h"
+#include "gtest/gtest.h"
+#include "image_dispatch.h"
+#include "key_string.h"
+#include "mock_rga_backend.h"
+#include "reflector.h"
+#include "utils.h"
+
+using namespace easymedia;
+
+// one 8 bit component
+struct Comp {
+  int w, h;
+  std::vector<uint8_t> v;
+  Comp(int cw = 0, int ch = 0) : w(cw), h(ch), v(cw * ch) {}
+  uint8_t &at(int x, int y) { return v[y * w + x]; }
+};
+
+static bool is_yuv(PixelFormat f) { return f <= PIX_FMT_NV61; }
+static bool is_semi(PixelFormat f) {
+  return f == PIX_FMT_NV12 || f == PIX_FMT_NV21 || f == PIX_FMT_NV16 ||
+         f == PIX_FMT_NV61;
+}
+static int chroma_shift(PixelFormat f) {
+  return f == PIX_FMT_YUV420P || f == PIX_FMT_NV12 || f == PIX_FMT_NV21;
+}
+
+static size_t image_size(const ImageInfo &info) {
+  if (is_yuv(info.pix_fmt))
+    return info.vir_width * info.vir_height +
+           info.vir_width * (info.vir_height >> chroma_shift(info.pix_fmt));
+  if (info.pix_fmt == PIX_FMT_RGB565 || info.pix_fmt == PIX_FMT_BGR565)
+    return info.vir_width * info.vir_height * 2;
+  return info.vir_width * info.vir_height * 3;
+}
+
+// the bytes of component k of pixel or chroma (x, y) of the rect
+static uint8_t *comp_ptr(const ImageInfo &info, uint8_t *data,
+                         const ImageRect &r, int k, int x, int y) {
+  int vw = info.vir_width, vh = info.vir_height;
+  PixelFormat f = info.pix_fmt;
+  if (is_yuv(f)) {
+    int ys = chroma_shift(f);
+    if (k == 0)
+      return data + (r.y + y) * vw + r.x + x;
+    int cx = (r.x >> 1) + x, cy = (r.y >> ys) + y;
+    uint8_t *chroma = data + vw * vh;
+    if (is_semi(f)) {
+      bool swap = f == PIX_FMT_NV21 || f == PIX_FMT_NV61;
+      return chroma + cy * vw + cx * 2 + ((k == 2) != swap);
+    }
+    if (k == 2)
+      chroma += vw / 2 * (vh >> ys);
+    return chroma + cy * (vw / 2) + cx;
+  }
+  if (f == PIX_FMT_RGB565 || f == PIX_FMT_BGR565)
+    return data + ((r.y + y) * vw + r.x + x) * 2;
+  // RGB888 is b, g, r in memory
+  int off = f == PIX_FMT_RGB888 ? 2 - k : k;
+  return data + ((r.y + y) * vw + r.x + x) * 3 + off;
+}
+
+static void read_comps(const ImageInfo &info, uint8_t *data,
+                       const ImageRect &r, Comp c[3]) {
+  PixelFormat f = info.pix_fmt;
+  for (int k = 0; k < 3; k++) {
+    int w = r.w, h = r.h;
+    if (is_yuv(f) && k) {
+      w = (r.w + 1) >> 1;
+      h = (r.h + (1 << chroma_shift(f)) - 1) >> chroma_shift(f);
+    }
+    c[k] = Comp(w, h);
+    for (int y = 0; y < h; y++)
+      for (int x = 0; x < w; x++) {
+        uint8_t *p = comp_ptr(info, data, r, k, x, y);
+        if (f != PIX_FMT_RGB565 && f != PIX_FMT_BGR565) {
+          c[k].at(x, y) = *p;
+          continue;
+        }
+        int v = p[0] | (p[1] << 8);
+        int hk = f == PIX_FMT_RGB565 ? 0 : 2;
+        int bits = k == 1 ? (v >> 5) & 63 : (k == hk ? v >> 11 : v & 31);
+        c[k].at(x, y) = k == 1 ? (bits << 2) | (bits >> 4)
+                               : (bits << 3) | (bits >> 2);
+      }
+  }
+}
+
+static void write_comps(const ImageInfo &info, uint8_t *data,
+                        const ImageRect &r, Comp c[3]) {
+  PixelFormat f = info.pix_fmt;
+  bool rgb16 = f == PIX_FMT_RGB565 || f == PIX_FMT_BGR565;
+  for (int k = 0; k < (rgb16 ? 1 : 3); k++)
+    for (int y = 0; y < c[k].h; y++)
+      for (int x = 0; x < c[k].w; x++) {
+        uint8_t *p = comp_ptr(info, data, r, k, x, y);
+        if (!rgb16) {
+          *p = c[k].at(x, y);
+          continue;
+        }
+        int hi = f == PIX_FMT_RGB565 ? 0 : 2;
+        int v = ((c[hi].at(x, y) >> 3) << 11) | ((c[1].at(x, y) >> 2) << 5) |
+                (c[2 - hi].at(x, y) >> 3);
+        p[0] = v & 0xFF;
+        p[1] = v >> 8;
+      }
+}
+
+static void pos(int src, int dst, int i, int &p, int &f) {
+  int64_t q = (((int64_t)(2 * i + 1) * src) << 16) / (2 * dst) - 32768;
+  q = std::max(q, (int64_t)0);
+  p = q >> 16;
+  f = (q >> 8) & 0xFF;
+  if (p >= src - 1) {
+    p = src - 1;
+    f = 0;
+  }
+}
+
+static Comp ref_scale(Comp &s, int w, int h, bool area) {
+  Comp d(w, h);
+  if (s.w == w && s.h == h)
+    return s;
+  if (area) {
+    for (int y = 0; y < h; y++)
+      for (int x = 0; x < w; x++) {
+        int x0 = (int64_t)x * s.w / w, y0 = (int64_t)y * s.h / h;
+        int x1 = std::max((int)((int64_t)(x + 1) * s.w / w), x0 + 1);
+        int y1 = std::max((int)((int64_t)(y + 1) * s.h / h), y0 + 1);
+        uint32_t sum = 0, n = (x1 - x0) * (y1 - y0);
+        for (int j = y0; j < y1; j++)
+          for (int i = x0; i < x1; i++)
+            sum += s.at(i, j);
+        d.at(x, y) = (sum + n / 2) / n;
+      }
+    return d;
+  }
+  Comp t(w, s.h);
+  for (int y = 0; y < s.h; y++)
+    for (int x = 0; x < w; x++) {
+      int p, f;
+      pos(s.w, w, x, p, f);
+      int b = f ? s.at(p + 1, y) : 0;
+      t.at(x, y) = (s.at(p, y) * (256 - f) + b * f + 128) >> 8;
+    }
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++) {
+      int p, f;
+      pos(s.h, h, y, p, f);
+      int b = f ? t.at(x, p + 1) : 0;
+      d.at(x, y) = (t.at(x, p) * (256 - f) + b * f + 128) >> 8;
+    }
+  return d;
+}
+
+static Comp ref_rotate(Comp &s, int rotate) {
+  if (!rotate)
+    return s;
+  bool turn = rotate != 180;
+  Comp d(turn ? s.h : s.w, turn ? s.w : s.h);
+  for (int y = 0; y < d.h; y++)
+    for (int x = 0; x < d.w; x++) {
+      if (rotate == 90)
+        d.at(x, y) = s.at(y, s.h - 1 - x);
+      else if (rotate == 270)
+        d.at(x, y) = s.at(s.w - 1 - y, x);
+      else
+        d.at(x, y) = s.at(s.w - 1 - x, s.h - 1 - y);
+    }
+  return d;
+}
+
+static uint8_t clamp8(int v) { return std::min(std::max(v, 0), 255); }
+
+static void ref_blit(const ImageInfo &si, uint8_t *src, ImageRect sr,
+                     const ImageInfo &di, uint8_t *dst, ImageRect dr,
+                     int rotate, CpuScaleMode mode) {
+  bool turn = rotate == 90 || rotate == 270;
+  int pw = turn ? dr.h : dr.w, ph = turn ? dr.w : dr.h;
+  bool area = mode == CPU_SCALE_AREA ||
+              (mode == CPU_SCALE_AUTO && sr.w >= pw * 2 && sr.h >= ph * 2);
+  bool scale = sr.w != pw || sr.h != ph;
+  Comp c[3];
+  read_comps(si, src, sr, c);
+  if (is_yuv(si.pix_fmt) && is_yuv(di.pix_fmt)) {
+    int ys = chroma_shift(di.pix_fmt);
+    for (int k = 0; k < 3; k++) {
+      int w = k ? (dr.w + 1) >> 1 : dr.w;
+      int h = k ? (dr.h + (1 << ys) - 1) >> ys : dr.h;
+      Comp t = ref_scale(c[k], turn ? h : w, turn ? w : h, area);
+      c[k] = ref_rotate(t, rotate);
+    }
+    write_comps(di, dst, dr, c);
+    return;
+  }
+  Comp rgb[3] = {Comp(pw, ph), Comp(pw, ph), Comp(pw, ph)};
+  if (is_yuv(si.pix_fmt)) {
+    int ys = chroma_shift(si.pix_fmt);
+    if (scale) {
+      c[0] = ref_scale(c[0], pw, ph, area);
+      for (int k = 1; k < 3; k++)
+        c[k] = ref_scale(c[k], (pw + 1) / 2, (ph + (1 << ys) - 1) >> ys, area);
+    }
+    for (int y = 0; y < ph; y++)
+      for (int x = 0; x < pw; x++) {
+        int yy = (c[0].at(x, y) - 16) * 74 + 32;
+        int u = c[1].at(x / 2, y >> ys) - 128;
+        int v = c[2].at(x / 2, y >> ys) - 128;
+        rgb[0].at(x, y) = clamp8((yy + 102 * v) >> 6);
+        rgb[1].at(x, y) = clamp8((yy - 25 * u - 52 * v) >> 6);
+        rgb[2].at(x, y) = clamp8((yy + 129 * u) >> 6);
+      }
+  } else {
+    for (int k = 0; k < 3; k++)
+      rgb[k] = scale ? ref_scale(c[k], pw, ph, area) : c[k];
+  }
+  for (int k = 0; k < 3; k++)
+    rgb[k] = ref_rotate(rgb[k], rotate);
+  if (!is_yuv(di.pix_fmt)) {
+    write_comps(di, dst, dr, rgb);
+    return;
+  }
+  int ys = chroma_shift(di.pix_fmt);
+  Comp o[3] = {Comp(dr.w, dr.h), Comp((dr.w + 1) / 2, (dr.h + ys) >> ys),
+               Comp((dr.w + 1) / 2, (dr.h + ys) >> ys)};
+  for (int y = 0; y < dr.h; y++)
+    for (int x = 0; x < dr.w; x++)
+      o[0].at(x, y) = ((66 * rgb[0].at(x, y) + 129 * rgb[1].at(x, y) +
+                        25 * rgb[2].at(x, y) + 128) >>
+                       8) +
+                      16;
+  for (int y = 0; y < o[1].h; y++)
+    for (int x = 0; x < o[1].w; x++) {
+      int a[3];
+      int x0 = x * 2, x1 = std::min(x0 + 1, dr.w - 1);
+      int y0 = y << ys, y1 = std::min(y0 + ys, dr.h - 1);
+      for (int k = 0; k < 3; k++) {
+        Comp &p = rgb[k];
+        if (ys)
+          a[k] = (p.at(x0, y0) + p.at(x1, y0) + p.at(x0, y1) + p.at(x1, y1) +
+                  2) >>
+                 2;
+        else
+          a[k] = (p.at(x0, y0) + p.at(x1, y0) + 1) >> 1;
+      }
+      o[1].at(x, y) = ((-38 * a[0] - 74 * a[1] + 112 * a[2] + 128) >> 8) + 128;
+      o[2].at(x, y) = ((112 * a[0] - 94 * a[1] - 18 * a[2] + 128) >> 8) + 128;
+    }
+  write_comps(di, dst, dr, o);
+}
+
+static const PixelFormat formats[] = {
+    PIX_FMT_NV12,   PIX_FMT_NV21,   PIX_FMT_NV16,   PIX_FMT_NV61,
+    PIX_FMT_YUV420P, PIX_FMT_YUV422P, PIX_FMT_RGB888, PIX_FMT_BGR888,
+    PIX_FMT_RGB565, PIX_FMT_BGR565};
+#define FORMAT_NUM (int)(sizeof(formats) / sizeof(formats[0]))
+
+static std::vector<uint8_t> random_image(const ImageInfo &info,
+                                         std::mt19937 &rng) {
+  std::vector<uint8_t> v(image_size(info));
+  for (auto &b : v)
+    b = rng();
+  return v;
+}
+
+// every pair of formats, rotation and scale mode, on one and on 3 threads
+TEST(FilterTest, CpuImageConformance) {
+  std::mt19937 rng(2020);
+  // crops at odd sizes, tails of every simd loop, bands over 3 threads
+  struct {
+    ImageRect sr, dr;
+  } cases[] = {
+      {{6, 4, 210, 190}, {0, 0, 210, 190}},  // crop
+      {{0, 0, 222, 198}, {4, 2, 301, 263}},  // up
+      {{2, 2, 218, 194}, {0, 0, 150, 137}},  // down by less than 2
+      {{0, 0, 222, 198}, {10, 6, 73, 65}},   // down by 3
+  };
+  const CpuScaleMode modes[] = {CPU_SCALE_AUTO, CPU_SCALE_BILINEAR,
+                                CPU_SCALE_AREA};
+  int fails = 0, runs = 0;
+  for (int s = 0; s < FORMAT_NUM; s++)
+    for (int d = 0; d < FORMAT_NUM; d++)
+      for (auto &c : cases)
+        for (int rotate = 0; rotate < 360; rotate += 90) {
+          ImageInfo si = {formats[s], 222, 198, 224, 200};
+          ImageRect dr = c.dr;
+          if (rotate == 90 || rotate == 270)
+            std::swap(dr.w, dr.h);
+          ImageInfo di = {formats[d], 320, 310, 320, 312};
+          std::vector<uint8_t> src = random_image(si, rng);
+          std::vector<uint8_t> init = random_image(di, rng);
+          for (auto mode : modes) {
+            std::vector<uint8_t> expect(init);
+            ref_blit(si, src.data(), c.sr, di, expect.data(), dr, rotate,
+                     mode);
+            for (int threads = 1; threads <= 3; threads += 2) {
+              std::vector<uint8_t> out(init);
+              runs++;
+              if (cpu_image_blit(si, src.data(), &c.sr, di, out.data(), &dr,
+                                 rotate, mode, threads) ||
+                  out != expect) {
+                if (fails++ < 10)
+                  ADD_FAILURE() << PixFmtToString(si.pix_fmt) << " -> "
+                                << PixFmtToString(di.pix_fmt) << " " << c.sr.w
+                                << "x" << c.sr.h << " -> " << dr.w << "x"
+                                << dr.h << " rotate " << rotate << " mode "
+                                << mode << " threads " << threads;
+              }
+            }
+          }
+        }
+  EXPECT_EQ(fails, 0) << "of " << runs << " blits";
+}
+
+// the filter of the reflector does the same
+TEST(FilterTest, CpuImageFilter) {
+  ImageInfo si = {PIX_FMT_NV12, 640, 360, 640, 360};
+  ImageInfo di = {PIX_FMT_RGB888, 240, 320, 240, 320};
+  std::mt19937 rng(7);
+  std::vector<uint8_t> src = random_image(si, rng);
+  std::vector<uint8_t> expect(image_size(di));
+  ImageRect sr = {0, 0, 640, 360}, dr = {0, 0, 240, 320};
+  ASSERT_EQ(
+      cpu_image_blit(si, src.data(), &sr, di, expect.data(), &dr, 90), 0);
+
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_BUFFER_RECT,
+                      TwoImageRectToString({sr, dr}).c_str());
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_ROTATE, 90);
+  auto filter = REFLECTOR(Filter)::Create<Filter>("cpu_image", param.c_str());
+  ASSERT_NE(filter, nullptr);
+  auto in = std::make_shared<ImageBuffer>(
+      MediaBuffer(src.data(), src.size()), si);
+  auto out = std::make_shared<ImageBuffer>(
+      MediaBuffer::Alloc2(expect.size()), di);
+  std::shared_ptr<MediaBuffer> output = out;
+  ASSERT_EQ(filter->Process(in, output), 0);
+  EXPECT_EQ(memcmp(out->GetPtr(), expect.data(), expect.size()), 0);
+}
+
+// 4 flows on the dispatcher for 300 ms, the blits each backend took
+static void dispatch_run(ImageDispatchPolicy policy, int64_t &hw_count,
+                         int64_t &cpu_count, int &fails) {
+  int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+  ImageDispatcher dispatcher(std::make_shared<MockRgaBackend>(4000),
+                             std::make_shared<CpuImageBackend>(cores));
+  std::atomic<int> failed(0);
+  std::atomic<bool> quit(false);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&] {
+      auto src = AllocMockImage(PIX_FMT_NV12, 1920, 1080);
+      auto dst = AllocMockImage(PIX_FMT_NV12, 720, 576);
+      while (!quit)
+        if (dispatcher.Blit(src, dst, nullptr, nullptr, 0, policy))
+          failed++;
+    });
+  }
+  easymedia::msleep(300);
+  quit = true;
+  for (auto &t : threads)
+    t.join();
+  fails = failed;
+  dispatcher.GetCount(hw_count, cpu_count);
+}
+
+// each policy takes the backends it says
+TEST(FilterTest, ImageDispatchPolicy) {
+  int64_t hw, cpu;
+  int fails;
+  dispatch_run(IMAGE_DISPATCH_HW, hw, cpu, fails);
+  EXPECT_EQ(fails, 0);
+  EXPECT_GT(hw, 0);
+  EXPECT_EQ(cpu, 0);
+  dispatch_run(IMAGE_DISPATCH_CPU, hw, cpu, fails);
+  EXPECT_EQ(fails, 0);
+  EXPECT_EQ(hw, 0);
+  EXPECT_GT(cpu, 0);
+  dispatch_run(IMAGE_DISPATCH_BALANCED, hw, cpu, fails);
+  EXPECT_EQ(fails, 0);
+  EXPECT_GT(hw, 0);
+  EXPECT_GT(cpu, 0);
+}
+
+// the mock has no bgr565, the cpu takes it under balanced and is right
+TEST(FilterTest, ImageDispatchFallback) {
+  int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+  ImageDispatcher dispatcher(std::make_shared<MockRgaBackend>(4000),
+                             std::make_shared<CpuImageBackend>(cores));
+  auto src = AllocMockImage(PIX_FMT_NV12, 640, 360);
+  uint8_t *data = (uint8_t *)src->GetPtr();
+  for (int i = 0; i < 640 * 360 * 3 / 2; i++)
+    data[i] = i * 7;
+  auto dst = AllocMockImage(PIX_FMT_BGR565, 320, 180);
+  auto expect = AllocMockImage(PIX_FMT_BGR565, 320, 180);
+  ASSERT_EQ(cpu_image_blit(src, expect), 0);
+  ASSERT_EQ(
+      dispatcher.Blit(src, dst, nullptr, nullptr, 0, IMAGE_DISPATCH_BALANCED),
+      0);
+  EXPECT_EQ(memcmp(dst->GetPtr(), expect->GetPtr(), dst->GetValidSize()), 0);
+  int64_t hw_count, cpu_count;
+  dispatcher.GetCount(hw_count, cpu_count);
+  EXPECT_EQ(hw_count, 0);
+  EXPECT_EQ(cpu_count, 1);
+  // hw only does not take a format the mock does not have
+  EXPECT_EQ(dispatcher.Blit(src, dst, nullptr, nullptr, 0, IMAGE_DISPATCH_HW),
+            -EINVAL);
+
+  // the filter, by the process dispatcher
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_BUFFER_RECT,
+                      TwoImageRectToString({{0, 0, 640, 360},
+                                            {0, 0, 320, 180}}).c_str());
+  PARAM_STRING_APPEND(param, KEY_DISPATCH_POLICY, KEY_DISPATCH_CPU);
+  auto filter =
+      REFLECTOR(Filter)::Create<Filter>("image_dispatch", param.c_str());
+  ASSERT_NE(filter, nullptr);
+  std::shared_ptr<MediaBuffer> output = dst;
+  memset(dst->GetPtr(), 0, dst->GetSize());
+  ASSERT_EQ(filter->Process(src, output), 0);
+  EXPECT_EQ(memcmp(dst->GetPtr(), expect->GetPtr(), dst->GetValidSize()), 0);
+}
@@ -0,0 +1,104 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// The MPix/s out of each cpu_image kernel at 1080p, on one and on several
+// threads. The conformance to the reference is in FilterTest.
+// usage: filter_bench cpu_image [loops] [threads]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <random>
+#include <vector>
+
+#include "buffer.h"
+#include "cpu_image.h"
+#include "utils.h"
+
+using namespace easymedia;
+
+static std::vector<uint8_t> random_image(const ImageInfo &info,
+                                         std::mt19937 &rng) {
+  std::vector<uint8_t> v(CalPixFmtSize(info));
+  for (auto &b : v)
+    b = rng();
+  return v;
+}
+
+typedef struct {
+  const char *name;
+  PixelFormat src, dst;
+  int sw, sh, dw, dh, rotate;
+  CpuScaleMode mode;
+} BenchCase;
+
+static double run(const BenchCase &c, int loops, int threads) {
+  std::mt19937 rng(1);
+  ImageInfo si = {c.src, c.sw, c.sh, c.sw, c.sh};
+  ImageInfo di = {c.dst, c.dw, c.dh, c.dw, c.dh};
+  std::vector<uint8_t> src = random_image(si, rng);
+  std::vector<uint8_t> dst(CalPixFmtSize(di));
+  cpu_image_blit(si, src.data(), nullptr, di, dst.data(), nullptr, c.rotate,
+                 c.mode, threads);
+  AutoDuration ad;
+  for (int l = 0; l < loops; l++)
+    cpu_image_blit(si, src.data(), nullptr, di, dst.data(), nullptr,
+                   c.rotate, c.mode, threads);
+  double us = ad.Get() / (double)loops;
+  return c.dw * c.dh / us;
+}
+
+int cpu_image_bench(int argc, char **argv) {
+  int loops = argc > 1 ? atoi(argv[1]) : 20;
+  int threads = argc > 2 ? atoi(argv[2]) : 4;
+  if (loops < 1)
+    loops = 1;
+
+  const BenchCase cases[] = {
+      {"copy", PIX_FMT_NV12, PIX_FMT_NV12, 1920, 1080, 1920, 1080, 0,
+       CPU_SCALE_AUTO},
+      {"nv12>yuv420p", PIX_FMT_NV12, PIX_FMT_YUV420P, 1920, 1080, 1920, 1080,
+       0, CPU_SCALE_AUTO},
+      {"nv16>nv12", PIX_FMT_NV16, PIX_FMT_NV12, 1920, 1080, 1920, 1080, 0,
+       CPU_SCALE_AUTO},
+      {"nv12>rgb888", PIX_FMT_NV12, PIX_FMT_RGB888, 1920, 1080, 1920, 1080, 0,
+       CPU_SCALE_AUTO},
+      {"nv12>rgb565", PIX_FMT_NV12, PIX_FMT_RGB565, 1920, 1080, 1920, 1080, 0,
+       CPU_SCALE_AUTO},
+      {"rgb888>nv12", PIX_FMT_RGB888, PIX_FMT_NV12, 1920, 1080, 1920, 1080, 0,
+       CPU_SCALE_AUTO},
+      {"rgb565>nv12", PIX_FMT_RGB565, PIX_FMT_NV12, 1920, 1080, 1920, 1080, 0,
+       CPU_SCALE_AUTO},
+      {"rgb565>rgb888", PIX_FMT_RGB565, PIX_FMT_RGB888, 1920, 1080, 1920,
+       1080, 0, CPU_SCALE_AUTO},
+      {"nv12 bilinear 720p", PIX_FMT_NV12, PIX_FMT_NV12, 1920, 1080, 1280, 720,
+       0, CPU_SCALE_BILINEAR},
+      {"nv12 bilinear 4k", PIX_FMT_NV12, PIX_FMT_NV12, 1920, 1080, 3840, 2160,
+       0, CPU_SCALE_BILINEAR},
+      {"nv12 area 540p", PIX_FMT_NV12, PIX_FMT_NV12, 1920, 1080, 960, 540, 0,
+       CPU_SCALE_AREA},
+      {"nv12 area 360p", PIX_FMT_NV12, PIX_FMT_NV12, 1920, 1080, 640, 360, 0,
+       CPU_SCALE_AREA},
+      {"rgb888 bilinear 720p", PIX_FMT_RGB888, PIX_FMT_RGB888, 1920, 1080,
+       1280, 720, 0, CPU_SCALE_BILINEAR},
+      {"nv12>rgb888 300x300", PIX_FMT_NV12, PIX_FMT_RGB888, 1920, 1080, 300,
+       300, 0, CPU_SCALE_AUTO},
+      {"nv12 rotate 90", PIX_FMT_NV12, PIX_FMT_NV12, 1920, 1080, 1080, 1920,
+       90, CPU_SCALE_AUTO},
+      {"nv12 rotate 180", PIX_FMT_NV12, PIX_FMT_NV12, 1920, 1080, 1920, 1080,
+       180, CPU_SCALE_AUTO},
+      {"nv12 rotate 270", PIX_FMT_NV12, PIX_FMT_NV12, 1920, 1080, 1080, 1920,
+       270, CPU_SCALE_AUTO},
+      {"rgb888 rotate 90", PIX_FMT_RGB888, PIX_FMT_RGB888, 1920, 1080, 1080,
+       1920, 90, CPU_SCALE_AUTO},
+      {"rgb565 rotate 90", PIX_FMT_RGB565, PIX_FMT_RGB565, 1920, 1080, 1080,
+       1920, 90, CPU_SCALE_AUTO},
+  };
+  printf("1080p source, MPix/s out, %d loops\n", loops);
+  printf("%-22s %10s %10s\n", "kernel", "1 thread", "threads");
+  for (auto &c : cases)
+    printf("%-22s %10.1f %10.1f\n", c.name, run(c, loops, 1),
+           run(c, loops, threads));
+  return 0;
+}
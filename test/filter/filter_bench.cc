@@ -0,0 +1,21 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benches of the cpu image kernels and the image dispatcher, the checks are
+// in FilterTest.
+// usage: filter_bench <bench> [args]
+
+#include "../bench_main.h"
+
+int cpu_image_bench(int argc, char **argv);
+int image_dispatch_bench(int argc, char **argv);
+
+static const BenchEntry benches[] = {
+    {"cpu_image", cpu_image_bench},
+    {"image_dispatch", image_dispatch_bench},
+};
+
+int main(int argc, char **argv) {
+  return bench_main(argc, argv, benches, BENCH_NUM(benches));
+}
@@ -0,0 +1,110 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// 8 flows scaling 1080p nv12 to D1 at once through an ImageDispatcher,
+// with a mock rga that takes one blit at a time for a fixed latency, under
+// each policy. Prints the frames/s of all the flows together. The policies
+// and the cpu fallback are checked in FilterTest.
+// usage: filter_bench image_dispatch [-l rga_us] [-t ms] [-n flows]
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "cpu_image.h"
+#include "image_dispatch.h"
+#include "key_string.h"
+#include "mock_rga_backend.h"
+#include "utils.h"
+
+using namespace easymedia;
+
+typedef struct {
+  double fps;
+  int64_t hw_count, cpu_count;
+  int fails;
+} RunResult;
+
+static RunResult run(ImageDispatchPolicy policy, int rga_us, int ms,
+                     int flows) {
+  int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+  ImageDispatcher dispatcher(std::make_shared<MockRgaBackend>(rga_us),
+                             std::make_shared<CpuImageBackend>(cores));
+  std::atomic<int> frames(0), fails(0);
+  std::atomic<bool> quit(false);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < flows; i++) {
+    threads.emplace_back([&] {
+      auto src = AllocMockImage(PIX_FMT_NV12, 1920, 1080);
+      auto dst = AllocMockImage(PIX_FMT_NV12, 720, 576);
+      while (!quit) {
+        if (dispatcher.Blit(src, dst, nullptr, nullptr, 0, policy))
+          fails++;
+        else
+          frames++;
+      }
+    });
+  }
+  AutoDuration ad;
+  easymedia::msleep(ms);
+  quit = true;
+  for (auto &t : threads)
+    t.join();
+  RunResult r;
+  r.fps = frames * 1000000.0 / ad.Get();
+  r.fails = fails;
+  dispatcher.GetCount(r.hw_count, r.cpu_count);
+  return r;
+}
+
+int image_dispatch_bench(int argc, char **argv) {
+  int rga_us = 4000, ms = 3000, flows = 8;
+  int c;
+  while ((c = getopt(argc, argv, "l:t:n:")) != -1) {
+    switch (c) {
+    case 'l':
+      rga_us = atoi(optarg);
+      break;
+    case 't':
+      ms = atoi(optarg);
+      break;
+    case 'n':
+      flows = atoi(optarg);
+      break;
+    default:
+      printf("usage: %s [-l rga_us] [-t ms] [-n flows]\n", argv[0]);
+      return -1;
+    }
+  }
+  if (rga_us < 0 || ms <= 0 || flows <= 0) {
+    printf("bad latency, time or flows\n");
+    return -1;
+  }
+
+  printf("%d flows 1080p nv12 -> 720x576, mock rga %d us, %u cores\n", flows,
+         rga_us, std::thread::hardware_concurrency());
+  printf("%-10s %10s %10s %10s\n", "policy", "frames/s", "rga", "cpu");
+  const struct {
+    const char *name;
+    ImageDispatchPolicy policy;
+  } policies[] = {{KEY_DISPATCH_HW, IMAGE_DISPATCH_HW},
+                  {KEY_DISPATCH_CPU, IMAGE_DISPATCH_CPU},
+                  {KEY_DISPATCH_BALANCED, IMAGE_DISPATCH_BALANCED}};
+  for (auto &p : policies) {
+    RunResult r = run(p.policy, rga_us, ms, flows);
+    printf("%-10s %10.1f %10lld %10lld\n", p.name, r.fps,
+           (long long)r.hw_count, (long long)r.cpu_count);
+    if (r.fails) {
+      printf("%d blits failed\n", r.fails);
+      return -1;
+    }
+  }
+  return 0;
+}
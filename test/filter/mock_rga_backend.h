@@ -0,0 +1,51 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_TEST_MOCK_RGA_BACKEND_H_
+#define EASYMEDIA_TEST_MOCK_RGA_BACKEND_H_
+
+#include <string.h>
+
+#include "buffer.h"
+#include "image_dispatch.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// as the rga, one blit at a time, but only the latency of it, no bgr565
+class MockRgaBackend : public ImageBackend {
+public:
+  MockRgaBackend(int us) : ImageBackend("mock_rga", 1), latency(us) {}
+  virtual bool Support(PixelFormat src, PixelFormat dst) override {
+    return src != PIX_FMT_BGR565 && dst != PIX_FMT_BGR565;
+  }
+  virtual int Blit(std::shared_ptr<ImageBuffer> src,
+                   std::shared_ptr<ImageBuffer> dst, ImageRect *src_rect,
+                   ImageRect *dst_rect, int rotate) override {
+    (void)src_rect;
+    (void)dst_rect;
+    (void)rotate;
+    easymedia::usleep(latency);
+    dst->SetValidSize(dst->GetSize());
+    dst->SetUSTimeStamp(src->GetUSTimeStamp());
+    return 0;
+  }
+
+private:
+  int latency;
+};
+
+static inline std::shared_ptr<ImageBuffer> AllocMockImage(PixelFormat fmt,
+                                                          int w, int h) {
+  ImageInfo info = {fmt, w, h, w, h};
+  size_t size = CalPixFmtSize(info);
+  auto ib = std::make_shared<ImageBuffer>(MediaBuffer::Alloc2(size), info);
+  memset(ib->GetPtr(), 0x80, size);
+  ib->SetValidSize(size);
+  return ib;
+}
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_TEST_MOCK_RGA_BACKEND_H_
@@ -1,11 +1,21 @@
 // Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
 #include <string>
 #include <thread>
 
 #include "easymedia/buffer.h"
 #include "easymedia/flow.h"
+#include "easymedia/flow_chain.h"
+#include "easymedia/key_string.h"
 #include "easymedia/media_reflector.h"
 #include "easymedia/reflector.h"
 #include "easymedia/utils.h"
@@ -15,6 +25,21 @@
 using ::testing::InSequence;
 using ::testing::Return;
 
+// count heap allocations of the current thread when enabled
+static thread_local bool alloc_counting = false;
+static thread_local long alloc_count = 0;
+
+void *operator new(size_t size) {
+  if (alloc_counting)
+    alloc_count++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
 namespace easymedia {
 
 #define KEY_IN_CNT "in_cnt"
@@ -244,6 +269,105 @@ DEFINE_FLOW_FACTORY(MockSinkFlow, Flow)
 const char *FACTORY(MockSinkFlow)::ExpectedInputDataType() { return nullptr; }
 const char *FACTORY(MockSinkFlow)::OutPutDataType() { return ""; }
 
+// record the atomic clock of input buffers as sequence
+static bool do_record(Flow *f, MediaBufferVector &input_vector);
+class MockRecordSinkFlow : public Flow {
+public:
+  MockRecordSinkFlow(const char *param);
+  virtual ~MockRecordSinkFlow() { StopAllThread(); }
+  static const char *GetFlowName() { return "mock_record_sink_flow"; }
+  std::vector<int64_t> GetRecord() {
+    std::lock_guard<std::mutex> _lg(mtx_);
+    return record_;
+  }
+
+private:
+  std::mutex mtx_;
+  std::vector<int64_t> record_;
+  friend bool do_record(Flow *f, MediaBufferVector &input_vector) {
+    MockRecordSinkFlow *flow = static_cast<MockRecordSinkFlow *>(f);
+    auto &in = input_vector[0];
+    if (!in)
+      return false;
+    std::lock_guard<std::mutex> _lg(flow->mtx_);
+    flow->record_.push_back(in->GetAtomicClock());
+    return true;
+  }
+};
+
+MockRecordSinkFlow::MockRecordSinkFlow(const char *param) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  SlotMap sm;
+  int input_maxcachenum = 2;
+  ParseParamToSlotMap(params, sm, input_maxcachenum);
+  if (sm.thread_model == Model::NONE)
+    sm.thread_model = Model::ASYNCCOMMON;
+  if (sm.mode_when_full == InputMode::NONE)
+    sm.mode_when_full = InputMode::DROPCURRENT;
+  sm.input_slots.push_back(0);
+  sm.input_maxcachenum.push_back(input_maxcachenum);
+  sm.process = do_record;
+  if (!InstallSlotMap(sm, "record_sink", -1)) {
+    SetError(-EINVAL);
+    return;
+  }
+}
+
+DEFINE_FLOW_FACTORY(MockRecordSinkFlow, Flow)
+const char *FACTORY(MockRecordSinkFlow)::ExpectedInputDataType() {
+  return nullptr;
+}
+const char *FACTORY(MockRecordSinkFlow)::OutPutDataType() { return ""; }
+
+// drop pooled_victim in the process, with a task of it queued
+std::shared_ptr<Flow> pooled_victim;
+std::atomic<bool> victim_dropped(false);
+
+static bool do_drop(Flow *f _UNUSED, MediaBufferVector &input_vector) {
+  if (!input_vector[0] || !pooled_victim)
+    return false;
+  auto mb = std::make_shared<MediaBuffer>();
+  pooled_victim->SendInput(mb, 0);
+  pooled_victim.reset();
+  victim_dropped = true;
+  return true;
+}
+
+class MockDropFlow : public Flow {
+public:
+  MockDropFlow(const char *param);
+  virtual ~MockDropFlow() { StopAllThread(); }
+  static const char *GetFlowName() { return "mock_drop_flow"; }
+};
+
+MockDropFlow::MockDropFlow(const char *param) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  SlotMap sm;
+  int input_maxcachenum = 2;
+  ParseParamToSlotMap(params, sm, input_maxcachenum);
+  if (sm.mode_when_full == InputMode::NONE)
+    sm.mode_when_full = InputMode::DROPCURRENT;
+  sm.input_slots.push_back(0);
+  sm.input_maxcachenum.push_back(input_maxcachenum);
+  sm.process = do_drop;
+  if (!InstallSlotMap(sm, "drop", -1)) {
+    SetError(-EINVAL);
+    return;
+  }
+}
+
+DEFINE_FLOW_FACTORY(MockDropFlow, Flow)
+const char *FACTORY(MockDropFlow)::ExpectedInputDataType() { return nullptr; }
+const char *FACTORY(MockDropFlow)::OutPutDataType() { return ""; }
+
 } // namespace easymedia
 
 TEST(FlowTest, AddDownFlow) {
@@ -334,6 +458,557 @@ TEST(FlowTest, AddDownFlow) {
   src2.reset();
 }
 
+TEST(FlowTest, LockFreeInputQueue) {
+  std::string flow_name = "mock_src_flow";
+  std::string param;
+
+  PARAM_STRING_APPEND(param, KEY_NAME, "src1");
+  auto src1 = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      flow_name.c_str(), param.c_str());
+  ASSERT_NE(src1, nullptr);
+
+  param = "";
+  PARAM_STRING_APPEND(param, KEY_NAME, "src2");
+  auto src2 = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      flow_name.c_str(), param.c_str());
+  ASSERT_NE(src2, nullptr);
+
+  flow_name = "mock_sink_flow";
+  param = "";
+  PARAM_STRING_APPEND(param, KEY_NAME, "spsc_sink");
+  PARAM_STRING_APPEND(param, KEY_INPUT_QUEUE, KEY_SPSC);
+  auto spsc_sink = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      flow_name.c_str(), param.c_str());
+  ASSERT_NE(spsc_sink, nullptr);
+
+  param = "";
+  PARAM_STRING_APPEND(param, KEY_NAME, "mpsc_sink");
+  PARAM_STRING_APPEND(param, KEY_INPUT_QUEUE, KEY_MPSC);
+  auto mpsc_sink = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      flow_name.c_str(), param.c_str());
+  ASSERT_NE(mpsc_sink, nullptr);
+
+  // spsc input accepts only one upstream
+  EXPECT_EQ(src1->AddDownFlow(spsc_sink, 0, 0), true);
+  EXPECT_EQ(src2->AddDownFlow(spsc_sink, 0, 0), false);
+  EXPECT_EQ(src2->AddDownFlow(spsc_sink, 0, 1), true);
+  EXPECT_EQ(src1->AddDownFlow(mpsc_sink, 0, 0), true);
+  EXPECT_EQ(src2->AddDownFlow(mpsc_sink, 0, 0), true);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  src1->RemoveDownFlow(spsc_sink);
+  src2->RemoveDownFlow(spsc_sink);
+  src1->RemoveDownFlow(mpsc_sink);
+  src2->RemoveDownFlow(mpsc_sink);
+  // upstream released, slot can be bound again
+  EXPECT_EQ(src2->AddDownFlow(spsc_sink, 0, 0), true);
+  src2->RemoveDownFlow(spsc_sink);
+  spsc_sink.reset();
+  mpsc_sink.reset();
+  src1.reset();
+  src2.reset();
+}
+
+TEST(FlowTest, PooledModel) {
+  const int num = 200;
+  std::string param;
+  std::shared_ptr<easymedia::Flow> io[3];
+  for (int i = 0; i < 3; i++) {
+    param = "";
+    PARAM_STRING_APPEND(param, KEY_NAME, "pooled_io" + std::to_string(i));
+    PARAM_STRING_APPEND(param, KEY_IN_CNT, "1");
+    PARAM_STRING_APPEND(param, KEY_OUT_CNT, "1");
+    PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_POOLED);
+    PARAM_STRING_APPEND_TO(param, KEY_INPUT_CACHE_NUM, num);
+    io[i] = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+        "mock_io_flow", param.c_str());
+    ASSERT_NE(io[i], nullptr);
+  }
+  param = "";
+  PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_POOLED);
+  PARAM_STRING_APPEND_TO(param, KEY_INPUT_CACHE_NUM, num);
+  auto sink = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "mock_record_sink_flow", param.c_str());
+  ASSERT_NE(sink, nullptr);
+
+  // io0 --> io1 --> io2 --> sink, all scheduled on the flow executor
+  EXPECT_EQ(io[0]->AddDownFlow(io[1], 0, 0), true);
+  EXPECT_EQ(io[1]->AddDownFlow(io[2], 0, 0), true);
+  EXPECT_EQ(io[2]->AddDownFlow(sink, 0, 0), true);
+  for (int i = 0; i < num; i++) {
+    auto mb = std::make_shared<easymedia::MediaBuffer>();
+    mb->SetAtomicClock(i);
+    io[0]->SendInput(mb, 0);
+  }
+  auto record_sink = static_cast<easymedia::MockRecordSinkFlow *>(sink.get());
+  for (int i = 0; i < 200; i++) {
+    if ((int)record_sink->GetRecord().size() == num)
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  // order of one flow is kept
+  auto record = record_sink->GetRecord();
+  ASSERT_EQ((int)record.size(), num);
+  for (int i = 0; i < num; i++)
+    EXPECT_EQ(record[i], i);
+
+  io[2]->RemoveDownFlow(sink);
+  io[1]->RemoveDownFlow(io[2]);
+  io[0]->RemoveDownFlow(io[1]);
+  sink.reset();
+  for (int i = 0; i < 3; i++)
+    io[i].reset();
+}
+
+// pooled_victim is dropped on the worker running the killer, after its task
+// is queued on the same worker
+TEST(FlowTest, PooledDestroyOnWorker) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_POOLED);
+  auto killer = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "mock_drop_flow", param.c_str());
+  ASSERT_NE(killer, nullptr);
+  easymedia::pooled_victim =
+      easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+          "mock_record_sink_flow", param.c_str());
+  ASSERT_NE(easymedia::pooled_victim, nullptr);
+
+  auto mb = std::make_shared<easymedia::MediaBuffer>();
+  killer->SendInput(mb, 0);
+  mb.reset();
+  for (int i = 0; i < 200 && !easymedia::victim_dropped; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_TRUE(easymedia::victim_dropped);
+  killer.reset();
+}
+
+TEST(FlowTest, SyncChainNoAllocation) {
+  std::string param;
+  std::shared_ptr<easymedia::Flow> io[3];
+  for (int i = 0; i < 3; i++) {
+    param = "";
+    PARAM_STRING_APPEND(param, KEY_NAME, "sync_io" + std::to_string(i));
+    PARAM_STRING_APPEND(param, KEY_IN_CNT, "1");
+    PARAM_STRING_APPEND(param, KEY_OUT_CNT, "1");
+    PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_SYNC);
+    io[i] = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+        "mock_io_flow", param.c_str());
+    ASSERT_NE(io[i], nullptr);
+  }
+  // io0 --> io1 --> io2, all run in this thread
+  EXPECT_EQ(io[0]->AddDownFlow(io[1], 0, 0), true);
+  EXPECT_EQ(io[1]->AddDownFlow(io[2], 0, 0), true);
+  auto mb = std::make_shared<easymedia::MediaBuffer>();
+  for (int i = 0; i < 10; i++)
+    io[0]->SendInput(mb, 0);
+
+  alloc_count = 0;
+  alloc_counting = true;
+  for (int i = 0; i < 100; i++)
+    io[0]->SendInput(mb, 0);
+  alloc_counting = false;
+  EXPECT_EQ(alloc_count, 0);
+
+  io[1]->RemoveDownFlow(io[2]);
+  io[0]->RemoveDownFlow(io[1]);
+  for (int i = 0; i < 3; i++)
+    io[i].reset();
+}
+
+struct RcuCounted {
+  RcuCounted() : freed(nullptr) {}
+  ~RcuCounted() {
+    if (freed)
+      (*freed)++;
+  }
+  std::atomic<int> *freed;
+};
+
+// a publish under a reader never waits for it, the reader frees the old
+TEST(FlowTest, RcuSnapshotNoWait) {
+  std::atomic<int> freed(0);
+  easymedia::RcuSnapshot<RcuCounted> snapshot;
+  auto first = new RcuCounted();
+  first->freed = &freed;
+  snapshot.Publish(first);
+  EXPECT_EQ(snapshot.Get(), first);
+
+  unsigned ticket;
+  const RcuCounted *seen = snapshot.ReadLock(ticket);
+  EXPECT_EQ(seen, first);
+  std::thread writer([&snapshot] {
+    for (int i = 0; i < 3; i++)
+      snapshot.Publish(new RcuCounted());
+  });
+  writer.join();
+  EXPECT_EQ(freed.load(), 0);
+  EXPECT_EQ(seen->freed, &freed);
+  snapshot.ReadUnlock(ticket);
+  EXPECT_EQ(freed.load(), 1);
+}
+
+TEST(FlowTest, Metrics) {
+  std::string param;
+  std::shared_ptr<easymedia::Flow> io[2];
+  for (int i = 0; i < 2; i++) {
+    param = "";
+    PARAM_STRING_APPEND(param, KEY_NAME, "metrics_io" + std::to_string(i));
+    PARAM_STRING_APPEND(param, KEY_IN_CNT, "1");
+    PARAM_STRING_APPEND(param, KEY_OUT_CNT, "1");
+    PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_SYNC);
+    io[i] = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+        "mock_io_flow", param.c_str());
+    ASSERT_NE(io[i], nullptr);
+  }
+  EXPECT_EQ(io[0]->AddDownFlow(io[1], 0, 0), true);
+  EXPECT_EQ(io[0]->Control(easymedia::S_FLOW_TRACE_START), 0);
+  const int num = 50;
+  for (int i = 0; i < num; i++) {
+    auto mb = std::make_shared<easymedia::MediaBuffer>();
+    // a capture stamp of another clock, such as v4l2, does not matter
+    mb->SetAtomicClock(i + 1);
+    io[0]->SendInput(mb, 0);
+  }
+
+  easymedia::FlowMetrics m;
+  EXPECT_EQ(io[0]->Control(easymedia::G_FLOW_METRICS, &m), 0);
+  EXPECT_EQ(m.input_num, 1);
+  EXPECT_EQ(m.output_num, 1);
+  EXPECT_EQ(m.input[0].in, num);
+  EXPECT_EQ(m.input[0].latency.count, num);
+  EXPECT_EQ(m.output[0].out, num);
+  EXPECT_EQ(m.process.count, num);
+  EXPECT_GE(easymedia::FlowHistogramPercentile(m.process, 0.99f),
+            m.process.sum / num);
+  io[1]->GetMetrics(m);
+  EXPECT_EQ(m.input[0].in, num);
+
+  std::string json;
+  EXPECT_EQ(io[0]->Control(easymedia::G_FLOW_TRACE_JSON, &json), 0);
+  EXPECT_NE(json.find("\"ph\":\"X\""), std::string::npos);
+  EXPECT_EQ(io[0]->Control(easymedia::S_FLOW_TRACE_STOP), 0);
+
+  EXPECT_EQ(io[0]->Control(easymedia::S_FLOW_METRICS_RESET), 0);
+  io[0]->GetMetrics(m);
+  EXPECT_EQ(m.input[0].in, 0);
+  EXPECT_EQ(m.process.count, 0);
+
+  io[0]->RemoveDownFlow(io[1]);
+  for (int i = 0; i < 2; i++)
+    io[i].reset();
+}
+
+TEST(FlowTest, AtomicLatencyOncePerBuffer) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_ASYNCATOMIC);
+  PARAM_STRING_APPEND(param, KEY_FPS, "200");
+  auto sink = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "mock_record_sink_flow", param.c_str());
+  ASSERT_NE(sink, nullptr);
+  // every buffer stays cached for several ticks
+  const int num = 3;
+  for (int i = 0; i < num; i++) {
+    auto mb = std::make_shared<easymedia::MediaBuffer>();
+    sink->SendInput(mb, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  }
+  easymedia::FlowMetrics m;
+  sink->GetMetrics(m);
+  EXPECT_GT(m.process.count, num);
+  EXPECT_EQ(m.input[0].latency.count, num);
+  sink.reset();
+}
+
+TEST(FlowTest, TimerGroup) {
+  std::vector<std::shared_ptr<easymedia::Flow>> flows;
+  for (const char *policy : {KEY_SKIP, KEY_CATCHUP}) {
+    std::string param;
+    PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_ASYNCATOMIC);
+    PARAM_STRING_APPEND(param, KEY_FPS, "100");
+    PARAM_STRING_APPEND(param, KEY_TIMER_GROUP, "flow_test");
+    PARAM_STRING_APPEND(param, KEY_DEADLINE_POLICY, policy);
+    auto f = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+        "mock_record_sink_flow", param.c_str());
+    ASSERT_NE(f, nullptr);
+    flows.push_back(f);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  // both ticked on the one timer thread of the group, at about 100 Hz
+  for (auto &f : flows) {
+    easymedia::FlowTimerStats stats;
+    ASSERT_TRUE(f->GetTimerStats(stats));
+    EXPECT_GE(stats.ticks, 25);
+    EXPECT_LE(stats.ticks, 55);
+    EXPECT_LE(stats.jitter_avg, stats.jitter_max);
+  }
+  flows.clear();
+}
+
+TEST(FlowTest, BlockingInputNoLoss) {
+  const int num = 64;
+  const int read_size = 16 * 1024;
+  const char *path = "/tmp/flow_test_blocking_input.bin";
+  FILE *fp = fopen(path, "wb");
+  ASSERT_NE(fp, nullptr);
+  std::string chunk(read_size, 'x');
+  for (int i = 0; i < num; i++)
+    fwrite(chunk.data(), 1, chunk.size(), fp);
+  fclose(fp);
+
+  std::string param;
+  PARAM_STRING_APPEND(param, KEK_INPUT_MODEL, KEY_BLOCKING);
+  PARAM_STRING_APPEND_TO(param, KEY_INPUT_CACHE_NUM, 2);
+  auto sink = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "mock_record_sink_flow", param.c_str());
+  ASSERT_NE(sink, nullptr);
+  param = "";
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, "rb");
+  PARAM_STRING_APPEND_TO(param, KEY_MEM_SIZE_PERTIME, read_size);
+  auto src = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "file_read_flow", param.c_str());
+  ASSERT_NE(src, nullptr);
+  // the reader outruns the sink, it waits instead of dropping
+  src->AddDownFlow(sink, 0, 0);
+  auto record_sink = static_cast<easymedia::MockRecordSinkFlow *>(sink.get());
+  for (int i = 0; i < 200; i++) {
+    if ((int)record_sink->GetRecord().size() > num)
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  // and the empty one at the end of file
+  EXPECT_EQ((int)record_sink->GetRecord().size(), num + 1);
+  easymedia::FlowMetrics m;
+  sink->GetMetrics(m);
+  EXPECT_EQ(m.input[0].dropped_front, 0);
+  EXPECT_EQ(m.input[0].dropped_current, 0);
+  src->RemoveDownFlow(sink);
+  src.reset();
+  sink.reset();
+  remove(path);
+}
+
+struct OrderStage {
+  std::vector<int> *order;
+  int id;
+  bool operator()(std::shared_ptr<easymedia::MediaBuffer> &buffer _UNUSED) {
+    order->push_back(id);
+    return true;
+  }
+};
+
+struct DropOddStage {
+  int64_t n;
+  bool operator()(std::shared_ptr<easymedia::MediaBuffer> &buffer _UNUSED) {
+    return n++ % 2 == 0;
+  }
+};
+
+TEST(FlowTest, FusedChain) {
+  typedef easymedia::FusedChainFlow<OrderStage, OrderStage, DropOddStage>
+      ChainFlow;
+  std::vector<int> order;
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_NAME, "fused_test");
+  auto chain = std::make_shared<ChainFlow>(
+      param.c_str(), OrderStage{&order, 1}, OrderStage{&order, 2},
+      DropOddStage{0});
+  ASSERT_EQ(chain->GetError(), 0);
+  param = "";
+  PARAM_STRING_APPEND(param, KEY_NAME, "fused_sink");
+  PARAM_STRING_APPEND(param, KEY_IN_CNT, "1");
+  PARAM_STRING_APPEND(param, KEY_OUT_CNT, "1");
+  PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_SYNC);
+  auto sink = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "mock_io_flow", param.c_str());
+  ASSERT_NE(sink, nullptr);
+  std::shared_ptr<easymedia::Flow> down = sink;
+  EXPECT_EQ(chain->AddDownFlow(down, 0, 0), true);
+
+  const int num = 10;
+  for (int i = 0; i < num; i++) {
+    auto mb = std::make_shared<easymedia::MediaBuffer>();
+    chain->SendInput(mb, 0);
+  }
+  ASSERT_EQ(order.size(), (size_t)num * 2);
+  for (int i = 0; i < num; i++) {
+    EXPECT_EQ(order[i * 2], 1);
+    EXPECT_EQ(order[i * 2 + 1], 2);
+  }
+  easymedia::FlowMetrics m;
+  chain->GetMetrics(m);
+  EXPECT_EQ(m.input[0].in, num);
+  EXPECT_EQ(m.output[0].out, num / 2);
+  sink->GetMetrics(m);
+  EXPECT_EQ(m.input[0].in, num / 2);
+  EXPECT_EQ(chain->GetChain().Get<2>().n, num);
+
+  chain->RemoveDownFlow(down);
+}
+
+// the test takes the events itself
+static int IdleEventProc(std::shared_ptr<easymedia::Flow> flow, bool &loop) {
+  UNUSED(flow);
+  while (loop)
+    easymedia::msleep(1);
+  return 0;
+}
+
+static std::shared_ptr<easymedia::EventParam> make_event(int id, int param) {
+  auto event = std::make_shared<easymedia::EventParam>(id, param);
+  void *data = malloc(4096);
+  if (data) {
+    memset(data, param, 4096);
+    event->SetParams(data, 4096);
+  }
+  return event;
+}
+
+TEST(FlowTest, EventQueueBounded) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_NAME, "event_io");
+  PARAM_STRING_APPEND(param, KEY_IN_CNT, "1");
+  PARAM_STRING_APPEND(param, KEY_OUT_CNT, "1");
+  PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_SYNC);
+  auto flow = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "mock_io_flow", param.c_str());
+  ASSERT_NE(flow, nullptr);
+  const int limit = 128;
+  flow->RegisterEventHandler(flow, IdleEventProc, limit);
+  easymedia::EventQueueStats stats;
+
+  // 4 times the limit of fifo events, the oldest are dropped
+  const int fifo_num = limit * 4;
+  std::vector<std::weak_ptr<easymedia::EventParam>> alive;
+  for (int i = 0; i < fifo_num; i++) {
+    auto event = make_event(i, 0);
+    ASSERT_NE(event->GetParams(), nullptr);
+    alive.push_back(event);
+    flow->NotifyToEventHandler(event, MESSAGE_TYPE_FIFO);
+  }
+  ASSERT_TRUE(flow->GetEventQueueStats(stats));
+  EXPECT_EQ(stats.limit, (size_t)limit + EVENT_LIFO_LIMIT);
+  EXPECT_EQ(stats.queued, (size_t)limit);
+  EXPECT_EQ(stats.pushed, fifo_num);
+  EXPECT_EQ(stats.dropped, fifo_num - limit);
+  // the payloads of the dropped ones are freed
+  EXPECT_EQ(std::count_if(alive.begin(), alive.end(),
+                          [](const std::weak_ptr<easymedia::EventParam> &w) {
+                            return !w.expired();
+                          }),
+            limit);
+
+  // unique events of one id merge into the first, which drops one more
+  const int unique_num = 10;
+  for (int i = 0; i < unique_num; i++)
+    flow->NotifyToEventHandler(make_event(100000, i), MESSAGE_TYPE_UNIQUE);
+  // lifo events past their limit drop their oldest
+  const int lifo_num = EVENT_LIFO_LIMIT + 4;
+  for (int i = 0; i < lifo_num; i++)
+    flow->NotifyToEventHandler(make_event(200000 + i, 0), MESSAGE_TYPE_LIFO);
+  ASSERT_TRUE(flow->GetEventQueueStats(stats));
+  EXPECT_EQ(stats.queued, stats.limit);
+  EXPECT_EQ(stats.pushed, fifo_num + unique_num + lifo_num);
+  EXPECT_EQ(stats.coalesced, unique_num - 1);
+  EXPECT_EQ(stats.dropped, fifo_num - limit + 1 + 4);
+
+  // lifo newest first, then fifo in order, the unique one with its last
+  int received = 0;
+  for (int i = lifo_num - 1; i >= 4; i--, received++) {
+    auto msg = flow->GetEventMessage();
+    ASSERT_NE(msg, nullptr);
+    EXPECT_EQ(msg->GetEventParam()->GetId(), 200000 + i);
+  }
+  for (int i = fifo_num - limit + 1; i < fifo_num; i++, received++) {
+    auto msg = flow->GetEventMessage();
+    ASSERT_NE(msg, nullptr);
+    EXPECT_EQ(msg->GetEventParam()->GetId(), i);
+  }
+  auto msg = flow->GetEventMessage();
+  ASSERT_NE(msg, nullptr);
+  received++;
+  EXPECT_EQ(msg->GetEventParam()->GetId(), 100000);
+  EXPECT_EQ(msg->GetEventParam()->GetParam(), unique_num - 1);
+  EXPECT_EQ(flow->GetEventMessage(), nullptr);
+  ASSERT_TRUE(flow->GetEventQueueStats(stats));
+  EXPECT_EQ(stats.queued, 0u);
+  EXPECT_EQ(received + stats.coalesced + stats.dropped, stats.pushed);
+
+  // producers racing, every event is still taken, merged or dropped
+  const int producer_num = 2, event_num = 20000;
+  std::vector<std::thread> producers;
+  for (int t = 0; t < producer_num; t++) {
+    producers.emplace_back([&flow, t] {
+      for (int i = 0; i < event_num; i++) {
+        int type = MESSAGE_TYPE_FIFO;
+        if (i % 8 == 1)
+          type = MESSAGE_TYPE_UNIQUE;
+        else if (i % 64 == 2)
+          type = MESSAGE_TYPE_LIFO;
+        int id = type == MESSAGE_TYPE_UNIQUE ? 1000 + t : i;
+        flow->NotifyToEventHandler(std::make_shared<easymedia::EventParam>(id),
+                                   type);
+      }
+    });
+  }
+  for (auto &t : producers)
+    t.join();
+  ASSERT_TRUE(flow->GetEventQueueStats(stats));
+  EXPECT_LE(stats.queued, stats.limit);
+  while (flow->GetEventMessage())
+    received++;
+  ASSERT_TRUE(flow->GetEventQueueStats(stats));
+  EXPECT_EQ(stats.queued, 0u);
+  EXPECT_EQ(stats.pushed,
+            fifo_num + unique_num + lifo_num + producer_num * event_num);
+  EXPECT_EQ(received + stats.coalesced + stats.dropped, stats.pushed);
+  flow->UnRegisterEventHandler();
+}
+
+TEST(FlowTest, EventQueueUnique) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_NAME, "unique_io");
+  PARAM_STRING_APPEND(param, KEY_IN_CNT, "1");
+  PARAM_STRING_APPEND(param, KEY_OUT_CNT, "1");
+  PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_SYNC);
+  auto flow = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "mock_io_flow", param.c_str());
+  ASSERT_NE(flow, nullptr);
+  const int limit = 4;
+  flow->RegisterEventHandler(flow, IdleEventProc, limit);
+  auto expect_next = [&flow](int id, int param) {
+    auto msg = flow->GetEventMessage();
+    ASSERT_NE(msg, nullptr);
+    EXPECT_EQ(msg->GetEventParam()->GetId(), id);
+    EXPECT_EQ(msg->GetEventParam()->GetParam(), param);
+  };
+
+  // a repost keeps the place of the queued one, with the last message
+  flow->NotifyToEventHandler(make_event(900, 0), MESSAGE_TYPE_UNIQUE);
+  flow->NotifyToEventHandler(make_event(1, 0), MESSAGE_TYPE_FIFO);
+  flow->NotifyToEventHandler(make_event(900, 1), MESSAGE_TYPE_UNIQUE);
+  expect_next(900, 1);
+  expect_next(1, 0);
+  EXPECT_EQ(flow->GetEventMessage(), nullptr);
+
+  // full, the oldest is a merged unique token: it goes to the tail with
+  // the merged message, and the next oldest is dropped
+  flow->NotifyToEventHandler(make_event(900, 2), MESSAGE_TYPE_UNIQUE);
+  for (int i = 1; i < limit; i++)
+    flow->NotifyToEventHandler(make_event(i, 0), MESSAGE_TYPE_FIFO);
+  flow->NotifyToEventHandler(make_event(900, 3), MESSAGE_TYPE_UNIQUE);
+  flow->NotifyToEventHandler(make_event(limit, 0), MESSAGE_TYPE_FIFO);
+  for (int i = 2; i < limit; i++)
+    expect_next(i, 0);
+  expect_next(900, 3);
+  expect_next(limit, 0);
+  EXPECT_EQ(flow->GetEventMessage(), nullptr);
+  easymedia::EventQueueStats stats;
+  ASSERT_TRUE(flow->GetEventQueueStats(stats));
+  EXPECT_EQ(stats.coalesced, 2);
+  EXPECT_EQ(stats.dropped, 1);
+  flow->UnRegisterEventHandler();
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,26 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benches of the flow models and queues, the checks are in FlowTest.
+// usage: flow_bench <bench> [args]
+
+#include "../bench_main.h"
+
+int flow_blocking_input_bench(int argc, char **argv);
+int flow_deadline_bench(int argc, char **argv);
+int flow_fused_chain_bench(int argc, char **argv);
+int flow_input_queue_bench(int argc, char **argv);
+int flow_pooled_bench(int argc, char **argv);
+
+static const BenchEntry benches[] = {
+    {"blocking_input", flow_blocking_input_bench},
+    {"deadline", flow_deadline_bench},
+    {"fused_chain", flow_fused_chain_bench},
+    {"input_queue", flow_input_queue_bench},
+    {"pooled", flow_pooled_bench},
+};
+
+int main(int argc, char **argv) {
+  return bench_main(argc, argv, benches, BENCH_NUM(benches));
+}
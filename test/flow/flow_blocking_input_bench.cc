@@ -0,0 +1,147 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Throughput of FileReadFlow -> sink with the BLOCKING input model, which
+// is the offline transcode case: the file reader is always faster than the
+// sink, so every buffer goes through the full-input path.
+// usage: flow_bench blocking_input [file size MB] [read size KB] [work us]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <string>
+
+#include "buffer.h"
+#include "flow.h"
+#include "key_string.h"
+#include "media_reflector.h"
+#include "utils.h"
+
+namespace easymedia {
+
+static bool do_blocking_sink(Flow *f, MediaBufferVector &input_vector);
+class BlockingSinkFlow : public Flow {
+public:
+  BlockingSinkFlow(const char *param);
+  virtual ~BlockingSinkFlow() { StopAllThread(); }
+  static const char *GetFlowName() { return "blocking_sink_flow"; }
+  int64_t GetBytes() { return bytes_; }
+
+private:
+  std::atomic<int64_t> bytes_;
+  int work_us_;
+
+  friend bool do_blocking_sink(Flow *f, MediaBufferVector &input_vector) {
+    BlockingSinkFlow *flow = static_cast<BlockingSinkFlow *>(f);
+    auto &in = input_vector[0];
+    if (!in)
+      return false;
+    // simulate the encoder
+    AutoDuration ad;
+    while (ad.Get() < flow->work_us_)
+      ;
+    flow->bytes_ += in->GetValidSize();
+    return true;
+  }
+};
+
+BlockingSinkFlow::BlockingSinkFlow(const char *param) : bytes_(0), work_us_(0) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  work_us_ = std::stoi(params[KEY_LOOP_TIME]);
+  SlotMap sm;
+  int input_maxcachenum = 2;
+  ParseParamToSlotMap(params, sm, input_maxcachenum);
+  sm.thread_model = Model::ASYNCCOMMON;
+  sm.mode_when_full = InputMode::BLOCKING;
+  sm.input_slots.push_back(0);
+  sm.input_maxcachenum.push_back(input_maxcachenum);
+  sm.process = do_blocking_sink;
+  if (!InstallSlotMap(sm, "bench_sink", -1)) {
+    SetError(-EINVAL);
+    return;
+  }
+  SetFlowTag("bench_sink");
+}
+
+DEFINE_FLOW_FACTORY(BlockingSinkFlow, Flow)
+const char *FACTORY(BlockingSinkFlow)::ExpectedInputDataType() {
+  return nullptr;
+}
+const char *FACTORY(BlockingSinkFlow)::OutPutDataType() { return ""; }
+
+} // namespace easymedia
+
+int flow_blocking_input_bench(int argc, char **argv) {
+  int file_mb = 64;
+  int read_kb = 64;
+  int work_us = 100;
+  if (argc > 1)
+    file_mb = atoi(argv[1]);
+  if (argc > 2)
+    read_kb = atoi(argv[2]);
+  if (argc > 3)
+    work_us = atoi(argv[3]);
+
+  const char *path = "/tmp/flow_blocking_input_bench.bin";
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "open %s failed\n", path);
+    return -1;
+  }
+  std::string chunk(1024 * 1024, 'x');
+  for (int i = 0; i < file_mb; i++)
+    fwrite(chunk.data(), 1, chunk.size(), fp);
+  fclose(fp);
+  int64_t total = file_mb * 1024LL * 1024LL;
+
+  std::string param;
+  PARAM_STRING_APPEND_TO(param, KEY_LOOP_TIME, work_us);
+  PARAM_STRING_APPEND(param, KEK_INPUT_MODEL, KEY_BLOCKING);
+  auto sink = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "blocking_sink_flow", param.c_str());
+  if (!sink) {
+    fprintf(stderr, "create blocking_sink_flow failed\n");
+    remove(path);
+    return -1;
+  }
+
+  param = "";
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, "rb");
+  PARAM_STRING_APPEND_TO(param, KEY_MEM_SIZE_PERTIME, read_kb * 1024);
+  auto src = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "file_read_flow", param.c_str());
+  if (!src) {
+    fprintf(stderr, "create file_read_flow failed\n");
+    remove(path);
+    return -1;
+  }
+
+  auto bench = static_cast<easymedia::BlockingSinkFlow *>(sink.get());
+  easymedia::AutoDuration ad;
+  src->AddDownFlow(sink, 0, 0);
+  while (bench->GetBytes() < total && ad.Get() < 600 * 1000000LL)
+    easymedia::usleep(1000);
+  int64_t cost = ad.Get();
+
+  printf("file: %dMB, read: %dKB, sink work: %dus\n", file_mb, read_kb,
+         work_us);
+  printf("cost: %.2fms, throughput: %.2fMB/s, %.0f buffers/s\n",
+         cost / 1000.0, bench->GetBytes() / (cost / 1000000.0) / 1048576.0,
+         bench->GetBytes() / (read_kb * 1024.0) / (cost / 1000000.0));
+  std::string dump;
+  sink->Dump(dump);
+  printf("%s", dump.c_str());
+
+  src->RemoveDownFlow(sink);
+  src.reset();
+  sink.reset();
+  remove(path);
+  return 0;
+}
@@ -0,0 +1,154 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Pacing of ASYNCATOMIC flows, such as display and periodic nn filters.
+// Every flow records the wakeup time of each period with a random work,
+// and reports the deviation from the ideal period and the total drift.
+// usage: flow_bench deadline [flows] [fps] [seconds] [max work us]
+//                            [timer group] [deadline policy]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "buffer.h"
+#include "flow.h"
+#include "key_string.h"
+#include "media_reflector.h"
+#include "utils.h"
+
+namespace easymedia {
+
+static bool do_bench_tick(Flow *f, MediaBufferVector &input_vector);
+class BenchTickFlow : public Flow {
+public:
+  BenchTickFlow(const char *param);
+  virtual ~BenchTickFlow() { StopAllThread(); }
+  static const char *GetFlowName() { return "bench_tick_flow"; }
+  std::vector<int64_t> &GetTicks() { return ticks_; }
+  void Stop() { stop_ = true; }
+
+private:
+  volatile bool stop_;
+  int work_us_;
+  unsigned int seed_;
+  std::vector<int64_t> ticks_;
+
+  friend bool do_bench_tick(Flow *f,
+                            MediaBufferVector &input_vector _UNUSED) {
+    BenchTickFlow *flow = static_cast<BenchTickFlow *>(f);
+    if (flow->stop_)
+      return true;
+    flow->ticks_.push_back(gettimeofday());
+    int work = flow->work_us_ > 0 ? rand_r(&flow->seed_) % flow->work_us_ : 0;
+    AutoDuration ad;
+    while (ad.Get() < work)
+      ;
+    return true;
+  }
+};
+
+BenchTickFlow::BenchTickFlow(const char *param)
+    : stop_(false), work_us_(0), seed_(0) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  work_us_ = std::stoi(params[KEY_LOOP_TIME]);
+  seed_ = std::stoi(params[KEY_NAME]);
+  ticks_.reserve(100000);
+  SlotMap sm;
+  int input_maxcachenum = 0;
+  ParseParamToSlotMap(params, sm, input_maxcachenum);
+  sm.thread_model = Model::ASYNCATOMIC;
+  sm.mode_when_full = InputMode::DROPFRONT;
+  sm.process = do_bench_tick;
+  if (!InstallSlotMap(sm, "bench_tick", -1)) {
+    SetError(-EINVAL);
+    return;
+  }
+  SetFlowTag("bench_tick");
+}
+
+DEFINE_FLOW_FACTORY(BenchTickFlow, Flow)
+const char *FACTORY(BenchTickFlow)::ExpectedInputDataType() { return nullptr; }
+const char *FACTORY(BenchTickFlow)::OutPutDataType() { return ""; }
+
+} // namespace easymedia
+
+int flow_deadline_bench(int argc, char **argv) {
+  int num = 4;
+  int fps = 30;
+  int seconds = 10;
+  int work_us = 10000;
+  std::string group;
+  std::string policy;
+  if (argc > 1)
+    num = atoi(argv[1]);
+  if (argc > 2)
+    fps = atoi(argv[2]);
+  if (argc > 3)
+    seconds = atoi(argv[3]);
+  if (argc > 4)
+    work_us = atoi(argv[4]);
+  if (argc > 5)
+    group = argv[5];
+  if (argc > 6)
+    policy = argv[6];
+
+  std::vector<std::shared_ptr<easymedia::Flow>> flows;
+  for (int i = 0; i < num; i++) {
+    std::string param;
+    PARAM_STRING_APPEND_TO(param, KEY_NAME, i + 1);
+    PARAM_STRING_APPEND_TO(param, KEY_FPS, fps);
+    PARAM_STRING_APPEND_TO(param, KEY_LOOP_TIME, work_us);
+    if (!group.empty())
+      PARAM_STRING_APPEND(param, KEY_TIMER_GROUP, group);
+    if (!policy.empty())
+      PARAM_STRING_APPEND(param, KEY_DEADLINE_POLICY, policy);
+    auto f = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+        "bench_tick_flow", param.c_str());
+    if (!f) {
+      fprintf(stderr, "create bench_tick_flow failed\n");
+      return -1;
+    }
+    flows.push_back(f);
+  }
+  easymedia::msleep(seconds * 1000);
+  for (auto &f : flows)
+    static_cast<easymedia::BenchTickFlow *>(f.get())->Stop();
+  // let the running period finish
+  easymedia::msleep(work_us / 1000 + 100);
+
+  double period = 1000000.0 / fps;
+  printf("%d flows, %dfps, %ds, work: 0~%dus, timer group: %s\n", num, fps,
+         seconds, work_us, group.empty() ? "none" : group.c_str());
+  printf("%-5s %7s %12s %12s %10s\n", "flow", "ticks", "avg dev(us)",
+         "max dev(us)", "drift(ms)");
+  for (int i = 0; i < num; i++) {
+    auto flow = static_cast<easymedia::BenchTickFlow *>(flows[i].get());
+    auto &ticks = flow->GetTicks();
+    size_t n = ticks.size();
+    double sum = 0, max = 0;
+    for (size_t k = 1; k < n; k++) {
+      double dev = fabs((ticks[k] - ticks[k - 1]) - period);
+      sum += dev;
+      if (dev > max)
+        max = dev;
+    }
+    // where the last tick is, against where it should be
+    double drift = n > 1 ? ticks[n - 1] - ticks[0] - (n - 1) * period : 0;
+    printf("%-5d %7zu %12.0f %12.0f %10.2f\n", i, n, n > 1 ? sum / (n - 1) : 0,
+           max, drift / 1000.0);
+  }
+  std::string dump;
+  flows[0]->Dump(dump);
+  printf("%s", dump.c_str());
+  flows.clear();
+  return 0;
+}
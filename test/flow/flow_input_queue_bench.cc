@@ -0,0 +1,147 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Microbenchmark of the ASYNCCOMMON input queue.
+// Producer threads call SendInput of one sink flow directly, the sink
+// records the handoff latency with the atomic clock stamp of MediaBuffer.
+// usage: flow_bench input_queue [buffers per producer] [input_model]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "flow.h"
+#include "key_string.h"
+#include "media_reflector.h"
+#include "utils.h"
+
+namespace easymedia {
+
+static bool do_queue_sink(Flow *f, MediaBufferVector &input_vector);
+class QueueSinkFlow : public Flow {
+public:
+  QueueSinkFlow(const char *param);
+  virtual ~QueueSinkFlow() { StopAllThread(); }
+  static const char *GetFlowName() { return "queue_sink_flow"; }
+  int64_t GetCount() { return count_; }
+  std::vector<int64_t> &GetLatency() { return latency_; }
+
+private:
+  std::atomic<int64_t> count_;
+  std::vector<int64_t> latency_;
+
+  friend bool do_queue_sink(Flow *f, MediaBufferVector &input_vector) {
+    QueueSinkFlow *flow = static_cast<QueueSinkFlow *>(f);
+    auto &in = input_vector[0];
+    if (!in)
+      return false;
+    int64_t delta = gettimeofday() - in->GetAtomicClock();
+    int64_t idx = flow->count_;
+    if (idx < (int64_t)flow->latency_.size())
+      flow->latency_[idx] = delta;
+    flow->count_ = idx + 1;
+    return true;
+  }
+};
+
+QueueSinkFlow::QueueSinkFlow(const char *param) : count_(0) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  latency_.resize(std::stoi(params[KEY_FRAMES]));
+  SlotMap sm;
+  int input_maxcachenum = 1024;
+  ParseParamToSlotMap(params, sm, input_maxcachenum);
+  sm.thread_model = Model::ASYNCCOMMON;
+  if (sm.mode_when_full == InputMode::NONE)
+    sm.mode_when_full = InputMode::DROPFRONT;
+  sm.input_slots.push_back(0);
+  sm.input_maxcachenum.push_back(input_maxcachenum);
+  sm.process = do_queue_sink;
+  if (!InstallSlotMap(sm, "bench_sink", -1)) {
+    SetError(-EINVAL);
+    return;
+  }
+}
+
+DEFINE_FLOW_FACTORY(QueueSinkFlow, Flow)
+const char *FACTORY(QueueSinkFlow)::ExpectedInputDataType() { return nullptr; }
+const char *FACTORY(QueueSinkFlow)::OutPutDataType() { return ""; }
+
+} // namespace easymedia
+
+static void producer_run(std::shared_ptr<easymedia::Flow> flow, int num) {
+  for (int i = 0; i < num; i++) {
+    auto mb = std::make_shared<easymedia::MediaBuffer>();
+    mb->SetAtomicClock(easymedia::gettimeofday());
+    flow->SendInput(mb, 0);
+  }
+}
+
+static bool bench_run(const char *queue, int producers, int num,
+                      const std::string &in_model) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_INPUT_QUEUE, queue);
+  PARAM_STRING_APPEND(param, KEK_INPUT_MODEL, in_model);
+  PARAM_STRING_APPEND_TO(param, KEY_FRAMES, producers * num);
+  auto sink = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "queue_sink_flow", param.c_str());
+  if (!sink) {
+    fprintf(stderr, "create queue_sink_flow failed\n");
+    return false;
+  }
+  auto bench = static_cast<easymedia::QueueSinkFlow *>(sink.get());
+
+  std::vector<std::thread> threads;
+  easymedia::AutoDuration ad;
+  for (int i = 0; i < producers; i++)
+    threads.emplace_back(producer_run, sink, num);
+  for (auto &th : threads)
+    th.join();
+  // wait for the consumer to drain
+  int64_t last = -1;
+  while (bench->GetCount() != last) {
+    last = bench->GetCount();
+    easymedia::usleep(20000);
+  }
+  int64_t cost = ad.Get() - 20000;
+  int64_t done = bench->GetCount();
+  auto &lat = bench->GetLatency();
+  std::vector<int64_t> sorted(lat.begin(), lat.begin() + done);
+  std::sort(sorted.begin(), sorted.end());
+  int64_t p50 = done ? sorted[done / 2] : 0;
+  int64_t p99 = done ? sorted[done * 99 / 100] : 0;
+  printf("%-7s %9d %12.0f %9lld %9lld %9lld\n", queue, producers,
+         done * 1000000.0 / (cost > 0 ? cost : 1), (long long)p50,
+         (long long)p99, (long long)(producers * num - done));
+  sink.reset();
+  return true;
+}
+
+int flow_input_queue_bench(int argc, char **argv) {
+  int num = 200000;
+  std::string in_model = KEY_DROPFRONT;
+  if (argc > 1)
+    num = atoi(argv[1]);
+  if (argc > 2)
+    in_model = argv[2];
+
+  printf("%-7s %9s %12s %9s %9s %9s\n", "queue", "producer", "buffers/s",
+         "p50(us)", "p99(us)", "dropped");
+  if (!bench_run(KEY_LOCKED, 1, num, in_model) ||
+      !bench_run(KEY_SPSC, 1, num, in_model) ||
+      !bench_run(KEY_MPSC, 1, num, in_model) ||
+      !bench_run(KEY_LOCKED, 4, num / 4, in_model) ||
+      !bench_run(KEY_MPSC, 4, num / 4, in_model))
+    return -1;
+  return 0;
+}
@@ -0,0 +1,197 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Synthetic 16 flows graph, 4 chains of stage -> stage -> stage -> sink,
+// run with the thread per coroutine models and the pooled model.
+// Reports threads of process, context switches and end to end latency.
+// usage: flow_bench pooled [seconds] [buffers/s per chain] [work us]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "buffer.h"
+#include "flow.h"
+#include "key_string.h"
+#include "media_reflector.h"
+#include "utils.h"
+
+namespace easymedia {
+
+static bool do_bench_stage(Flow *f, MediaBufferVector &input_vector);
+class BenchStageFlow : public Flow {
+public:
+  BenchStageFlow(const char *param);
+  virtual ~BenchStageFlow() { StopAllThread(); }
+  static const char *GetFlowName() { return "bench_stage_flow"; }
+  std::vector<int64_t> &GetLatency() { return latency_; }
+
+private:
+  bool sink_;
+  int work_us_;
+  std::vector<int64_t> latency_;
+
+  friend bool do_bench_stage(Flow *f, MediaBufferVector &input_vector) {
+    BenchStageFlow *flow = static_cast<BenchStageFlow *>(f);
+    auto &in = input_vector[0];
+    if (!in)
+      return false;
+    AutoDuration ad;
+    while (ad.Get() < flow->work_us_)
+      ;
+    if (!flow->sink_)
+      return flow->SetOutput(in, 0);
+    flow->latency_.push_back(gettimeofday() - in->GetAtomicClock());
+    return true;
+  }
+};
+
+BenchStageFlow::BenchStageFlow(const char *param) : sink_(false), work_us_(0) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  work_us_ = std::stoi(params[KEY_LOOP_TIME]);
+  sink_ = !params[KEY_FRAMES].empty();
+  if (sink_)
+    latency_.reserve(std::stoi(params[KEY_FRAMES]));
+  SlotMap sm;
+  int input_maxcachenum = 16;
+  ParseParamToSlotMap(params, sm, input_maxcachenum);
+  sm.mode_when_full = InputMode::DROPFRONT;
+  sm.input_slots.push_back(0);
+  sm.input_maxcachenum.push_back(input_maxcachenum);
+  if (!sink_)
+    sm.output_slots.push_back(0);
+  sm.process = do_bench_stage;
+  if (!InstallSlotMap(sm, "bench_stage", -1)) {
+    SetError(-EINVAL);
+    return;
+  }
+  SetFlowTag(sink_ ? "bench_sink" : "bench_stage");
+}
+
+DEFINE_FLOW_FACTORY(BenchStageFlow, Flow)
+const char *FACTORY(BenchStageFlow)::ExpectedInputDataType() { return nullptr; }
+const char *FACTORY(BenchStageFlow)::OutPutDataType() { return ""; }
+
+} // namespace easymedia
+
+#define CHAIN_NUM 4
+#define CHAIN_LEN 4
+
+static int get_thread_num() {
+  int num = -1;
+  char line[256];
+  FILE *fp = fopen("/proc/self/status", "r");
+  if (!fp)
+    return -1;
+  while (fgets(line, sizeof(line), fp)) {
+    if (!strncmp(line, "Threads:", 8)) {
+      num = atoi(line + 8);
+      break;
+    }
+  }
+  fclose(fp);
+  return num;
+}
+
+static int64_t get_context_switches() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static bool bench_run(const char *model, int seconds, int rate, int work_us) {
+  std::vector<std::shared_ptr<easymedia::Flow>> heads;
+  std::vector<std::shared_ptr<easymedia::Flow>> flows;
+  int frames = seconds * rate;
+  for (int c = 0; c < CHAIN_NUM; c++) {
+    std::shared_ptr<easymedia::Flow> last;
+    for (int i = 0; i < CHAIN_LEN; i++) {
+      std::string param;
+      PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, model);
+      PARAM_STRING_APPEND_TO(param, KEY_LOOP_TIME, work_us);
+      if (i == CHAIN_LEN - 1)
+        PARAM_STRING_APPEND_TO(param, KEY_FRAMES, frames);
+      auto f = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+          "bench_stage_flow", param.c_str());
+      if (!f) {
+        fprintf(stderr, "create bench_stage_flow failed\n");
+        return false;
+      }
+      if (last)
+        last->AddDownFlow(f, 0, 0);
+      else
+        heads.push_back(f);
+      flows.push_back(f);
+      last = f;
+    }
+  }
+
+  int threads = get_thread_num();
+  int64_t csw = get_context_switches();
+  int64_t interval = 1000000 / rate;
+  easymedia::AutoDuration ad;
+  for (int n = 0; n < frames; n++) {
+    for (auto &h : heads) {
+      auto mb = std::make_shared<easymedia::MediaBuffer>();
+      mb->SetAtomicClock(easymedia::gettimeofday());
+      h->SendInput(mb, 0);
+    }
+    int64_t remain = interval * (n + 1) - ad.Get();
+    if (remain > 0)
+      easymedia::usleep(remain);
+  }
+  easymedia::usleep(100000);
+  csw = get_context_switches() - csw;
+
+  std::vector<int64_t> lat;
+  for (int c = 0; c < CHAIN_NUM; c++) {
+    auto sink = static_cast<easymedia::BenchStageFlow *>(
+        flows[c * CHAIN_LEN + CHAIN_LEN - 1].get());
+    auto &l = sink->GetLatency();
+    lat.insert(lat.end(), l.begin(), l.end());
+  }
+  std::sort(lat.begin(), lat.end());
+  size_t done = lat.size();
+  printf("%-12s %8d %10lld %8zu %9lld %9lld %9lld\n", model, threads,
+         (long long)csw, done, (long long)(done ? lat[done / 2] : 0),
+         (long long)(done ? lat[done * 99 / 100] : 0),
+         (long long)(done ? lat[done - 1] : 0));
+
+  for (int c = 0; c < CHAIN_NUM; c++)
+    for (int i = 0; i < CHAIN_LEN - 1; i++)
+      flows[c * CHAIN_LEN + i]->RemoveDownFlow(flows[c * CHAIN_LEN + i + 1]);
+  heads.clear();
+  flows.clear();
+  return true;
+}
+
+int flow_pooled_bench(int argc, char **argv) {
+  int seconds = 3;
+  int rate = 1000;
+  int work_us = 20;
+  if (argc > 1)
+    seconds = atoi(argv[1]);
+  if (argc > 2)
+    rate = atoi(argv[2]);
+  if (argc > 3)
+    work_us = atoi(argv[3]);
+
+  printf("%d flows, %d buffers/s per chain, %ds, stage work: %dus\n",
+         CHAIN_NUM * CHAIN_LEN, rate, seconds, work_us);
+  printf("%-12s %8s %10s %8s %9s %9s %9s\n", "model", "threads", "ctx-switch",
+         "buffers", "p50(us)", "p99(us)", "max(us)");
+  if (!bench_run(KEY_ASYNCCOMMON, seconds, rate, work_us) ||
+      !bench_run(KEY_POOLED, seconds, rate, work_us))
+    return -1;
+  return 0;
+}
@@ -0,0 +1,307 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Server cpu per viewer of the rtsp flow, for a 1080p/25fps h264 stream and
+// N local clients over loopback (RTP over RTSP/TCP). The clients run in a
+// child process, so the cpu time of this process is the encoder stand-in,
+// the rtsp flow and the live555 event loop. The cost with no viewer is
+// taken off before dividing by N.
+// usage: rtsp_loopback_bench [seconds] [port]
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "flow.h"
+#include "key_string.h"
+#include "media_type.h"
+#include "utils.h"
+
+#define FPS 25
+#define GOP 50
+#define IDR_SIZE (200 * 1024)
+#define P_SIZE (20 * 1024)
+#define CHANNEL "bench"
+
+static const uint8_t sps_pps[] = {0, 0, 0, 1, 0x67, 0x64, 0x00, 0x28, 0xac,
+                                  0x2c, 0xa4, 0x01, 0xe0, 0x08, 0x9f, 0x96,
+                                  0x10, 0x00, 0x00, 0x03, 0x00, 0x10, 0x00,
+                                  0x00, 0x03, 0x03, 0x28, 0xf1, 0x83, 0x2a,
+                                  0,    0,    0,    1,    0x68, 0xeb, 0xcc,
+                                  0xb2, 0x2c};
+
+static std::shared_ptr<easymedia::MediaBuffer> encode(int frame) {
+  bool idr = frame % GOP == 0;
+  size_t size = idr ? IDR_SIZE : P_SIZE;
+  auto mb = easymedia::MediaBuffer::Alloc(size);
+  if (!mb)
+    return nullptr;
+  uint8_t *p = (uint8_t *)mb->GetPtr();
+  size_t pos = 0;
+  if (idr) {
+    memcpy(p, sps_pps, sizeof(sps_pps));
+    pos = sizeof(sps_pps);
+  }
+  static const uint8_t start[] = {0, 0, 0, 1};
+  memcpy(p + pos, start, sizeof(start));
+  p[pos + 4] = idr ? 0x65 : 0x41;
+  memset(p + pos + 5, 0x5a, size - pos - 5);
+  mb->SetValidSize(size);
+  mb->SetUserFlag(idr ? easymedia::MediaBuffer::kIntra
+                      : easymedia::MediaBuffer::kPredicted);
+  mb->SetType(Type::Video);
+  mb->SetUSTimeStamp(easymedia::gettimeofday());
+  return mb;
+}
+
+static int64_t cpu_us() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL +
+         ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// one request, the body of the response to body, the status code returned
+static int request(int fd, const char *method, const std::string &url,
+                   int cseq, const std::string &extra, std::string &head,
+                   std::string &body) {
+  std::string req = std::string(method) + " " + url + " RTSP/1.0\r\n" +
+                    "CSeq: " + std::to_string(cseq) + "\r\n" + extra + "\r\n";
+  if (send(fd, req.data(), req.size(), MSG_NOSIGNAL) != (ssize_t)req.size())
+    return -1;
+  std::string buf;
+  size_t end;
+  char tmp[4096];
+  while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+    ssize_t ret = recv(fd, tmp, sizeof(tmp), 0);
+    if (ret <= 0)
+      return -1;
+    buf.append(tmp, ret);
+  }
+  head = buf.substr(0, end + 2);
+  body = buf.substr(end + 4);
+  size_t len = 0;
+  auto cl = head.find("Content-Length:");
+  if (cl != std::string::npos)
+    len = strtoul(head.c_str() + cl + 15, nullptr, 10);
+  while (body.size() < len) {
+    ssize_t ret = recv(fd, tmp, sizeof(tmp), 0);
+    if (ret <= 0)
+      return -1;
+    body.append(tmp, ret);
+  }
+  int status = 0;
+  if (sscanf(head.c_str(), "RTSP/1.0 %d", &status) != 1)
+    return -1;
+  return status;
+}
+
+static std::string header(const std::string &head, const char *key) {
+  auto pos = head.find(key);
+  if (pos == std::string::npos)
+    return std::string();
+  pos += strlen(key);
+  while (pos < head.size() && head[pos] == ' ')
+    pos++;
+  return head.substr(pos, head.find("\r\n", pos) - pos);
+}
+
+// DESCRIBE, SETUP and PLAY, the connected fd returned
+static int play(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    close(fd);
+    return -1;
+  }
+  std::string url =
+      "rtsp://127.0.0.1:" + std::to_string(port) + "/" + CHANNEL;
+  std::string head, body;
+  int cseq = 1;
+  if (request(fd, "DESCRIBE", url, cseq++, "Accept: application/sdp\r\n",
+              head, body) != 200)
+    goto err;
+  {
+    std::string base = header(head, "Content-Base:");
+    if (base.empty())
+      base = url + "/";
+    auto m = body.find("m=video");
+    auto a = body.find("a=control:", m);
+    if (m == std::string::npos || a == std::string::npos)
+      goto err;
+    a += strlen("a=control:");
+    std::string control = body.substr(a, body.find_first_of("\r\n", a) - a);
+    std::string track =
+        control.compare(0, 7, "rtsp://") ? base + control : control;
+    if (request(fd, "SETUP", track, cseq++,
+                "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n", head,
+                body) != 200)
+      goto err;
+    std::string session = header(head, "Session:");
+    session = session.substr(0, session.find(';'));
+    if (request(fd, "PLAY", base, cseq++,
+                "Session: " + session + "\r\nRange: npt=0.000-\r\n", head,
+                body) != 200)
+      goto err;
+  }
+  return fd;
+
+err:
+  fprintf(stderr, "rtsp client failed, %s\n", head.c_str());
+  close(fd);
+  return -1;
+}
+
+// the child: n clients, prints "ready" once all play, then the bytes read
+static int run_clients(int n, int port, int seconds) {
+  std::vector<int> fds;
+  for (int i = 0; i < n; i++) {
+    int fd = play(port);
+    if (fd < 0)
+      return EXIT_FAILURE;
+    struct timeval tv = {0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    fds.push_back(fd);
+  }
+  printf("ready\n");
+  fflush(stdout);
+  std::atomic<int64_t> bytes(0);
+  int64_t end = easymedia::gettimeofday() + seconds * 1000000LL;
+  std::vector<std::thread> threads;
+  for (int fd : fds) {
+    threads.emplace_back([fd, end, &bytes] {
+      char buf[64 * 1024];
+      while (easymedia::gettimeofday() < end) {
+        ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+        if (ret > 0)
+          bytes += ret;
+        else if (ret == 0)
+          break;
+      }
+      close(fd);
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  printf("%lld\n", (long long)bytes.load());
+  return EXIT_SUCCESS;
+}
+
+// server cpu us per second with n viewers, the bytes per second of them
+static int64_t measure(int n, int port, int seconds, int64_t *rx) {
+  *rx = 0;
+  if (n == 0) {
+    int64_t cpu = cpu_us();
+    easymedia::msleep(seconds * 1000);
+    return (cpu_us() - cpu) / seconds;
+  }
+  // no allocation between fork and exec, the flow threads may hold locks
+  std::string num = std::to_string(n), p = std::to_string(port),
+              sec = std::to_string(seconds);
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC))
+    return -1;
+  pid_t pid = fork();
+  if (pid < 0)
+    return -1;
+  if (pid == 0) {
+    dup2(fds[1], STDOUT_FILENO);
+    execl("/proc/self/exe", "rtsp_loopback_bench", "client", num.c_str(),
+          p.c_str(), sec.c_str(), (char *)nullptr);
+    _exit(EXIT_FAILURE);
+  }
+  close(fds[1]);
+  FILE *f = fdopen(fds[0], "r");
+  char line[64];
+  int64_t ret = -1;
+  if (fgets(line, sizeof(line), f) && !strcmp(line, "ready\n")) {
+    int64_t cpu = cpu_us();
+    if (fgets(line, sizeof(line), f)) {
+      ret = (cpu_us() - cpu) / seconds;
+      *rx = strtoll(line, nullptr, 10) / seconds;
+    }
+  }
+  fclose(f);
+  waitpid(pid, nullptr, 0);
+  return ret;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 5 && !strcmp(argv[1], "client"))
+    return run_clients(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+  int seconds = argc > 1 ? atoi(argv[1]) : 10;
+  int port = argc > 2 ? atoi(argv[2]) : 8554;
+  if (seconds <= 0 || port <= 0) {
+    fprintf(stderr, "usage: %s [seconds] [port]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_INPUTDATATYPE, VIDEO_H264);
+  PARAM_STRING_APPEND(param, KEY_CHANNEL_NAME, CHANNEL);
+  PARAM_STRING_APPEND_TO(param, KEY_PORT_NUM, port);
+  auto rtsp_flow = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "live555_rtsp_server", param.c_str());
+  if (!rtsp_flow) {
+    fprintf(stderr, "Create flow live555_rtsp_server failed\n");
+    return EXIT_FAILURE;
+  }
+  // the encoder stand-in, the sps/pps are needed before any DESCRIBE
+  std::atomic<bool> quit(false);
+  std::thread encoder([&rtsp_flow, &quit] {
+    int64_t next = easymedia::gettimeofday();
+    for (int frame = 0; !quit; frame++) {
+      auto mb = encode(frame);
+      if (mb)
+        rtsp_flow->SendInput(mb, 0);
+      next += 1000000 / FPS;
+      int64_t now = easymedia::gettimeofday();
+      if (next > now)
+        easymedia::usleep(next - now);
+    }
+  });
+
+  printf("1080p h264 %dfps, gop %d, %ds, rtp over rtsp/tcp on loopback\n",
+         FPS, GOP, seconds);
+  printf("%8s %16s %20s %18s\n", "viewers", "server(ms/s)",
+         "per viewer(ms/s)", "rx/viewer(KB/s)");
+  int64_t rx;
+  int64_t idle = measure(0, port, seconds, &rx);
+  printf("%8d %16.2f %20s %18s\n", 0, idle / 1000.0, "-", "-");
+  static const int viewers[] = {1, 2, 4, 8, 16, 32};
+  for (int n : viewers) {
+    int64_t cpu = measure(n, port, seconds, &rx);
+    if (cpu < 0) {
+      fprintf(stderr, "%d viewers failed\n", n);
+      break;
+    }
+    printf("%8d %16.2f %20.3f %18.1f\n", n, cpu / 1000.0,
+           (cpu - idle) / 1000.0 / n, rx / 1024.0 / n);
+  }
+  quit = true;
+  encoder.join();
+  rtsp_flow.reset();
+  return EXIT_SUCCESS;
+}
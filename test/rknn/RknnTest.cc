@@ -0,0 +1,217 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// The face feature index against a linear search, and the rect borders
+// against a per pixel drawing.
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "draw_rect.h"
+#include "face_feature_index.h"
+#include "gtest/gtest.h"
+
+using namespace easymedia;
+
+#define DIM 512
+
+static std::vector<float> make_feature(std::mt19937 &rng) {
+  std::normal_distribution<float> gauss(0, 1);
+  std::vector<float> f(DIM);
+  float n = 0;
+  for (auto &v : f) {
+    v = gauss(rng);
+    n += v * v;
+  }
+  n = sqrtf(n);
+  for (auto &v : f)
+    v /= n;
+  return f;
+}
+
+static float l2(const float *a, const float *b) {
+  float s = 0;
+  for (int i = 0; i < DIM; i++)
+    s += (a[i] - b[i]) * (a[i] - b[i]);
+  return sqrtf(s);
+}
+
+TEST(RknnTest, FaceIndexSearch) {
+  std::mt19937 rng(1);
+  const int size = 3000, k = 5;
+  std::vector<std::vector<float>> db;
+  FaceFeatureIndex index;
+  for (int i = 0; i < size; i++) {
+    db.push_back(make_feature(rng));
+    ASSERT_TRUE(index.Add(i, 1, db.back().data(), DIM));
+  }
+  EXPECT_EQ(index.Size(), (size_t)size);
+  EXPECT_EQ(index.GetDim(), DIM);
+  // the dimension is set by the first
+  EXPECT_FALSE(index.Add(size, 1, db[0].data(), DIM / 2));
+
+  std::normal_distribution<float> gauss(0, 1);
+  for (int threads : {1, 4}) {
+    index.SetThreads(threads, 256);
+    for (int q = 0; q < 20; q++) {
+      // a face seen again, with noise
+      int user = rng() % size;
+      std::vector<float> query(db[user]);
+      for (auto &v : query)
+        v += gauss(rng) * 0.02f;
+      std::vector<std::pair<float, int>> expect;
+      for (int i = 0; i < size; i++)
+        expect.emplace_back(l2(query.data(), db[i].data()), i);
+      std::partial_sort(expect.begin(), expect.begin() + k, expect.end());
+      FaceMatch matches[k];
+      ASSERT_EQ(index.Search(query.data(), DIM, k, matches), k);
+      EXPECT_EQ(matches[0].user_id, user);
+      for (int i = 0; i < k; i++) {
+        EXPECT_EQ(matches[i].user_id, expect[i].second)
+            << threads << " threads, query " << q << ", match " << i;
+        EXPECT_NEAR(matches[i].distance, expect[i].first, 1e-3);
+      }
+    }
+  }
+}
+
+TEST(RknnTest, FaceIndexUpdate) {
+  std::mt19937 rng(2);
+  FaceFeatureIndex index;
+  auto a = make_feature(rng), b = make_feature(rng);
+  ASSERT_TRUE(index.Add(7, 1, a.data(), DIM));
+  ASSERT_TRUE(index.Add(9, 1, b.data(), DIM));
+  std::vector<float> got(DIM);
+  ASSERT_TRUE(index.GetFeature(9, got.data()));
+  EXPECT_EQ(got, b);
+  index.Remove(9);
+  EXPECT_EQ(index.Size(), 1U);
+  EXPECT_FALSE(index.GetFeature(9, got.data()));
+  FaceMatch match[2];
+  ASSERT_EQ(index.Search(b.data(), DIM, 2, match), 1);
+  EXPECT_EQ(match[0].user_id, 7);
+  index.Clear();
+  EXPECT_EQ(index.Size(), 0U);
+  EXPECT_EQ(index.Search(a.data(), DIM, 2, match), 0);
+}
+
+// draw_filter before, the rect edges included and thick + 1 wide
+static void draw_nv12_before(uint8_t *data, int img_w, int img_h,
+                             const Rect &rect, int thick, int yuv_color) {
+  int uv_offset = img_w * img_h;
+  int rect_x = rect.left, rect_y = rect.top;
+  int rect_w = rect.right - rect.left, rect_h = rect.bottom - rect.top;
+  int y = (yuv_color >> 16) & 0xFF;
+  int u = (yuv_color >> 8) & 0xFF;
+  int v = (yuv_color >> 0) & 0xFF;
+  for (int j = rect_y; j <= rect_y + rect_h; j++) {
+    for (int k = rect_x; k <= rect_x + rect_w; k++) {
+      if (k <= (rect_x + thick) || k >= (rect_x + rect_w - thick) ||
+          j <= (rect_y + thick) || j >= (rect_y + rect_h - thick)) {
+        int y_offset = j * img_w + k;
+        int u_offset = (j >> 1) * img_w + k - k % 2 + uv_offset;
+        data[y_offset] = y;
+        data[u_offset] = u;
+        data[u_offset + 1] = v;
+      }
+    }
+  }
+}
+
+// per pixel drawing of the other formats
+static void draw_reference(const ImageInfo &info, uint8_t *data,
+                           const Rect &r, int thick, uint32_t color) {
+  uint8_t c[3] = {(uint8_t)(color >> 16), (uint8_t)(color >> 8),
+                  (uint8_t)color};
+  for (int j = r.top; j <= r.bottom; j++)
+    for (int k = r.left; k <= r.right; k++) {
+      if (k >= r.left + thick && k <= r.right - thick &&
+          j >= r.top + thick && j <= r.bottom - thick)
+        continue;
+      if (info.pix_fmt == PIX_FMT_NV16) {
+        data[j * info.width + k] = c[0];
+        uint8_t *uv =
+            data + info.width * info.height + j * info.width + (k & ~1);
+        uv[0] = c[1];
+        uv[1] = c[2];
+      } else {
+        memcpy(data + (j * info.width + k) * 3, c, 3);
+      }
+    }
+}
+
+// face sized boxes, in the image and clamped like draw_filter
+static std::vector<Rect> make_boxes(int w, int h, int num, int thick) {
+  std::mt19937 rng(num);
+  std::vector<Rect> rects;
+  for (int i = 0; i < num; i++) {
+    int bw = w / 40 + rng() % (w / 8), bh = bw * 5 / 4;
+    Rect r;
+    r.left = rng() % (w - bw);
+    r.top = rng() % (h - bh);
+    r.right = std::min(r.left + bw, w - thick);
+    r.bottom = std::min(r.top + bh, h - thick);
+    rects.push_back(r);
+  }
+  return rects;
+}
+
+TEST(RknnTest, DrawRectNV12) {
+  const int w = 640, h = 360, thick = 2;
+  const uint32_t red = (0x4C << 16) | (0x54 << 8) | 0xFF;
+  ImageInfo info = {PIX_FMT_NV12, w, h, w, h};
+  for (int num : {1, 10, 100}) {
+    std::vector<Rect> rects = make_boxes(w, h, num, thick);
+    std::vector<uint8_t> expect(w * h * 3 / 2, 0x80), frame(expect);
+    for (auto &r : rects)
+      draw_nv12_before(expect.data(), w, h, r, thick, red);
+    for (int threads : {1, 4}) {
+      std::fill(frame.begin(), frame.end(), 0x80);
+      ASSERT_EQ(draw_rect_borders(info, frame.data(), rects.data(), num,
+                                  thick + 1, red, threads),
+                0);
+      EXPECT_TRUE(frame == expect) << num << " boxes, " << threads
+                                   << " threads";
+    }
+  }
+}
+
+TEST(RknnTest, DrawRectFormats) {
+  const int w = 640, h = 360, thick = 3;
+  const struct {
+    PixelFormat fmt;
+    uint32_t color;
+  } formats[] = {{PIX_FMT_NV16, (0x4C << 16) | (0x54 << 8) | 0xFF},
+                 {PIX_FMT_RGB888, 0xFF0000}};
+  for (auto &f : formats) {
+    ImageInfo info = {f.fmt, w, h, w, h};
+    int size = f.fmt == PIX_FMT_NV16 ? w * h * 2 : w * h * 3;
+    std::vector<uint8_t> expect(size, 0x10), frame(expect);
+    std::vector<Rect> rects = make_boxes(w, h, 40, 2);
+    // out of the image on each side and thinner than the border
+    rects.push_back({-20, -20, 30, 40});
+    rects.push_back({600, 300, 700, 400});
+    rects.push_back({100, 100, 103, 300});
+    for (auto r : rects) {
+      r.left = std::max(r.left, 0);
+      r.top = std::max(r.top, 0);
+      r.right = std::min(r.right, w - 1);
+      r.bottom = std::min(r.bottom, h - 1);
+      draw_reference(info, expect.data(), r, thick, f.color);
+    }
+    ASSERT_EQ(draw_rect_borders(info, frame.data(), rects.data(),
+                                rects.size(), thick, f.color, 4),
+              0);
+    EXPECT_TRUE(frame == expect) << PixFmtToString(f.fmt);
+  }
+  // not supported
+  ImageInfo info = {PIX_FMT_YUV420P, w, h, w, h};
+  std::vector<uint8_t> frame(w * h * 3 / 2);
+  Rect r = {0, 0, 10, 10};
+  EXPECT_EQ(draw_rect_borders(info, frame.data(), &r, 1, thick, 0), -1);
+}
@@ -0,0 +1,126 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Enrolment speed of FaceDBManager, one user per call, in batches and from
+// a feature file, into a database of as many users already, and the latency
+// of the recognition reads meanwhile: the full table read on the reader
+// connection and the index search.
+// usage: rknn_bench face_db [db path] [users]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "rockface_db_manager.h"
+#include "utils.h"
+
+#define BATCH 500
+
+static std::vector<rockface_feature_t> make_features(int num, int seed) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<float> gauss(0, 1);
+  std::vector<rockface_feature_t> features(num);
+  for (auto &f : features) {
+    f.version = 1;
+    f.len = sizeof(f.feature);
+    float *p = (float *)f.feature;
+    for (size_t i = 0; i < f.len / sizeof(float); i++)
+      p[i] = gauss(rng);
+  }
+  return features;
+}
+
+struct Latency {
+  std::vector<int64_t> us;
+  void Print(const char *name) {
+    if (us.empty()) {
+      printf("  %-12s no read\n", name);
+      return;
+    }
+    std::sort(us.begin(), us.end());
+    printf("  %-12s %6d reads, p50 %8.3f ms, p99 %8.3f ms, max %8.3f ms\n",
+           name, (int)us.size(), us[us.size() / 2] / 1000.0,
+           us[us.size() * 99 / 100] / 1000.0, us.back() / 1000.0);
+  }
+};
+
+// enrol with f while a reader reads all and one searches the index
+template <typename F>
+static void run(const char *name, easymedia::FaceDBManager &db,
+                std::vector<rockface_feature_t> &base,
+                std::vector<rockface_feature_t> &features, F f) {
+  db.ClearDb();
+  db.AddUsers(base);
+  std::atomic<bool> done(false);
+  Latency all, nearest;
+  std::thread reader([&] {
+    rockface_feature_t query = features[0];
+    while (!done) {
+      easymedia::AutoDuration ad;
+      db.GetAllFaceDb();
+      all.us.push_back(ad.GetAndReset());
+      db.GetNearestFaceDb(&query, 3);
+      nearest.us.push_back(ad.Get());
+    }
+  });
+  easymedia::AutoDuration ad;
+  int num = f();
+  int64_t us = ad.Get();
+  done = true;
+  reader.join();
+  printf("%-20s %6d users in %8.1f ms, %10.1f users/s\n", name, num,
+         us / 1000.0, num * 1000000.0 / us);
+  all.Print("read all");
+  nearest.Print("nearest");
+}
+
+int face_db_bench(int argc, char **argv) {
+  std::string path = argc > 1 ? argv[1] : "face_db_bench.db";
+  int users = argc > 2 ? atoi(argv[2]) : 2000;
+  std::string feature_file = path + ".features";
+  unlink(path.c_str());
+  unlink((path + "-wal").c_str());
+  unlink((path + "-shm").c_str());
+
+  auto base = make_features(users, 1);
+  auto features = make_features(users, 2);
+  FILE *fp = fopen(feature_file.c_str(), "wb");
+  if (!fp)
+    return -1;
+  for (auto &f : features) {
+    int32_t head[2] = {f.version, f.len};
+    fwrite(head, sizeof(head), 1, fp);
+    fwrite(f.feature, f.len, 1, fp);
+  }
+  fclose(fp);
+
+  easymedia::FaceDBManager db(path);
+  db.EnableIndex(true);
+  run("AddUser", db, base, features, [&] {
+    int num = 0;
+    for (auto &f : features)
+      num += db.AddUser(&f) >= 0;
+    return num;
+  });
+  run("AddUsers", db, base, features, [&] {
+    int num = 0;
+    for (size_t i = 0; i < features.size(); i += BATCH) {
+      size_t end = std::min(features.size(), i + BATCH);
+      std::vector<rockface_feature_t> batch(features.begin() + i,
+                                            features.begin() + end);
+      num += std::max(db.AddUsers(batch), 0);
+    }
+    return num;
+  });
+  run("ImportFeatures", db, base, features,
+      [&] { return db.ImportFeatures(feature_file); });
+  unlink(feature_file.c_str());
+  return 0;
+}
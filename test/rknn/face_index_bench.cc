@@ -0,0 +1,153 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Time of one face match against a database of random 512-d features.
+// Before, RockFaceRecognize::MatchFeature copied every row out of the
+// database, the sqlite step not counted here, and compared one by one.
+// Now it searches the resident FaceFeatureIndex, with one and with all
+// cores, then the sdk compares the few nearest. The search is checked in
+// RknnTest.
+// usage: rknn_bench face_index [threads]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "face_feature_index.h"
+#include "utils.h"
+
+#define DIM 512
+#define TOP_K 3
+
+// FaceDb before, rockface_feature_t is 512 floats
+struct FaceRow {
+  int version;
+  int len;
+  float feature[DIM];
+  int user_id;
+};
+
+static void normalize(float *f) {
+  float n = 0;
+  for (int i = 0; i < DIM; i++)
+    n += f[i] * f[i];
+  n = sqrtf(n);
+  for (int i = 0; i < DIM; i++)
+    f[i] /= n;
+}
+
+// rockface_feature_compare stand in
+static float compare(const float *a, const float *b) {
+  float s = 0;
+  for (int i = 0; i < DIM; i++)
+    s += (a[i] - b[i]) * (a[i] - b[i]);
+  return sqrtf(s);
+}
+
+static int match_before(const std::vector<FaceRow> &db, const float *query) {
+  // GetAllFaceDb
+  std::vector<FaceRow> vec;
+  for (auto &row : db) {
+    FaceRow face;
+    face.user_id = row.user_id;
+    face.version = row.version;
+    face.len = row.len;
+    memcpy(face.feature, row.feature, row.len);
+    vec.push_back(face);
+  }
+  int user = -1;
+  float best = 99.9;
+  for (auto &face : vec) {
+    float similarity = compare(query, face.feature);
+    if (similarity < best) {
+      best = similarity;
+      user = face.user_id;
+    }
+  }
+  return user;
+}
+
+static int match_index(easymedia::FaceFeatureIndex &index, const float *query) {
+  easymedia::FaceMatch matches[TOP_K];
+  int num = index.Search(query, DIM, TOP_K, matches);
+  int user = -1;
+  float best = 99.9;
+  float feature[DIM];
+  for (int i = 0; i < num; i++) {
+    if (!index.GetFeature(matches[i].user_id, feature))
+      continue;
+    float similarity = compare(query, feature);
+    if (similarity < best) {
+      best = similarity;
+      user = matches[i].user_id;
+    }
+  }
+  return user;
+}
+
+static void run(int size, int queries, int threads) {
+  std::mt19937 rng(size);
+  std::normal_distribution<float> gauss(0, 1);
+  std::vector<FaceRow> db(size);
+  easymedia::FaceFeatureIndex index;
+  for (int i = 0; i < size; i++) {
+    FaceRow &row = db[i];
+    row.version = 1;
+    row.len = sizeof(row.feature);
+    row.user_id = i;
+    for (int j = 0; j < DIM; j++)
+      row.feature[j] = gauss(rng);
+    normalize(row.feature);
+    index.Add(row.user_id, row.version, row.feature, DIM);
+  }
+  // the same faces seen again, with noise
+  std::vector<std::vector<float>> query(queries, std::vector<float>(DIM));
+  for (int q = 0; q < queries; q++) {
+    const FaceRow &row = db[rng() % size];
+    for (int j = 0; j < DIM; j++)
+      query[q][j] = row.feature[j] + gauss(rng) * 0.02f;
+    normalize(query[q].data());
+  }
+
+  std::vector<int> expect(queries);
+  easymedia::AutoDuration ad;
+  for (int q = 0; q < queries; q++)
+    expect[q] = match_before(db, query[q].data());
+  double before = ad.GetAndReset() / 1000.0 / queries;
+
+  double now[2];
+  int thread_num[2] = {1, threads};
+  for (int t = 0; t < 2; t++) {
+    index.SetThreads(thread_num[t], 1024);
+    ad.Reset();
+    int found = 0;
+    for (int q = 0; q < queries; q++)
+      found += match_index(index, query[q].data()) == expect[q];
+    now[t] = ad.Get() / 1000.0 / queries;
+    if (found != queries)
+      printf("%d of %d matches differ at %d entries\n", queries - found,
+             queries, size);
+  }
+  printf("%-8d %12.3f %12.3f %12.3f %8.1fx\n", size, before, now[0], now[1],
+         before / std::min(now[0], now[1]));
+}
+
+int face_index_bench(int argc, char **argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+  if (threads < 1)
+    threads = 1;
+  printf("%d-d float features, top %d then compare, ms per match\n", DIM,
+         TOP_K);
+  printf("%-8s %12s %12s %9s(%d) %9s\n", "entries", "before", "index(1)",
+         "index", threads, "speedup");
+  run(1000, 200, threads);
+  run(10000, 50, threads);
+  run(100000, 5, threads);
+  return 0;
+}
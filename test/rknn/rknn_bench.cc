@@ -0,0 +1,26 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benches of the rknn helpers, the checks are in RknnTest.
+// usage: rknn_bench <bench> [args]
+
+#include "../bench_main.h"
+
+int draw_rect_bench(int argc, char **argv);
+int face_index_bench(int argc, char **argv);
+#ifdef FACE_RECOGNIZE
+int face_db_bench(int argc, char **argv);
+#endif
+
+static const BenchEntry benches[] = {
+    {"draw_rect", draw_rect_bench},
+#ifdef FACE_RECOGNIZE
+    {"face_db", face_db_bench},
+#endif
+    {"face_index", face_index_bench},
+};
+
+int main(int argc, char **argv) {
+  return bench_main(argc, argv, benches, BENCH_NUM(benches));
+}